@@ -0,0 +1,59 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * address_utils.h
+ *
+ * Helpers for matching the address fields of samples.
+ */
+
+#ifndef ADDRESS_UTILS_H_
+#define ADDRESS_UTILS_H_
+
+#include "pathogenomics_service_library.h"
+#include "typedefs.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Normalise an address value so that trivially different spellings
+ * of it can be matched. The value is trimmed, converted to lower case
+ * and has any runs of whitespace replaced by a single space.
+ *
+ * @param value_s The value to normalise.
+ * @param dest_s The buffer to write the normalised value to. This must
+ * have room for at least strlen (value_s) + 1 characters. It can be the
+ * same as value_s to normalise the value in place.
+ * @return The length of the normalised value.
+ */
+PATHOGENOMICS_SERVICE_LOCAL size_t NormaliseAddressValue (const char *value_s, char *dest_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* ADDRESS_UTILS_H_ */
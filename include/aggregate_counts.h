@@ -0,0 +1,87 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * aggregate_counts.h
+ *
+ * Count the live samples in each group of values such as their disease,
+ * region or month of collection. The grouping is done by the database so
+ * only the counts are sent to the service.
+ */
+
+#ifndef AGGREGATE_COUNTS_H_
+#define AGGREGATE_COUNTS_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+/**
+ * The key in an aggregation request for the array of names to group by.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_GROUP_S "group"
+
+
+/**
+ * The key in each aggregated result for the number of samples in the group.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_COUNT_S "count"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Count the live documents that match a query for each distinct
+ * combination of the requested group values.
+ *
+ * An aggregation request has an optional "data" query, in the same form as
+ * for a search, and a "group" array of names. The names "year" and "month"
+ * are the year and month that the sample was collected. Any other name must
+ * be in keys_p or, if that is <code>NULL</code>, be one of "Disease",
+ * "County" or "Country".
+ *
+ * @param tool_p The MongoTool to use.
+ * @param aggregate_p The aggregation request.
+ * @param keys_p A JSON object mapping each of the names that can be grouped
+ * by to the dotted path of its field, or <code>NULL</code> for the defaults.
+ * @param preview_flag If this is <code>true</code> the live dates are ignored.
+ * @param error_ss If the request is invalid, this will be set to the reason why.
+ * @return A new JSON array with an object for each group, holding its values
+ * and count, ordered by descending count, which the caller must decref, or
+ * <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *GetAggregateCounts (MongoTool *tool_p, const json_t *aggregate_p, const json_t *keys_p, const bool preview_flag, const char **error_ss);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* AGGREGATE_COUNTS_H_ */
@@ -0,0 +1,58 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * aggregation_utils.h
+ *
+ * Helpers for building the stages of MongoDB aggregation pipelines.
+ */
+
+#ifndef AGGREGATION_UTILS_H_
+#define AGGREGATION_UTILS_H_
+
+#include "pathogenomics_service_library.h"
+#include "jansson.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Add a stage of the form <code>{ operator_s: value_p }</code> to the end
+ * of a pipeline.
+ *
+ * @param stages_p The JSON array of aggregation stages to add to.
+ * @param operator_s The stage's operator, e.g. "$match".
+ * @param value_p The stage's value. The reference to this is stolen, even
+ * upon error. If this is <code>NULL</code>, nothing is added.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddAggregationStage (json_t *stages_p, const char *operator_s, json_t *value_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* AGGREGATION_UTILS_H_ */
@@ -0,0 +1,118 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * async_jobs.h
+ *
+ * A background executor for long-running requests along with a table
+ * of their results, which are kept for a limited time after they finish.
+ */
+
+#ifndef ASYNC_JOBS_H_
+#define ASYNC_JOBS_H_
+
+#include "pathogenomics_service_library.h"
+#include "service.h"
+#include "service_job.h"
+#include "jansson.h"
+
+
+typedef struct AsyncJobManager AsyncJobManager;
+
+
+/**
+ * A function that does the work for a background job.
+ *
+ * @param task_p The task data that was passed to SubmitAsyncJob ().
+ * @param job_p The ServiceJob to store the status, results and errors in.
+ */
+typedef void (*RunAsyncTaskFn) (void *task_p, ServiceJob *job_p);
+
+
+/**
+ * A function that frees the task data for a background job.
+ *
+ * @param task_p The task data that was passed to SubmitAsyncJob ().
+ */
+typedef void (*FreeAsyncTaskFn) (void *task_p);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate an AsyncJobManager and start its worker threads.
+ *
+ * @param service_p The Service that the jobs are for.
+ * @param num_workers The number of jobs that can run at the same time.
+ * @param retention_time The number of seconds that a job's results are
+ * kept for after it has finished.
+ * @return The new AsyncJobManager or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL AsyncJobManager *AllocateAsyncJobManager (Service *service_p, const uint32 num_workers, const uint32 retention_time);
+
+
+/**
+ * Free an AsyncJobManager. Any jobs that are running are allowed to
+ * finish, any that have not started yet are discarded.
+ *
+ * @param manager_p The AsyncJobManager to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeAsyncJobManager (AsyncJobManager *manager_p);
+
+
+/**
+ * Queue a job to be run in the background.
+ *
+ * @param manager_p The AsyncJobManager to use.
+ * @param id The id that the job's status and results will be available under.
+ * @param run_fn The function that does the work.
+ * @param free_fn The function used to free task_p once the job has run,
+ * or if it is discarded.
+ * @param task_p The data for the job. The AsyncJobManager takes ownership of
+ * this if the job is queued successfully.
+ * @return <code>true</code> if the job was queued successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool SubmitAsyncJob (AsyncJobManager *manager_p, const uuid_t id, RunAsyncTaskFn run_fn, FreeAsyncTaskFn free_fn, void *task_p);
+
+
+/**
+ * Copy the status of a background job into a ServiceJob. If the job has
+ * finished, its results, errors and metadata are copied as well.
+ *
+ * @param manager_p The AsyncJobManager to use.
+ * @param id The id of the background job.
+ * @param dest_job_p The ServiceJob to copy the details into.
+ * @return <code>true</code> if the job was found, <code>false</code> if
+ * there is no job with the given id or its results have expired.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool CopyAsyncJobToServiceJob (AsyncJobManager *manager_p, const uuid_t id, ServiceJob *dest_job_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* ASYNC_JOBS_H_ */
@@ -0,0 +1,134 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * bulk_writer.h
+ *
+ * Collects upserts and removals for a collection and sends them
+ * to MongoDB as bulk operations rather than one request per row.
+ */
+
+#ifndef BULK_WRITER_H_
+#define BULK_WRITER_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "service_job.h"
+#include "jansson.h"
+
+
+/**
+ * A BulkWriter queues write operations against the current collection of
+ * a MongoTool and executes them in batches. Each queued operation remembers
+ * the row that it came from so that any write errors reported by the
+ * server can be mapped back to that row.
+ *
+ * @ingroup pathogenomics_service
+ */
+typedef struct BulkWriter BulkWriter;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a BulkWriter.
+ *
+ * @param tool_p The MongoTool whose current collection will be written to.
+ * @param job_p The ServiceJob that any per-row errors will be added to.
+ * @param batch_size The maximum number of operations to queue before they
+ * are automatically sent to the server.
+ * @param ordered_flag If this is <code>true</code> then the operations in each
+ * batch are run in order and a batch stops at its first error. If this is
+ * <code>false</code> the server may run them in any order and will attempt
+ * all of them.
+ * @return The new BulkWriter or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL BulkWriter *AllocateBulkWriter (MongoTool *tool_p, ServiceJob *job_p, const uint32 batch_size, const bool ordered_flag);
+
+
+/**
+ * Free a BulkWriter. Any operations that are still queued are discarded
+ * so call FlushBulkWriter() first if they need to be written.
+ *
+ * @param writer_p The BulkWriter to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeBulkWriter (BulkWriter *writer_p);
+
+
+/**
+ * Queue an upsert of a single document.
+ *
+ * @param writer_p The BulkWriter to use.
+ * @param selector_p The query used to find the document to update.
+ * @param update_p The update document e.g. <code>{ "$set": { ... } }</code>
+ * @param row The index of the row that this operation is for.
+ * @param id_s The identifier to use for this row when reporting errors.
+ * This can be <code>NULL</code>.
+ * @return <code>NULL</code> if the operation was queued successfully or an
+ * error message upon failure.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *AddUpsertToBulkWriter (BulkWriter *writer_p, const json_t *selector_p, const json_t *update_p, const size_t row, const char *id_s);
+
+
+/**
+ * Queue the removal of the first document matching a selector.
+ *
+ * @param writer_p The BulkWriter to use.
+ * @param selector_p The query used to find the document to remove.
+ * @param row The index of the row that this operation is for.
+ * @param id_s The identifier to use for this row when reporting errors.
+ * This can be <code>NULL</code>.
+ * @return <code>NULL</code> if the operation was queued successfully or an
+ * error message upon failure.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *AddRemoveToBulkWriter (BulkWriter *writer_p, const json_t *selector_p, const size_t row, const char *id_s);
+
+
+/**
+ * Send any queued operations to the server. Any write errors are added
+ * to the BulkWriter's ServiceJob against the rows that caused them.
+ *
+ * @param writer_p The BulkWriter to flush.
+ * @return <code>true</code> if all of the queued operations succeeded,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool FlushBulkWriter (BulkWriter *writer_p);
+
+
+/**
+ * Get the number of distinct rows that have had at least one of their
+ * operations fail since the BulkWriter was allocated.
+ *
+ * @param writer_p The BulkWriter to query.
+ * @return The number of failed rows.
+ */
+PATHOGENOMICS_SERVICE_LOCAL uint32 GetBulkWriterNumberOfFailedRows (const BulkWriter *writer_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* BULK_WRITER_H_ */
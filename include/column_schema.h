@@ -0,0 +1,138 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * column_schema.h
+ *
+ * The column definitions from the service's "field_defs" configuration
+ * compiled into a lookup table when the service is configured. Each
+ * column has the JSON type that its text values are converted to along
+ * with the data types that require it, so that the column headings of
+ * an upload can be checked and the converter for each column chosen
+ * once without going back to the configuration for each value.
+ */
+
+#ifndef COLUMN_SCHEMA_H_
+#define COLUMN_SCHEMA_H_
+
+#include "pathogenomics_service_library.h"
+#include "pathogenomics_service_data.h"
+#include "linked_list.h"
+#include "service_job.h"
+#include "jansson.h"
+
+
+/**
+ * The maximum number of columns that can be required for each
+ * data type.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_MAX_REQUIRED_COLUMNS (32)
+
+
+/**
+ * A function to convert a text value from an upload into JSON.
+ *
+ * @param value_s The value to convert.
+ * @return The new JSON value or <code>NULL</code> if the value
+ * is not valid for the column.
+ */
+typedef json_t *(*ColumnConverter) (const char *value_s);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Compile the column definitions into a ColumnSchema.
+ *
+ * @param field_defs_p The JSON object of column names to their types, which can be
+ * "int", "real", "bool" or "string". This can be <code>NULL</code> in which case every
+ * column holds strings.
+ * @return The new ColumnSchema or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL ColumnSchema *AllocateColumnSchema (const json_t *field_defs_p);
+
+
+/**
+ * Free a ColumnSchema.
+ *
+ * @param schema_p The ColumnSchema to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeColumnSchema (ColumnSchema *schema_p);
+
+
+/**
+ * Set the columns that uploads of a given data type must have.
+ *
+ * @param schema_p The ColumnSchema to update.
+ * @param data_type The data type to set the columns for.
+ * @param names_ss The <code>NULL</code>-terminated array of column names. There can
+ * be up to PG_MAX_REQUIRED_COLUMNS of them.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool SetRequiredColumns (ColumnSchema *schema_p, const PathogenomicsData data_type, const char **names_ss);
+
+
+/**
+ * Get the JSON type that the values of a column are converted to.
+ *
+ * @param schema_p The ColumnSchema to use.
+ * @param name_s The name of the column.
+ * @return The JSON type, which is JSON_STRING for any column without a definition.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_type GetColumnType (const ColumnSchema *schema_p, const char *name_s);
+
+
+/**
+ * Get the converter for the values of a given JSON type.
+ *
+ * @param column_type The JSON type, as returned by GetColumnType ().
+ * @return The converter.
+ */
+PATHOGENOMICS_SERVICE_LOCAL ColumnConverter GetColumnConverter (const json_type column_type);
+
+
+/**
+ * Check that the column headings of an upload include all of the
+ * columns required for its data type. An error is added to the
+ * ServiceJob for each one that is missing.
+ *
+ * @param schema_p The ColumnSchema to use.
+ * @param data_type The data type of the upload.
+ * @param headers_p The column headings, as FieldNodes, as returned by GetTabularHeaders ().
+ * @param job_p The ServiceJob to add any errors to.
+ * @return <code>true</code> if all of the required columns are present,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool CheckRequiredColumns (const ColumnSchema *schema_p, const PathogenomicsData data_type, const LinkedList *headers_p, ServiceJob *job_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* COLUMN_SCHEMA_H_ */
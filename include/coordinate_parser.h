@@ -0,0 +1,68 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * coordinate_parser.h
+ *
+ * Parse the GPS values that collectors record for their samples.
+ */
+
+#ifndef COORDINATE_PARSER_H_
+#define COORDINATE_PARSER_H_
+
+#include "pathogenomics_service_library.h"
+#include "typedefs.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Parse a GPS value into WGS84 coordinates. The value can be in any of
+ * the following forms:
+ *
+ * - Decimal degrees, e.g. <code>52.6219, 1.2197</code> or <code>52.6219N 1.2197E</code>
+ * - Degrees and decimal minutes, e.g. <code>52&deg;37.31'N 1&deg;13.18'E</code>
+ * - Degrees, minutes and seconds, e.g. <code>52&deg;37'18.8"N 1&deg;13'10.9"E</code>
+ * or <code>N 52 37 18.8 E 1 13 10.9</code>
+ * - An Ordnance Survey National Grid reference, e.g. <code>TG 2161 0688</code>.
+ * The centre of the referenced square is converted from OSGB36 to WGS84.
+ *
+ * The latitude comes first unless the hemispheres show otherwise and
+ * negative values can be used instead of S and W.
+ *
+ * @param value_s The value to parse.
+ * @param latitude_p If the value is parsed successfully, this will be set to its latitude.
+ * @param longitude_p If the value is parsed successfully, this will be set to its longitude.
+ * @return <code>true</code> if the value was parsed successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool ParseGPSCoordinate (const char *value_s, double64 *latitude_p, double64 *longitude_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* COORDINATE_PARSER_H_ */
@@ -0,0 +1,207 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * date_normaliser.h
+ *
+ * Conversion of the dates in uploads to ISO 8601. As well as the
+ * day-first forms that the uploads have always used, dates can be in
+ * ISO 8601, as Excel serial day numbers, as month names or, if an
+ * upload asks for it, in US month-first order. Each DateNormaliser
+ * remembers the dates that it has already converted since uploads
+ * repeat the same dates many times over.
+ */
+
+#ifndef DATE_NORMALISER_H_
+#define DATE_NORMALISER_H_
+
+#include "pathogenomics_service_library.h"
+#include "jansson.h"
+
+
+/**
+ * The size of the buffer needed for an ISO 8601 date, YYYY-MM-DD,
+ * along with its terminating '\0'.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_ISO_DATE_BUFFER_SIZE (11)
+
+
+/**
+ * The order of the day and month in numeric dates such as 03/04/2020.
+ * Dates that start with a 4 digit year are always year, month and day.
+ *
+ * @ingroup pathogenomics_service
+ */
+typedef enum
+{
+	/** DD/MM/YYYY, the default */
+	DO_DAY_FIRST,
+
+	/** MM/DD/YYYY, as used in the US */
+	DO_MONTH_FIRST,
+
+	/** The number of date orders */
+	DO_NUM_ORDERS
+} DateOrder;
+
+
+/**
+ * The result of converting a row's date, as returned by
+ * NormaliseRowDate ().
+ *
+ * @ingroup pathogenomics_service
+ */
+typedef enum
+{
+	/** The date was converted. */
+	DS_CONVERTED,
+
+	/** The row has no date. */
+	DS_MISSING,
+
+	/** The date could not be converted. */
+	DS_INVALID,
+
+	/** The number of statuses */
+	DS_NUM_STATUSES
+} DateStatus;
+
+
+typedef struct DateNormaliser DateNormaliser;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a DateNormaliser. It can be used by more than one thread
+ * at the same time.
+ *
+ * @param order The order of the day and month in numeric dates.
+ * @return The new DateNormaliser or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL DateNormaliser *AllocateDateNormaliser (const DateOrder order);
+
+
+/**
+ * Free a DateNormaliser.
+ *
+ * @param normaliser_p The DateNormaliser to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeDateNormaliser (DateNormaliser *normaliser_p);
+
+
+/**
+ * Get the order of the day and month that a DateNormaliser reads numeric dates in.
+ *
+ * @param normaliser_p The DateNormaliser.
+ * @return The DateOrder.
+ */
+PATHOGENOMICS_SERVICE_LOCAL DateOrder GetDateNormaliserOrder (const DateNormaliser *normaliser_p);
+
+
+/**
+ * Convert a date to ISO 8601.
+ *
+ * @param normaliser_p The DateNormaliser to use. If this is <code>NULL</code>, numeric
+ * dates are read as day-first and the result isn't remembered.
+ * @param date_p The date, either as a string or, for Excel serial day numbers,
+ * a JSON number.
+ * @param iso_date_s The buffer, of at least PG_ISO_DATE_BUFFER_SIZE characters,
+ * to write the YYYY-MM-DD date to.
+ * @return <code>true</code> if the date was converted successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool NormaliseDate (DateNormaliser *normaliser_p, const json_t *date_p, char *iso_date_s);
+
+
+/**
+ * Convert the date from a row to ISO 8601 and count the row against
+ * the DateStatus that it gets.
+ *
+ * @param normaliser_p The DateNormaliser to use. If this is <code>NULL</code>, numeric
+ * dates are read as day-first and the row isn't counted.
+ * @param row_p The row.
+ * @param key_s The key for the date within the row.
+ * @param iso_date_s The buffer, of at least PG_ISO_DATE_BUFFER_SIZE characters,
+ * to write the YYYY-MM-DD date to.
+ * @return DS_CONVERTED if the date was written to iso_date_s, DS_MISSING if the
+ * row has no date or DS_INVALID if its date couldn't be converted.
+ */
+PATHOGENOMICS_SERVICE_LOCAL DateStatus NormaliseRowDate (DateNormaliser *normaliser_p, const json_t *row_p, const char *key_s, char *iso_date_s);
+
+
+/**
+ * Convert the dates for a batch of rows in a single pass. The rows are left
+ * as they are and the converted dates are remembered by the DateNormaliser so
+ * that NormaliseRowDate () can get them for each row without converting them again.
+ * The rows aren't counted until then.
+ *
+ * @param normaliser_p The DateNormaliser to use.
+ * @param rows_p The JSON array of rows.
+ * @param key_s The key for the date within each row.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void NormaliseDateColumn (DateNormaliser *normaliser_p, const json_t *rows_p, const char *key_s);
+
+
+/**
+ * Get the number of rows that have been converted by NormaliseRowDate ()
+ * with each DateStatus.
+ *
+ * @param normaliser_p The DateNormaliser.
+ * @param counts_p The array of DS_NUM_STATUSES values to write the counts to,
+ * indexed by DateStatus.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void GetDateStatusCounts (DateNormaliser *normaliser_p, size_t *counts_p);
+
+
+/**
+ * Get the name of a DateOrder, which is the form of a date in that order,
+ * e.g. "DD/MM/YYYY".
+ *
+ * @param order The DateOrder.
+ * @return The name or <code>NULL</code> if the DateOrder is invalid.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *GetDateOrderName (const DateOrder order);
+
+
+/**
+ * Get the DateOrder with a given name.
+ *
+ * @param name_s The name, as returned by GetDateOrderName ().
+ * @param order_p Where the DateOrder will be stored.
+ * @return <code>true</code> if the name is for a DateOrder,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool GetDateOrderFromName (const char *name_s, DateOrder *order_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* DATE_NORMALISER_H_ */
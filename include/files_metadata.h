@@ -32,6 +32,7 @@
 #include "pathogenomics_service_library.h"
 #include "mongodb_tool.h"
 #include "pathogenomics_service_data.h"
+#include "import_session.h"
 
 #include "pathogenomics_service.h"
 #include "jansson.h"
@@ -43,7 +44,19 @@ extern "C"
 #endif
 
 
-PATHOGENOMICS_SERVICE_LOCAL	const char *InsertFilesData (MongoTool *tool_p, json_t *values_p, const uint32 stage_time, PathogenomicsServiceData *data_p);
+PATHOGENOMICS_SERVICE_LOCAL	const char *InsertFilesData (ImportSession *session_p, json_t *values_p, const size_t row);
+
+
+/**
+ * Check that a row of files data has an ID to store it by,
+ * without accessing the database.
+ *
+ * @param values_p The row to check.
+ * @param normaliser_p The DateNormaliser for the upload. This isn't used as
+ * files rows have no dates to convert.
+ * @return <code>NULL</code> if the row is valid or an error message otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *ValidateFilesRow (json_t *values_p, DateNormaliser *normaliser_p);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,181 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * gazetteer.h
+ *
+ * An offline index of the centroids of countries, counties, towns and
+ * postcodes that can be used to locate samples without the remote geocoder.
+ *
+ * The index is a file, created by gazetteer_builder, which is memory-mapped
+ * read-only so it can be shared by all threads. It consists of a
+ * GazetteerHeader followed by an array of GazetteerEntry structures sorted
+ * by their key hashes. The values are stored in the native byte order so
+ * an index should be built on the same architecture that it is used on.
+ */
+
+#ifndef GAZETTEER_H_
+#define GAZETTEER_H_
+
+#include "pathogenomics_service_library.h"
+#include "typedefs.h"
+
+
+/** The magic bytes at the start of a gazetteer index. */
+#define GAZETTEER_MAGIC_S "PGGAZIDX"
+
+/** The current version of the gazetteer index format. */
+#define GAZETTEER_VERSION (1)
+
+
+/**
+ * The levels of place in a gazetteer.
+ */
+typedef enum
+{
+	/** A country's centroid, keyed by country. */
+	GL_COUNTRY = 'n',
+
+	/** A county's centroid, keyed by country and county. */
+	GL_COUNTY = 'c',
+
+	/**
+	 * A town's centroid, keyed by country, county and town. Each town is
+	 * also stored with an empty county for addresses that don't have one.
+	 */
+	GL_TOWN = 't',
+
+	/**
+	 * A postcode's centroid, keyed by country and postcode. Each postcode
+	 * is also stored with an empty country for addresses that don't have one.
+	 */
+	GL_POSTCODE = 'p'
+} GazetteerLevel;
+
+
+/**
+ * The header at the start of a gazetteer index.
+ */
+typedef struct GazetteerHeader
+{
+	/** This is GAZETTEER_MAGIC_S without its terminating '\\0'. */
+	char gh_magic [8];
+
+	/** The version of the index format. */
+	uint32 gh_version;
+
+	/** The number of GazetteerEntries that follow the header. */
+	uint32 gh_num_entries;
+} GazetteerHeader;
+
+
+/**
+ * A place in a gazetteer index.
+ */
+typedef struct GazetteerEntry
+{
+	/** The hash of the place's key from HashGazetteerKey (). */
+	uint64 ge_hash;
+
+	/** The latitude of the place's centroid. */
+	float32 ge_latitude;
+
+	/** The longitude of the place's centroid. */
+	float32 ge_longitude;
+} GazetteerEntry;
+
+
+typedef struct Gazetteer Gazetteer;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Open a gazetteer index.
+ *
+ * @param filename_s The filename of the index.
+ * @return The Gazetteer or <code>NULL</code> if the file could not be
+ * opened or is not a valid index.
+ */
+PATHOGENOMICS_SERVICE_LOCAL Gazetteer *OpenGazetteer (const char *filename_s);
+
+
+/**
+ * Close a gazetteer index.
+ *
+ * @param gazetteer_p The Gazetteer to close.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void CloseGazetteer (Gazetteer *gazetteer_p);
+
+
+/**
+ * Get the number of places in a gazetteer index.
+ *
+ * @param gazetteer_p The Gazetteer to query.
+ * @return The number of places.
+ */
+PATHOGENOMICS_SERVICE_LOCAL uint32 GetGazetteerSize (const Gazetteer *gazetteer_p);
+
+
+/**
+ * Find the centroid for an address. The most specific part of the
+ * address is used: the postcode if there is one, then the town and,
+ * only if the address has no town, the county or country.
+ *
+ * This is safe to call from multiple threads.
+ *
+ * @param gazetteer_p The Gazetteer to search.
+ * @param town_s The town, this can be <code>NULL</code>.
+ * @param county_s The county, this can be <code>NULL</code>.
+ * @param country_s The country, this can be <code>NULL</code>.
+ * @param postcode_s The postcode, this can be <code>NULL</code>.
+ * @param latitude_p If the address is found, this will be set to its latitude.
+ * @param longitude_p If the address is found, this will be set to its longitude.
+ * @return <code>true</code> if the address was found, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool FindInGazetteer (const Gazetteer *gazetteer_p, const char *town_s, const char *county_s, const char *country_s, const char *postcode_s, double64 *latitude_p, double64 *longitude_p);
+
+
+/**
+ * Hash the key for a place in a gazetteer. Each of the values is normalised
+ * with NormaliseAddressValue () and postcodes also have their spaces removed.
+ *
+ * @param level The level of the place.
+ * @param country_s The country, this can be <code>NULL</code>.
+ * @param county_s The county, this can be <code>NULL</code>.
+ * @param town_s The town, this can be <code>NULL</code>.
+ * @param postcode_s The postcode, this can be <code>NULL</code>.
+ * @param hash_p If successful, this will be set to the hash.
+ * @return <code>true</code> if the hash was calculated successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool HashGazetteerKey (const GazetteerLevel level, const char *country_s, const char *county_s, const char *town_s, const char *postcode_s, uint64 *hash_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* GAZETTEER_H_ */
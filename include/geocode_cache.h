@@ -0,0 +1,169 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * geocode_cache.h
+ *
+ * A cache of geocoded locations, keyed by their normalised address,
+ * so that repeated addresses don't need to be sent to the geocoder.
+ * An in-memory LRU cache sits in front of a MongoDB collection.
+ */
+
+#ifndef GEOCODE_CACHE_H_
+#define GEOCODE_CACHE_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+typedef struct GeocodeCache GeocodeCache;
+
+
+/**
+ * The number of lookups made against a GeocodeCache. These are updated
+ * by the GeocodeCache so can be shared between threads using the same cache.
+ *
+ * @ingroup pathogenomics_service
+ */
+typedef struct GeocodeCacheStats
+{
+	/** The number of locations found in the in-memory cache. */
+	uint32 gcs_memory_hits;
+
+	/** The number of locations found in the database collection. */
+	uint32 gcs_store_hits;
+
+	/** The number of addresses that are cached as having no location. */
+	uint32 gcs_negative_hits;
+
+	/** The number of addresses that were not in the cache. */
+	uint32 gcs_misses;
+} GeocodeCacheStats;
+
+
+/**
+ * The result of looking up an address in a GeocodeCache.
+ */
+typedef enum
+{
+	/** The address is not in the cache. */
+	GCR_MISS,
+
+	/** The address is in the cache along with its location. */
+	GCR_FOUND,
+
+	/** The address is in the cache as one that the geocoder couldn't find. */
+	GCR_NO_LOCATION
+} GeocodeCacheResult;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a GeocodeCache.
+ *
+ * @param mongo_manager_p The MongoClientManager used to connect to the database.
+ * @param database_s The database that holds the cache collection.
+ * @param collection_s The collection to store the cached locations in.
+ * @param capacity The maximum number of locations to keep in memory.
+ * If this is 0, only the database collection is used.
+ * @param negative_ttl The number of seconds that an address which the geocoder
+ * could not find is cached for before it is tried again. As the failure may
+ * have been temporary, this should be short.
+ * @return The new GeocodeCache or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL GeocodeCache *AllocateGeocodeCache (MongoClientManager *mongo_manager_p, const char *database_s, const char *collection_s, const uint32 capacity, const uint32 negative_ttl);
+
+
+/**
+ * Free a GeocodeCache.
+ *
+ * @param cache_p The GeocodeCache to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeGeocodeCache (GeocodeCache *cache_p);
+
+
+/**
+ * Make the key used to cache an address. Each part is normalised with
+ * NormaliseAddressValue () so that trivially different spellings of the
+ * same address share an entry.
+ *
+ * @param town_s The town, this can be <code>NULL</code>.
+ * @param county_s The county, this can be <code>NULL</code>.
+ * @param country_s The country, this can be <code>NULL</code>.
+ * @param postcode_s The postcode, this can be <code>NULL</code>.
+ * @param gps_s The GPS value, this can be <code>NULL</code>.
+ * @return The key which should be freed with FreeCopiedString () or
+ * <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL char *MakeGeocodeCacheKey (const char *town_s, const char *county_s, const char *country_s, const char *postcode_s, const char *gps_s);
+
+
+/**
+ * Look up an address in a GeocodeCache. This is safe to call from
+ * multiple threads.
+ *
+ * @param cache_p The GeocodeCache to search.
+ * @param key_s The address key from MakeGeocodeCacheKey ().
+ * @param location_pp If the result is GCR_FOUND, this will be set to
+ * a new copy of the cached location which the caller must decref.
+ * @param stats_p If this is not <code>NULL</code>, the appropriate count
+ * will be incremented.
+ * @return The result of the lookup.
+ */
+PATHOGENOMICS_SERVICE_LOCAL GeocodeCacheResult FindInGeocodeCache (GeocodeCache *cache_p, const char *key_s, json_t **location_pp, GeocodeCacheStats *stats_p);
+
+
+/**
+ * Add an address to a GeocodeCache. This is safe to call from
+ * multiple threads.
+ *
+ * @param cache_p The GeocodeCache to add to.
+ * @param key_s The address key from MakeGeocodeCacheKey ().
+ * @param location_p The location for the address, as created by ConvertAddressToJSON (),
+ * or <code>NULL</code> if the geocoder could not find the address.
+ * @return <code>true</code> if the address was added successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddToGeocodeCache (GeocodeCache *cache_p, const char *key_s, const json_t *location_p);
+
+
+/**
+ * Add the counts from a GeocodeCacheStats to a JSON object.
+ *
+ * @param stats_p The GeocodeCacheStats to add.
+ * @param json_p The JSON object to add the counts to.
+ * @return <code>true</code> if the counts were added successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddGeocodeCacheStatsToJSON (const GeocodeCacheStats *stats_p, json_t *json_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* GEOCODE_CACHE_H_ */
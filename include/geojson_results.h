@@ -0,0 +1,109 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * geojson_results.h
+ *
+ * Convert search results into a GeoJSON FeatureCollection that can be
+ * drawn straight onto a map, with each sample as a point feature that
+ * has just a chosen set of its fields as properties.
+ */
+
+#ifndef GEOJSON_RESULTS_H_
+#define GEOJSON_RESULTS_H_
+
+#include "pathogenomics_service_library.h"
+#include "jansson.h"
+
+
+/**
+ * The key in a search request for the format of the results.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_FORMAT_S "format"
+
+
+/**
+ * The format value for getting the results as GeoJSON.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_GEOJSON_FORMAT_S "geojson"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Check whether a search request asks for its results as GeoJSON.
+ *
+ * @param search_p The search request.
+ * @return <code>true</code> if the results should be GeoJSON,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool IsGeoJSONSearch (const json_t *search_p);
+
+
+/**
+ * Get the properties that features have when none have been configured.
+ *
+ * @return A <code>NULL</code>-terminated array of the field names.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char **GetDefaultGeoJSONProperties (void);
+
+
+/**
+ * Get the fields that need to be fetched from the database to make
+ * features with the given properties.
+ *
+ * @param properties_ss A <code>NULL</code>-terminated array of the field
+ * names to use as properties.
+ * @return A new <code>NULL</code>-terminated array of the field names which
+ * the caller must free with FreeMemory (), or <code>NULL</code> upon error.
+ * The names themselves are not copied.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char **GetGeoJSONFields (const char **properties_ss);
+
+
+/**
+ * Convert an array of documents into a GeoJSON FeatureCollection. Each
+ * feature's geometry is the sample's location point and its properties
+ * are the given fields, keyed by their full dotted names. Documents
+ * without a location are left out.
+ *
+ * @param docs_p The JSON array of documents.
+ * @param properties_ss A <code>NULL</code>-terminated array of the field
+ * names to use as properties.
+ * @return The new FeatureCollection which the caller must decref or
+ * <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *GetDocumentsAsGeoJSON (const json_t *docs_p, const char **properties_ss);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* GEOJSON_RESULTS_H_ */
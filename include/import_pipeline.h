@@ -0,0 +1,98 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * import_pipeline.h
+ *
+ * A two-stage import where a pool of worker threads prepares the rows
+ * and the calling thread stores them in their original order.
+ */
+
+#ifndef IMPORT_PIPELINE_H_
+#define IMPORT_PIPELINE_H_
+
+#include "pathogenomics_service_library.h"
+#include "pathogenomics_service_data.h"
+#include "import_session.h"
+#include "row_source.h"
+#include "jansson.h"
+
+
+/**
+ * A function that prepares a row for storage. This is called from the
+ * worker threads, so it must not use the session's MongoTool or
+ * BulkWriter or any other state that is shared between rows unless
+ * that state is thread-safe.
+ *
+ * @param session_p The ImportSession that the row is for.
+ * @param row_p The row to prepare. This is updated in place.
+ * @param row The index of the row.
+ * @return <code>NULL</code> upon success or an error message upon failure.
+ * This must not be a temporary buffer.
+ */
+typedef const char *(*PrepareRowFn) (ImportSession *session_p, json_t *row_p, const size_t row);
+
+
+/**
+ * A function that stores a prepared row. This is only ever called
+ * from the thread that is running the pipeline.
+ *
+ * @param session_p The ImportSession to store the row with.
+ * @param row_p The prepared row.
+ * @param row The index of the row.
+ * @return <code>NULL</code> upon success or an error message upon failure.
+ */
+typedef const char *(*StoreRowFn) (ImportSession *session_p, json_t *row_p, const size_t row);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Import all of the rows from a RowSource using a pool of worker threads
+ * to prepare them. At most a fixed window of rows are held in memory at
+ * any time. The rows are stored, and any errors reported, in the same
+ * order that they were read regardless of which worker prepared them.
+ *
+ * This does not finish the ImportSession.
+ *
+ * @param session_p The ImportSession to store the rows with.
+ * @param source_p The RowSource to read the rows from.
+ * @param prepare_fn The function used by the worker threads to prepare each row.
+ * @param store_fn The function used to store each prepared row.
+ * @param num_workers The number of worker threads to use.
+ * @param num_imports_p If the pipeline was run, this will be set to the number
+ * of rows that were stored successfully.
+ * @return <code>true</code> if the pipeline was run, <code>false</code>
+ * if none of the worker threads could be started. In this case, no rows
+ * will have been read from source_p.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool RunImportPipeline (ImportSession *session_p, RowSource *source_p, PrepareRowFn prepare_fn, StoreRowFn store_fn, const uint32 num_workers, uint32 *num_imports_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMPORT_PIPELINE_H_ */
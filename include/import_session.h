@@ -0,0 +1,362 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * import_session.h
+ *
+ * The state shared by all of the rows of a single upload.
+ */
+
+#ifndef IMPORT_SESSION_H_
+#define IMPORT_SESSION_H_
+
+#include "pathogenomics_service_library.h"
+#include "pathogenomics_service_data.h"
+#include "bulk_writer.h"
+#include "row_source.h"
+#include "geocode_cache.h"
+#include "upload_checkpoints.h"
+#include "date_normaliser.h"
+#include "mongodb_tool.h"
+#include "service_job.h"
+#include "jansson.h"
+
+
+/**
+ * An ImportSession holds the details needed to store each of the rows
+ * of an upload.
+ *
+ * @ingroup pathogenomics_service
+ */
+typedef struct ImportSession
+{
+	/** The MongoTool connected to the collection being imported into. */
+	MongoTool *is_tool_p;
+
+	/** The ServiceJob that any errors are reported to. */
+	ServiceJob *is_job_p;
+
+	/** The configuration for the Pathogenomics Service. */
+	PathogenomicsServiceData *is_data_p;
+
+	/** The type of data being imported. */
+	PathogenomicsData is_collection_type;
+
+	/** The number of days before the imported data is made public. */
+	uint32 is_stage_time;
+
+	/**
+	 * The BulkWriter used to batch up the writes. If this is <code>NULL</code>
+	 * then each row is written to the database as soon as it is ready.
+	 */
+	BulkWriter *is_writer_p;
+
+	/**
+	 * The number of geocoding cache lookups made while preparing the rows.
+	 * These are updated by the GeocodeCache so can be shared by the
+	 * worker threads of an import pipeline.
+	 */
+	GeocodeCacheStats is_geocode_stats;
+
+	/**
+	 * The existing documents fetched for the rows that are about to be
+	 * stored. The layout is up to the type of data being imported and
+	 * this is <code>NULL</code> until the first batch is fetched.
+	 */
+	json_t *is_prefetched_p;
+
+	/**
+	 * The map tiles that contain the stored samples, as the keys of a JSON
+	 * object, so that they can be rebuilt once the import has finished.
+	 * This is <code>NULL</code> unless samples are being imported and the
+	 * service has map tiles.
+	 */
+	json_t *is_changed_tiles_p;
+
+	/**
+	 * The IDs of the stored documents, as the keys of a JSON object, so that
+	 * their rollups can be updated once the import has finished. This is
+	 * <code>NULL</code> unless the type of data being imported is counted
+	 * by the rollups and the service has them.
+	 */
+	json_t *is_changed_ids_p;
+
+	/**
+	 * The hashes of the rows that the existing documents were stored from.
+	 * This has a JSON object for each key that documents are looked up by,
+	 * which maps each value to its document's hash. This is <code>NULL</code>
+	 * unless unchanged rows are being skipped.
+	 */
+	json_t *is_stored_hashes_p;
+
+	/**
+	 * The hashes of the rows that have been read but not stored yet, keyed
+	 * by their row index, so that they can be added to their documents.
+	 */
+	json_t *is_pending_hashes_p;
+
+	/** The number of rows that were stored as new documents. */
+	uint32 is_num_inserted;
+
+	/** The number of rows that were stored over existing documents. */
+	uint32 is_num_updated;
+
+	/** The number of rows that were skipped as they hadn't changed. */
+	uint32 is_num_unchanged;
+
+	/**
+	 * The id that the upload's progress is recorded under so that it can
+	 * be resumed. This is <code>NULL</code> if the upload isn't checkpointed.
+	 */
+	const char *is_upload_id_s;
+
+	/** The checkpoint that the upload was resumed from. */
+	UploadCheckpoint is_resumed_checkpoint;
+
+	/** The most recently recorded checkpoint for the upload. */
+	UploadCheckpoint is_checkpoint;
+
+	/**
+	 * The sum of the fingerprints of the rows that have been stored, or
+	 * have failed, so far including any that were skipped when the upload
+	 * was resumed.
+	 */
+	uint64 is_fingerprint;
+
+	/**
+	 * The DateNormaliser for the upload's dates. This is only
+	 * used for samples and is <code>NULL</code> otherwise.
+	 */
+	DateNormaliser *is_date_normaliser_p;
+} ImportSession;
+
+
+/**
+ * A function to fetch the existing documents needed to store a batch
+ * of rows before any of them are stored.
+ *
+ * @param session_p The ImportSession to add the fetched documents to.
+ * @param rows_p A JSON array of the rows about to be stored.
+ */
+typedef void (*PrefetchRowsFn) (ImportSession *session_p, const json_t *rows_p);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate an ImportSession. If the service is configured to use bulk writes,
+ * a BulkWriter will be created for it.
+ *
+ * @param tool_p The MongoTool to write the data with.
+ * @param job_p The ServiceJob to report errors to.
+ * @param data_p The configuration for the Pathogenomics Service.
+ * @param collection_type The type of data being imported.
+ * @param stage_time The number of days before the imported data is made public.
+ * @param upload_id_s The id to record the upload's progress under so that it
+ * can be resumed if the import is interrupted. This can be <code>NULL</code>
+ * and must remain valid for the lifetime of the ImportSession.
+ * @param date_order The order of the day and month in the upload's numeric dates.
+ * @return The new ImportSession or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL ImportSession *AllocateImportSession (MongoTool *tool_p, ServiceJob *job_p, PathogenomicsServiceData *data_p, const PathogenomicsData collection_type, const uint32 stage_time, const char *upload_id_s, const DateOrder date_order);
+
+
+/**
+ * Free an ImportSession.
+ *
+ * @param session_p The ImportSession to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeImportSession (ImportSession *session_p);
+
+
+/**
+ * Import all of the rows from a RowSource. If the service is configured
+ * with more than one import worker and the type of data can be prepared
+ * separately from being stored, the rows are prepared concurrently by
+ * an import pipeline. Otherwise each row is read, stored and released
+ * before the next one is read. In both cases the rows are stored, and any
+ * errors added to the session's ServiceJob, in the order that they were read.
+ * If the type of data needs existing documents to store its rows, these
+ * are fetched for batches of rows as they are read.
+ *
+ * @param session_p The ImportSession to use.
+ * @param source_p The RowSource to read the rows from.
+ * @return The number of rows that were imported successfully.
+ */
+PATHOGENOMICS_SERVICE_LOCAL uint32 ImportRows (ImportSession *session_p, RowSource *source_p);
+
+
+/**
+ * Check whether a row is the same as when its document was last stored,
+ * in which case it doesn't need preparing or storing again. Otherwise
+ * the row's hash is kept so that it can be stored with its document.
+ * This must be called, in the order that the rows are read, from the
+ * thread that stores them.
+ *
+ * @param session_p The ImportSession to use.
+ * @param row_p The row as it was read, before it has been prepared.
+ * @param row The index of the row.
+ * @return <code>true</code> if the row is unchanged and can be skipped,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool IsUnchangedImportRow (ImportSession *session_p, const json_t *row_p, const size_t row);
+
+
+/**
+ * Store a prepared document, either immediately or by adding it to the
+ * session's current bulk operation.
+ *
+ * @param session_p The ImportSession to use.
+ * @param doc_p The document to store.
+ * @param primary_key_s The key in doc_p whose value identifies the document to update.
+ * @param row The index of the row that doc_p was created from.
+ * @return <code>NULL</code> upon success or an error message upon failure.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *SaveImportedDocument (ImportSession *session_p, json_t *doc_p, const char * const primary_key_s, const size_t row);
+
+
+/**
+ * Store a prepared document by setting each of the values in one of its
+ * sections by their dotted paths, so the database merges them into any
+ * existing document in a single upsert. The ID fields are only set when
+ * the document is created and any other top-level values are set as they
+ * are. If the service isn't configured for partial upserts, or any of the
+ * section's keys can't be used in a dotted path, the document is stored
+ * with SaveImportedDocument () instead.
+ *
+ * @param session_p The ImportSession to use.
+ * @param doc_p The document to store.
+ * @param primary_key_s The key in doc_p whose value identifies the document to update.
+ * @param section_s The key in doc_p of the section whose values will be set.
+ * @param id_keys_ss A <code>NULL</code>-terminated array of the keys in doc_p
+ * that are only set when the document is created.
+ * @param row The index of the row that doc_p was created from.
+ * @return <code>NULL</code> upon success or an error message upon failure.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *SaveImportedSection (ImportSession *session_p, json_t *doc_p, const char * const primary_key_s, const char * const section_s, const char **id_keys_ss, const size_t row);
+
+
+/**
+ * Remove the first document matching a selector, either immediately or by
+ * adding the removal to the session's current bulk operation.
+ *
+ * @param session_p The ImportSession to use.
+ * @param selector_p The query for the document to remove.
+ * @param row The index of the row that this removal is for.
+ * @return <code>NULL</code> upon success or an error message upon failure.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *RemoveImportedDocument (ImportSession *session_p, const json_t *selector_p, const size_t row);
+
+
+/**
+ * Report an error for a row of an upload to the session's ServiceJob.
+ *
+ * @param session_p The ImportSession to use.
+ * @param row_p The row that the error is for. This can be <code>NULL</code>
+ * if the row could not be read.
+ * @param error_s The error message.
+ * @param row The index of the row.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void AddImportSessionRowError (ImportSession *session_p, const json_t *row_p, const char *error_s, const size_t row);
+
+
+/**
+ * Get the fingerprint of a row as it is read so that it can be added
+ * to the ImportSession's fingerprint once the row is stored. This must be
+ * called before the row is changed by being prepared or stored.
+ *
+ * @param session_p The ImportSession that the row is for.
+ * @param row_p The row. This can be <code>NULL</code> if the row could not be read.
+ * @param row The index of the row.
+ * @return The row's fingerprint or 0 if the upload isn't checkpointed.
+ */
+PATHOGENOMICS_SERVICE_LOCAL uint64 GetImportRowFingerprint (const ImportSession *session_p, const json_t *row_p, const size_t row);
+
+
+/**
+ * Add the fingerprint of a row that has just been stored, or has failed,
+ * to an ImportSession. This must be called for each row, before
+ * CheckpointImportSession (), from the thread that stores them.
+ *
+ * @param session_p The ImportSession to update.
+ * @param fingerprint The row's fingerprint from GetImportRowFingerprint ().
+ */
+PATHOGENOMICS_SERVICE_LOCAL void AddImportRowFingerprint (ImportSession *session_p, const uint64 fingerprint);
+
+
+/**
+ * Record how far through its upload an ImportSession has got, if the upload
+ * is checkpointed and enough rows have been stored since the last checkpoint.
+ * Any outstanding operations are written first so that the checkpoint only
+ * covers rows that are in the database. This must be called after each row
+ * has been stored, in order, from the thread that stores them.
+ *
+ * @param session_p The ImportSession to checkpoint.
+ * @param num_rows The number of rows that have been stored, or have failed,
+ * since the import started.
+ * @param num_imports The number of those rows that were stored successfully.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void CheckpointImportSession (ImportSession *session_p, const size_t num_rows, const uint32 num_imports);
+
+
+/**
+ * Check all of the rows from a RowSource for the problems that would
+ * stop them from being imported, without geocoding them or writing
+ * anything to the database. An error is added to the ServiceJob for
+ * each row that would fail.
+ *
+ * @param source_p The RowSource to read the rows from.
+ * @param collection_type The type of data that the rows are.
+ * @param date_order The order of the day and month in the rows' numeric dates.
+ * @param job_p The ServiceJob to add the errors to.
+ * @return The number of rows that are valid.
+ */
+PATHOGENOMICS_SERVICE_LOCAL uint32 ValidateRows (RowSource *source_p, const PathogenomicsData collection_type, const DateOrder date_order, ServiceJob *job_p);
+
+
+/**
+ * Write any outstanding operations for an ImportSession.
+ *
+ * @param session_p The ImportSession to finish.
+ * @return <code>true</code> if all of the outstanding operations succeeded,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool FinishImportSession (ImportSession *session_p);
+
+
+/**
+ * Get the number of rows whose queued writes were rejected by the database.
+ *
+ * @param session_p The ImportSession to query.
+ * @return The number of failed rows.
+ */
+PATHOGENOMICS_SERVICE_LOCAL uint32 GetImportSessionNumberOfFailedRows (const ImportSession *session_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMPORT_SESSION_H_ */
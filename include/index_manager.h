@@ -0,0 +1,94 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * index_manager.h
+ *
+ * Make sure that the collections have the indexes that the searches
+ * and imports rely on. The indexes are described by a JSON array of
+ * index specifications, each of which is an object such as
+ *
+ *   {
+ *     "name": "id",
+ *     "key": { "ID": 1 },
+ *     "unique": true,
+ *     "sparse": true,
+ *     "collections": [ "sample" ]
+ *   }
+ *
+ * where "unique" and "sparse" default to false and "collections" lists
+ * the types of data that the index is for. If "collections" is missing,
+ * the index is for every type of data.
+ */
+
+#ifndef INDEX_MANAGER_H_
+#define INDEX_MANAGER_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the index specifications used when the service configuration
+ * does not have any.
+ *
+ * @return A new JSON array of index specifications which the caller
+ * must decref or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *GetDefaultIndexSpecs (void);
+
+
+/**
+ * Make sure that a collection has the indexes that are specified for
+ * the types of data stored in it. Any missing indexes are created. Any
+ * existing indexes whose definitions differ from their specifications,
+ * or that are not specified at all, are reported as drift but are left
+ * in place.
+ *
+ * @param tool_p The MongoTool to use. Its current database and collection
+ * will be changed to database_s and collection_s.
+ * @param database_s The name of the database that collection_s is in.
+ * @param collection_s The name of the collection to check.
+ * @param specs_p The JSON array of index specifications.
+ * @param data_names_ss A <code>NULL</code>-terminated array of the names of
+ * the types of data stored in collection_s. Only the specifications for
+ * these types are used.
+ * @param num_drifts_p If this is not <code>NULL</code>, it will be set to
+ * the number of indexes that have drifted from their specifications or
+ * could not be created.
+ * @return <code>true</code> if the existing indexes could be read,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool ReconcileIndexes (MongoTool *tool_p, const char *database_s, const char *collection_s, const json_t *specs_p, const char **data_names_ss, uint32 *num_drifts_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* INDEX_MANAGER_H_ */
@@ -0,0 +1,139 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * live_dates.h
+ *
+ * Get documents with any sections that have not yet reached their
+ * live dates removed. The filtering is done by the database as an
+ * aggregation pipeline so embargoed data is never sent to the service.
+ */
+
+#ifndef LIVE_DATES_H_
+#define LIVE_DATES_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "search_page.h"
+#include "jansson.h"
+
+
+/**
+ * A function called with each document found by ForEachLiveDocument ().
+ *
+ * @param doc_p The document. This is only valid for the duration of the
+ * call so the callback must incref it to keep it.
+ * @param data_p The data passed to ForEachLiveDocument ().
+ * @return <code>true</code> to carry on with the next document,
+ * <code>false</code> to stop.
+ */
+typedef bool (*LiveDocumentCallback) (json_t *doc_p, void *data_p);
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Find the documents in the tool's current collection that match a query.
+ * For the public view, each of the sample, phenotype, genotype and files
+ * sections whose live date is after today is removed, along with all of
+ * the live dates, and any documents that are left without a sample,
+ * phenotype or genotype are dropped. Sections without a live date are
+ * always public. The internal MongoDB ids are never returned.
+ *
+ * @param tool_p The MongoTool to search with.
+ * @param query_p The query, in the same form as for FindMatchingMongoDocumentsByJSON (),
+ * or <code>NULL</code> to match every document.
+ * @param fields_ss A <code>NULL</code>-terminated array of the fields to
+ * return or <code>NULL</code> to return all of them.
+ * @param preview_flag If this is <code>true</code> the live dates are ignored
+ * and the documents are returned as they are stored.
+ * @param page_p The SearchPage to get or <code>NULL</code> to get all of the
+ * documents. If this is set, each document has its sort key added which
+ * must be removed with FinishSearchPage ().
+ * @return A new JSON array of the documents which the caller must decref
+ * or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *FindLiveDocuments (MongoTool *tool_p, const json_t *query_p, const char **fields_ss, const bool preview_flag, const SearchPage *page_p);
+
+
+/**
+ * Find the same documents as FindLiveDocuments () but pass each of them to
+ * a callback function as they are read from the database rather than
+ * collecting them all, so the memory used doesn't depend upon how many
+ * documents there are.
+ *
+ * @param tool_p The MongoTool to search with.
+ * @param query_p The query or <code>NULL</code> to match every document.
+ * @param fields_ss A <code>NULL</code>-terminated array of the fields to
+ * return or <code>NULL</code> to return all of them.
+ * @param preview_flag If this is <code>true</code> the live dates are ignored.
+ * @param page_p The SearchPage to get or <code>NULL</code> to get all of the
+ * documents.
+ * @param doc_fn The function to call with each document.
+ * @param data_p The data to pass to doc_fn.
+ * @return <code>true</code> if all of the documents were found and doc_fn
+ * succeeded for each of them, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool ForEachLiveDocument (MongoTool *tool_p, const json_t *query_p, const char **fields_ss, const bool preview_flag, const SearchPage *page_p, LiveDocumentCallback doc_fn, void *data_p);
+
+
+/**
+ * Find the same documents as ForEachLiveDocument () but using a MongoDB
+ * query filter, such as a geospatial one, rather than a search query.
+ *
+ * @param tool_p The MongoTool to search with.
+ * @param filter_p The MongoDB query filter, in extended JSON, or
+ * <code>NULL</code> to match every document.
+ * @param fields_ss A <code>NULL</code>-terminated array of the fields to
+ * return or <code>NULL</code> to return all of them.
+ * @param preview_flag If this is <code>true</code> the live dates are ignored.
+ * @param doc_fn The function to call with each document.
+ * @param data_p The data to pass to doc_fn.
+ * @return <code>true</code> if all of the documents were found and doc_fn
+ * succeeded for each of them, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool ForEachLiveDocumentMatchingFilter (MongoTool *tool_p, const json_t *filter_p, const char **fields_ss, const bool preview_flag, LiveDocumentCallback doc_fn, void *data_p);
+
+
+/**
+ * Run further aggregation stages, such as a $group, on the documents that
+ * FindLiveDocuments () would return, so that only their output is sent
+ * from the database.
+ *
+ * @param tool_p The MongoTool to use.
+ * @param query_p The query or <code>NULL</code> to match every document.
+ * @param preview_flag If this is <code>true</code> the live dates are ignored.
+ * @param extra_stages_p The JSON array of stages to run on the live documents.
+ * @return A new JSON array of the output documents which the caller must
+ * decref or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *AggregateLiveDocuments (MongoTool *tool_p, const json_t *query_p, const bool preview_flag, const json_t *extra_stages_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* LIVE_DATES_H_ */
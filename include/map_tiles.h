@@ -0,0 +1,129 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * map_tiles.h
+ *
+ * Clustered sample markers for each z/x/y tile of a zoomable web map.
+ * Each tile splits its area into a grid and has a cluster for each grid
+ * cell with samples in it, giving their number and mean location. The
+ * tiles are built from the samples' GeoJSON points when they are first
+ * requested and kept in a MongoDB collection, separately for the public
+ * and preview views. A tile is rebuilt when a sample within it changes
+ * or, since live dates are by day, when it was built before today.
+ */
+
+#ifndef MAP_TILES_H_
+#define MAP_TILES_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+typedef struct MapTiles MapTiles;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a MapTiles.
+ *
+ * @param mongo_manager_p The MongoClientManager to connect to the database with.
+ * @param database_s The name of the database.
+ * @param tiles_collection_s The name of the collection to keep the tiles in.
+ * @param samples_collection_s The name of the collection of samples.
+ * @param max_zoom The highest zoom level that tiles can be requested for.
+ * @param grid_size The number of grid cells along each side of a tile.
+ * @return The new MapTiles or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL MapTiles *AllocateMapTiles (MongoClientManager *mongo_manager_p, const char *database_s, const char *tiles_collection_s, const char *samples_collection_s, const uint32 max_zoom, const uint32 grid_size);
+
+
+/**
+ * Free a MapTiles.
+ *
+ * @param tiles_p The MapTiles to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeMapTiles (MapTiles *tiles_p);
+
+
+/**
+ * Get a tile, building it if it isn't stored or is out of date.
+ *
+ * @param tiles_p The MapTiles to use.
+ * @param tile_s The tile as "z/x/y".
+ * @param preview_flag If this is <code>true</code> the tile has all of the
+ * samples, otherwise it only has the public ones.
+ * @param error_ss If the tile can't be got, this will be set to the reason why.
+ * @return The tile, with its "z", "x" and "y" values and its array of
+ * "clusters", each of which has "coordinates" of [longitude, latitude] and a
+ * "count". The caller must decref this. Upon error this is <code>NULL</code>.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *GetMapTile (MapTiles *tiles_p, const char *tile_s, const bool preview_flag, const char **error_ss);
+
+
+/**
+ * Add the tiles, at every zoom level, that contain a sample's location to
+ * a set of changed tiles.
+ *
+ * @param tiles_p The MapTiles to use.
+ * @param changed_tiles_p The JSON object whose keys are the changed tiles.
+ * @param sample_p The sample. If it has no GeoJSON point, nothing is added.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddChangedMapTiles (const MapTiles *tiles_p, json_t *changed_tiles_p, const json_t *sample_p);
+
+
+/**
+ * Add the tiles that contain the locations of the samples in the documents
+ * matching a MongoDB query filter to a set of changed tiles. This is for
+ * documents that are about to be changed or removed.
+ *
+ * @param tiles_p The MapTiles to use.
+ * @param tool_p The MongoTool for the collection that the documents are in.
+ * @param filter_p The MongoDB query filter for the documents.
+ * @param changed_tiles_p The JSON object whose keys are the changed tiles.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddChangedMapTilesForFilter (const MapTiles *tiles_p, MongoTool *tool_p, const json_t *filter_p, json_t *changed_tiles_p);
+
+
+/**
+ * Remove a set of changed tiles from the store so that they are
+ * rebuilt the next time that they are requested.
+ *
+ * @param tiles_p The MapTiles to use.
+ * @param changed_tiles_p The JSON object whose keys are the changed tiles.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool InvalidateMapTiles (MapTiles *tiles_p, const json_t *changed_tiles_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* MAP_TILES_H_ */
@@ -0,0 +1,105 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * mongo_tool_pool.h
+ *
+ * A bounded pool of MongoTools so that requests running at the same time
+ * each have their own connection rather than sharing one. The tools are
+ * created as they are first needed, up to the size of the pool, and any
+ * request that finds them all in use waits for one to be returned.
+ */
+
+#ifndef MONGO_TOOL_POOL_H_
+#define MONGO_TOOL_POOL_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+typedef struct MongoToolPool MongoToolPool;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a MongoToolPool.
+ *
+ * @param mongo_manager_p The MongoClientManager to connect to the database with.
+ * @param size The maximum number of MongoTools that can be checked out at the same time.
+ * @param wait_timeout The number of milliseconds to wait for a MongoTool to be
+ * returned when they are all in use. If this is 0, the wait is unlimited.
+ * @return The new MongoToolPool or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL MongoToolPool *AllocateMongoToolPool (MongoClientManager *mongo_manager_p, const uint32 size, const uint32 wait_timeout);
+
+
+/**
+ * Free a MongoToolPool along with all of its MongoTools. None of them
+ * may still be checked out.
+ *
+ * @param pool_p The MongoToolPool to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeMongoToolPool (MongoToolPool *pool_p);
+
+
+/**
+ * Get a MongoTool for the sole use of the caller until it is returned with
+ * CheckInMongoTool (). If they are all in use, this waits for up to the
+ * pool's timeout for one to be returned.
+ *
+ * @param pool_p The MongoToolPool to get the MongoTool from.
+ * @return The MongoTool or <code>NULL</code> if none became free in time
+ * or a new one could not be created.
+ */
+PATHOGENOMICS_SERVICE_LOCAL MongoTool *CheckOutMongoTool (MongoToolPool *pool_p);
+
+
+/**
+ * Return a MongoTool to its pool so that it can be used by another request.
+ *
+ * @param pool_p The MongoToolPool that the MongoTool was checked out from.
+ * @param tool_p The MongoTool to return.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void CheckInMongoTool (MongoToolPool *pool_p, MongoTool *tool_p);
+
+
+/**
+ * Add the utilisation counts for a MongoToolPool to a JSON object.
+ *
+ * @param pool_p The MongoToolPool to get the counts for.
+ * @param json_p The JSON object to add the counts to.
+ * @return <code>true</code> if the counts were added successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddMongoToolPoolStatsToJSON (MongoToolPool *pool_p, json_t *json_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* MONGO_TOOL_POOL_H_ */
@@ -0,0 +1,101 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * ndjson_dump.h
+ *
+ * Write the live documents of a collection as newline-delimited JSON,
+ * one compact document per line, straight from the database cursor so
+ * that the whole collection is never held in memory.
+ */
+
+#ifndef NDJSON_DUMP_H_
+#define NDJSON_DUMP_H_
+
+#include <stdio.h>
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+
+
+/**
+ * The file extension used for dump files.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_NDJSON_EXTENSION_S ".ndjson"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Write all of the live documents in the tool's current collection to a stream.
+ *
+ * @param tool_p The MongoTool to use.
+ * @param preview_flag If this is <code>true</code> the live dates are ignored.
+ * @param out_f The stream to write to.
+ * @param num_docs_p If this is not <code>NULL</code>, it will be set to the
+ * number of documents that were written.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool WriteNDJSONDump (MongoTool *tool_p, const bool preview_flag, FILE *out_f, uint32 *num_docs_p);
+
+
+/**
+ * Write all of the live documents in the tool's current collection to a
+ * file in a spool directory. The documents are written to a temporary file
+ * which is only renamed to its final name once it is complete, so a partial
+ * dump is never visible.
+ *
+ * @param tool_p The MongoTool to use.
+ * @param preview_flag If this is <code>true</code> the live dates are ignored.
+ * @param directory_s The directory to write the file to.
+ * @param name_s The name of the file, without the extension.
+ * @param num_docs_p If this is not <code>NULL</code>, it will be set to the
+ * number of documents that were written.
+ * @return The full path of the file which the caller must free with
+ * FreeCopiedString (), or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL char *SpoolNDJSONDump (MongoTool *tool_p, const bool preview_flag, const char *directory_s, const char *name_s, uint32 *num_docs_p);
+
+
+/**
+ * Remove the dump files, and any partial files left by dumps that didn't
+ * finish, from a spool directory once they have not been modified for
+ * a given time.
+ *
+ * @param directory_s The spool directory.
+ * @param retention_time The number of seconds to keep the files for.
+ * @return <code>true</code> if all of the expired files were removed,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool RemoveExpiredNDJSONDumps (const char *directory_s, const uint32 retention_time);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* NDJSON_DUMP_H_ */
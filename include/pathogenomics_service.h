@@ -204,6 +204,23 @@ PATHOGENOMICS_PREFIX const char *PG_COMPANY_S PATHOGENOMICS_VAL ("Company");
 PATHOGENOMICS_PREFIX const char *PG_ADDRESS_S PATHOGENOMICS_VAL ("Address");
 
 
+/**
+ * The key used to give the location of a sample as a GeoJSON point
+ * so that it can be geospatially indexed.
+ *
+ * @ingroup pathogenomics_service
+ */
+PATHOGENOMICS_PREFIX const char *PG_GEO_S PATHOGENOMICS_VAL ("geo");
+
+
+/**
+ * The key used to give the genetic group of a genotype.
+ *
+ * @ingroup pathogenomics_service
+ */
+PATHOGENOMICS_PREFIX const char *PG_GENETIC_GROUP_S PATHOGENOMICS_VAL ("Genetic group");
+
+
 
 /**
  * The flag used to determine whether to ignore the publication date for a given sample.
@@ -229,6 +246,24 @@ PATHOGENOMICS_PREFIX const char *PG_PRIVATE_VIEW_S PATHOGENOMICS_VAL ("ignore_li
 #define PG_LIVE_DATE_SUFFIX_S "_live_date"
 
 
+/**
+ * The key within a live date object that holds the same date as a
+ * BSON date, in MongoDB extended JSON, so that it can be indexed and
+ * compared by the database.
+ *
+ * For example
+ *
+ * 	"genotype_live_date": {
+ * 		"@type": "Date",
+ * 		"date": "2016-01-01",
+ * 		"datetime": { "$date": "2016-01-01T00:00:00Z" }
+ * 	}
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_LIVE_DATE_TIME_S "datetime"
+
+
 #ifdef __cplusplus
 extern "C"
 {
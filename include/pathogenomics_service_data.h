@@ -32,6 +32,13 @@
 
 #include "service.h"
 #include "mongodb_tool.h"
+#include "async_jobs.h"
+#include "geocode_cache.h"
+#include "gazetteer.h"
+#include "map_tiles.h"
+#include "rollups.h"
+#include "mongo_tool_pool.h"
+#include "upload_checkpoints.h"
 #include "pathogenomics_service_library.h"
 
 
@@ -46,6 +53,9 @@ typedef enum
 
 typedef struct PathogenomicsServiceData PathogenomicsServiceData;
 
+/* Declared here as the ColumnSchema functions need the PathogenomicsData types */
+typedef struct ColumnSchema ColumnSchema;
+
 /**
  * The configuration data used by the Pathogenomics Service.
  *
@@ -60,6 +70,8 @@ struct /*PATHOGENOMICS_SERVICE_LOCAL*/ PathogenomicsServiceData
 	 * @private
 	 *
 	 * The MongoTool to connect to the database where our data is stored.
+	 * This is only used while the service is being configured, each request
+	 * gets its own MongoTool.
 	 */
 	MongoTool *psd_tool_p;
 
@@ -92,6 +104,181 @@ struct /*PATHOGENOMICS_SERVICE_LOCAL*/ PathogenomicsServiceData
 	 * The default stage time, in days, before the filed sample data gets published
 	 */
 	json_int_t psd_default_stage_time;
+
+	/**
+	 * @private
+	 *
+	 * The number of write operations to send to the database in each
+	 * bulk operation when importing data. If this is 0, each row is
+	 * written individually.
+	 */
+	uint32 psd_bulk_batch_size;
+
+	/**
+	 * @private
+	 *
+	 * Whether the operations in each bulk write should be run in order,
+	 * stopping at the first error, or unordered.
+	 */
+	bool psd_ordered_bulk_writes_flag;
+
+	/**
+	 * @private
+	 *
+	 * Whether phenotypes, genotypes and files are stored by setting each of
+	 * their values rather than by replacing their whole section.
+	 */
+	bool psd_partial_upserts_flag;
+
+	/**
+	 * @private
+	 *
+	 * Whether uploaded rows that are the same as when their documents
+	 * were last stored are skipped rather than stored again.
+	 */
+	bool psd_skip_unchanged_rows_flag;
+
+	/**
+	 * @private
+	 *
+	 * The number of worker threads used to prepare the rows of
+	 * sample uploads. If this is 1 or less, each row is prepared
+	 * and stored in turn.
+	 */
+	uint32 psd_num_import_workers;
+
+	/**
+	 * @private
+	 *
+	 * The number of sample rows whose existing documents are fetched
+	 * together when importing. If this is 0, the existing documents
+	 * are looked up separately for each row.
+	 */
+	uint32 psd_merge_prefetch_size;
+
+	/**
+	 * @private
+	 *
+	 * The number of rows of a checkpointed upload that are stored
+	 * between each of its checkpoints.
+	 */
+	uint32 psd_upload_checkpoint_interval;
+
+	/**
+	 * @private
+	 *
+	 * The largest number of results that a search can return at once.
+	 * If this is 0, there is no maximum.
+	 */
+	uint32 psd_search_page_limit;
+
+	/**
+	 * @private
+	 *
+	 * The directory that dumps are written to as newline-delimited JSON
+	 * files. If this is <code>NULL</code>, dumps are not available.
+	 */
+	const char *psd_dump_directory_s;
+
+	/**
+	 * @private
+	 *
+	 * The URI that the dump directory is served from. If this is
+	 * <code>NULL</code>, dump results refer to the local file instead.
+	 */
+	const char *psd_dump_host_s;
+
+	/**
+	 * @private
+	 *
+	 * The number of seconds that dump files are kept for before they
+	 * are removed. If this is 0, they are never removed.
+	 */
+	uint32 psd_dump_retention_time;
+
+	/**
+	 * @private
+	 *
+	 * The fields that are used as the properties of the features in
+	 * GeoJSON search results. If this is <code>NULL</code>, the
+	 * defaults are used.
+	 */
+	const char **psd_geojson_properties_ss;
+
+	/**
+	 * @private
+	 *
+	 * The names that aggregations can group by, mapped to the dotted
+	 * paths of their fields. If this is <code>NULL</code>, the defaults
+	 * are used.
+	 */
+	const json_t *psd_aggregate_keys_p;
+
+	/**
+	 * @private
+	 *
+	 * The executor for requests that are run in the background.
+	 * If this is <code>NULL</code>, all requests are run synchronously.
+	 */
+	AsyncJobManager *psd_async_manager_p;
+
+	/**
+	 * @private
+	 *
+	 * The cache of previously geocoded addresses. If this is <code>NULL</code>,
+	 * every address is sent to the geocoder.
+	 */
+	GeocodeCache *psd_geocode_cache_p;
+
+	/**
+	 * @private
+	 *
+	 * The offline index of place centroids that is searched before using
+	 * the geocoder. If this is <code>NULL</code>, every address is geocoded.
+	 */
+	Gazetteer *psd_gazetteer_p;
+
+	/**
+	 * @private
+	 *
+	 * The clustered map tiles built from the sample locations. If this
+	 * is <code>NULL</code>, map tiles are not available.
+	 */
+	MapTiles *psd_map_tiles_p;
+
+	/**
+	 * @private
+	 *
+	 * The sample counters that summaries are read from. If this is
+	 * <code>NULL</code>, summaries are not available.
+	 */
+	Rollups *psd_rollups_p;
+
+	/**
+	 * @private
+	 *
+	 * The MongoTools that requests check out so that those running at the
+	 * same time don't share a connection. If this is <code>NULL</code>,
+	 * synchronous requests use psd_tool_p.
+	 */
+	MongoToolPool *psd_tool_pool_p;
+
+	/**
+	 * @private
+	 *
+	 * The progress of uploads that have been given an upload id. If this
+	 * is <code>NULL</code>, uploads can't be resumed.
+	 */
+	UploadCheckpoints *psd_upload_checkpoints_p;
+
+	/**
+	 * @private
+	 *
+	 * The column types from the "field_defs" configuration and the
+	 * columns that each data type requires, compiled when the
+	 * service is configured.
+	 */
+	ColumnSchema *psd_column_schema_p;
 };
 
 
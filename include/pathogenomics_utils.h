@@ -46,7 +46,18 @@ PATHOGENOMICS_SERVICE_LOCAL bool AddPublishDateToJSON (json_t *json_p, const cha
 PATHOGENOMICS_SERVICE_LOCAL bool SetDateForSchemaOrg (json_t *values_p, const char * const key_s, const char * const iso_date_s);
 
 
-PATHOGENOMICS_SERVICE_LOCAL bool CheckForFields (const LinkedList *column_headers_p, const char **headers_ss, ServiceJob *job_p);
+/*
+ * Find the first object with numeric latitude and longitude values,
+ * wherever the location data has put it.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool FindLocationCoordinates (const json_t *value_p, double64 *latitude_p, double64 *longitude_p);
+
+
+/*
+ * Get the current date as YYYY-MM-DD, the same form as the
+ * live dates. The caller must free it with FreeCopiedString ().
+ */
+PATHOGENOMICS_SERVICE_LOCAL char *GetTodayAsString (void);
 
 
 #ifdef __cplusplus
@@ -31,6 +31,7 @@
 #include "pathogenomics_service_library.h"
 #include "mongodb_tool.h"
 #include "pathogenomics_service_data.h"
+#include "import_session.h"
 
 #include "pathogenomics_service.h"
 #include "linked_list.h"
@@ -43,9 +44,40 @@ extern "C"
 #endif
 
 
-PATHOGENOMICS_SERVICE_LOCAL const char *InsertPhenotypeData (MongoTool *tool_p, json_t *values_p, const uint32 stage_time, PathogenomicsServiceData *data_p);
+PATHOGENOMICS_SERVICE_LOCAL const char *InsertPhenotypeData (ImportSession *session_p, json_t *values_p, const size_t row);
 
 
+/**
+ * Check that a row of phenotype data has an ID or isolate to store it by,
+ * without accessing the database.
+ *
+ * @param values_p The row to check.
+ * @param normaliser_p The DateNormaliser for the upload. This isn't used as
+ * phenotype rows have no dates to convert.
+ * @return <code>NULL</code> if the row is valid or an error message otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *ValidatePhenotypeRow (json_t *values_p, DateNormaliser *normaliser_p);
+
+
+/**
+ * Set the columns that uploaded phenotype tables must have.
+ *
+ * @param schema_p The ColumnSchema to set the columns in.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool SetPhenotypeRequiredColumns (ColumnSchema *schema_p);
+
+
+/**
+ * Check that the column headings of an uploaded phenotype table include
+ * all of the required columns.
+ *
+ * @param headers_p The column headings, as returned by GetTabularHeaders ().
+ * @param job_p The ServiceJob to add an error to for each missing column.
+ * @param data_p The configuration data for the service.
+ * @return <code>true</code> if all of the required columns are present,
+ * <code>false</code> otherwise.
+ */
 PATHOGENOMICS_SERVICE_LOCAL bool CheckPhenotypeData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p);
 
 
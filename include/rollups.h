@@ -0,0 +1,125 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * rollups.h
+ *
+ * Sample counters kept up to date as data is imported and deleted, so
+ * that summaries can be read without going through every sample. Each
+ * counter is for a disease, genetic group, country, county and ISO week
+ * along with the date that its samples become public. The counters that
+ * each document has added to are stored separately so that they can be
+ * taken off again when the document changes.
+ */
+
+#ifndef ROLLUPS_H_
+#define ROLLUPS_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+/**
+ * The key for the ISO week, as YYYY-Www, that a sample was collected
+ * in within the rollup counters.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_ROLLUP_WEEK_S "week"
+
+
+typedef struct Rollups Rollups;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate a Rollups.
+ *
+ * @param mongo_manager_p The MongoClientManager to connect to the database with.
+ * @param database_s The name of the database.
+ * @param counters_collection_s The name of the collection to keep the counters in.
+ * @param sources_collection_s The name of the collection to keep the counters
+ * that each document has added to in.
+ * @return The new Rollups or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL Rollups *AllocateRollups (MongoClientManager *mongo_manager_p, const char *database_s, const char *counters_collection_s, const char *sources_collection_s);
+
+
+/**
+ * Free a Rollups.
+ *
+ * @param rollups_p The Rollups to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeRollups (Rollups *rollups_p);
+
+
+/**
+ * Bring the counters up to date for some documents that have been
+ * stored or removed. The counters that each document previously added
+ * to are taken off and those for its current values, if it still
+ * exists, are added.
+ *
+ * @param rollups_p The Rollups to update.
+ * @param tool_p The MongoTool for the collection that the documents are in.
+ * @param ids_p The JSON object whose keys are the IDs of the changed documents.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool UpdateRollups (Rollups *rollups_p, MongoTool *tool_p, const json_t *ids_p);
+
+
+/**
+ * Add the IDs of the documents that match a MongoDB query filter to a set
+ * of changed documents. This is for documents that are about to be removed.
+ *
+ * @param tool_p The MongoTool for the collection that the documents are in.
+ * @param filter_p The MongoDB query filter for the documents.
+ * @param ids_p The JSON object whose keys are the IDs of the changed documents.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddRollupIdsForFilter (MongoTool *tool_p, const json_t *filter_p, json_t *ids_p);
+
+
+/**
+ * Get the number of samples in each group of counter values.
+ *
+ * @param rollups_p The Rollups to read.
+ * @param summary_p The summary request with a "group" array of the names to
+ * group by and an optional "data" object of the values that the counters must have.
+ * @param preview_flag If this is <code>true</code>, the samples that are still
+ * embargoed are counted too.
+ * @param error_ss If the request is invalid, this will be set to the reason why.
+ * @return A new JSON array of the counts which the caller must decref
+ * or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *GetRollupCounts (Rollups *rollups_p, const json_t *summary_p, const bool preview_flag, const char **error_ss);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* ROLLUPS_H_ */
@@ -0,0 +1,105 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * row_hashes.h
+ *
+ * Hashes of the uploaded rows that each section was stored from, so
+ * that rows which haven't changed since they were last uploaded can
+ * be skipped.
+ */
+
+#ifndef ROW_HASHES_H_
+#define ROW_HASHES_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+/**
+ * The suffix attached to a section's key to give the key that holds
+ * the hash of the row that the section was stored from.
+ *
+ * For example
+ *
+ * 	"genotype": { ... },
+ * 	"genotype_hash": "8c3f9a0b12d4e567"
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_HASH_SUFFIX_S "_hash"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the hash of an uploaded row. The row is serialised with its keys
+ * sorted, so the order of the columns doesn't matter, along with the
+ * number of days before it is made public, so that changing that stores
+ * the row again.
+ *
+ * @param row_p The row to hash.
+ * @param stage_time The number of days before the row's data is made public.
+ * @return The hash as a newly-allocated string of hex digits which should
+ * be freed with FreeCopiedString () or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL char *GetRowContentHash (const json_t *row_p, const uint32 stage_time);
+
+
+/**
+ * Get the fingerprint of an uploaded row at a given position. Adding up
+ * the fingerprints of the rows from the start of an upload gives a value
+ * that changes if any of those rows, or their order, is different.
+ *
+ * @param row_p The row to get the fingerprint of. This can be <code>NULL</code>
+ * if the row could not be read.
+ * @param row The index of the row.
+ * @return The fingerprint.
+ */
+PATHOGENOMICS_SERVICE_LOCAL uint64 GetRowFingerprint (const json_t *row_p, const size_t row);
+
+
+/**
+ * Get the stored hashes for the documents with any of a set of values
+ * in one query.
+ *
+ * @param tool_p The MongoTool for the collection to search.
+ * @param key_s The key whose values to search for.
+ * @param values_p The JSON array of the values to search for.
+ * @param hash_key_s The key of the stored hashes.
+ * @return A new JSON object with each value that matched as a key. Its value
+ * is the stored hash, an empty string if its document doesn't have one or
+ * <code>null</code> if more than one document has the value. The caller must
+ * decref this. <code>NULL</code> is returned upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL json_t *FetchStoredRowHashes (MongoTool *tool_p, const char *key_s, json_t *values_p, const char *hash_key_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* ROW_HASHES_H_ */
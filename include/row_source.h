@@ -0,0 +1,163 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * row_source.h
+ *
+ * Sources of rows to import, read one row at a time so that an upload
+ * never needs to be converted into a single large JSON array.
+ */
+
+#ifndef ROW_SOURCE_H_
+#define ROW_SOURCE_H_
+
+#include "pathogenomics_service_library.h"
+#include "jansson.h"
+#include "linked_list.h"
+
+
+typedef struct RowSource RowSource;
+
+
+/**
+ * A function called with each batch of rows read by a read-ahead RowSource.
+ *
+ * @param rows_p A JSON array of the valid rows in the batch.
+ * @param data_p The data passed to AllocateReadAheadRowSource ().
+ */
+typedef void (*RowBatchCallback) (const json_t *rows_p, void *data_p);
+
+
+/**
+ * The base datatype for getting rows to import.
+ *
+ * @ingroup pathogenomics_service
+ */
+struct RowSource
+{
+	/**
+	 * Get the next row.
+	 *
+	 * @param source_p The RowSource to get the row from.
+	 * @param row_pp If there is a valid next row, this will be set to a new
+	 * reference to it which the caller must decref.
+	 * @param error_ss If the next row could not be read, this will be set to
+	 * the reason why.
+	 * @return <code>true</code> if there was another row, whether valid or not,
+	 * <code>false</code> if all of the rows have been read.
+	 */
+	bool (*rs_get_next_row_fn) (RowSource *source_p, json_t **row_pp, const char **error_ss);
+
+	/** The callback function to free this RowSource. */
+	void (*rs_free_fn) (RowSource *source_p);
+
+	/** The number of rows read so far. */
+	size_t rs_num_rows;
+};
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a RowSource for a JSON value. If this is an array then each of its
+ * elements is a row, otherwise the value itself is treated as a single row.
+ *
+ * @param values_p The JSON value to read the rows from. This must remain
+ * valid for the lifetime of the RowSource.
+ * @return The new RowSource or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL RowSource *AllocateJSONRowSource (const json_t *values_p);
+
+
+/**
+ * Create a RowSource that parses delimited tabular data a row at a time.
+ *
+ * @param data_s The tabular data, positioned at the start of the first row
+ * after the column headings. This must remain valid for the lifetime of
+ * the RowSource.
+ * @param column_delimiter The character separating each column.
+ * @param row_delimiter The character separating each row.
+ * @param headers_p The column headings, as FieldNodes, as returned by GetTabularHeaders ().
+ * These are used for the row keys and the types of the values. This must remain valid for
+ * the lifetime of the RowSource.
+ * @return The new RowSource or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL RowSource *AllocateTabularRowSource (const char *data_s, const char column_delimiter, const char row_delimiter, const LinkedList *headers_p);
+
+
+/**
+ * Create a RowSource that reads rows from another RowSource a batch at a
+ * time. Each batch is passed to a callback function before any of its rows
+ * are returned, so that the data needed to store them can be fetched
+ * together. The rows, and any errors, are returned in the same order as
+ * the underlying RowSource.
+ *
+ * @param source_p The RowSource to read from. This must remain valid for
+ * the lifetime of the new RowSource and is not freed by it. The row indices
+ * carry on from any rows that have already been read from it.
+ * @param batch_size The number of rows to read at a time.
+ * @param batch_fn The function to call with each batch of rows.
+ * @param data_p The data to pass to batch_fn.
+ * @return The new RowSource or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL RowSource *AllocateReadAheadRowSource (RowSource *source_p, const size_t batch_size, RowBatchCallback batch_fn, void *data_p);
+
+
+/**
+ * Get the next row from a RowSource.
+ *
+ * @param source_p The RowSource to read from.
+ * @param row_pp If there is a valid next row, this will be set to a new
+ * reference to it which the caller must decref.
+ * @param error_ss If the next row could not be read, this will be set to
+ * the reason why.
+ * @return <code>true</code> if there was another row, whether valid or not,
+ * <code>false</code> if all of the rows have been read.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool GetNextRow (RowSource *source_p, json_t **row_pp, const char **error_ss);
+
+
+/**
+ * Get the index of the row most recently read from a RowSource.
+ *
+ * @param source_p The RowSource to query.
+ * @return The zero-based index of the current row.
+ */
+PATHOGENOMICS_SERVICE_LOCAL size_t GetCurrentRowIndex (const RowSource *source_p);
+
+
+/**
+ * Free a RowSource.
+ *
+ * @param source_p The RowSource to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeRowSource (RowSource *source_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* ROW_SOURCE_H_ */
@@ -31,6 +31,8 @@
 
 #include "pathogenomics_service_library.h"
 #include "pathogenomics_service_data.h"
+#include "import_session.h"
+#include "date_normaliser.h"
 
 #include "pathogenomics_service.h"
 
@@ -41,20 +43,37 @@ extern "C"
 
 
 
-PATHOGENOMICS_SERVICE_LOCAL bool GetLocationData (json_t *row_p, const char * const id_s, GrassrootsServer *grassroots_p);
+/**
+ * Add the location data for a row. If the service has a GeocodeCache,
+ * the row's address is looked up in that first and the geocoder is only
+ * used if the address is not in the cache, with its result then being
+ * cached for future lookups.
+ *
+ * @param row_p The row to add the location to.
+ * @param id_s The id of the row, used for error messages.
+ * @param data_p The configuration for the Pathogenomics Service.
+ * @param stats_p The cache lookup counts to update. This can be <code>NULL</code>.
+ * @return <code>true</code> if the location data was added successfully,
+ * <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool GetLocationData (json_t *row_p, const char * const id_s, PathogenomicsServiceData *data_p, GeocodeCacheStats *stats_p);
 
 
 
 /**
  * Convert a date from the given json.
  *
- * If successful, the converted date will
+ * If successful, the converted date will be stored in its schema.org form
+ * and its compact YYYYMMDD form will be added too.
  *
  * @param row_p The json fragment containing the date.
- * @return <code>true</code> if the date was converted successfully,
- * <code>false</code> otherwise.
+ * @param normaliser_p The DateNormaliser for the upload that the row is from.
+ * This can be <code>NULL</code> in which case the date is read as day-first.
+ * Otherwise the row is counted in the DateNormaliser's DateStatus counts.
+ * @return <code>NULL</code> if the date was converted successfully,
+ * otherwise the row error saying whether the date was missing or invalid.
  */
-PATHOGENOMICS_SERVICE_LOCAL bool ConvertDate (json_t *row_p);
+PATHOGENOMICS_SERVICE_LOCAL const char *ConvertDate (json_t *row_p, DateNormaliser *normaliser_p);
 
 
 
@@ -62,9 +81,81 @@ PATHOGENOMICS_SERVICE_LOCAL bool ConvertDate (json_t *row_p);
 PATHOGENOMICS_SERVICE_LOCAL bool RefineLocationDataForOpenCage (PathogenomicsServiceData *service_data_p, json_t *row_p, const json_t *raw_data_p, const char * const town_s, const char * const county_s);
 
 
-PATHOGENOMICS_SERVICE_LOCAL const char *InsertSampleData (MongoTool *tool_p, json_t *values_p, const uint32 stage_time, PathogenomicsServiceData *data_p);
+PATHOGENOMICS_SERVICE_LOCAL const char *InsertSampleData (ImportSession *session_p, json_t *values_p, const size_t row);
+
+
+/**
+ * Check a row of sample data for the problems that would stop it from
+ * being imported, without geocoding it or accessing the database. This
+ * checks the id, the date, the pathogen and that there is either a GPS
+ * value that can be parsed or an address that could be geocoded.
+ *
+ * @param values_p The row to check. This may be updated in place.
+ * @param normaliser_p The DateNormaliser for the upload that the row is from.
+ * @return <code>NULL</code> if the row is valid or an error message
+ * describing the first problem found.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *ValidateSampleRow (json_t *values_p, DateNormaliser *normaliser_p);
+
+
+/**
+ * Prepare a row of sample data for storage. This adds the schema.org context,
+ * converts the date, determines the location and normalises the pathogen,
+ * collector and company values. It does not access the database, so
+ * different rows can be prepared concurrently.
+ *
+ * @param session_p The ImportSession that the row is for.
+ * @param values_p The row to prepare. This is updated in place.
+ * @param row The index of the row.
+ * @return <code>NULL</code> upon success or an error message upon failure.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *PrepareSampleRow (ImportSession *session_p, json_t *values_p, const size_t row);
+
+
+/**
+ * Store a row of sample data that has been prepared by PrepareSampleRow (),
+ * merging it with any existing phenotype data for the same UKCPVS ID.
+ *
+ * @param session_p The ImportSession to store the row with.
+ * @param values_p The prepared row.
+ * @param row The index of the row.
+ * @return <code>NULL</code> upon success or an error message upon failure.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *StoreSampleRow (ImportSession *session_p, json_t *values_p, const size_t row);
 
 
+/**
+ * Fetch the existing documents that a batch of sample rows may need to be
+ * merged with. This uses one query for all of the rows' UKCPVS IDs and
+ * another for the IDs of those rows that match a single existing document,
+ * rather than two queries for each row. Any rows whose documents could not
+ * be fetched are looked up individually when they are stored.
+ *
+ * @param session_p The ImportSession to store the fetched documents in.
+ * @param rows_p A JSON array of the rows about to be stored.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void PrefetchSampleRows (ImportSession *session_p, const json_t *rows_p);
+
+
+/**
+ * Set the columns that uploaded sample tables must have.
+ *
+ * @param schema_p The ColumnSchema to set the columns in.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool SetSampleRequiredColumns (ColumnSchema *schema_p);
+
+
+/**
+ * Check that the column headings of an uploaded sample table include
+ * all of the required columns.
+ *
+ * @param headers_p The column headings, as returned by GetTabularHeaders ().
+ * @param job_p The ServiceJob to add an error to for each missing column.
+ * @param data_p The configuration data for the service.
+ * @return <code>true</code> if all of the required columns are present,
+ * <code>false</code> otherwise.
+ */
 PATHOGENOMICS_SERVICE_LOCAL bool CheckSampleData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p);
 
 #ifdef __cplusplus
@@ -0,0 +1,153 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * search_page.h
+ *
+ * The ordering and size of a page of search results. Pages can follow on
+ * from each other using continuation tokens which hold the sort key of
+ * the last document of the previous page, so the database can use an
+ * index to start at the next document rather than skipping over all of
+ * the earlier ones.
+ */
+
+#ifndef SEARCH_PAGE_H_
+#define SEARCH_PAGE_H_
+
+#include "pathogenomics_service_library.h"
+#include "jansson.h"
+
+
+/**
+ * The key that holds the continuation token in a search request and
+ * in the metadata of a search's ServiceJob.
+ *
+ * @ingroup pathogenomics_service
+ */
+#define PG_CONTINUATION_S "continuation"
+
+
+/**
+ * A page of search results.
+ *
+ * @ingroup pathogenomics_service
+ */
+typedef struct SearchPage
+{
+	/**
+	 * The fields to sort by, in order, with values of 1 for ascending and
+	 * -1 for descending. This always ends with the MongoDB id so that
+	 * every document has a distinct position.
+	 */
+	json_t *sp_sort_p;
+
+	/**
+	 * The sort key values of the last document of the previous page, from
+	 * the continuation token, or <code>NULL</code> to start at the beginning.
+	 */
+	json_t *sp_after_p;
+
+	/** The number of documents to skip. */
+	uint32 sp_skip;
+
+	/** The maximum number of documents in the page, 0 for no limit. */
+	uint32 sp_limit;
+} SearchPage;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Initialise a SearchPage from the "limit", "skip", "sort" and "continuation"
+ * keys of a search request.
+ *
+ * @param page_p The SearchPage to initialise.
+ * @param search_p The search request.
+ * @param max_limit The largest number of documents allowed in a page, 0 for
+ * no maximum. If the request asks for more, or doesn't have a limit, this
+ * is used instead.
+ * @param error_ss If the request is invalid, this will be set to the reason why.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool InitSearchPage (SearchPage *page_p, const json_t *search_p, const uint32 max_limit, const char **error_ss);
+
+
+/**
+ * Free the values held by a SearchPage.
+ *
+ * @param page_p The SearchPage to clear.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void ClearSearchPage (SearchPage *page_p);
+
+
+/**
+ * Add the aggregation stages that sort the matching documents and move past
+ * the previous page. These need to come straight after the query so that
+ * they can use the indexes and must come before any fields are removed.
+ *
+ * @param page_p The SearchPage to use.
+ * @param stages_p The JSON array of aggregation stages to add to.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddSearchPageStartStages (const SearchPage *page_p, json_t *stages_p);
+
+
+/**
+ * Add the aggregation stages that skip and limit the documents. These
+ * come after any stages that drop documents.
+ *
+ * @param page_p The SearchPage to use.
+ * @param stages_p The JSON array of aggregation stages to add to.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool AddSearchPageEndStages (const SearchPage *page_p, json_t *stages_p);
+
+
+/**
+ * Get the name of the field that the start stages add to each document
+ * to hold its sort key. This must be kept by any projections.
+ *
+ * @return The field name.
+ */
+PATHOGENOMICS_SERVICE_LOCAL const char *GetSearchPageKeyField (void);
+
+
+/**
+ * Remove the sort keys from a page of documents and get the continuation
+ * token for the following page.
+ *
+ * @param page_p The SearchPage that the documents were found with.
+ * @param docs_p The JSON array of documents.
+ * @return The continuation token, which the caller must free with
+ * FreeCopiedString (), or <code>NULL</code> if this is the last page.
+ */
+PATHOGENOMICS_SERVICE_LOCAL char *FinishSearchPage (const SearchPage *page_p, json_t *docs_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* SEARCH_PAGE_H_ */
@@ -0,0 +1,134 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+/**
+ * @file
+ * @brief
+ */
+/*
+ * upload_checkpoints.h
+ *
+ * Progress checkpoints for uploads that are given an upload id. Once each
+ * batch of rows has been written to the database, the number of rows done
+ * so far is recorded against the upload id so that, if the import is cut
+ * short, the same upload can be sent again and carry on from there rather
+ * than preparing and storing every row again.
+ */
+
+#ifndef UPLOAD_CHECKPOINTS_H_
+#define UPLOAD_CHECKPOINTS_H_
+
+#include "pathogenomics_service_library.h"
+#include "mongodb_tool.h"
+#include "jansson.h"
+
+
+/**
+ * How far through an upload its import has got.
+ *
+ * @ingroup pathogenomics_service
+ */
+typedef struct UploadCheckpoint
+{
+	/** The number of rows, from the start of the upload, that have been committed. */
+	uint32 uc_num_rows;
+
+	/** The number of batches of rows that have been committed. */
+	uint32 uc_num_batches;
+
+	/** The number of the committed rows that were imported successfully. */
+	uint32 uc_num_imports;
+
+	/**
+	 * The sum of the fingerprints of the committed rows, from GetRowFingerprint (),
+	 * so that a different upload sent with the same id can be spotted.
+	 */
+	uint64 uc_fingerprint;
+} UploadCheckpoint;
+
+
+typedef struct UploadCheckpoints UploadCheckpoints;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Allocate an UploadCheckpoints.
+ *
+ * @param mongo_manager_p The MongoClientManager to connect to the database with.
+ * @param database_s The name of the database.
+ * @param collection_s The name of the collection to keep the checkpoints in.
+ * @return The new UploadCheckpoints or <code>NULL</code> upon error.
+ */
+PATHOGENOMICS_SERVICE_LOCAL UploadCheckpoints *AllocateUploadCheckpoints (MongoClientManager *mongo_manager_p, const char *database_s, const char *collection_s);
+
+
+/**
+ * Free an UploadCheckpoints.
+ *
+ * @param checkpoints_p The UploadCheckpoints to free.
+ */
+PATHOGENOMICS_SERVICE_LOCAL void FreeUploadCheckpoints (UploadCheckpoints *checkpoints_p);
+
+
+/**
+ * Get the last checkpoint for an upload.
+ *
+ * @param checkpoints_p The UploadCheckpoints to use.
+ * @param upload_id_s The upload id.
+ * @param data_type_s The name of the type of data that the upload is, e.g. "sample".
+ * @param checkpoint_p This will be set to the last checkpoint or, if the upload
+ * doesn't have one, cleared so that the import starts from the beginning.
+ * @param error_ss If the checkpoint can't be used, this will be set to the reason why.
+ * @return <code>true</code> upon success, <code>false</code> if the checkpoint
+ * couldn't be read or is for a different type of data.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool GetUploadCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s, const char *data_type_s, UploadCheckpoint *checkpoint_p, const char **error_ss);
+
+
+/**
+ * Record a checkpoint for an upload, replacing any previous one.
+ *
+ * @param checkpoints_p The UploadCheckpoints to use.
+ * @param upload_id_s The upload id.
+ * @param data_type_s The name of the type of data that the upload is, e.g. "sample".
+ * @param checkpoint_p The checkpoint to store.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool SaveUploadCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s, const char *data_type_s, const UploadCheckpoint *checkpoint_p);
+
+
+/**
+ * Remove the checkpoint for an upload once all of its rows have been imported.
+ *
+ * @param checkpoints_p The UploadCheckpoints to use.
+ * @param upload_id_s The upload id.
+ * @return <code>true</code> upon success, <code>false</code> otherwise.
+ */
+PATHOGENOMICS_SERVICE_LOCAL bool RemoveUploadCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* UPLOAD_CHECKPOINTS_H_ */
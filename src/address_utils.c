@@ -0,0 +1,62 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * address_utils.c
+ *
+ */
+
+#include <ctype.h>
+
+#include "address_utils.h"
+
+
+size_t NormaliseAddressValue (const char *value_s, char *dest_s)
+{
+	char *dest_p = dest_s;
+	bool pending_space_flag = false;
+	bool started_flag = false;
+
+	while (*value_s)
+		{
+			const unsigned char c = (unsigned char) *value_s;
+
+			if (isspace (c))
+				{
+					/* Only keep the space if there is more text after it */
+					pending_space_flag = started_flag;
+				}
+			else
+				{
+					if (pending_space_flag)
+						{
+							*dest_p = ' ';
+							++ dest_p;
+							pending_space_flag = false;
+						}
+
+					*dest_p = (char) tolower (c);
+					++ dest_p;
+
+					started_flag = true;
+				}
+
+			++ value_s;
+		}		/* while (*value_s) */
+
+	*dest_p = '\0';
+
+	return (size_t) (dest_p - dest_s);
+}
@@ -0,0 +1,322 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * aggregate_counts.c
+ *
+ */
+
+#include <string.h>
+
+#include "aggregate_counts.h"
+#include "live_dates.h"
+#include "pathogenomics_service.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define AGGREGATE_COUNTS_DEBUG	(STM_LEVEL_FINER)
+#else
+	#define AGGREGATE_COUNTS_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The names that can be grouped by when none have been configured,
+ * along with the fields that they use.
+ */
+static const char *S_DEFAULT_KEYS_SS [] =
+{
+	"Disease", "sample.Disease",
+	"County", "sample.County",
+	"Country", "sample.Country",
+	NULL
+};
+
+
+static const char * const S_YEAR_S = "year";
+
+static const char * const S_MONTH_S = "month";
+
+
+static json_t *GetAggregationStages (const json_t *group_p, const json_t *keys_p, const char **error_ss);
+
+static json_t *GetGroupExpression (const char *name_s, const json_t *keys_p, const char **error_ss);
+
+static json_t *GetCollectionDateExpression (const bool month_flag);
+
+static const char *GetGroupFieldPath (const char *name_s, const json_t *keys_p);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+json_t *GetAggregateCounts (MongoTool *tool_p, const json_t *aggregate_p, const json_t *keys_p, const bool preview_flag, const char **error_ss)
+{
+	json_t *counts_p = NULL;
+	const json_t *group_p = json_object_get (aggregate_p, PG_GROUP_S);
+
+	if (json_is_array (group_p))
+		{
+			json_t *stages_p = GetAggregationStages (group_p, keys_p, error_ss);
+
+			if (stages_p)
+				{
+					const json_t *query_p = json_object_get (aggregate_p, MONGO_OPERATION_DATA_S);
+
+					#if AGGREGATE_COUNTS_DEBUG >= STM_LEVEL_FINER
+					PrintJSONToLog (STM_LEVEL_FINER, __FILE__, __LINE__, stages_p, "aggregation stages: ");
+					#endif
+
+					counts_p = AggregateLiveDocuments (tool_p, query_p, preview_flag, stages_p);
+
+					if (!counts_p)
+						{
+							*error_ss = "Failed to get the aggregated counts";
+						}
+
+					json_decref (stages_p);
+				}
+		}
+	else
+		{
+			*error_ss = "The aggregation needs a \"" PG_GROUP_S "\" array";
+		}
+
+	return counts_p;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+/*
+ * Get the stages that count the samples in each group and tidy up the
+ * output so each count is a flat object of the group's values.
+ */
+static json_t *GetAggregationStages (const json_t *group_p, const json_t *keys_p, const char **error_ss)
+{
+	json_t *id_p = json_object ();
+	json_t *projection_p = json_pack ("{s:i,s:i}", MONGO_ID_S, 0, PG_COUNT_S, 1);
+
+	if (id_p && projection_p)
+		{
+			size_t i;
+			json_t *name_p;
+			bool success_flag = true;
+
+			json_array_foreach (group_p, i, name_p)
+				{
+					const char *name_s = json_string_value (name_p);
+
+					if (name_s)
+						{
+							json_t *expression_p = GetGroupExpression (name_s, keys_p, error_ss);
+
+							if (expression_p)
+								{
+									char *id_value_s = ConcatenateVarargsStrings ("$", MONGO_ID_S, ".", name_s, NULL);
+
+									success_flag = false;
+
+									if (id_value_s)
+										{
+											if ((json_object_set_new (id_p, name_s, expression_p) == 0) &&
+												(json_object_set_new (projection_p, name_s, json_string (id_value_s)) == 0))
+												{
+													success_flag = true;
+												}
+
+											FreeCopiedString (id_value_s);
+										}
+									else
+										{
+											json_decref (expression_p);
+										}
+								}
+							else
+								{
+									success_flag = false;
+								}
+						}
+					else
+						{
+							*error_ss = "The group names must be strings";
+							success_flag = false;
+						}
+
+					if (!success_flag)
+						{
+							break;
+						}
+				}		/* json_array_foreach (group_p, i, name_p) */
+
+			if (success_flag)
+				{
+					/*
+					 * Only the samples are counted, so drop any documents whose
+					 * sample is missing or still embargoed.
+					 */
+					json_t *stages_p = json_pack ("[{s:{s:{s:b}}},{s:{s:o,s:{s:i}}},{s:{s:i,s:i}},{s:o}]",
+						"$match", PG_SAMPLE_S, "$exists", true,
+						"$group", MONGO_ID_S, id_p, PG_COUNT_S, "$sum", 1,
+						"$sort", PG_COUNT_S, -1, MONGO_ID_S, 1,
+						"$project", projection_p);
+
+					if (stages_p)
+						{
+							return stages_p;
+						}
+
+					*error_ss = "Failed to create the aggregation";
+					return NULL;
+				}
+
+			if (!*error_ss)
+				{
+					*error_ss = "Failed to create the aggregation";
+				}
+		}		/* if (id_p && projection_p) */
+	else
+		{
+			*error_ss = "Failed to create the aggregation";
+		}
+
+	if (id_p)
+		{
+			json_decref (id_p);
+		}
+
+	if (projection_p)
+		{
+			json_decref (projection_p);
+		}
+
+	return NULL;
+}
+
+
+static json_t *GetGroupExpression (const char *name_s, const json_t *keys_p, const char **error_ss)
+{
+	json_t *expression_p = NULL;
+
+	/* The names become field names in the output so can't be paths or operators */
+	if ((*name_s == '\0') || (*name_s == '$') || (strchr (name_s, '.')))
+		{
+			*error_ss = "Invalid group name";
+		}
+	else if (strcmp (name_s, S_YEAR_S) == 0)
+		{
+			expression_p = GetCollectionDateExpression (false);
+		}
+	else if (strcmp (name_s, S_MONTH_S) == 0)
+		{
+			expression_p = GetCollectionDateExpression (true);
+		}
+	else
+		{
+			const char *path_s = GetGroupFieldPath (name_s, keys_p);
+
+			if (path_s)
+				{
+					char *value_s = ConcatenateStrings ("$", path_s);
+
+					if (value_s)
+						{
+							expression_p = json_string (value_s);
+							FreeCopiedString (value_s);
+						}
+				}
+			else
+				{
+					*error_ss = "Unknown group name";
+				}
+		}
+
+	if ((!expression_p) && (!*error_ss))
+		{
+			*error_ss = "Failed to create group expression";
+		}
+
+	return expression_p;
+}
+
+
+/*
+ * Get the year, as YYYY, or the month, as YYYY-MM, from the compact
+ * collection date which is stored as YYYYMMDD. Samples without the date
+ * are put in a null group.
+ */
+static json_t *GetCollectionDateExpression (const bool month_flag)
+{
+	json_t *expression_p = NULL;
+	char *date_s = ConcatenateVarargsStrings ("$", PG_SAMPLE_S, ".", PG_RAW_DATE_S, NULL);
+
+	if (date_s)
+		{
+			json_t *value_p = NULL;
+
+			if (month_flag)
+				{
+					value_p = json_pack ("{s:[{s:[s,i,i]},s,{s:[s,i,i]}]}", "$concat",
+						"$substrCP", date_s, 0, 4,
+						"-",
+						"$substrCP", date_s, 4, 2);
+				}
+			else
+				{
+					value_p = json_pack ("{s:[s,i,i]}", "$substrCP", date_s, 0, 4);
+				}
+
+			if (value_p)
+				{
+					expression_p = json_pack ("{s:[{s:[{s:s},s]},o,n]}", "$cond", "$eq", "$type", date_s, "string", value_p);
+				}
+
+			FreeCopiedString (date_s);
+		}
+
+	return expression_p;
+}
+
+
+static const char *GetGroupFieldPath (const char *name_s, const json_t *keys_p)
+{
+	if (keys_p)
+		{
+			return GetJSONString (keys_p, name_s);
+		}
+	else
+		{
+			const char **key_ss;
+
+			for (key_ss = S_DEFAULT_KEYS_SS; *key_ss; key_ss += 2)
+				{
+					if (strcmp (*key_ss, name_s) == 0)
+						{
+							return * (key_ss + 1);
+						}
+				}
+		}
+
+	return NULL;
+}
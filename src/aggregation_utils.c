@@ -0,0 +1,53 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * aggregation_utils.c
+ *
+ */
+
+#include "aggregation_utils.h"
+
+
+bool AddAggregationStage (json_t *stages_p, const char *operator_s, json_t *value_p)
+{
+	bool success_flag = false;
+
+	if (value_p)
+		{
+			json_t *stage_p = json_object ();
+
+			if (stage_p)
+				{
+					if (json_object_set_new (stage_p, operator_s, value_p) == 0)
+						{
+							if (json_array_append_new (stages_p, stage_p) == 0)
+								{
+									success_flag = true;
+								}
+						}
+					else
+						{
+							json_decref (stage_p);
+						}
+				}
+			else
+				{
+					json_decref (value_p);
+				}
+		}
+
+	return success_flag;
+}
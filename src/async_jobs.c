@@ -0,0 +1,441 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * async_jobs.c
+ *
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "async_jobs.h"
+#include "memory_allocations.h"
+#include "uuid_util.h"
+
+
+#ifdef _DEBUG
+	#define ASYNC_JOBS_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define ASYNC_JOBS_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+typedef struct AsyncJob
+{
+	/* The id that the caller knows this job by */
+	uuid_t aj_id;
+
+	/*
+	 * The job set that the task writes to. This is owned by the
+	 * AsyncJob rather than by the Service so that it stays valid
+	 * after the request that submitted it has finished.
+	 */
+	ServiceJobSet *aj_jobs_p;
+
+	RunAsyncTaskFn aj_run_fn;
+
+	FreeAsyncTaskFn aj_free_fn;
+
+	void *aj_task_p;
+
+	/*
+	 * OS_PENDING until a worker takes the job, OS_STARTED while it runs
+	 * and then the final status of its ServiceJob.
+	 */
+	OperationStatus aj_status;
+
+	/*
+	 * The ServiceJob is only read by other threads once this is set
+	 * as, until then, the worker may still be writing to it.
+	 */
+	bool aj_finished_flag;
+
+	time_t aj_finished_time;
+
+	struct AsyncJob *aj_next_p;
+} AsyncJob;
+
+
+struct AsyncJobManager
+{
+	Service *ajm_service_p;
+
+	pthread_t *ajm_workers_p;
+
+	uint32 ajm_num_workers;
+
+	/* The number of seconds to keep finished jobs for */
+	uint32 ajm_retention_time;
+
+	/* The jobs in the order that they were submitted */
+	AsyncJob *ajm_head_p;
+
+	AsyncJob *ajm_tail_p;
+
+	bool ajm_stop_flag;
+
+	pthread_mutex_t ajm_mutex;
+
+	/* Signalled when a job is submitted or the manager is stopping */
+	pthread_cond_t ajm_work_cond;
+};
+
+
+static void *RunAsyncJobWorker (void *arg_p);
+
+static AsyncJob *GetNextPendingAsyncJob (AsyncJobManager *manager_p);
+
+static AsyncJob *FindAsyncJob (AsyncJobManager *manager_p, const uuid_t id);
+
+static void RemoveExpiredAsyncJobs (AsyncJobManager *manager_p);
+
+static void FreeAsyncJob (AsyncJob *job_p);
+
+static json_t *CopyJobJSON (const json_t *src_p);
+
+
+AsyncJobManager *AllocateAsyncJobManager (Service *service_p, const uint32 num_workers, const uint32 retention_time)
+{
+	AsyncJobManager *manager_p = (AsyncJobManager *) AllocMemory (sizeof (AsyncJobManager));
+
+	if (manager_p)
+		{
+			manager_p -> ajm_workers_p = (pthread_t *) AllocMemoryArray (num_workers, sizeof (pthread_t));
+
+			if (manager_p -> ajm_workers_p)
+				{
+					uint32 i;
+
+					manager_p -> ajm_service_p = service_p;
+					manager_p -> ajm_num_workers = 0;
+					manager_p -> ajm_retention_time = retention_time;
+					manager_p -> ajm_head_p = NULL;
+					manager_p -> ajm_tail_p = NULL;
+					manager_p -> ajm_stop_flag = false;
+
+					pthread_mutex_init (& (manager_p -> ajm_mutex), NULL);
+					pthread_cond_init (& (manager_p -> ajm_work_cond), NULL);
+
+					for (i = 0; i < num_workers; ++ i)
+						{
+							if (pthread_create ((manager_p -> ajm_workers_p) + (manager_p -> ajm_num_workers), NULL, RunAsyncJobWorker, manager_p) == 0)
+								{
+									++ (manager_p -> ajm_num_workers);
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start background worker " UINT32_FMT " of " UINT32_FMT, i + 1, num_workers);
+								}
+						}
+
+					if (manager_p -> ajm_num_workers > 0)
+						{
+							return manager_p;
+						}
+
+					pthread_cond_destroy (& (manager_p -> ajm_work_cond));
+					pthread_mutex_destroy (& (manager_p -> ajm_mutex));
+
+					FreeMemory (manager_p -> ajm_workers_p);
+				}		/* if (manager_p -> ajm_workers_p) */
+
+			FreeMemory (manager_p);
+		}		/* if (manager_p) */
+
+	return NULL;
+}
+
+
+void FreeAsyncJobManager (AsyncJobManager *manager_p)
+{
+	AsyncJob *job_p;
+	uint32 i;
+
+	pthread_mutex_lock (& (manager_p -> ajm_mutex));
+	manager_p -> ajm_stop_flag = true;
+	pthread_cond_broadcast (& (manager_p -> ajm_work_cond));
+	pthread_mutex_unlock (& (manager_p -> ajm_mutex));
+
+	for (i = 0; i < manager_p -> ajm_num_workers; ++ i)
+		{
+			pthread_join (* ((manager_p -> ajm_workers_p) + i), NULL);
+		}
+
+	job_p = manager_p -> ajm_head_p;
+
+	while (job_p)
+		{
+			AsyncJob *next_p = job_p -> aj_next_p;
+
+			FreeAsyncJob (job_p);
+			job_p = next_p;
+		}
+
+	pthread_cond_destroy (& (manager_p -> ajm_work_cond));
+	pthread_mutex_destroy (& (manager_p -> ajm_mutex));
+
+	FreeMemory (manager_p -> ajm_workers_p);
+	FreeMemory (manager_p);
+}
+
+
+bool SubmitAsyncJob (AsyncJobManager *manager_p, const uuid_t id, RunAsyncTaskFn run_fn, FreeAsyncTaskFn free_fn, void *task_p)
+{
+	bool success_flag = false;
+	AsyncJob *job_p = (AsyncJob *) AllocMemory (sizeof (AsyncJob));
+
+	if (job_p)
+		{
+			job_p -> aj_jobs_p = AllocateSimpleServiceJobSet (manager_p -> ajm_service_p, NULL, "Pathogenomics");
+
+			if (job_p -> aj_jobs_p)
+				{
+					uuid_copy (job_p -> aj_id, id);
+					job_p -> aj_run_fn = run_fn;
+					job_p -> aj_free_fn = free_fn;
+					job_p -> aj_task_p = task_p;
+					job_p -> aj_status = OS_PENDING;
+					job_p -> aj_finished_flag = false;
+					job_p -> aj_finished_time = 0;
+					job_p -> aj_next_p = NULL;
+
+					pthread_mutex_lock (& (manager_p -> ajm_mutex));
+
+					RemoveExpiredAsyncJobs (manager_p);
+
+					if (manager_p -> ajm_tail_p)
+						{
+							manager_p -> ajm_tail_p -> aj_next_p = job_p;
+						}
+					else
+						{
+							manager_p -> ajm_head_p = job_p;
+						}
+
+					manager_p -> ajm_tail_p = job_p;
+
+					pthread_cond_signal (& (manager_p -> ajm_work_cond));
+					pthread_mutex_unlock (& (manager_p -> ajm_mutex));
+
+					success_flag = true;
+				}		/* if (job_p -> aj_jobs_p) */
+			else
+				{
+					FreeMemory (job_p);
+				}
+
+		}		/* if (job_p) */
+
+	return success_flag;
+}
+
+
+bool CopyAsyncJobToServiceJob (AsyncJobManager *manager_p, const uuid_t id, ServiceJob *dest_job_p)
+{
+	AsyncJob *job_p;
+	bool found_flag = false;
+
+	pthread_mutex_lock (& (manager_p -> ajm_mutex));
+
+	RemoveExpiredAsyncJobs (manager_p);
+
+	job_p = FindAsyncJob (manager_p, id);
+
+	if (job_p)
+		{
+			if (job_p -> aj_finished_flag)
+				{
+					const ServiceJob *src_job_p = GetServiceJobFromServiceJobSet (job_p -> aj_jobs_p, 0);
+
+					if (dest_job_p -> sj_result_p)
+						{
+							json_decref (dest_job_p -> sj_result_p);
+						}
+					dest_job_p -> sj_result_p = CopyJobJSON (src_job_p -> sj_result_p);
+
+					if (dest_job_p -> sj_errors_p)
+						{
+							json_decref (dest_job_p -> sj_errors_p);
+						}
+					dest_job_p -> sj_errors_p = CopyJobJSON (src_job_p -> sj_errors_p);
+
+					if (dest_job_p -> sj_metadata_p)
+						{
+							json_decref (dest_job_p -> sj_metadata_p);
+						}
+					dest_job_p -> sj_metadata_p = CopyJobJSON (src_job_p -> sj_metadata_p);
+				}
+
+			SetServiceJobStatus (dest_job_p, job_p -> aj_status);
+			found_flag = true;
+		}		/* if (job_p) */
+
+	pthread_mutex_unlock (& (manager_p -> ajm_mutex));
+
+	return found_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static void *RunAsyncJobWorker (void *arg_p)
+{
+	AsyncJobManager *manager_p = (AsyncJobManager *) arg_p;
+
+	pthread_mutex_lock (& (manager_p -> ajm_mutex));
+
+	while (!manager_p -> ajm_stop_flag)
+		{
+			AsyncJob *job_p = GetNextPendingAsyncJob (manager_p);
+
+			if (job_p)
+				{
+					ServiceJob *service_job_p = GetServiceJobFromServiceJobSet (job_p -> aj_jobs_p, 0);
+					char uuid_s [UUID_STRING_BUFFER_SIZE];
+
+					job_p -> aj_status = OS_STARTED;
+
+					pthread_mutex_unlock (& (manager_p -> ajm_mutex));
+
+					ConvertUUIDToString (job_p -> aj_id, uuid_s);
+
+					#if ASYNC_JOBS_DEBUG >= STM_LEVEL_FINE
+					PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Starting background job %s", uuid_s);
+					#endif
+
+					job_p -> aj_run_fn (job_p -> aj_task_p, service_job_p);
+
+					job_p -> aj_free_fn (job_p -> aj_task_p);
+					job_p -> aj_task_p = NULL;
+
+					PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Background job %s finished with status %d", uuid_s, service_job_p -> sj_status);
+
+					pthread_mutex_lock (& (manager_p -> ajm_mutex));
+
+					job_p -> aj_status = service_job_p -> sj_status;
+					job_p -> aj_finished_time = time (NULL);
+					job_p -> aj_finished_flag = true;
+				}
+			else
+				{
+					pthread_cond_wait (& (manager_p -> ajm_work_cond), & (manager_p -> ajm_mutex));
+				}
+
+		}		/* while (!manager_p -> ajm_stop_flag) */
+
+	pthread_mutex_unlock (& (manager_p -> ajm_mutex));
+
+	return NULL;
+}
+
+
+/*
+ * The jobs are kept in submission order, so the first pending job is
+ * the one that has been waiting the longest.
+ */
+static AsyncJob *GetNextPendingAsyncJob (AsyncJobManager *manager_p)
+{
+	AsyncJob *job_p = manager_p -> ajm_head_p;
+
+	while (job_p)
+		{
+			if (job_p -> aj_status == OS_PENDING)
+				{
+					return job_p;
+				}
+
+			job_p = job_p -> aj_next_p;
+		}
+
+	return NULL;
+}
+
+
+static AsyncJob *FindAsyncJob (AsyncJobManager *manager_p, const uuid_t id)
+{
+	AsyncJob *job_p = manager_p -> ajm_head_p;
+
+	while (job_p)
+		{
+			if (uuid_compare (job_p -> aj_id, id) == 0)
+				{
+					return job_p;
+				}
+
+			job_p = job_p -> aj_next_p;
+		}
+
+	return NULL;
+}
+
+
+static void RemoveExpiredAsyncJobs (AsyncJobManager *manager_p)
+{
+	const time_t now = time (NULL);
+	AsyncJob *prev_p = NULL;
+	AsyncJob *job_p = manager_p -> ajm_head_p;
+
+	while (job_p)
+		{
+			AsyncJob *next_p = job_p -> aj_next_p;
+
+			if ((job_p -> aj_finished_flag) && (difftime (now, job_p -> aj_finished_time) >= (double) (manager_p -> ajm_retention_time)))
+				{
+					if (prev_p)
+						{
+							prev_p -> aj_next_p = next_p;
+						}
+					else
+						{
+							manager_p -> ajm_head_p = next_p;
+						}
+
+					if (manager_p -> ajm_tail_p == job_p)
+						{
+							manager_p -> ajm_tail_p = prev_p;
+						}
+
+					FreeAsyncJob (job_p);
+				}
+			else
+				{
+					prev_p = job_p;
+				}
+
+			job_p = next_p;
+		}		/* while (job_p) */
+}
+
+
+static void FreeAsyncJob (AsyncJob *job_p)
+{
+	if (job_p -> aj_task_p)
+		{
+			job_p -> aj_free_fn (job_p -> aj_task_p);
+		}
+
+	FreeServiceJobSet (job_p -> aj_jobs_p);
+	FreeMemory (job_p);
+}
+
+
+static json_t *CopyJobJSON (const json_t *src_p)
+{
+	return src_p ? json_deep_copy (src_p) : NULL;
+}
@@ -0,0 +1,500 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * bulk_writer.c
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bulk_writer.h"
+#include "pathogenomics_service.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+
+
+#ifdef _DEBUG
+	#define BULK_WRITER_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define BULK_WRITER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The row details for each queued operation so that any errors
+ * returned by the server can be reported against the correct row.
+ */
+typedef struct BulkOperation
+{
+	size_t bo_row;
+	char *bo_id_s;
+} BulkOperation;
+
+
+struct BulkWriter
+{
+	MongoTool *bw_tool_p;
+
+	ServiceJob *bw_job_p;
+
+	mongoc_bulk_operation_t *bw_bulk_p;
+
+	BulkOperation *bw_ops_p;
+
+	uint32 bw_batch_size;
+
+	uint32 bw_num_ops;
+
+	bool bw_ordered_flag;
+
+	/*
+	 * The indexes of the rows that have had an operation fail. A row can
+	 * have more than one operation, possibly in different batches, and an
+	 * unordered batch can report the errors for its rows in any order, so
+	 * these are kept as a set to make sure that each row is counted once.
+	 */
+	json_t *bw_failed_rows_p;
+};
+
+
+static const char *QueueBulkOperation (BulkWriter *writer_p, const size_t row, const char *id_s);
+
+static bool ReportWriteErrors (BulkWriter *writer_p, const bson_t *reply_p, bool *failed_ops_p);
+
+static void ReportFailedOperation (BulkWriter *writer_p, const uint32 op_index, const char *error_s);
+
+static void ClearBulkOperations (BulkWriter *writer_p);
+
+
+BulkWriter *AllocateBulkWriter (MongoTool *tool_p, ServiceJob *job_p, const uint32 batch_size, const bool ordered_flag)
+{
+	if (batch_size > 0)
+		{
+			BulkOperation *ops_p = (BulkOperation *) AllocMemoryArray (batch_size, sizeof (BulkOperation));
+
+			if (ops_p)
+				{
+					BulkWriter *writer_p = (BulkWriter *) AllocMemory (sizeof (BulkWriter));
+
+					if (writer_p)
+						{
+							writer_p -> bw_failed_rows_p = json_object ();
+
+							if (!writer_p -> bw_failed_rows_p)
+								{
+									FreeMemory (writer_p);
+									FreeMemory (ops_p);
+
+									return NULL;
+								}
+
+							memset (ops_p, 0, batch_size * sizeof (BulkOperation));
+
+							writer_p -> bw_tool_p = tool_p;
+							writer_p -> bw_job_p = job_p;
+							writer_p -> bw_bulk_p = NULL;
+							writer_p -> bw_ops_p = ops_p;
+							writer_p -> bw_batch_size = batch_size;
+							writer_p -> bw_num_ops = 0;
+							writer_p -> bw_ordered_flag = ordered_flag;
+
+							return writer_p;
+						}
+
+					FreeMemory (ops_p);
+				}		/* if (ops_p) */
+
+		}		/* if (batch_size > 0) */
+
+	return NULL;
+}
+
+
+void FreeBulkWriter (BulkWriter *writer_p)
+{
+	ClearBulkOperations (writer_p);
+
+	json_decref (writer_p -> bw_failed_rows_p);
+	FreeMemory (writer_p -> bw_ops_p);
+	FreeMemory (writer_p);
+}
+
+
+const char *AddUpsertToBulkWriter (BulkWriter *writer_p, const json_t *selector_p, const json_t *update_p, const size_t row, const char *id_s)
+{
+	const char *error_s = QueueBulkOperation (writer_p, row, id_s);
+
+	if (!error_s)
+		{
+			bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+			error_s = "Failed to convert selector for bulk upsert";
+
+			if (selector_bson_p)
+				{
+					bson_t *update_bson_p = ConvertJSONToBSON (update_p);
+
+					error_s = "Failed to convert values for bulk upsert";
+
+					if (update_bson_p)
+						{
+							bson_t opts;
+							bson_error_t error;
+
+							bson_init (&opts);
+							BSON_APPEND_BOOL (&opts, "upsert", true);
+
+							if (mongoc_bulk_operation_update_one_with_opts (writer_p -> bw_bulk_p, selector_bson_p, update_bson_p, &opts, &error))
+								{
+									++ (writer_p -> bw_num_ops);
+									error_s = NULL;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add upsert for row " SIZET_FMT " to bulk operation: %s", row, error.message);
+									error_s = "Failed to add upsert to bulk operation";
+								}
+
+							bson_destroy (&opts);
+							bson_destroy (update_bson_p);
+						}		/* if (update_bson_p) */
+
+					bson_destroy (selector_bson_p);
+				}		/* if (selector_bson_p) */
+
+			if (!error_s)
+				{
+					if (writer_p -> bw_num_ops == writer_p -> bw_batch_size)
+						{
+							FlushBulkWriter (writer_p);
+						}
+				}
+			else
+				{
+					/* Free the id that QueueBulkOperation stored for this operation */
+					BulkOperation *op_p = (writer_p -> bw_ops_p) + (writer_p -> bw_num_ops);
+
+					if (op_p -> bo_id_s)
+						{
+							FreeCopiedString (op_p -> bo_id_s);
+							op_p -> bo_id_s = NULL;
+						}
+				}
+
+		}		/* if (!error_s) */
+
+	return error_s;
+}
+
+
+const char *AddRemoveToBulkWriter (BulkWriter *writer_p, const json_t *selector_p, const size_t row, const char *id_s)
+{
+	const char *error_s = QueueBulkOperation (writer_p, row, id_s);
+
+	if (!error_s)
+		{
+			bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+			error_s = "Failed to convert selector for bulk removal";
+
+			if (selector_bson_p)
+				{
+					bson_error_t error;
+
+					if (mongoc_bulk_operation_remove_one_with_opts (writer_p -> bw_bulk_p, selector_bson_p, NULL, &error))
+						{
+							++ (writer_p -> bw_num_ops);
+							error_s = NULL;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add removal for row " SIZET_FMT " to bulk operation: %s", row, error.message);
+							error_s = "Failed to add removal to bulk operation";
+						}
+
+					bson_destroy (selector_bson_p);
+				}		/* if (selector_bson_p) */
+
+			if (!error_s)
+				{
+					if (writer_p -> bw_num_ops == writer_p -> bw_batch_size)
+						{
+							FlushBulkWriter (writer_p);
+						}
+				}
+			else
+				{
+					BulkOperation *op_p = (writer_p -> bw_ops_p) + (writer_p -> bw_num_ops);
+
+					if (op_p -> bo_id_s)
+						{
+							FreeCopiedString (op_p -> bo_id_s);
+							op_p -> bo_id_s = NULL;
+						}
+				}
+
+		}		/* if (!error_s) */
+
+	return error_s;
+}
+
+
+bool FlushBulkWriter (BulkWriter *writer_p)
+{
+	bool success_flag = true;
+
+	if (writer_p -> bw_num_ops > 0)
+		{
+			bson_t reply;
+			bson_error_t error;
+
+			#if BULK_WRITER_DEBUG >= STM_LEVEL_FINE
+			PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Flushing " UINT32_FMT " bulk operations", writer_p -> bw_num_ops);
+			#endif
+
+			if (mongoc_bulk_operation_execute (writer_p -> bw_bulk_p, &reply, &error) == 0)
+				{
+					bool *failed_ops_p = (bool *) AllocMemoryArray (writer_p -> bw_num_ops, sizeof (bool));
+
+					success_flag = false;
+
+					if (failed_ops_p)
+						{
+							memset (failed_ops_p, 0, (writer_p -> bw_num_ops) * sizeof (bool));
+
+							if (ReportWriteErrors (writer_p, &reply, failed_ops_p))
+								{
+									/*
+									 * For an ordered bulk operation, the server stops at the first
+									 * error so none of the subsequent operations were attempted.
+									 */
+									if (writer_p -> bw_ordered_flag)
+										{
+											uint32 i = 0;
+
+											while ((i < writer_p -> bw_num_ops) && (! (* (failed_ops_p + i))))
+												{
+													++ i;
+												}
+
+											for (++ i; i < writer_p -> bw_num_ops; ++ i)
+												{
+													if (! (* (failed_ops_p + i)))
+														{
+															ReportFailedOperation (writer_p, i, "Not written as an earlier row in the same batch failed");
+														}
+												}
+										}
+								}
+							else
+								{
+									/*
+									 * There weren't any row-specific errors so the whole batch
+									 * failed e.g. a network error or a write concern error.
+									 */
+									uint32 i;
+
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Bulk operation failed: %s", error.message);
+
+									for (i = 0; i < writer_p -> bw_num_ops; ++ i)
+										{
+											ReportFailedOperation (writer_p, i, error.message);
+										}
+								}
+
+							FreeMemory (failed_ops_p);
+						}		/* if (failed_ops_p) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate memory to report bulk operation errors: %s", error.message);
+						}
+
+				}		/* if (mongoc_bulk_operation_execute (writer_p -> bw_bulk_p, &reply, &error) == 0) */
+
+			bson_destroy (&reply);
+
+			ClearBulkOperations (writer_p);
+		}		/* if (writer_p -> bw_num_ops > 0) */
+
+	return success_flag;
+}
+
+
+uint32 GetBulkWriterNumberOfFailedRows (const BulkWriter *writer_p)
+{
+	return (uint32) json_object_size (writer_p -> bw_failed_rows_p);
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static const char *QueueBulkOperation (BulkWriter *writer_p, const size_t row, const char *id_s)
+{
+	BulkOperation *op_p = (writer_p -> bw_ops_p) + (writer_p -> bw_num_ops);
+
+	if (!writer_p -> bw_bulk_p)
+		{
+			bson_t opts;
+
+			bson_init (&opts);
+			BSON_APPEND_BOOL (&opts, "ordered", writer_p -> bw_ordered_flag);
+
+			writer_p -> bw_bulk_p = mongoc_collection_create_bulk_operation_with_opts (writer_p -> bw_tool_p -> mt_collection_p, &opts);
+
+			bson_destroy (&opts);
+
+			if (!writer_p -> bw_bulk_p)
+				{
+					return "Failed to create bulk operation";
+				}
+		}
+
+	op_p -> bo_row = row;
+
+	if (id_s)
+		{
+			op_p -> bo_id_s = EasyCopyToNewString (id_s);
+
+			if (!op_p -> bo_id_s)
+				{
+					return "Failed to copy id for bulk operation";
+				}
+		}
+	else
+		{
+			op_p -> bo_id_s = NULL;
+		}
+
+	return NULL;
+}
+
+
+static bool ReportWriteErrors (BulkWriter *writer_p, const bson_t *reply_p, bool *failed_ops_p)
+{
+	bool found_errors_flag = false;
+	bson_iter_t iter;
+
+	if (bson_iter_init_find (&iter, reply_p, "writeErrors") && BSON_ITER_HOLDS_ARRAY (&iter))
+		{
+			bson_iter_t errors_iter;
+
+			if (bson_iter_recurse (&iter, &errors_iter))
+				{
+					while (bson_iter_next (&errors_iter))
+						{
+							bson_iter_t error_iter;
+
+							if (BSON_ITER_HOLDS_DOCUMENT (&errors_iter) && bson_iter_recurse (&errors_iter, &error_iter))
+								{
+									int32 op_index = -1;
+									const char *message_s = "Unknown write error";
+
+									while (bson_iter_next (&error_iter))
+										{
+											const char *key_s = bson_iter_key (&error_iter);
+
+											if (strcmp (key_s, "index") == 0)
+												{
+													op_index = bson_iter_int32 (&error_iter);
+												}
+											else if (strcmp (key_s, "errmsg") == 0)
+												{
+													message_s = bson_iter_utf8 (&error_iter, NULL);
+												}
+										}
+
+									if ((op_index >= 0) && (op_index < (int32) (writer_p -> bw_num_ops)))
+										{
+											* (failed_ops_p + op_index) = true;
+											ReportFailedOperation (writer_p, (uint32) op_index, message_s);
+											found_errors_flag = true;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Bulk write error index " INT32_FMT " is out of range: %s", op_index, message_s);
+										}
+								}
+
+						}		/* while (bson_iter_next (&errors_iter)) */
+
+				}		/* if (bson_iter_recurse (&iter, &errors_iter)) */
+
+		}		/* if (bson_iter_init_find (&iter, reply_p, "writeErrors") && BSON_ITER_HOLDS_ARRAY (&iter)) */
+
+	return found_errors_flag;
+}
+
+
+static void ReportFailedOperation (BulkWriter *writer_p, const uint32 op_index, const char *error_s)
+{
+	const BulkOperation *op_p = (writer_p -> bw_ops_p) + op_index;
+	json_t *value_p = json_object ();
+	char row_s [32];
+
+	if (value_p)
+		{
+			if (op_p -> bo_id_s)
+				{
+					if (json_object_set_new (value_p, PG_ID_S, json_string (op_p -> bo_id_s)) != 0)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set id \"%s\" for error reporting", op_p -> bo_id_s);
+						}
+				}
+
+			AddErrorMessage (writer_p -> bw_job_p, value_p, error_s, (int) (op_p -> bo_row));
+
+			json_decref (value_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to report bulk error for row " SIZET_FMT ": %s", op_p -> bo_row, error_s);
+		}
+
+	snprintf (row_s, sizeof (row_s), SIZET_FMT, op_p -> bo_row);
+
+	if (json_object_set_new (writer_p -> bw_failed_rows_p, row_s, json_true ()) != 0)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to record row %s as failed", row_s);
+		}
+}
+
+
+static void ClearBulkOperations (BulkWriter *writer_p)
+{
+	uint32 i;
+	BulkOperation *op_p = writer_p -> bw_ops_p;
+
+	for (i = 0; i < writer_p -> bw_num_ops; ++ i, ++ op_p)
+		{
+			if (op_p -> bo_id_s)
+				{
+					FreeCopiedString (op_p -> bo_id_s);
+					op_p -> bo_id_s = NULL;
+				}
+		}
+
+	writer_p -> bw_num_ops = 0;
+
+	if (writer_p -> bw_bulk_p)
+		{
+			mongoc_bulk_operation_destroy (writer_p -> bw_bulk_p);
+			writer_p -> bw_bulk_p = NULL;
+		}
+}
@@ -0,0 +1,510 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * column_schema.c
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "column_schema.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+typedef struct ColumnEntry
+{
+	json_type ce_type;
+
+	/*
+	 * For each data type, the bit for this column within the required
+	 * columns or 0 if that data type doesn't require it.
+	 */
+	uint32 ce_required_bits [PD_NUM_TYPES];
+} ColumnEntry;
+
+
+struct ColumnSchema
+{
+	/* The column names mapped to their index in cs_entries_p */
+	json_t *cs_indexes_p;
+
+	ColumnEntry *cs_entries_p;
+
+	size_t cs_num_entries;
+
+	size_t cs_max_entries;
+
+	/* For each data type, the names of the required columns in bit order */
+	json_t *cs_required_names_p [PD_NUM_TYPES];
+
+	/* For each data type, the bits of all of its required columns */
+	uint32 cs_required_masks [PD_NUM_TYPES];
+};
+
+
+static const size_t S_INITIAL_NUM_ENTRIES = 32;
+
+
+static ColumnEntry *GetColumnEntry (const ColumnSchema *schema_p, const char *name_s);
+
+static ColumnEntry *AddColumnEntry (ColumnSchema *schema_p, const char *name_s);
+
+static json_type GetColumnDefinitionType (const char *name_s, const char *def_s);
+
+static json_t *ConvertIntegerValue (const char *value_s);
+
+static json_t *ConvertRealValue (const char *value_s);
+
+static json_t *ConvertBooleanValue (const char *value_s);
+
+static json_t *ConvertStringValue (const char *value_s);
+
+static bool IsValueEnd (const char *end_s);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+ColumnSchema *AllocateColumnSchema (const json_t *field_defs_p)
+{
+	ColumnSchema *schema_p = (ColumnSchema *) AllocMemory (sizeof (ColumnSchema));
+
+	if (schema_p)
+		{
+			uint32 i;
+			bool success_flag = true;
+
+			schema_p -> cs_indexes_p = json_object ();
+			schema_p -> cs_entries_p = (ColumnEntry *) AllocMemoryArray (S_INITIAL_NUM_ENTRIES, sizeof (ColumnEntry));
+			schema_p -> cs_num_entries = 0;
+			schema_p -> cs_max_entries = S_INITIAL_NUM_ENTRIES;
+
+			for (i = 0; i < PD_NUM_TYPES; ++ i)
+				{
+					* ((schema_p -> cs_required_names_p) + i) = NULL;
+					* ((schema_p -> cs_required_masks) + i) = 0;
+				}
+
+			if ((schema_p -> cs_indexes_p) && (schema_p -> cs_entries_p))
+				{
+					if (json_is_object (field_defs_p))
+						{
+							const char *name_s;
+							json_t *def_p;
+
+							json_object_foreach ((json_t *) field_defs_p, name_s, def_p)
+								{
+									if (success_flag)
+										{
+											ColumnEntry *entry_p = AddColumnEntry (schema_p, name_s);
+
+											if (entry_p)
+												{
+													entry_p -> ce_type = GetColumnDefinitionType (name_s, json_string_value (def_p));
+												}
+											else
+												{
+													success_flag = false;
+												}
+										}
+								}
+						}
+
+					if (success_flag)
+						{
+							return schema_p;
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate column schema entries");
+				}
+
+			FreeColumnSchema (schema_p);
+		}		/* if (schema_p) */
+
+	return NULL;
+}
+
+
+void FreeColumnSchema (ColumnSchema *schema_p)
+{
+	uint32 i;
+
+	for (i = 0; i < PD_NUM_TYPES; ++ i)
+		{
+			json_t *names_p = * ((schema_p -> cs_required_names_p) + i);
+
+			if (names_p)
+				{
+					json_decref (names_p);
+				}
+		}
+
+	if (schema_p -> cs_indexes_p)
+		{
+			json_decref (schema_p -> cs_indexes_p);
+		}
+
+	if (schema_p -> cs_entries_p)
+		{
+			FreeMemory (schema_p -> cs_entries_p);
+		}
+
+	FreeMemory (schema_p);
+}
+
+
+bool SetRequiredColumns (ColumnSchema *schema_p, const PathogenomicsData data_type, const char **names_ss)
+{
+	bool success_flag = false;
+	json_t *names_p = json_array ();
+
+	if (names_p)
+		{
+			uint32 mask = 0;
+			uint32 bit = 1;
+			size_t i;
+
+			/* Clear any columns that were previously required */
+			for (i = 0; i < schema_p -> cs_num_entries; ++ i)
+				{
+					* (((schema_p -> cs_entries_p) + i) -> ce_required_bits + data_type) = 0;
+				}
+
+			i = 0;
+			success_flag = true;
+
+			while ((*names_ss) && success_flag)
+				{
+					ColumnEntry *entry_p = NULL;
+
+					if (i < PG_MAX_REQUIRED_COLUMNS)
+						{
+							entry_p = GetColumnEntry (schema_p, *names_ss);
+
+							if (!entry_p)
+								{
+									entry_p = AddColumnEntry (schema_p, *names_ss);
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "More than %d columns are required for data type %d", PG_MAX_REQUIRED_COLUMNS, (int) data_type);
+						}
+
+					if (entry_p && (json_array_append_new (names_p, json_string (*names_ss)) == 0))
+						{
+							* ((entry_p -> ce_required_bits) + data_type) = bit;
+							mask |= bit;
+
+							bit <<= 1;
+							++ i;
+							++ names_ss;
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}		/* while ((*names_ss) && success_flag) */
+
+			if (success_flag)
+				{
+					json_t *old_names_p = * ((schema_p -> cs_required_names_p) + data_type);
+
+					if (old_names_p)
+						{
+							json_decref (old_names_p);
+						}
+
+					* ((schema_p -> cs_required_names_p) + data_type) = names_p;
+					* ((schema_p -> cs_required_masks) + data_type) = mask;
+				}
+			else
+				{
+					json_decref (names_p);
+				}
+		}		/* if (names_p) */
+
+	return success_flag;
+}
+
+
+json_type GetColumnType (const ColumnSchema *schema_p, const char *name_s)
+{
+	const ColumnEntry *entry_p = GetColumnEntry (schema_p, name_s);
+
+	return (entry_p ? entry_p -> ce_type : JSON_STRING);
+}
+
+
+ColumnConverter GetColumnConverter (const json_type column_type)
+{
+	ColumnConverter converter_fn = ConvertStringValue;
+
+	switch (column_type)
+		{
+			case JSON_INTEGER:
+				converter_fn = ConvertIntegerValue;
+				break;
+
+			case JSON_REAL:
+				converter_fn = ConvertRealValue;
+				break;
+
+			case JSON_TRUE:
+			case JSON_FALSE:
+				converter_fn = ConvertBooleanValue;
+				break;
+
+			default:
+				break;
+		}
+
+	return converter_fn;
+}
+
+
+bool CheckRequiredColumns (const ColumnSchema *schema_p, const PathogenomicsData data_type, const LinkedList *headers_p, ServiceJob *job_p)
+{
+	const uint32 mask = * ((schema_p -> cs_required_masks) + data_type);
+	uint32 found = 0;
+	bool success_flag = true;
+	const FieldNode *node_p = (const FieldNode *) (headers_p -> ll_head_p);
+
+	/* Mark off each required column as its heading is found */
+	while (node_p)
+		{
+			const ColumnEntry *entry_p = GetColumnEntry (schema_p, node_p -> fn_base_node.sln_string_s);
+
+			if (entry_p)
+				{
+					found |= * ((entry_p -> ce_required_bits) + data_type);
+				}
+
+			node_p = (const FieldNode *) (node_p -> fn_base_node.sln_node.ln_next_p);
+		}
+
+	if ((found & mask) != mask)
+		{
+			const json_t *names_p = * ((schema_p -> cs_required_names_p) + data_type);
+			size_t i;
+			json_t *name_p;
+
+			json_array_foreach (names_p, i, name_p)
+				{
+					if (! (found & (((uint32) 1) << i)))
+						{
+							char *error_s = ConcatenateVarargsStrings ("Missing column \"", json_string_value (name_p), "\"", NULL);
+
+							if (error_s)
+								{
+									if (!AddGeneralErrorMessageToServiceJob (job_p, error_s))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add error for %s to job response", error_s);
+										}
+
+									FreeCopiedString (error_s);
+								}		/* if (error_s) */
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add error for missing column %s to job response", json_string_value (name_p));
+								}
+						}
+				}		/* json_array_foreach (names_p, i, name_p) */
+
+			success_flag = false;
+		}		/* if ((found & mask) != mask) */
+
+	return success_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static ColumnEntry *GetColumnEntry (const ColumnSchema *schema_p, const char *name_s)
+{
+	const json_t *index_p = json_object_get (schema_p -> cs_indexes_p, name_s);
+
+	return (index_p ? (schema_p -> cs_entries_p) + json_integer_value (index_p) : NULL);
+}
+
+
+/*
+ * Add a column which, until its type is set, holds strings and isn't
+ * required for any data type.
+ */
+static ColumnEntry *AddColumnEntry (ColumnSchema *schema_p, const char *name_s)
+{
+	ColumnEntry *entry_p = NULL;
+
+	if (schema_p -> cs_num_entries == schema_p -> cs_max_entries)
+		{
+			const size_t new_size = (schema_p -> cs_max_entries) << 1;
+			ColumnEntry *new_entries_p = (ColumnEntry *) AllocMemoryArray (new_size, sizeof (ColumnEntry));
+
+			if (new_entries_p)
+				{
+					memcpy (new_entries_p, schema_p -> cs_entries_p, (schema_p -> cs_num_entries) * sizeof (ColumnEntry));
+					FreeMemory (schema_p -> cs_entries_p);
+
+					schema_p -> cs_entries_p = new_entries_p;
+					schema_p -> cs_max_entries = new_size;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " column schema entries", new_size);
+					return NULL;
+				}
+		}
+
+	if (json_object_set_new (schema_p -> cs_indexes_p, name_s, json_integer ((json_int_t) (schema_p -> cs_num_entries))) == 0)
+		{
+			uint32 i;
+
+			entry_p = (schema_p -> cs_entries_p) + (schema_p -> cs_num_entries);
+
+			entry_p -> ce_type = JSON_STRING;
+
+			for (i = 0; i < PD_NUM_TYPES; ++ i)
+				{
+					* ((entry_p -> ce_required_bits) + i) = 0;
+				}
+
+			++ (schema_p -> cs_num_entries);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add column \"%s\" to schema", name_s);
+		}
+
+	return entry_p;
+}
+
+
+static json_type GetColumnDefinitionType (const char *name_s, const char *def_s)
+{
+	json_type t = JSON_STRING;
+
+	if (def_s)
+		{
+			if (strcmp (def_s, "int") == 0)
+				{
+					t = JSON_INTEGER;
+				}
+			else if (strcmp (def_s, "real") == 0)
+				{
+					t = JSON_REAL;
+				}
+			else if (strcmp (def_s, "bool") == 0)
+				{
+					t = JSON_TRUE;
+				}
+			else if (strcmp (def_s, "string") != 0)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Unknown type \"%s\" for column \"%s\", using string", def_s, name_s);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "The type for column \"%s\" is not a string, using string", name_s);
+		}
+
+	return t;
+}
+
+
+static json_t *ConvertIntegerValue (const char *value_s)
+{
+	json_t *value_p = NULL;
+	char *end_s = NULL;
+	long long l;
+
+	errno = 0;
+	l = strtoll (value_s, &end_s, 10);
+
+	if ((errno == 0) && (end_s != value_s) && (IsValueEnd (end_s)))
+		{
+			value_p = json_integer ((json_int_t) l);
+		}
+
+	return value_p;
+}
+
+
+static json_t *ConvertRealValue (const char *value_s)
+{
+	json_t *value_p = NULL;
+	char *end_s = NULL;
+	double d;
+
+	errno = 0;
+	d = strtod (value_s, &end_s);
+
+	if ((errno == 0) && (end_s != value_s) && (IsValueEnd (end_s)))
+		{
+			value_p = json_real (d);
+		}
+
+	return value_p;
+}
+
+
+static json_t *ConvertBooleanValue (const char *value_s)
+{
+	json_t *value_p = NULL;
+
+	if ((Stricmp (value_s, "true") == 0) || (Stricmp (value_s, "yes") == 0) || (strcmp (value_s, "1") == 0))
+		{
+			value_p = json_true ();
+		}
+	else if ((Stricmp (value_s, "false") == 0) || (Stricmp (value_s, "no") == 0) || (strcmp (value_s, "0") == 0))
+		{
+			value_p = json_false ();
+		}
+
+	return value_p;
+}
+
+
+static json_t *ConvertStringValue (const char *value_s)
+{
+	return json_string (value_s);
+}
+
+
+/* Only trailing whitespace may follow a number */
+static bool IsValueEnd (const char *end_s)
+{
+	while (isspace ((unsigned char) *end_s))
+		{
+			++ end_s;
+		}
+
+	return (*end_s == '\0');
+}
@@ -0,0 +1,710 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * coordinate_parser.c
+ *
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coordinate_parser.h"
+
+
+#define S_PI (3.14159265358979323846)
+
+#define S_DEGREES_TO_RADIANS(x) ((x) * S_PI / 180.0)
+
+#define S_RADIANS_TO_DEGREES(x) ((x) * 180.0 / S_PI)
+
+/* Enough values for two coordinates in degrees, minutes and seconds */
+#define S_MAX_NUM_VALUES (6)
+
+
+/*
+ * A latitude or longitude as it is being parsed. Each value is in
+ * degrees, minutes or seconds, depending upon its position.
+ */
+typedef struct Coordinate
+{
+	double64 c_values [S_MAX_NUM_VALUES];
+
+	uint32 c_num_values;
+
+	/* 'N', 'S', 'E', 'W' or '\0' if no hemisphere was given */
+	char c_hemisphere;
+
+	bool c_negative_flag;
+
+	/* Whether any of the values had a degree, minute or second mark */
+	bool c_marked_flag;
+} Coordinate;
+
+
+/* An ellipsoid's semi-major and semi-minor axes in metres */
+typedef struct Ellipsoid
+{
+	double64 e_a;
+	double64 e_b;
+} Ellipsoid;
+
+
+static const Ellipsoid S_AIRY_1830 = { 6377563.396, 6356256.909 };
+
+static const Ellipsoid S_WGS84 = { 6378137.000, 6356752.314245 };
+
+
+static bool ParseGridReference (const char *value_s, double64 *latitude_p, double64 *longitude_p);
+
+static bool ParseLatitudeAndLongitude (const char *value_s, double64 *latitude_p, double64 *longitude_p);
+
+static bool AddValueToCoordinates (Coordinate *coords_p, uint32 *current_p, const double64 value, const bool signed_flag, const int position);
+
+static void CloseCoordinate (const Coordinate *coords_p, uint32 *current_p);
+
+static int GetUnitMark (const char **value_ss);
+
+static bool ConvertCoordinate (const Coordinate *coord_p, double64 *degrees_p);
+
+static void ConvertGridToOSGB36 (const double64 easting, const double64 northing, double64 *latitude_p, double64 *longitude_p);
+
+static double64 GetMeridionalArc (const double64 scaled_b, const double64 n, const double64 lat0, const double64 lat);
+
+static void ConvertOSGB36ToWGS84 (const double64 osgb_latitude, const double64 osgb_longitude, double64 *latitude_p, double64 *longitude_p);
+
+
+bool ParseGPSCoordinate (const char *value_s, double64 *latitude_p, double64 *longitude_p)
+{
+	while (isspace ((unsigned char) *value_s))
+		{
+			++ value_s;
+		}
+
+	/*
+	 * A grid reference starts with two letters followed by a digit, which
+	 * can't be the start of any of the latitude and longitude forms
+	 */
+	if (isalpha ((unsigned char) *value_s) && isalpha ((unsigned char) * (value_s + 1)))
+		{
+			const char *c_p = value_s + 2;
+
+			while (*c_p == ' ')
+				{
+					++ c_p;
+				}
+
+			if (isdigit ((unsigned char) *c_p))
+				{
+					return ParseGridReference (value_s, latitude_p, longitude_p);
+				}
+		}
+
+	return ParseLatitudeAndLongitude (value_s, latitude_p, longitude_p);
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool ParseGridReference (const char *value_s, double64 *latitude_p, double64 *longitude_p)
+{
+	char digits_s [11];
+	size_t num_digits = 0;
+	int l1 = toupper ((unsigned char) *value_s) - 'A';
+	int l2 = toupper ((unsigned char) * (value_s + 1)) - 'A';
+	const char *c_p = value_s + 2;
+	int e100km;
+	int n100km;
+
+	/* There is no I in the grid letters */
+	if ((l1 == 8) || (l2 == 8))
+		{
+			return false;
+		}
+
+	if (l1 > 7)
+		{
+			-- l1;
+		}
+
+	if (l2 > 7)
+		{
+			-- l2;
+		}
+
+	/* The 500km squares that cover Great Britain are H, J, N, O, S and T */
+	if (l1 < 2)
+		{
+			return false;
+		}
+
+	e100km = (((l1 - 2) % 5) * 5) + (l2 % 5);
+	n100km = (19 - ((l1 / 5) * 5)) - (l2 / 5);
+
+	if ((e100km < 0) || (e100km > 6) || (n100km < 0) || (n100km > 12))
+		{
+			return false;
+		}
+
+	while (*c_p)
+		{
+			if (isdigit ((unsigned char) *c_p))
+				{
+					if (num_digits == 10)
+						{
+							return false;
+						}
+
+					digits_s [num_digits ++] = *c_p;
+				}
+			else if (!isspace ((unsigned char) *c_p))
+				{
+					return false;
+				}
+
+			++ c_p;
+		}
+
+	if ((num_digits > 0) && ((num_digits & 1) == 0))
+		{
+			const size_t half = num_digits >> 1;
+			/* The size of the referenced square in metres */
+			const double64 precision = pow (10.0, (double64) (5 - half));
+			double64 easting = 0.0;
+			double64 northing = 0.0;
+			double64 osgb_latitude;
+			double64 osgb_longitude;
+			size_t i;
+
+			for (i = 0; i < half; ++ i)
+				{
+					easting = (easting * 10.0) + (digits_s [i] - '0');
+					northing = (northing * 10.0) + (digits_s [half + i] - '0');
+				}
+
+			/* Use the centre of the square */
+			easting = (e100km * 100000.0) + (easting * precision) + (precision / 2.0);
+			northing = (n100km * 100000.0) + (northing * precision) + (precision / 2.0);
+
+			ConvertGridToOSGB36 (easting, northing, &osgb_latitude, &osgb_longitude);
+			ConvertOSGB36ToWGS84 (osgb_latitude, osgb_longitude, latitude_p, longitude_p);
+
+			return true;
+		}
+
+	return false;
+}
+
+
+static bool ParseLatitudeAndLongitude (const char *value_s, double64 *latitude_p, double64 *longitude_p)
+{
+	Coordinate coords [2];
+	uint32 current = 0;
+	const char *c_p = value_s;
+	double64 values [2];
+	uint32 i;
+
+	memset (coords, 0, 2 * sizeof (Coordinate));
+
+	while (*c_p)
+		{
+			const unsigned char c = (unsigned char) *c_p;
+
+			if (isspace (c))
+				{
+					++ c_p;
+				}
+			else if ((c == ',') || (c == ';') || (c == '/'))
+				{
+					/* A separator can't come before the first value */
+					if ((current == 0) && (coords [0].c_num_values == 0))
+						{
+							return false;
+						}
+
+					CloseCoordinate (coords, &current);
+					++ c_p;
+				}
+			else if (strchr ("NSEWnsew", c))
+				{
+					Coordinate *coord_p;
+
+					if (current == 2)
+						{
+							return false;
+						}
+
+					coord_p = coords + current;
+
+					if (coord_p -> c_num_values == 0)
+						{
+							/* A hemisphere before the values */
+							if (coord_p -> c_hemisphere)
+								{
+									return false;
+								}
+
+							coord_p -> c_hemisphere = (char) toupper (c);
+						}
+					else if (coord_p -> c_hemisphere)
+						{
+							/* The coordinate had a leading hemisphere so this starts the next one */
+							CloseCoordinate (coords, &current);
+
+							if (current == 2)
+								{
+									return false;
+								}
+
+							coords [current].c_hemisphere = (char) toupper (c);
+						}
+					else
+						{
+							/* A hemisphere after the values */
+							coord_p -> c_hemisphere = (char) toupper (c);
+							CloseCoordinate (coords, &current);
+						}
+
+					++ c_p;
+				}
+			else if (isdigit (c) || (c == '-') || (c == '+') || (c == '.'))
+				{
+					char *end_p = NULL;
+					const double64 value = strtod (c_p, &end_p);
+					const char *d_p;
+					bool got_digit_flag = false;
+
+					if (end_p == c_p)
+						{
+							return false;
+						}
+
+					/* strtod also accepts exponents, hex, inf and nan which we don't */
+					for (d_p = c_p; d_p < end_p; ++ d_p)
+						{
+							if (isdigit ((unsigned char) *d_p))
+								{
+									got_digit_flag = true;
+								}
+							else if (!strchr ("+-.", *d_p))
+								{
+									return false;
+								}
+						}
+
+					if (!got_digit_flag)
+						{
+							return false;
+						}
+
+					c_p = end_p;
+
+					if (!AddValueToCoordinates (coords, &current, value, (c == '-') || (c == '+'), GetUnitMark (&c_p)))
+						{
+							return false;
+						}
+				}
+			else
+				{
+					return false;
+				}
+
+		}		/* while (*c_p) */
+
+	CloseCoordinate (coords, &current);
+
+	/*
+	 * Plain numbers separated only by spaces, e.g. "52.62 1.22" or
+	 * "52 37 18 1 13 10", will all be in the first coordinate so split
+	 * them in half.
+	 */
+	if ((current == 1) && (! (coords [0].c_hemisphere)) && (! (coords [0].c_marked_flag)) && ((coords [0].c_num_values & 1) == 0))
+		{
+			const uint32 half = coords [0].c_num_values >> 1;
+
+			for (i = 0; i < half; ++ i)
+				{
+					coords [1].c_values [i] = coords [0].c_values [half + i];
+				}
+
+			coords [1].c_num_values = half;
+			coords [1].c_negative_flag = (coords [1].c_values [0] < 0.0);
+			coords [0].c_num_values = half;
+			current = 2;
+		}
+
+	if (current != 2)
+		{
+			return false;
+		}
+
+	for (i = 0; i < 2; ++ i)
+		{
+			if (!ConvertCoordinate (coords + i, values + i))
+				{
+					return false;
+				}
+		}
+
+	/* Put the latitude first if the hemispheres show that the longitude was */
+	if ((coords [0].c_hemisphere == 'E') || (coords [0].c_hemisphere == 'W') || (coords [1].c_hemisphere == 'N') || (coords [1].c_hemisphere == 'S'))
+		{
+			const double64 d = values [0];
+			const char h = coords [0].c_hemisphere;
+
+			values [0] = values [1];
+			values [1] = d;
+
+			coords [0].c_hemisphere = coords [1].c_hemisphere;
+			coords [1].c_hemisphere = h;
+		}
+
+	/* Make sure that we don't have two latitudes or two longitudes */
+	if ((coords [0].c_hemisphere == 'E') || (coords [0].c_hemisphere == 'W') || (coords [1].c_hemisphere == 'N') || (coords [1].c_hemisphere == 'S'))
+		{
+			return false;
+		}
+
+	if ((values [0] < -90.0) || (values [0] > 90.0) || (values [1] < -180.0) || (values [1] > 180.0))
+		{
+			return false;
+		}
+
+	*latitude_p = values [0];
+	*longitude_p = values [1];
+
+	return true;
+}
+
+
+/*
+ * Add a value to the coordinate currently being parsed. The position is
+ * 0, 1 or 2 if the value was marked as degrees, minutes or seconds
+ * respectively, or -1 if it was unmarked.
+ */
+static bool AddValueToCoordinates (Coordinate *coords_p, uint32 *current_p, const double64 value, const bool signed_flag, const int position)
+{
+	Coordinate *coord_p;
+
+	if (*current_p == 2)
+		{
+			return false;
+		}
+
+	coord_p = coords_p + *current_p;
+
+	if (position >= 0)
+		{
+			if ((position == 0) && (coord_p -> c_num_values > 0))
+				{
+					/* A new set of degrees starts the next coordinate */
+					CloseCoordinate (coords_p, current_p);
+
+					if (*current_p == 2)
+						{
+							return false;
+						}
+
+					coord_p = coords_p + *current_p;
+				}
+
+			if ((uint32) position != coord_p -> c_num_values)
+				{
+					return false;
+				}
+
+			coord_p -> c_marked_flag = true;
+		}
+	else if (coord_p -> c_num_values == S_MAX_NUM_VALUES)
+		{
+			return false;
+		}
+
+	if (coord_p -> c_num_values == 0)
+		{
+			coord_p -> c_negative_flag = (value < 0.0);
+		}
+	else if (signed_flag && (coord_p -> c_marked_flag || coord_p -> c_hemisphere))
+		{
+			/* Only the degrees can have a sign */
+			return false;
+		}
+
+	coord_p -> c_values [coord_p -> c_num_values] = value;
+	++ (coord_p -> c_num_values);
+
+	return true;
+}
+
+
+static void CloseCoordinate (const Coordinate *coords_p, uint32 *current_p)
+{
+	if ((*current_p < 2) && ((coords_p [*current_p].c_num_values > 0) || (coords_p [*current_p].c_hemisphere)))
+		{
+			++ (*current_p);
+		}
+}
+
+
+/*
+ * Skip over any degree, minute or second mark after a value and return
+ * its position or -1 if there isn't one.
+ */
+static int GetUnitMark (const char **value_ss)
+{
+	const unsigned char *c_p = (const unsigned char *) *value_ss;
+	int position = -1;
+	size_t length = 0;
+
+	while (*c_p == ' ')
+		{
+			++ c_p;
+		}
+
+	/* Degree and masculine ordinal signs in UTF-8 */
+	if ((*c_p == 0xC2) && ((* (c_p + 1) == 0xB0) || (* (c_p + 1) == 0xBA)))
+		{
+			position = 0;
+			length = 2;
+		}
+	/* Prime and double prime in UTF-8 */
+	else if ((*c_p == 0xE2) && (* (c_p + 1) == 0x80) && ((* (c_p + 2) == 0xB2) || (* (c_p + 2) == 0xB3)))
+		{
+			position = (* (c_p + 2) == 0xB2) ? 1 : 2;
+			length = 3;
+		}
+	else if (*c_p == '\'')
+		{
+			if (* (c_p + 1) == '\'')
+				{
+					position = 2;
+					length = 2;
+				}
+			else
+				{
+					position = 1;
+					length = 1;
+				}
+		}
+	else if (*c_p == '"')
+		{
+			position = 2;
+			length = 1;
+		}
+
+	if (position != -1)
+		{
+			*value_ss = (const char *) (c_p + length);
+		}
+
+	return position;
+}
+
+
+static bool ConvertCoordinate (const Coordinate *coord_p, double64 *degrees_p)
+{
+	const double64 *values_p = coord_p -> c_values;
+	double64 degrees;
+	uint32 i;
+
+	if ((coord_p -> c_num_values == 0) || (coord_p -> c_num_values > 3))
+		{
+			return false;
+		}
+
+	/* Only the last of the degrees, minutes and seconds can have a fraction */
+	for (i = 0; i < coord_p -> c_num_values; ++ i)
+		{
+			if ((i < coord_p -> c_num_values - 1) && (values_p [i] != floor (values_p [i])))
+				{
+					return false;
+				}
+
+			if ((i > 0) && ((values_p [i] < 0.0) || (values_p [i] >= 60.0)))
+				{
+					return false;
+				}
+		}
+
+	degrees = fabs (values_p [0]);
+
+	if (coord_p -> c_num_values > 1)
+		{
+			degrees += values_p [1] / 60.0;
+
+			if (coord_p -> c_num_values > 2)
+				{
+					degrees += values_p [2] / 3600.0;
+				}
+		}
+
+	if (coord_p -> c_negative_flag)
+		{
+			/* A negative value with a hemisphere is contradictory */
+			if (coord_p -> c_hemisphere)
+				{
+					return false;
+				}
+
+			degrees = -degrees;
+		}
+	else if ((coord_p -> c_hemisphere == 'S') || (coord_p -> c_hemisphere == 'W'))
+		{
+			degrees = -degrees;
+		}
+
+	*degrees_p = degrees;
+
+	return true;
+}
+
+
+/*
+ * Convert National Grid eastings and northings to OSGB36 latitude and
+ * longitude using the inverse Transverse Mercator projection from the
+ * Ordnance Survey's "A guide to coordinate systems in Great Britain".
+ */
+static void ConvertGridToOSGB36 (const double64 easting, const double64 northing, double64 *latitude_p, double64 *longitude_p)
+{
+	const double64 a = S_AIRY_1830.e_a;
+	const double64 b = S_AIRY_1830.e_b;
+	const double64 f0 = 0.9996012717;
+	const double64 lat0 = S_DEGREES_TO_RADIANS (49.0);
+	const double64 lon0 = S_DEGREES_TO_RADIANS (-2.0);
+	const double64 n0 = -100000.0;
+	const double64 e0 = 400000.0;
+	const double64 e2 = 1.0 - ((b * b) / (a * a));
+	const double64 n = (a - b) / (a + b);
+	double64 lat = lat0;
+	double64 m = 0.0;
+	double64 sin_lat;
+	double64 cos_lat;
+	double64 nu;
+	double64 rho;
+	double64 eta2;
+	double64 tan_lat;
+	double64 tan2;
+	double64 tan4;
+	double64 tan6;
+	double64 sec_lat;
+	double64 de;
+	double64 vii;
+	double64 viii;
+	double64 ix;
+	double64 x;
+	double64 xi;
+	double64 xii;
+	double64 xiia;
+
+	/* Iterate until the meridional arc is within 0.01mm */
+	do
+		{
+			lat += (northing - n0 - m) / (a * f0);
+			m = GetMeridionalArc (b * f0, n, lat0, lat);
+		}
+	while (fabs (northing - n0 - m) >= 0.00001);
+
+	sin_lat = sin (lat);
+	cos_lat = cos (lat);
+	nu = a * f0 / sqrt (1.0 - (e2 * sin_lat * sin_lat));
+	rho = a * f0 * (1.0 - e2) / pow (1.0 - (e2 * sin_lat * sin_lat), 1.5);
+	eta2 = (nu / rho) - 1.0;
+
+	tan_lat = tan (lat);
+	tan2 = tan_lat * tan_lat;
+	tan4 = tan2 * tan2;
+	tan6 = tan4 * tan2;
+	sec_lat = 1.0 / cos_lat;
+
+	vii = tan_lat / (2.0 * rho * nu);
+	viii = tan_lat / (24.0 * rho * pow (nu, 3.0)) * (5.0 + (3.0 * tan2) + eta2 - (9.0 * tan2 * eta2));
+	ix = tan_lat / (720.0 * rho * pow (nu, 5.0)) * (61.0 + (90.0 * tan2) + (45.0 * tan4));
+	x = sec_lat / nu;
+	xi = sec_lat / (6.0 * pow (nu, 3.0)) * ((nu / rho) + (2.0 * tan2));
+	xii = sec_lat / (120.0 * pow (nu, 5.0)) * (5.0 + (28.0 * tan2) + (24.0 * tan4));
+	xiia = sec_lat / (5040.0 * pow (nu, 7.0)) * (61.0 + (662.0 * tan2) + (1320.0 * tan4) + (720.0 * tan6));
+
+	de = easting - e0;
+
+	*latitude_p = lat - (vii * pow (de, 2.0)) + (viii * pow (de, 4.0)) - (ix * pow (de, 6.0));
+	*longitude_p = lon0 + (x * de) - (xi * pow (de, 3.0)) + (xii * pow (de, 5.0)) - (xiia * pow (de, 7.0));
+}
+
+
+static double64 GetMeridionalArc (const double64 scaled_b, const double64 n, const double64 lat0, const double64 lat)
+{
+	const double64 n2 = n * n;
+	const double64 n3 = n2 * n;
+	const double64 ma = (1.0 + n + (1.25 * n2) + (1.25 * n3)) * (lat - lat0);
+	const double64 mb = ((3.0 * n) + (3.0 * n2) + (2.625 * n3)) * sin (lat - lat0) * cos (lat + lat0);
+	const double64 mc = ((1.875 * n2) + (1.875 * n3)) * sin (2.0 * (lat - lat0)) * cos (2.0 * (lat + lat0));
+	const double64 md = (35.0 / 24.0) * n3 * sin (3.0 * (lat - lat0)) * cos (3.0 * (lat + lat0));
+
+	return scaled_b * (ma - mb + mc - md);
+}
+
+
+/*
+ * Convert OSGB36 latitude and longitude, in radians, to WGS84 degrees
+ * with a Helmert transformation, which is accurate to a few metres.
+ */
+static void ConvertOSGB36ToWGS84 (const double64 osgb_latitude, const double64 osgb_longitude, double64 *latitude_p, double64 *longitude_p)
+{
+	/* The Helmert parameters from OSGB36 to WGS84 */
+	const double64 tx = 446.448;
+	const double64 ty = -125.157;
+	const double64 tz = 542.060;
+	const double64 s = -20.4894 / 1e6;
+	const double64 rx = S_DEGREES_TO_RADIANS (0.1502 / 3600.0);
+	const double64 ry = S_DEGREES_TO_RADIANS (0.2470 / 3600.0);
+	const double64 rz = S_DEGREES_TO_RADIANS (0.8421 / 3600.0);
+	double64 a = S_AIRY_1830.e_a;
+	double64 b = S_AIRY_1830.e_b;
+	double64 e2 = 1.0 - ((b * b) / (a * a));
+	double64 sin_lat = sin (osgb_latitude);
+	double64 nu = a / sqrt (1.0 - (e2 * sin_lat * sin_lat));
+	const double64 x1 = nu * cos (osgb_latitude) * cos (osgb_longitude);
+	const double64 y1 = nu * cos (osgb_latitude) * sin (osgb_longitude);
+	const double64 z1 = (1.0 - e2) * nu * sin_lat;
+	const double64 x2 = tx + (x1 * (1.0 + s)) - (y1 * rz) + (z1 * ry);
+	const double64 y2 = ty + (x1 * rz) + (y1 * (1.0 + s)) - (z1 * rx);
+	const double64 z2 = tz - (x1 * ry) + (y1 * rx) + (z1 * (1.0 + s));
+	const double64 p = sqrt ((x2 * x2) + (y2 * y2));
+	double64 lat;
+	double64 prev_lat;
+
+	a = S_WGS84.e_a;
+	b = S_WGS84.e_b;
+	e2 = 1.0 - ((b * b) / (a * a));
+
+	lat = atan2 (z2, p * (1.0 - e2));
+
+	do
+		{
+			prev_lat = lat;
+			sin_lat = sin (lat);
+			nu = a / sqrt (1.0 - (e2 * sin_lat * sin_lat));
+			lat = atan2 (z2 + (e2 * nu * sin_lat), p);
+		}
+	while (fabs (lat - prev_lat) > 1e-12);
+
+	*latitude_p = S_RADIANS_TO_DEGREES (lat);
+	*longitude_p = S_RADIANS_TO_DEGREES (atan2 (y2, x2));
+}
@@ -0,0 +1,721 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * date_normaliser.c
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "date_normaliser.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define DATE_NORMALISER_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define DATE_NORMALISER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+struct DateNormaliser
+{
+	DateOrder dn_order;
+
+	/*
+	 * The dates that have been seen so far mapped to their ISO 8601
+	 * forms or to null if they couldn't be converted.
+	 */
+	json_t *dn_cache_p;
+
+	/* The number of rows converted with NormaliseRowDate () with each DateStatus */
+	size_t dn_counts [DS_NUM_STATUSES];
+
+	pthread_mutex_t dn_mutex;
+};
+
+
+typedef struct DateParts
+{
+	int32 dp_year;
+
+	int32 dp_month;
+
+	int32 dp_day;
+} DateParts;
+
+
+/*
+ * Each part of a date is a run of digits or letters, as long as the
+ * letters are a month name. The parts are classified by their length
+ * and the classes of all of the parts are combined into a single value
+ * so that the form of the date can be found with one switch.
+ */
+typedef enum
+{
+	/*
+	 * This isn't 0 so that an unrecognised part still counts towards the
+	 * pattern, e.g. "2020-03-123" doesn't match the pattern for "2020-03".
+	 */
+	DTC_OTHER = 1,
+	DTC_MONTH_NAME,
+	DTC_SHORT,
+	DTC_YEAR,
+	DTC_COMPACT
+} DateTokenClass;
+
+
+typedef struct DateToken
+{
+	/* The numeric value or, for a month name, the month from 1 to 12 */
+	int32 dt_value;
+
+	/* The number of digits or 0 for a month name */
+	uint32 dt_num_digits;
+} DateToken;
+
+
+#define S_MAX_DATE_TOKENS (3)
+
+#define S_DATE_PATTERN_1(a) ((uint32) (a))
+#define S_DATE_PATTERN_2(a,b) ((uint32) (a) | ((uint32) (b) << 4))
+#define S_DATE_PATTERN_3(a,b,c) ((uint32) (a) | ((uint32) (b) << 4) | ((uint32) (c) << 8))
+
+
+static const char * const S_DATE_ORDER_NAMES_SS [DO_NUM_ORDERS] = { "DD/MM/YYYY", "MM/DD/YYYY" };
+
+static const char * const S_MONTH_NAMES_SS [12] = { "january", "february", "march", "april", "may", "june", "july", "august", "september", "october", "november", "december" };
+
+static const int32 S_DAYS_IN_MONTH [12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+/* The Excel serial day numbers for 1900-03-01 and 9999-12-31 */
+static const double S_MIN_EXCEL_SERIAL = 61.0;
+
+static const double S_MAX_EXCEL_SERIAL = 2958465.0;
+
+/* The Excel serial day number for 1970-01-01 */
+static const int32 S_EXCEL_UNIX_EPOCH = 25569;
+
+/* The number of digits that the text form of an Excel serial day number has */
+static const size_t S_EXCEL_SERIAL_NUM_DIGITS = 5;
+
+/* Stop the cache from growing without limit for uploads with many different dates */
+static const size_t S_MAX_CACHED_DATES = 16384;
+
+
+static bool ConvertDateString (const char *date_s, const DateOrder order, DateParts *parts_p);
+
+static uint32 GetDateTokens (const char *date_s, DateToken *tokens_p, const char **end_ss);
+
+static uint32 GetDateTokenClass (const DateToken *token_p);
+
+static int32 GetMonthFromName (const char *name_s, const size_t length);
+
+static int32 GetYear (const DateToken *token_p);
+
+static bool IsExcelSerial (const char *date_s);
+
+static bool ConvertExcelSerial (const double serial, DateParts *parts_p);
+
+static bool IsValidDate (const DateParts *parts_p);
+
+static void WriteISODate (const DateParts *parts_p, char *iso_date_s);
+
+static void WriteDigits (char *buffer_s, int32 value, size_t num_digits);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+DateNormaliser *AllocateDateNormaliser (const DateOrder order)
+{
+	json_t *cache_p = json_object ();
+
+	if (cache_p)
+		{
+			DateNormaliser *normaliser_p = (DateNormaliser *) AllocMemory (sizeof (DateNormaliser));
+
+			if (normaliser_p)
+				{
+					normaliser_p -> dn_order = order;
+					normaliser_p -> dn_cache_p = cache_p;
+
+					memset (normaliser_p -> dn_counts, 0, DS_NUM_STATUSES * sizeof (size_t));
+
+					pthread_mutex_init (& (normaliser_p -> dn_mutex), NULL);
+
+					return normaliser_p;
+				}
+
+			json_decref (cache_p);
+		}
+
+	return NULL;
+}
+
+
+void FreeDateNormaliser (DateNormaliser *normaliser_p)
+{
+	#if DATE_NORMALISER_DEBUG >= STM_LEVEL_FINE
+	PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, SIZET_FMT " distinct dates were converted", json_object_size (normaliser_p -> dn_cache_p));
+	#endif
+
+	pthread_mutex_destroy (& (normaliser_p -> dn_mutex));
+	json_decref (normaliser_p -> dn_cache_p);
+	FreeMemory (normaliser_p);
+}
+
+
+DateOrder GetDateNormaliserOrder (const DateNormaliser *normaliser_p)
+{
+	return normaliser_p -> dn_order;
+}
+
+
+bool NormaliseDate (DateNormaliser *normaliser_p, const json_t *date_p, char *iso_date_s)
+{
+	bool success_flag = false;
+	DateParts parts;
+
+	if (json_is_string (date_p))
+		{
+			const char *date_s = json_string_value (date_p);
+
+			if (normaliser_p)
+				{
+					bool cached_flag = false;
+					const json_t *cached_p;
+
+					pthread_mutex_lock (& (normaliser_p -> dn_mutex));
+
+					cached_p = json_object_get (normaliser_p -> dn_cache_p, date_s);
+
+					if (cached_p)
+						{
+							cached_flag = true;
+
+							if (json_is_string (cached_p))
+								{
+									memcpy (iso_date_s, json_string_value (cached_p), PG_ISO_DATE_BUFFER_SIZE * sizeof (char));
+									success_flag = true;
+								}
+						}
+
+					pthread_mutex_unlock (& (normaliser_p -> dn_mutex));
+
+					if (!cached_flag)
+						{
+							json_t *result_p;
+
+							if (ConvertDateString (date_s, normaliser_p -> dn_order, &parts))
+								{
+									WriteISODate (&parts, iso_date_s);
+									success_flag = true;
+								}
+
+							result_p = success_flag ? json_string (iso_date_s) : json_null ();
+
+							if (result_p)
+								{
+									pthread_mutex_lock (& (normaliser_p -> dn_mutex));
+
+									if (json_object_size (normaliser_p -> dn_cache_p) >= S_MAX_CACHED_DATES)
+										{
+											json_object_clear (normaliser_p -> dn_cache_p);
+										}
+
+									if (json_object_set_new (normaliser_p -> dn_cache_p, date_s, result_p) != 0)
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to cache converted date for \"%s\"", date_s);
+										}
+
+									pthread_mutex_unlock (& (normaliser_p -> dn_mutex));
+								}
+						}		/* if (!cached_flag) */
+
+				}		/* if (normaliser_p) */
+			else if (ConvertDateString (date_s, DO_DAY_FIRST, &parts))
+				{
+					WriteISODate (&parts, iso_date_s);
+					success_flag = true;
+				}
+
+		}		/* if (json_is_string (date_p)) */
+	else if (json_is_number (date_p))
+		{
+			if (ConvertExcelSerial (json_number_value (date_p), &parts))
+				{
+					WriteISODate (&parts, iso_date_s);
+					success_flag = true;
+				}
+		}
+
+	return success_flag;
+}
+
+
+DateStatus NormaliseRowDate (DateNormaliser *normaliser_p, const json_t *row_p, const char *key_s, char *iso_date_s)
+{
+	const json_t *date_p = json_object_get (row_p, key_s);
+	DateStatus status = DS_MISSING;
+
+	if (date_p)
+		{
+			status = NormaliseDate (normaliser_p, date_p, iso_date_s) ? DS_CONVERTED : DS_INVALID;
+		}
+
+	if (normaliser_p)
+		{
+			pthread_mutex_lock (& (normaliser_p -> dn_mutex));
+			++ (* ((normaliser_p -> dn_counts) + status));
+			pthread_mutex_unlock (& (normaliser_p -> dn_mutex));
+		}
+
+	return status;
+}
+
+
+void NormaliseDateColumn (DateNormaliser *normaliser_p, const json_t *rows_p, const char *key_s)
+{
+	char iso_date_s [PG_ISO_DATE_BUFFER_SIZE];
+	size_t i;
+	json_t *row_p;
+
+	json_array_foreach (rows_p, i, row_p)
+		{
+			const json_t *date_p = json_object_get (row_p, key_s);
+
+			if (date_p)
+				{
+					NormaliseDate (normaliser_p, date_p, iso_date_s);
+				}
+		}
+}
+
+
+void GetDateStatusCounts (DateNormaliser *normaliser_p, size_t *counts_p)
+{
+	pthread_mutex_lock (& (normaliser_p -> dn_mutex));
+	memcpy (counts_p, normaliser_p -> dn_counts, DS_NUM_STATUSES * sizeof (size_t));
+	pthread_mutex_unlock (& (normaliser_p -> dn_mutex));
+}
+
+
+const char *GetDateOrderName (const DateOrder order)
+{
+	return ((order >= DO_DAY_FIRST) && (order < DO_NUM_ORDERS)) ? * (S_DATE_ORDER_NAMES_SS + order) : NULL;
+}
+
+
+bool GetDateOrderFromName (const char *name_s, DateOrder *order_p)
+{
+	uint32 i;
+
+	for (i = 0; i < DO_NUM_ORDERS; ++ i)
+		{
+			if (strcmp (name_s, * (S_DATE_ORDER_NAMES_SS + i)) == 0)
+				{
+					*order_p = (DateOrder) i;
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool ConvertDateString (const char *date_s, const DateOrder order, DateParts *parts_p)
+{
+	DateToken tokens [S_MAX_DATE_TOKENS];
+	const char *end_s = NULL;
+	uint32 num_tokens;
+	uint32 pattern = 0;
+	uint32 i;
+
+	if (IsExcelSerial (date_s))
+		{
+			return ConvertExcelSerial (strtod (date_s, NULL), parts_p);
+		}
+
+	num_tokens = GetDateTokens (date_s, tokens, &end_s);
+
+	for (i = 0; i < num_tokens; ++ i)
+		{
+			pattern |= GetDateTokenClass (tokens + i) << (i << 2);
+		}
+
+	/* ISO 8601 dates may have a time after them, which we don't need */
+	if (!((pattern == S_DATE_PATTERN_3 (DTC_YEAR, DTC_SHORT, DTC_SHORT)) && ((*end_s == 'T') || (*end_s == ' '))))
+		{
+			while (isspace ((unsigned char) *end_s))
+				{
+					++ end_s;
+				}
+
+			if (*end_s != '\0')
+				{
+					return false;
+				}
+		}
+
+	parts_p -> dp_day = 1;
+
+	switch (pattern)
+		{
+			/* YYYYMMDD */
+			case S_DATE_PATTERN_1 (DTC_COMPACT):
+				parts_p -> dp_year = tokens [0].dt_value / 10000;
+				parts_p -> dp_month = (tokens [0].dt_value / 100) % 100;
+				parts_p -> dp_day = tokens [0].dt_value % 100;
+				break;
+
+			/* YYYY-MM */
+			case S_DATE_PATTERN_2 (DTC_YEAR, DTC_SHORT):
+				parts_p -> dp_year = tokens [0].dt_value;
+				parts_p -> dp_month = tokens [1].dt_value;
+				break;
+
+			/* MM/YYYY */
+			case S_DATE_PATTERN_2 (DTC_SHORT, DTC_YEAR):
+				parts_p -> dp_year = tokens [1].dt_value;
+				parts_p -> dp_month = tokens [0].dt_value;
+				break;
+
+			/* Mar 2020 and Mar-20 */
+			case S_DATE_PATTERN_2 (DTC_MONTH_NAME, DTC_YEAR):
+			case S_DATE_PATTERN_2 (DTC_MONTH_NAME, DTC_SHORT):
+				parts_p -> dp_year = GetYear (tokens + 1);
+				parts_p -> dp_month = tokens [0].dt_value;
+				break;
+
+			/* YYYY-MM-DD and YYYY/MM/DD */
+			case S_DATE_PATTERN_3 (DTC_YEAR, DTC_SHORT, DTC_SHORT):
+				parts_p -> dp_year = tokens [0].dt_value;
+				parts_p -> dp_month = tokens [1].dt_value;
+				parts_p -> dp_day = tokens [2].dt_value;
+				break;
+
+			/* DD/MM/YY, DD/MM/YYYY or their US equivalents */
+			case S_DATE_PATTERN_3 (DTC_SHORT, DTC_SHORT, DTC_SHORT):
+			case S_DATE_PATTERN_3 (DTC_SHORT, DTC_SHORT, DTC_YEAR):
+				{
+					const uint32 month_index = (order == DO_MONTH_FIRST) ? 0 : 1;
+
+					parts_p -> dp_year = GetYear (tokens + 2);
+					parts_p -> dp_month = tokens [month_index].dt_value;
+					parts_p -> dp_day = tokens [1 - month_index].dt_value;
+				}
+				break;
+
+			/* March 15, 2020 */
+			case S_DATE_PATTERN_3 (DTC_MONTH_NAME, DTC_SHORT, DTC_SHORT):
+			case S_DATE_PATTERN_3 (DTC_MONTH_NAME, DTC_SHORT, DTC_YEAR):
+				parts_p -> dp_year = GetYear (tokens + 2);
+				parts_p -> dp_month = tokens [0].dt_value;
+				parts_p -> dp_day = tokens [1].dt_value;
+				break;
+
+			/* 15 Mar 2020 and 15-Mar-20 */
+			case S_DATE_PATTERN_3 (DTC_SHORT, DTC_MONTH_NAME, DTC_SHORT):
+			case S_DATE_PATTERN_3 (DTC_SHORT, DTC_MONTH_NAME, DTC_YEAR):
+				parts_p -> dp_year = GetYear (tokens + 2);
+				parts_p -> dp_month = tokens [1].dt_value;
+				parts_p -> dp_day = tokens [0].dt_value;
+				break;
+
+			default:
+				return false;
+		}
+
+	return IsValidDate (parts_p);
+}
+
+
+/*
+ * Split a date into up to S_MAX_DATE_TOKENS runs of digits or month names,
+ * separated by spaces, slashes, dashes, dots or commas. Ordinal suffixes
+ * such as the "th" in "15th" are skipped. *end_ss is set to where the
+ * reading stopped.
+ */
+static uint32 GetDateTokens (const char *date_s, DateToken *tokens_p, const char **end_ss)
+{
+	uint32 num_tokens = 0;
+	const char *c_p = date_s;
+	bool loop_flag = true;
+
+	while (loop_flag)
+		{
+			while ((*c_p == ' ') || (*c_p == '/') || (*c_p == '-') || (*c_p == '.') || (*c_p == ','))
+				{
+					++ c_p;
+				}
+
+			if (isdigit ((unsigned char) *c_p))
+				{
+					int32 value = 0;
+					uint32 num_digits = 0;
+
+					while (isdigit ((unsigned char) *c_p))
+						{
+							/* Anything this long isn't a date part so stop it from overflowing */
+							if (num_digits < 9)
+								{
+									value = (value * 10) + (*c_p - '0');
+								}
+
+							++ num_digits;
+							++ c_p;
+						}
+
+					tokens_p -> dt_value = value;
+					tokens_p -> dt_num_digits = num_digits;
+					++ tokens_p;
+					++ num_tokens;
+				}
+			else if (isalpha ((unsigned char) *c_p))
+				{
+					const char *word_s = c_p;
+					size_t length;
+
+					while (isalpha ((unsigned char) *c_p))
+						{
+							++ c_p;
+						}
+
+					length = c_p - word_s;
+
+					if ((num_tokens > 0) && (length == 2) && (tokens_p [-1].dt_num_digits > 0) &&
+							((Strnicmp (word_s, "st", 2) == 0) || (Strnicmp (word_s, "nd", 2) == 0) || (Strnicmp (word_s, "rd", 2) == 0) || (Strnicmp (word_s, "th", 2) == 0)))
+						{
+							/* an ordinal suffix */
+						}
+					else if ((tokens_p -> dt_value = GetMonthFromName (word_s, length)) > 0)
+						{
+							tokens_p -> dt_num_digits = 0;
+							++ tokens_p;
+							++ num_tokens;
+						}
+					else
+						{
+							c_p = word_s;
+							loop_flag = false;
+						}
+				}
+			else
+				{
+					loop_flag = false;
+				}
+
+			if (num_tokens == S_MAX_DATE_TOKENS)
+				{
+					loop_flag = false;
+				}
+
+		}		/* while (loop_flag) */
+
+	*end_ss = c_p;
+
+	return num_tokens;
+}
+
+
+static uint32 GetDateTokenClass (const DateToken *token_p)
+{
+	uint32 token_class = DTC_OTHER;
+
+	switch (token_p -> dt_num_digits)
+		{
+			case 0:
+				token_class = DTC_MONTH_NAME;
+				break;
+
+			case 1:
+			case 2:
+				token_class = DTC_SHORT;
+				break;
+
+			case 4:
+				token_class = DTC_YEAR;
+				break;
+
+			case 8:
+				token_class = DTC_COMPACT;
+				break;
+
+			default:
+				break;
+		}
+
+	return token_class;
+}
+
+
+/*
+ * Month names can be abbreviated to as few as 3 letters,
+ * e.g. "Sep", "Sept" and "September" are all allowed.
+ */
+static int32 GetMonthFromName (const char *name_s, const size_t length)
+{
+	if ((length >= 3) && (length <= 9))
+		{
+			const char c = (char) tolower ((unsigned char) *name_s);
+			int32 i;
+
+			for (i = 0; i < 12; ++ i)
+				{
+					const char *month_s = * (S_MONTH_NAMES_SS + i);
+
+					if ((*month_s == c) && (length <= strlen (month_s)) && (Strnicmp (name_s, month_s, length) == 0))
+						{
+							return i + 1;
+						}
+				}
+		}
+
+	return 0;
+}
+
+
+/* Two digit years are taken to be in the 2000s */
+static int32 GetYear (const DateToken *token_p)
+{
+	int32 year = -1;
+
+	if (token_p -> dt_num_digits == 4)
+		{
+			year = token_p -> dt_value;
+		}
+	else if (token_p -> dt_num_digits == 2)
+		{
+			year = 2000 + token_p -> dt_value;
+		}
+
+	return year;
+}
+
+
+/* An Excel serial day number has 5 digits and possibly a fraction for the time */
+static bool IsExcelSerial (const char *date_s)
+{
+	const char *c_p = date_s;
+
+	while (isdigit ((unsigned char) *c_p))
+		{
+			++ c_p;
+		}
+
+	if ((size_t) (c_p - date_s) == S_EXCEL_SERIAL_NUM_DIGITS)
+		{
+			if (*c_p == '.')
+				{
+					++ c_p;
+
+					while (isdigit ((unsigned char) *c_p))
+						{
+							++ c_p;
+						}
+				}
+
+			while (isspace ((unsigned char) *c_p))
+				{
+					++ c_p;
+				}
+
+			return (*c_p == '\0');
+		}
+
+	return false;
+}
+
+
+/*
+ * Excel counts days from 1899-12-30 for all dates after its fictitious
+ * 1900-02-29 and any fraction is the time of day, which is dropped as
+ * the serial is never negative. The day number is converted to a date using the civil
+ * calendar algorithm from http://howardhinnant.github.io/date_algorithms.html
+ */
+static bool ConvertExcelSerial (const double serial, DateParts *parts_p)
+{
+	if ((serial >= S_MIN_EXCEL_SERIAL) && (serial <= S_MAX_EXCEL_SERIAL))
+		{
+			const int32 days = (int32) serial - S_EXCEL_UNIX_EPOCH + 719468;
+			const int32 era = days / 146097;
+			const int32 day_of_era = days - (era * 146097);
+			const int32 year_of_era = (day_of_era - (day_of_era / 1460) + (day_of_era / 36524) - (day_of_era / 146096)) / 365;
+			const int32 day_of_year = day_of_era - ((365 * year_of_era) + (year_of_era / 4) - (year_of_era / 100));
+			const int32 mp = ((5 * day_of_year) + 2) / 153;
+
+			parts_p -> dp_day = day_of_year - (((153 * mp) + 2) / 5) + 1;
+			parts_p -> dp_month = (mp < 10) ? (mp + 3) : (mp - 9);
+			parts_p -> dp_year = year_of_era + (era * 400) + ((parts_p -> dp_month <= 2) ? 1 : 0);
+
+			return true;
+		}
+
+	return false;
+}
+
+
+static bool IsValidDate (const DateParts *parts_p)
+{
+	if ((parts_p -> dp_year >= 1000) && (parts_p -> dp_year <= 9999) && (parts_p -> dp_month >= 1) && (parts_p -> dp_month <= 12))
+		{
+			const int32 year = parts_p -> dp_year;
+			const bool leap_flag = ((year % 4 == 0) && (year % 100 != 0)) || (year % 400 == 0);
+			const int32 num_days = * (S_DAYS_IN_MONTH + (parts_p -> dp_month - 1)) + (((parts_p -> dp_month == 2) && leap_flag) ? 1 : 0);
+
+			return ((parts_p -> dp_day >= 1) && (parts_p -> dp_day <= num_days));
+		}
+
+	return false;
+}
+
+
+static void WriteISODate (const DateParts *parts_p, char *iso_date_s)
+{
+	WriteDigits (iso_date_s, parts_p -> dp_year, 4);
+	* (iso_date_s + 4) = '-';
+	WriteDigits (iso_date_s + 5, parts_p -> dp_month, 2);
+	* (iso_date_s + 7) = '-';
+	WriteDigits (iso_date_s + 8, parts_p -> dp_day, 2);
+	* (iso_date_s + 10) = '\0';
+}
+
+
+static void WriteDigits (char *buffer_s, int32 value, size_t num_digits)
+{
+	char *c_p = buffer_s + num_digits;
+
+	while (c_p > buffer_s)
+		{
+			-- c_p;
+			*c_p = (char) ('0' + (value % 10));
+			value /= 10;
+		}
+}
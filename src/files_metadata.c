@@ -25,7 +25,7 @@
 #include "pathogenomics_utils.h"
 
 
-const char *InsertFilesData (MongoTool *tool_p, json_t *values_p, const uint32 stage_time, PathogenomicsServiceData *data_p)
+const char *InsertFilesData (ImportSession *session_p, json_t *values_p, const size_t row)
 {
 	const char *error_s = NULL;
 	const char * const key_s = PG_ID_S;
@@ -47,7 +47,9 @@ const char *InsertFilesData (MongoTool *tool_p, json_t *values_p, const uint32 s
 
 							if (json_object_set (doc_p, PG_FILES_S, values_p) == 0)
 								{
-									error_s = EasyInsertOrUpdateMongoData (tool_p, doc_p, PG_ID_S);
+									const char *id_keys_ss [] = { PG_ID_S, NULL };
+
+									error_s = SaveImportedSection (session_p, doc_p, PG_ID_S, PG_FILES_S, id_keys_ss, row);
 								}
 							else
 								{
@@ -75,3 +77,9 @@ const char *InsertFilesData (MongoTool *tool_p, json_t *values_p, const uint32 s
 
 	return error_s;
 }
+
+
+const char *ValidateFilesRow (json_t *values_p, DateNormaliser * UNUSED_PARAM (normaliser_p))
+{
+	return GetJSONString (values_p, PG_ID_S) ? NULL : "Failed to get ID value";
+}
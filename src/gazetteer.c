@@ -0,0 +1,357 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * gazetteer.c
+ *
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gazetteer.h"
+#include "address_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+
+
+#ifdef _DEBUG
+	#define GAZETTEER_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define GAZETTEER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/* Values shorter than this are normalised without allocating any memory */
+#define S_LOCAL_BUFFER_SIZE (256)
+
+#define S_FNV_OFFSET_BASIS (14695981039346656037ULL)
+
+#define S_FNV_PRIME (1099511628211ULL)
+
+
+struct Gazetteer
+{
+	void *g_data_p;
+
+	size_t g_data_size;
+
+	const GazetteerEntry *g_entries_p;
+
+	uint32 g_num_entries;
+};
+
+
+static bool HashValue (const char *value_s, const bool strip_spaces_flag, uint64 *hash_p);
+
+static void HashByte (const char c, uint64 *hash_p);
+
+static const GazetteerEntry *FindGazetteerEntry (const Gazetteer *gazetteer_p, const uint64 hash);
+
+static bool FindGazetteerLevel (const Gazetteer *gazetteer_p, const GazetteerLevel level, const char *country_s, const char *county_s, const char *town_s, const char *postcode_s, double64 *latitude_p, double64 *longitude_p);
+
+
+Gazetteer *OpenGazetteer (const char *filename_s)
+{
+	int fd = open (filename_s, O_RDONLY);
+
+	if (fd != -1)
+		{
+			struct stat file_stat;
+
+			if (fstat (fd, &file_stat) == 0)
+				{
+					const size_t size = (size_t) file_stat.st_size;
+
+					if (size >= sizeof (GazetteerHeader))
+						{
+							void *data_p = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+							if (data_p != MAP_FAILED)
+								{
+									const GazetteerHeader *header_p = (const GazetteerHeader *) data_p;
+
+									if ((memcmp (header_p -> gh_magic, GAZETTEER_MAGIC_S, sizeof (header_p -> gh_magic)) == 0) && (header_p -> gh_version == GAZETTEER_VERSION))
+										{
+											if (size == sizeof (GazetteerHeader) + (header_p -> gh_num_entries * sizeof (GazetteerEntry)))
+												{
+													Gazetteer *gazetteer_p = (Gazetteer *) AllocMemory (sizeof (Gazetteer));
+
+													if (gazetteer_p)
+														{
+															gazetteer_p -> g_data_p = data_p;
+															gazetteer_p -> g_data_size = size;
+															gazetteer_p -> g_entries_p = (const GazetteerEntry *) (header_p + 1);
+															gazetteer_p -> g_num_entries = header_p -> gh_num_entries;
+
+															close (fd);
+
+															#if GAZETTEER_DEBUG >= STM_LEVEL_FINE
+															PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Opened gazetteer \"%s\" with " UINT32_FMT " entries", filename_s, gazetteer_p -> g_num_entries);
+															#endif
+
+															return gazetteer_p;
+														}
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Gazetteer \"%s\" is " SIZET_FMT " bytes which doesn't match its " UINT32_FMT " entries", filename_s, size, header_p -> gh_num_entries);
+												}
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "\"%s\" is not a version %d gazetteer", filename_s, GAZETTEER_VERSION);
+										}
+
+									munmap (data_p, size);
+								}		/* if (data_p != MAP_FAILED) */
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to map gazetteer \"%s\"", filename_s);
+								}
+
+						}		/* if (size >= sizeof (GazetteerHeader)) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Gazetteer \"%s\" is too small", filename_s);
+						}
+
+				}		/* if (fstat (fd, &file_stat) == 0) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get size of gazetteer \"%s\"", filename_s);
+				}
+
+			close (fd);
+		}		/* if (fd != -1) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open gazetteer \"%s\"", filename_s);
+		}
+
+	return NULL;
+}
+
+
+void CloseGazetteer (Gazetteer *gazetteer_p)
+{
+	munmap (gazetteer_p -> g_data_p, gazetteer_p -> g_data_size);
+	FreeMemory (gazetteer_p);
+}
+
+
+uint32 GetGazetteerSize (const Gazetteer *gazetteer_p)
+{
+	return gazetteer_p -> g_num_entries;
+}
+
+
+bool FindInGazetteer (const Gazetteer *gazetteer_p, const char *town_s, const char *county_s, const char *country_s, const char *postcode_s, double64 *latitude_p, double64 *longitude_p)
+{
+	if (!IsStringEmpty (postcode_s))
+		{
+			if (FindGazetteerLevel (gazetteer_p, GL_POSTCODE, country_s, NULL, NULL, postcode_s, latitude_p, longitude_p))
+				{
+					return true;
+				}
+
+			if (!IsStringEmpty (country_s))
+				{
+					if (FindGazetteerLevel (gazetteer_p, GL_POSTCODE, NULL, NULL, NULL, postcode_s, latitude_p, longitude_p))
+						{
+							return true;
+						}
+				}
+		}
+
+	/*
+	 * Don't fall back to the county or country centroid for an address
+	 * with a town that isn't in the index as that would be a much less
+	 * accurate location than the remote geocoder could find.
+	 */
+	if (!IsStringEmpty (town_s))
+		{
+			if (FindGazetteerLevel (gazetteer_p, GL_TOWN, country_s, county_s, town_s, NULL, latitude_p, longitude_p))
+				{
+					return true;
+				}
+
+			if (!IsStringEmpty (county_s))
+				{
+					return FindGazetteerLevel (gazetteer_p, GL_TOWN, country_s, NULL, town_s, NULL, latitude_p, longitude_p);
+				}
+		}
+	else if (!IsStringEmpty (county_s))
+		{
+			return FindGazetteerLevel (gazetteer_p, GL_COUNTY, country_s, county_s, NULL, NULL, latitude_p, longitude_p);
+		}
+	else if (!IsStringEmpty (country_s))
+		{
+			return FindGazetteerLevel (gazetteer_p, GL_COUNTRY, country_s, NULL, NULL, NULL, latitude_p, longitude_p);
+		}
+
+	return false;
+}
+
+
+bool HashGazetteerKey (const GazetteerLevel level, const char *country_s, const char *county_s, const char *town_s, const char *postcode_s, uint64 *hash_p)
+{
+	bool success_flag = false;
+	uint64 hash = S_FNV_OFFSET_BASIS;
+
+	HashByte ((char) level, &hash);
+
+	if (HashValue (country_s, false, &hash))
+		{
+			switch (level)
+				{
+					case GL_COUNTRY:
+						success_flag = true;
+						break;
+
+					case GL_COUNTY:
+						success_flag = HashValue (county_s, false, &hash);
+						break;
+
+					case GL_TOWN:
+						success_flag = HashValue (county_s, false, &hash) && HashValue (town_s, false, &hash);
+						break;
+
+					case GL_POSTCODE:
+						success_flag = HashValue (postcode_s, true, &hash);
+						break;
+
+					default:
+						PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Unknown gazetteer level %d", level);
+						break;
+				}
+		}
+
+	if (success_flag)
+		{
+			*hash_p = hash;
+		}
+
+	return success_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool FindGazetteerLevel (const Gazetteer *gazetteer_p, const GazetteerLevel level, const char *country_s, const char *county_s, const char *town_s, const char *postcode_s, double64 *latitude_p, double64 *longitude_p)
+{
+	uint64 hash;
+
+	if (HashGazetteerKey (level, country_s, county_s, town_s, postcode_s, &hash))
+		{
+			const GazetteerEntry *entry_p = FindGazetteerEntry (gazetteer_p, hash);
+
+			if (entry_p)
+				{
+					*latitude_p = (double64) entry_p -> ge_latitude;
+					*longitude_p = (double64) entry_p -> ge_longitude;
+
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+static const GazetteerEntry *FindGazetteerEntry (const Gazetteer *gazetteer_p, const uint64 hash)
+{
+	uint32 lower = 0;
+	uint32 upper = gazetteer_p -> g_num_entries;
+
+	while (lower < upper)
+		{
+			const uint32 mid = lower + ((upper - lower) >> 1);
+			const GazetteerEntry *entry_p = (gazetteer_p -> g_entries_p) + mid;
+
+			if (entry_p -> ge_hash < hash)
+				{
+					lower = mid + 1;
+				}
+			else if (entry_p -> ge_hash > hash)
+				{
+					upper = mid;
+				}
+			else
+				{
+					return entry_p;
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Add a separator and then the normalised value to a 64-bit FNV-1a hash.
+ * A NULL value is treated the same as an empty one.
+ */
+static bool HashValue (const char *value_s, const bool strip_spaces_flag, uint64 *hash_p)
+{
+	HashByte ('|', hash_p);
+
+	if (value_s)
+		{
+			char local_buffer_s [S_LOCAL_BUFFER_SIZE];
+			const size_t l = strlen (value_s);
+			char *buffer_s = (l < S_LOCAL_BUFFER_SIZE) ? local_buffer_s : (char *) AllocMemory (l + 1);
+
+			if (buffer_s)
+				{
+					const char *c_p = buffer_s;
+
+					NormaliseAddressValue (value_s, buffer_s);
+
+					while (*c_p)
+						{
+							if (! (strip_spaces_flag && (*c_p == ' ')))
+								{
+									HashByte (*c_p, hash_p);
+								}
+
+							++ c_p;
+						}
+
+					if (buffer_s != local_buffer_s)
+						{
+							FreeMemory (buffer_s);
+						}
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+static void HashByte (const char c, uint64 *hash_p)
+{
+	*hash_p ^= (unsigned char) c;
+	*hash_p *= S_FNV_PRIME;
+}
@@ -21,6 +21,7 @@
  */
 #include "genotype_metadata.h"
 #include "pathogenomics_utils.h"
+#include "column_schema.h"
 #include "json_tools.h"
 #include "string_utils.h"
 
@@ -33,11 +34,10 @@
 
 
 static const char * const GM_LIB_NAME_S = "Library name";
-static const char * const GM_GENETIC_GROUP_S = "Genetic group";
 static const char * const GM_SAMPLE_NAME_S = "Sample name";
 
 
-const char *InsertGenotypeData (MongoTool *tool_p, json_t *values_p,  const uint32 stage_time, PathogenomicsServiceData * UNUSED_PARAM (data_p))
+const char *InsertGenotypeData (ImportSession *session_p, json_t *values_p, const size_t row)
 {
 	const char *error_s = NULL;
 	const char * const key_s = PG_ID_S;
@@ -71,9 +71,19 @@ const char *InsertGenotypeData (MongoTool *tool_p, json_t *values_p,  const uint
 													hidden_flag = true;
 												}
 
-											if (AddPublishDateToJSON (doc_p, date_s, stage_time, hidden_flag))
+											if (AddPublishDateToJSON (doc_p, date_s, session_p -> is_stage_time, hidden_flag))
 												{
-													error_s = EasyInsertOrUpdateMongoData (tool_p, doc_p, PG_ID_S);
+													const char *id_keys_ss [] = { PG_ID_S, NULL };
+
+													error_s = SaveImportedSection (session_p, doc_p, PG_ID_S, PG_GENOTYPE_S, id_keys_ss, row);
+
+													if ((!error_s) && (session_p -> is_changed_ids_p))
+														{
+															if (json_object_set_new (session_p -> is_changed_ids_p, GetJSONString (doc_p, PG_ID_S), json_true ()) != 0)
+																{
+																	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add genotype %s to the rollups", GetJSONString (doc_p, PG_ID_S));
+																}
+														}
 												}
 											else
 												{
@@ -115,16 +125,28 @@ const char *InsertGenotypeData (MongoTool *tool_p, json_t *values_p,  const uint
 }
 
 
-bool CheckGenotypeData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p)
+const char *ValidateGenotypeRow (json_t *values_p, DateNormaliser * UNUSED_PARAM (normaliser_p))
+{
+	return GetJSONString (values_p, PG_ID_S) ? NULL : "Failed to get ID value";
+}
+
+
+bool SetGenotypeRequiredColumns (ColumnSchema *schema_p)
 {
 	const char *headers_ss [] = {
 		PG_ID_S,
 		GM_LIB_NAME_S,
-		GM_GENETIC_GROUP_S,
+		PG_GENETIC_GROUP_S,
 		GM_SAMPLE_NAME_S,
 		NULL
 	};
 
-	return CheckForFields (headers_p, headers_ss, job_p);
+	return SetRequiredColumns (schema_p, PD_GENOTYPE, headers_ss);
+}
+
+
+bool CheckGenotypeData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p)
+{
+	return CheckRequiredColumns (data_p -> psd_column_schema_p, PD_GENOTYPE, headers_p, job_p);
 }
 
@@ -0,0 +1,657 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * geocode_cache.c
+ *
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "geocode_cache.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_tools.h"
+#include "json_util.h"
+#include "byte_buffer.h"
+#include "address_utils.h"
+
+
+#ifdef _DEBUG
+	#define GEOCODE_CACHE_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define GEOCODE_CACHE_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static const char * const S_KEY_S = "key";
+
+static const char * const S_LOCATION_S = "location";
+
+static const char * const S_CREATED_S = "created";
+
+
+typedef struct GeocodeCacheEntry
+{
+	char *gce_key_s;
+
+	uint32 gce_hash;
+
+	/* The cached location or NULL if the geocoder couldn't find the address */
+	json_t *gce_location_p;
+
+	time_t gce_created;
+
+	/* The next entry in the same hash bucket */
+	struct GeocodeCacheEntry *gce_bucket_next_p;
+
+	/* The LRU list, the most recently used entry is at the head */
+	struct GeocodeCacheEntry *gce_prev_p;
+
+	struct GeocodeCacheEntry *gce_next_p;
+} GeocodeCacheEntry;
+
+
+struct GeocodeCache
+{
+	/* The connection to the collection of cached locations */
+	MongoTool *gc_tool_p;
+
+	/*
+	 * The in-memory entries and the database collection each have their
+	 * own lock so that memory hits aren't held up by database lookups.
+	 */
+	pthread_mutex_t gc_memory_mutex;
+
+	pthread_mutex_t gc_store_mutex;
+
+	GeocodeCacheEntry **gc_buckets_pp;
+
+	uint32 gc_num_buckets;
+
+	GeocodeCacheEntry *gc_head_p;
+
+	GeocodeCacheEntry *gc_tail_p;
+
+	uint32 gc_num_entries;
+
+	uint32 gc_capacity;
+
+	uint32 gc_negative_ttl;
+};
+
+
+static uint32 HashGeocodeCacheKey (const char *key_s);
+
+static bool AppendNormalisedValue (ByteBuffer *buffer_p, const char *value_s);
+
+static bool IsGeocodeCacheEntryValid (const GeocodeCache *cache_p, const json_t *location_p, const time_t created);
+
+static GeocodeCacheResult FindInMemory (GeocodeCache *cache_p, const char *key_s, json_t **location_pp, GeocodeCacheStats *stats_p);
+
+static GeocodeCacheResult FindInStore (GeocodeCache *cache_p, const char *key_s, json_t **location_pp, time_t *created_p);
+
+static bool AddToMemory (GeocodeCache *cache_p, const char *key_s, const json_t *location_p, const time_t created);
+
+static bool AddToStore (GeocodeCache *cache_p, const char *key_s, const json_t *location_p, const time_t created);
+
+static void UnlinkEntry (GeocodeCache *cache_p, GeocodeCacheEntry *entry_p);
+
+static void FreeGeocodeCacheEntry (GeocodeCacheEntry *entry_p);
+
+
+GeocodeCache *AllocateGeocodeCache (MongoClientManager *mongo_manager_p, const char *database_s, const char *collection_s, const uint32 capacity, const uint32 negative_ttl)
+{
+	MongoTool *tool_p = AllocateMongoTool (NULL, mongo_manager_p);
+
+	if (tool_p)
+		{
+			if (SetMongoToolDatabaseAndCollection (tool_p, database_s, collection_s))
+				{
+					GeocodeCache *cache_p = (GeocodeCache *) AllocMemory (sizeof (GeocodeCache));
+
+					if (cache_p)
+						{
+							/* Keep the buckets' chains short when the cache is full */
+							const uint32 num_buckets = (capacity > 0) ? capacity : 1;
+							GeocodeCacheEntry **buckets_pp = (GeocodeCacheEntry **) AllocMemoryArray (num_buckets, sizeof (GeocodeCacheEntry *));
+
+							if (buckets_pp)
+								{
+									memset (buckets_pp, 0, num_buckets * sizeof (GeocodeCacheEntry *));
+
+									cache_p -> gc_tool_p = tool_p;
+									cache_p -> gc_buckets_pp = buckets_pp;
+									cache_p -> gc_num_buckets = num_buckets;
+									cache_p -> gc_head_p = NULL;
+									cache_p -> gc_tail_p = NULL;
+									cache_p -> gc_num_entries = 0;
+									cache_p -> gc_capacity = capacity;
+									cache_p -> gc_negative_ttl = negative_ttl;
+
+									pthread_mutex_init (& (cache_p -> gc_memory_mutex), NULL);
+									pthread_mutex_init (& (cache_p -> gc_store_mutex), NULL);
+
+									return cache_p;
+								}
+
+							FreeMemory (cache_p);
+						}		/* if (cache_p) */
+
+				}		/* if (SetMongoToolDatabaseAndCollection (tool_p, database_s, collection_s)) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set geocode cache collection to \"%s\".\"%s\"", database_s, collection_s);
+				}
+
+			FreeMongoTool (tool_p);
+		}		/* if (tool_p) */
+
+	return NULL;
+}
+
+
+void FreeGeocodeCache (GeocodeCache *cache_p)
+{
+	GeocodeCacheEntry *entry_p = cache_p -> gc_head_p;
+
+	while (entry_p)
+		{
+			GeocodeCacheEntry *next_p = entry_p -> gce_next_p;
+
+			FreeGeocodeCacheEntry (entry_p);
+			entry_p = next_p;
+		}
+
+	pthread_mutex_destroy (& (cache_p -> gc_store_mutex));
+	pthread_mutex_destroy (& (cache_p -> gc_memory_mutex));
+
+	FreeMemory (cache_p -> gc_buckets_pp);
+	FreeMongoTool (cache_p -> gc_tool_p);
+	FreeMemory (cache_p);
+}
+
+
+char *MakeGeocodeCacheKey (const char *town_s, const char *county_s, const char *country_s, const char *postcode_s, const char *gps_s)
+{
+	char *key_s = NULL;
+	ByteBuffer *buffer_p = AllocateByteBuffer (256);
+
+	if (buffer_p)
+		{
+			if (AppendNormalisedValue (buffer_p, town_s) && AppendStringToByteBuffer (buffer_p, "|") &&
+					AppendNormalisedValue (buffer_p, county_s) && AppendStringToByteBuffer (buffer_p, "|") &&
+					AppendNormalisedValue (buffer_p, country_s) && AppendStringToByteBuffer (buffer_p, "|") &&
+					AppendNormalisedValue (buffer_p, postcode_s) && AppendStringToByteBuffer (buffer_p, "|") &&
+					AppendNormalisedValue (buffer_p, gps_s))
+				{
+					key_s = EasyCopyToNewString (GetByteBufferData (buffer_p));
+				}
+
+			FreeByteBuffer (buffer_p);
+		}
+
+	return key_s;
+}
+
+
+GeocodeCacheResult FindInGeocodeCache (GeocodeCache *cache_p, const char *key_s, json_t **location_pp, GeocodeCacheStats *stats_p)
+{
+	GeocodeCacheResult res = FindInMemory (cache_p, key_s, location_pp, stats_p);
+
+	if (res == GCR_MISS)
+		{
+			time_t created = 0;
+
+			res = FindInStore (cache_p, key_s, location_pp, &created);
+
+			if (res != GCR_MISS)
+				{
+					/* Keep it in memory for the next time */
+					AddToMemory (cache_p, key_s, (res == GCR_FOUND) ? *location_pp : NULL, created);
+				}
+
+			if (stats_p)
+				{
+					pthread_mutex_lock (& (cache_p -> gc_memory_mutex));
+
+					switch (res)
+						{
+							case GCR_FOUND:
+								++ (stats_p -> gcs_store_hits);
+								break;
+
+							case GCR_NO_LOCATION:
+								++ (stats_p -> gcs_negative_hits);
+								break;
+
+							default:
+								++ (stats_p -> gcs_misses);
+								break;
+						}
+
+					pthread_mutex_unlock (& (cache_p -> gc_memory_mutex));
+				}
+
+		}		/* if (res == GCR_MISS) */
+
+	return res;
+}
+
+
+bool AddToGeocodeCache (GeocodeCache *cache_p, const char *key_s, const json_t *location_p)
+{
+	const time_t now = time (NULL);
+	bool success_flag = AddToStore (cache_p, key_s, location_p, now);
+
+	AddToMemory (cache_p, key_s, location_p, now);
+
+	return success_flag;
+}
+
+
+bool AddGeocodeCacheStatsToJSON (const GeocodeCacheStats *stats_p, json_t *json_p)
+{
+	bool success_flag = false;
+	json_error_t err;
+	json_t *stats_json_p = json_pack_ex (&err, 0, "{s:i,s:i,s:i,s:i}",
+																			 "memory cache hits", stats_p -> gcs_memory_hits,
+																			 "stored cache hits", stats_p -> gcs_store_hits,
+																			 "cached failures", stats_p -> gcs_negative_hits,
+																			 "cache misses", stats_p -> gcs_misses);
+
+	if (stats_json_p)
+		{
+			if (json_object_set_new (json_p, "geocoding", stats_json_p) == 0)
+				{
+					success_flag = true;
+				}
+			else
+				{
+					json_decref (stats_json_p);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create geocoding stats: %s", err.text);
+		}
+
+	return success_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+/* 32-bit FNV-1a */
+static uint32 HashGeocodeCacheKey (const char *key_s)
+{
+	uint32 hash = 2166136261U;
+
+	while (*key_s)
+		{
+			hash ^= (unsigned char) *key_s;
+			hash *= 16777619U;
+			++ key_s;
+		}
+
+	return hash;
+}
+
+
+static bool AppendNormalisedValue (ByteBuffer *buffer_p, const char *value_s)
+{
+	bool success_flag = true;
+
+	if (value_s)
+		{
+			char *normalised_s = (char *) AllocMemory (strlen (value_s) + 1);
+
+			if (normalised_s)
+				{
+					const size_t l = NormaliseAddressValue (value_s, normalised_s);
+
+					success_flag = AppendToByteBuffer (buffer_p, normalised_s, l);
+
+					FreeMemory (normalised_s);
+				}
+			else
+				{
+					success_flag = false;
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Addresses that the geocoder couldn't find are only cached for a
+ * limited time in case the geocoder's data improves.
+ */
+static bool IsGeocodeCacheEntryValid (const GeocodeCache *cache_p, const json_t *location_p, const time_t created)
+{
+	return ((location_p != NULL) || (difftime (time (NULL), created) < (double) (cache_p -> gc_negative_ttl)));
+}
+
+
+static GeocodeCacheResult FindInMemory (GeocodeCache *cache_p, const char *key_s, json_t **location_pp, GeocodeCacheStats *stats_p)
+{
+	GeocodeCacheResult res = GCR_MISS;
+
+	if (cache_p -> gc_capacity > 0)
+		{
+			const uint32 hash = HashGeocodeCacheKey (key_s);
+			GeocodeCacheEntry **entry_pp;
+
+			pthread_mutex_lock (& (cache_p -> gc_memory_mutex));
+
+			entry_pp = (cache_p -> gc_buckets_pp) + (hash % (cache_p -> gc_num_buckets));
+
+			while (*entry_pp)
+				{
+					GeocodeCacheEntry *entry_p = *entry_pp;
+
+					if ((entry_p -> gce_hash == hash) && (strcmp (entry_p -> gce_key_s, key_s) == 0))
+						{
+							if (IsGeocodeCacheEntryValid (cache_p, entry_p -> gce_location_p, entry_p -> gce_created))
+								{
+									if (entry_p -> gce_location_p)
+										{
+											*location_pp = json_deep_copy (entry_p -> gce_location_p);
+
+											if (*location_pp)
+												{
+													res = GCR_FOUND;
+												}
+										}
+									else
+										{
+											res = GCR_NO_LOCATION;
+										}
+
+									if (res != GCR_MISS)
+										{
+											/* Move it to the front of the LRU list */
+											if (entry_p != cache_p -> gc_head_p)
+												{
+													UnlinkEntry (cache_p, entry_p);
+
+													entry_p -> gce_next_p = cache_p -> gc_head_p;
+													cache_p -> gc_head_p -> gce_prev_p = entry_p;
+													cache_p -> gc_head_p = entry_p;
+												}
+
+											if (stats_p)
+												{
+													if (res == GCR_FOUND)
+														{
+															++ (stats_p -> gcs_memory_hits);
+														}
+													else
+														{
+															++ (stats_p -> gcs_negative_hits);
+														}
+												}
+										}
+								}
+							else
+								{
+									/* The entry has expired */
+									*entry_pp = entry_p -> gce_bucket_next_p;
+									UnlinkEntry (cache_p, entry_p);
+									FreeGeocodeCacheEntry (entry_p);
+									-- (cache_p -> gc_num_entries);
+								}
+
+							break;
+						}
+
+					entry_pp = & (entry_p -> gce_bucket_next_p);
+				}		/* while (*entry_pp) */
+
+			pthread_mutex_unlock (& (cache_p -> gc_memory_mutex));
+		}		/* if (cache_p -> gc_capacity > 0) */
+
+	return res;
+}
+
+
+static GeocodeCacheResult FindInStore (GeocodeCache *cache_p, const char *key_s, json_t **location_pp, time_t *created_p)
+{
+	GeocodeCacheResult res = GCR_MISS;
+	json_t *query_p = json_pack ("{s:s}", S_KEY_S, key_s);
+
+	if (query_p)
+		{
+			pthread_mutex_lock (& (cache_p -> gc_store_mutex));
+
+			if (FindMatchingMongoDocumentsByJSON (cache_p -> gc_tool_p, query_p, NULL, NULL))
+				{
+					json_t *results_p = GetAllExistingMongoResultsAsJSON (cache_p -> gc_tool_p);
+
+					if (results_p)
+						{
+							if (json_is_array (results_p) && (json_array_size (results_p) > 0))
+								{
+									const json_t *doc_p = json_array_get (results_p, 0);
+									const json_t *location_p = json_object_get (doc_p, S_LOCATION_S);
+									long created = 0;
+
+									GetJSONLong (doc_p, S_CREATED_S, &created);
+
+									if (json_is_object (location_p))
+										{
+											if ((*location_pp = json_deep_copy (location_p)) != NULL)
+												{
+													res = GCR_FOUND;
+												}
+										}
+									else if (IsGeocodeCacheEntryValid (cache_p, NULL, (time_t) created))
+										{
+											res = GCR_NO_LOCATION;
+										}
+
+									*created_p = (time_t) created;
+								}
+
+							json_decref (results_p);
+						}		/* if (results_p) */
+
+				}		/* if (FindMatchingMongoDocumentsByJSON (cache_p -> gc_tool_p, query_p, NULL, NULL)) */
+
+			pthread_mutex_unlock (& (cache_p -> gc_store_mutex));
+
+			json_decref (query_p);
+		}		/* if (query_p) */
+
+	return res;
+}
+
+
+static bool AddToMemory (GeocodeCache *cache_p, const char *key_s, const json_t *location_p, const time_t created)
+{
+	bool success_flag = false;
+
+	if (cache_p -> gc_capacity > 0)
+		{
+			GeocodeCacheEntry *entry_p = (GeocodeCacheEntry *) AllocMemory (sizeof (GeocodeCacheEntry));
+
+			if (entry_p)
+				{
+					memset (entry_p, 0, sizeof (GeocodeCacheEntry));
+
+					entry_p -> gce_key_s = EasyCopyToNewString (key_s);
+
+					if (entry_p -> gce_key_s)
+						{
+							if ((!location_p) || ((entry_p -> gce_location_p = json_deep_copy (location_p)) != NULL))
+								{
+									GeocodeCacheEntry **entry_pp;
+
+									entry_p -> gce_hash = HashGeocodeCacheKey (key_s);
+									entry_p -> gce_created = created;
+
+									pthread_mutex_lock (& (cache_p -> gc_memory_mutex));
+
+									/* Replace any existing entry for the same key */
+									entry_pp = (cache_p -> gc_buckets_pp) + (entry_p -> gce_hash % (cache_p -> gc_num_buckets));
+
+									while (*entry_pp)
+										{
+											GeocodeCacheEntry *old_entry_p = *entry_pp;
+
+											if ((old_entry_p -> gce_hash == entry_p -> gce_hash) && (strcmp (old_entry_p -> gce_key_s, key_s) == 0))
+												{
+													*entry_pp = old_entry_p -> gce_bucket_next_p;
+													UnlinkEntry (cache_p, old_entry_p);
+													FreeGeocodeCacheEntry (old_entry_p);
+													-- (cache_p -> gc_num_entries);
+													break;
+												}
+
+											entry_pp = & (old_entry_p -> gce_bucket_next_p);
+										}
+
+									/* Evict the least recently used entry if we're full */
+									if (cache_p -> gc_num_entries >= cache_p -> gc_capacity)
+										{
+											GeocodeCacheEntry *lru_p = cache_p -> gc_tail_p;
+
+											entry_pp = (cache_p -> gc_buckets_pp) + (lru_p -> gce_hash % (cache_p -> gc_num_buckets));
+
+											while (*entry_pp != lru_p)
+												{
+													entry_pp = & ((*entry_pp) -> gce_bucket_next_p);
+												}
+
+											*entry_pp = lru_p -> gce_bucket_next_p;
+											UnlinkEntry (cache_p, lru_p);
+											FreeGeocodeCacheEntry (lru_p);
+											-- (cache_p -> gc_num_entries);
+										}
+
+									entry_pp = (cache_p -> gc_buckets_pp) + (entry_p -> gce_hash % (cache_p -> gc_num_buckets));
+									entry_p -> gce_bucket_next_p = *entry_pp;
+									*entry_pp = entry_p;
+
+									entry_p -> gce_next_p = cache_p -> gc_head_p;
+
+									if (cache_p -> gc_head_p)
+										{
+											cache_p -> gc_head_p -> gce_prev_p = entry_p;
+										}
+									else
+										{
+											cache_p -> gc_tail_p = entry_p;
+										}
+
+									cache_p -> gc_head_p = entry_p;
+									++ (cache_p -> gc_num_entries);
+
+									pthread_mutex_unlock (& (cache_p -> gc_memory_mutex));
+
+									return true;
+								}
+
+						}		/* if (entry_p -> gce_key_s) */
+
+					FreeGeocodeCacheEntry (entry_p);
+				}		/* if (entry_p) */
+
+		}		/* if (cache_p -> gc_capacity > 0) */
+
+	return success_flag;
+}
+
+
+static bool AddToStore (GeocodeCache *cache_p, const char *key_s, const json_t *location_p, const time_t created)
+{
+	bool success_flag = false;
+	json_error_t err;
+	json_t *doc_p = json_pack_ex (&err, 0, "{s:s,s:O,s:I}", S_KEY_S, key_s, S_LOCATION_S, location_p ? location_p : json_null (), S_CREATED_S, (json_int_t) created);
+
+	if (doc_p)
+		{
+			const char *error_s;
+
+			pthread_mutex_lock (& (cache_p -> gc_store_mutex));
+			error_s = EasyInsertOrUpdateMongoData (cache_p -> gc_tool_p, doc_p, S_KEY_S);
+			pthread_mutex_unlock (& (cache_p -> gc_store_mutex));
+
+			if (error_s)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to cache location for \"%s\": %s", key_s, error_s);
+				}
+			else
+				{
+					success_flag = true;
+				}
+
+			json_decref (doc_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create geocode cache entry for \"%s\": %s", key_s, err.text);
+		}
+
+	return success_flag;
+}
+
+
+/* Remove an entry from the LRU list, the caller must hold gc_memory_mutex */
+static void UnlinkEntry (GeocodeCache *cache_p, GeocodeCacheEntry *entry_p)
+{
+	if (entry_p -> gce_prev_p)
+		{
+			entry_p -> gce_prev_p -> gce_next_p = entry_p -> gce_next_p;
+		}
+	else
+		{
+			cache_p -> gc_head_p = entry_p -> gce_next_p;
+		}
+
+	if (entry_p -> gce_next_p)
+		{
+			entry_p -> gce_next_p -> gce_prev_p = entry_p -> gce_prev_p;
+		}
+	else
+		{
+			cache_p -> gc_tail_p = entry_p -> gce_prev_p;
+		}
+
+	entry_p -> gce_prev_p = NULL;
+	entry_p -> gce_next_p = NULL;
+}
+
+
+static void FreeGeocodeCacheEntry (GeocodeCacheEntry *entry_p)
+{
+	if (entry_p -> gce_key_s)
+		{
+			FreeCopiedString (entry_p -> gce_key_s);
+		}
+
+	if (entry_p -> gce_location_p)
+		{
+			json_decref (entry_p -> gce_location_p);
+		}
+
+	FreeMemory (entry_p);
+}
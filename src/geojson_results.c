@@ -0,0 +1,270 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * geojson_results.c
+ *
+ */
+
+#include <string.h>
+
+#include "geojson_results.h"
+#include "pathogenomics_service.h"
+#include "pathogenomics_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define GEOJSON_RESULTS_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define GEOJSON_RESULTS_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static const char *S_DEFAULT_PROPERTIES_SS [] =
+{
+	"ID",
+	"UKCPVS ID",
+	"sample.Disease",
+	"sample.Date collected (compact)",
+	NULL
+};
+
+
+static json_t *GetFeature (const json_t *doc_p, const char **properties_ss);
+
+static json_t *GetFeatureGeometry (const json_t *doc_p);
+
+static const json_t *GetValueByPath (const json_t *doc_p, const char *path_s);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+bool IsGeoJSONSearch (const json_t *search_p)
+{
+	const char *format_s = GetJSONString (search_p, PG_FORMAT_S);
+
+	return ((format_s != NULL) && (Stricmp (format_s, PG_GEOJSON_FORMAT_S) == 0));
+}
+
+
+const char **GetDefaultGeoJSONProperties (void)
+{
+	return S_DEFAULT_PROPERTIES_SS;
+}
+
+
+const char **GetGeoJSONFields (const char **properties_ss)
+{
+	const char **fields_ss;
+	size_t num_properties = 0;
+
+	while (properties_ss [num_properties])
+		{
+			++ num_properties;
+		}
+
+	/* The properties, then the sample for the location and the terminator */
+	fields_ss = (const char **) AllocMemoryArray (num_properties + 2, sizeof (const char *));
+
+	if (fields_ss)
+		{
+			const char **field_ss = fields_ss;
+			const size_t sample_length = strlen (PG_SAMPLE_S);
+
+			/*
+			 * The whole sample is fetched so any properties within it must be
+			 * left out as the database rejects overlapping projections.
+			 */
+			for ( ; *properties_ss; ++ properties_ss)
+				{
+					if (! ((strncmp (*properties_ss, PG_SAMPLE_S, sample_length) == 0) && (((*properties_ss) [sample_length] == '\0') || ((*properties_ss) [sample_length] == '.'))))
+						{
+							*field_ss = *properties_ss;
+							++ field_ss;
+						}
+				}
+
+			*field_ss = PG_SAMPLE_S;
+			* (++ field_ss) = NULL;
+		}
+
+	return fields_ss;
+}
+
+
+json_t *GetDocumentsAsGeoJSON (const json_t *docs_p, const char **properties_ss)
+{
+	json_t *features_p = json_array ();
+
+	if (features_p)
+		{
+			size_t i;
+			json_t *doc_p;
+
+			json_array_foreach (docs_p, i, doc_p)
+				{
+					json_t *feature_p = GetFeature (doc_p, properties_ss);
+
+					if (feature_p)
+						{
+							if (json_array_append_new (features_p, feature_p) != 0)
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add feature " SIZET_FMT " to collection", i);
+									json_decref (feature_p);
+									json_decref (features_p);
+
+									return NULL;
+								}
+						}
+				}		/* json_array_foreach (docs_p, i, doc_p) */
+
+			return json_pack ("{s:s,s:o}", "type", "FeatureCollection", "features", features_p);
+		}		/* if (features_p) */
+
+	return NULL;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static json_t *GetFeature (const json_t *doc_p, const char **properties_ss)
+{
+	json_t *geometry_p = GetFeatureGeometry (doc_p);
+
+	if (geometry_p)
+		{
+			json_t *properties_p = json_object ();
+
+			if (properties_p)
+				{
+					json_t *feature_p = NULL;
+					const json_t *id_p = json_object_get (doc_p, PG_ID_S);
+
+					for ( ; *properties_ss; ++ properties_ss)
+						{
+							const json_t *value_p = GetValueByPath (doc_p, *properties_ss);
+
+							if (value_p)
+								{
+									if (json_object_set (properties_p, *properties_ss, (json_t *) value_p) != 0)
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add \"%s\" to feature properties", *properties_ss);
+										}
+								}
+						}
+
+					feature_p = json_pack ("{s:s,s:o,s:o}", "type", "Feature", "geometry", geometry_p, "properties", properties_p);
+
+					if (feature_p)
+						{
+							if (json_is_string (id_p) || json_is_number (id_p))
+								{
+									json_object_set (feature_p, "id", (json_t *) id_p);
+								}
+						}
+
+					return feature_p;
+				}		/* if (properties_p) */
+
+			json_decref (geometry_p);
+		}		/* if (geometry_p) */
+	else
+		{
+			#if GEOJSON_RESULTS_DEBUG >= STM_LEVEL_FINE
+			const char *id_s = GetJSONString (doc_p, PG_ID_S);
+
+			PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "No location for \"%s\"", id_s ? id_s : "");
+			#endif
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Use the sample's GeoJSON point if it has one, otherwise build one from
+ * the location data for samples that were stored before the points were
+ * added.
+ */
+static json_t *GetFeatureGeometry (const json_t *doc_p)
+{
+	const json_t *sample_p = json_object_get (doc_p, PG_SAMPLE_S);
+
+	if (sample_p)
+		{
+			const json_t *geo_p = json_object_get (sample_p, PG_GEO_S);
+
+			if (json_is_object (geo_p))
+				{
+					return json_deep_copy (geo_p);
+				}
+			else
+				{
+					double64 latitude;
+					double64 longitude;
+
+					if (FindLocationCoordinates (sample_p, &latitude, &longitude))
+						{
+							return json_pack ("{s:s,s:[f,f]}", "type", "Point", "coordinates", longitude, latitude);
+						}
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Get a value by its dotted path, e.g. "sample.Disease".
+ */
+static const json_t *GetValueByPath (const json_t *doc_p, const char *path_s)
+{
+	const json_t *value_p = doc_p;
+	const char *dot_s;
+
+	while ((dot_s = strchr (path_s, '.')) != NULL)
+		{
+			char *key_s = CopyToNewString (path_s, dot_s - path_s, false);
+
+			if (key_s)
+				{
+					value_p = json_object_get (value_p, key_s);
+					FreeCopiedString (key_s);
+				}
+			else
+				{
+					return NULL;
+				}
+
+			if (!json_is_object (value_p))
+				{
+					return NULL;
+				}
+
+			path_s = dot_s + 1;
+		}
+
+	return json_object_get (value_p, path_s);
+}
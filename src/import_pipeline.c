@@ -0,0 +1,378 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * import_pipeline.c
+ *
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "import_pipeline.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+
+
+#ifdef _DEBUG
+	#define IMPORT_PIPELINE_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define IMPORT_PIPELINE_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/*
+ * The number of rows that can be in flight for each worker. This lets
+ * a worker move on to a new row while an earlier, slower row is still
+ * holding up the writer.
+ */
+static const size_t S_SLOTS_PER_WORKER = 4;
+
+
+/*
+ * A row that has been read and is waiting to be prepared and stored.
+ */
+typedef struct PipelineSlot
+{
+	/* The row, or NULL if it could not be read */
+	json_t *ps_row_p;
+
+	/* The index of the row in the RowSource */
+	size_t ps_row;
+
+	/* The row's fingerprint, taken as it was read, for checkpointing the upload */
+	uint64 ps_fingerprint;
+
+	/* The error from reading or preparing the row */
+	const char *ps_error_s;
+
+	/*
+	 * The RowSource may reuse its error buffer for the next row,
+	 * so any read error is copied here.
+	 */
+	char *ps_read_error_s;
+
+	/* Is the row the same as when it was last stored? */
+	bool ps_unchanged_flag;
+
+	/* Has a worker finished with this row? */
+	bool ps_ready_flag;
+} PipelineSlot;
+
+
+typedef struct ImportPipeline
+{
+	PipelineSlot *ip_slots_p;
+	size_t ip_num_slots;
+
+	/*
+	 * Rows are numbered in the order that they are read and each one
+	 * uses the slot at (number % ip_num_slots). The writer does not
+	 * read a new row until the one that last used its slot has been
+	 * stored, so ip_next_read - ip_next_store never exceeds ip_num_slots.
+	 */
+	size_t ip_next_read;
+	size_t ip_next_prepare;
+	size_t ip_next_store;
+
+	/* Have all of the rows been read? */
+	bool ip_finished_flag;
+
+	pthread_mutex_t ip_mutex;
+
+	/* Signalled when a new row is read or all of the rows have been read */
+	pthread_cond_t ip_work_cond;
+
+	/* Signalled when a worker has finished with a row */
+	pthread_cond_t ip_ready_cond;
+
+	PrepareRowFn ip_prepare_fn;
+	ImportSession *ip_session_p;
+} ImportPipeline;
+
+
+static void *RunPipelineWorker (void *arg_p);
+
+static bool ReadPipelineRow (ImportPipeline *pipeline_p, RowSource *source_p);
+
+static bool StorePipelineRow (ImportPipeline *pipeline_p, ImportSession *session_p, StoreRowFn store_fn);
+
+static void ClearPipelineSlot (PipelineSlot *slot_p);
+
+static void FinishPipelineReads (ImportPipeline *pipeline_p);
+
+
+bool RunImportPipeline (ImportSession *session_p, RowSource *source_p, PrepareRowFn prepare_fn, StoreRowFn store_fn, const uint32 num_workers, uint32 *num_imports_p)
+{
+	bool run_flag = false;
+	ImportPipeline pipeline;
+	pthread_t *workers_p = NULL;
+
+	pipeline.ip_num_slots = num_workers * S_SLOTS_PER_WORKER;
+	pipeline.ip_slots_p = (PipelineSlot *) AllocMemory (pipeline.ip_num_slots * sizeof (PipelineSlot));
+
+	if (pipeline.ip_slots_p)
+		{
+			workers_p = (pthread_t *) AllocMemory (num_workers * sizeof (pthread_t));
+
+			if (workers_p)
+				{
+					uint32 num_started = 0;
+					uint32 i;
+
+					memset (pipeline.ip_slots_p, 0, pipeline.ip_num_slots * sizeof (PipelineSlot));
+
+					pipeline.ip_next_read = 0;
+					pipeline.ip_next_prepare = 0;
+					pipeline.ip_next_store = 0;
+					pipeline.ip_finished_flag = false;
+					pipeline.ip_prepare_fn = prepare_fn;
+					pipeline.ip_session_p = session_p;
+
+					pthread_mutex_init (& (pipeline.ip_mutex), NULL);
+					pthread_cond_init (& (pipeline.ip_work_cond), NULL);
+					pthread_cond_init (& (pipeline.ip_ready_cond), NULL);
+
+					for (i = 0; i < num_workers; ++ i)
+						{
+							if (pthread_create (workers_p + num_started, NULL, RunPipelineWorker, &pipeline) == 0)
+								{
+									++ num_started;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start import worker " UINT32_FMT " of " UINT32_FMT, i + 1, num_workers);
+								}
+						}
+
+					if (num_started > 0)
+						{
+							uint32 num_imports = 0;
+							bool more_rows_flag = true;
+
+							#if IMPORT_PIPELINE_DEBUG >= STM_LEVEL_FINE
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Started " UINT32_FMT " import workers with " SIZET_FMT " slots", num_started, pipeline.ip_num_slots);
+							#endif
+
+							run_flag = true;
+
+							while (more_rows_flag || (pipeline.ip_next_store < pipeline.ip_next_read))
+								{
+									/* Keep the workers busy by filling any free slots */
+									while (more_rows_flag && (pipeline.ip_next_read - pipeline.ip_next_store < pipeline.ip_num_slots))
+										{
+											more_rows_flag = ReadPipelineRow (&pipeline, source_p);
+										}
+
+									/* Then store the oldest row once it is ready */
+									if (pipeline.ip_next_store < pipeline.ip_next_read)
+										{
+											if (StorePipelineRow (&pipeline, session_p, store_fn))
+												{
+													++ num_imports;
+												}
+
+											CheckpointImportSession (session_p, pipeline.ip_next_store, num_imports);
+										}
+
+								}		/* while (more_rows_flag || (pipeline.ip_next_store < pipeline.ip_next_read)) */
+
+							*num_imports_p = num_imports;
+						}		/* if (num_started > 0) */
+
+					/* Let the workers know that there are no more rows and wait for them */
+					FinishPipelineReads (&pipeline);
+
+					for (i = 0; i < num_started; ++ i)
+						{
+							pthread_join (* (workers_p + i), NULL);
+						}
+
+					pthread_cond_destroy (& (pipeline.ip_ready_cond));
+					pthread_cond_destroy (& (pipeline.ip_work_cond));
+					pthread_mutex_destroy (& (pipeline.ip_mutex));
+
+					FreeMemory (workers_p);
+				}		/* if (workers_p) */
+
+			FreeMemory (pipeline.ip_slots_p);
+		}		/* if (pipeline.ip_slots_p) */
+
+	return run_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static void *RunPipelineWorker (void *arg_p)
+{
+	ImportPipeline *pipeline_p = (ImportPipeline *) arg_p;
+
+	pthread_mutex_lock (& (pipeline_p -> ip_mutex));
+
+	while (true)
+		{
+			PipelineSlot *slot_p;
+
+			while ((pipeline_p -> ip_next_prepare == pipeline_p -> ip_next_read) && (!pipeline_p -> ip_finished_flag))
+				{
+					pthread_cond_wait (& (pipeline_p -> ip_work_cond), & (pipeline_p -> ip_mutex));
+				}
+
+			if (pipeline_p -> ip_next_prepare == pipeline_p -> ip_next_read)
+				{
+					/* All of the rows have been read and taken by the workers */
+					break;
+				}
+
+			slot_p = pipeline_p -> ip_slots_p + (pipeline_p -> ip_next_prepare % pipeline_p -> ip_num_slots);
+			++ (pipeline_p -> ip_next_prepare);
+
+			pthread_mutex_unlock (& (pipeline_p -> ip_mutex));
+
+			if ((slot_p -> ps_row_p) && (!slot_p -> ps_unchanged_flag))
+				{
+					slot_p -> ps_error_s = pipeline_p -> ip_prepare_fn (pipeline_p -> ip_session_p, slot_p -> ps_row_p, slot_p -> ps_row);
+				}
+
+			pthread_mutex_lock (& (pipeline_p -> ip_mutex));
+
+			slot_p -> ps_ready_flag = true;
+			pthread_cond_broadcast (& (pipeline_p -> ip_ready_cond));
+		}		/* while (true) */
+
+	pthread_mutex_unlock (& (pipeline_p -> ip_mutex));
+
+	return NULL;
+}
+
+
+/*
+ * Read the next row into its slot and hand it to the workers.
+ * Returns false when there are no more rows.
+ */
+static bool ReadPipelineRow (ImportPipeline *pipeline_p, RowSource *source_p)
+{
+	json_t *row_p = NULL;
+	const char *error_s = NULL;
+	bool row_flag = GetNextRow (source_p, &row_p, &error_s);
+
+	if (row_flag)
+		{
+			/* The slot is free as the writer has already stored its previous row */
+			PipelineSlot *slot_p = pipeline_p -> ip_slots_p + (pipeline_p -> ip_next_read % pipeline_p -> ip_num_slots);
+
+			slot_p -> ps_row_p = row_p;
+			slot_p -> ps_row = GetCurrentRowIndex (source_p);
+			slot_p -> ps_fingerprint = GetImportRowFingerprint (pipeline_p -> ip_session_p, row_p, slot_p -> ps_row);
+			slot_p -> ps_ready_flag = false;
+			slot_p -> ps_unchanged_flag = false;
+
+			if (row_p)
+				{
+					slot_p -> ps_error_s = NULL;
+
+					/* This is checked here, in row order, rather than by the workers */
+					slot_p -> ps_unchanged_flag = IsUnchangedImportRow (pipeline_p -> ip_session_p, row_p, slot_p -> ps_row);
+				}
+			else
+				{
+					slot_p -> ps_read_error_s = EasyCopyToNewString (error_s);
+					slot_p -> ps_error_s = slot_p -> ps_read_error_s ? slot_p -> ps_read_error_s : "Failed to read row";
+				}
+
+			pthread_mutex_lock (& (pipeline_p -> ip_mutex));
+			++ (pipeline_p -> ip_next_read);
+			pthread_cond_signal (& (pipeline_p -> ip_work_cond));
+			pthread_mutex_unlock (& (pipeline_p -> ip_mutex));
+		}
+	else
+		{
+			FinishPipelineReads (pipeline_p);
+		}
+
+	return row_flag;
+}
+
+
+/*
+ * Wait for the oldest outstanding row to be prepared and then store it.
+ * Returns true if the row was stored successfully.
+ */
+static bool StorePipelineRow (ImportPipeline *pipeline_p, ImportSession *session_p, StoreRowFn store_fn)
+{
+	PipelineSlot *slot_p = pipeline_p -> ip_slots_p + (pipeline_p -> ip_next_store % pipeline_p -> ip_num_slots);
+	const char *error_s;
+
+	pthread_mutex_lock (& (pipeline_p -> ip_mutex));
+
+	while (!slot_p -> ps_ready_flag)
+		{
+			pthread_cond_wait (& (pipeline_p -> ip_ready_cond), & (pipeline_p -> ip_mutex));
+		}
+
+	pthread_mutex_unlock (& (pipeline_p -> ip_mutex));
+
+	error_s = slot_p -> ps_error_s;
+
+	if ((!error_s) && (!slot_p -> ps_unchanged_flag))
+		{
+			error_s = store_fn (session_p, slot_p -> ps_row_p, slot_p -> ps_row);
+		}
+
+	if (error_s)
+		{
+			AddImportSessionRowError (session_p, slot_p -> ps_row_p, error_s, slot_p -> ps_row);
+		}
+
+	AddImportRowFingerprint (session_p, slot_p -> ps_fingerprint);
+
+	ClearPipelineSlot (slot_p);
+
+	/* Only this thread uses ip_next_store so it doesn't need the lock */
+	++ (pipeline_p -> ip_next_store);
+
+	return (error_s == NULL);
+}
+
+
+static void ClearPipelineSlot (PipelineSlot *slot_p)
+{
+	if (slot_p -> ps_row_p)
+		{
+			json_decref (slot_p -> ps_row_p);
+			slot_p -> ps_row_p = NULL;
+		}
+
+	if (slot_p -> ps_read_error_s)
+		{
+			FreeCopiedString (slot_p -> ps_read_error_s);
+			slot_p -> ps_read_error_s = NULL;
+		}
+
+	slot_p -> ps_error_s = NULL;
+}
+
+
+static void FinishPipelineReads (ImportPipeline *pipeline_p)
+{
+	pthread_mutex_lock (& (pipeline_p -> ip_mutex));
+	pipeline_p -> ip_finished_flag = true;
+	pthread_cond_broadcast (& (pipeline_p -> ip_work_cond));
+	pthread_mutex_unlock (& (pipeline_p -> ip_mutex));
+}
@@ -0,0 +1,1465 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * import_session.c
+ *
+ */
+
+#include <string.h>
+
+#include "import_session.h"
+#include "memory_allocations.h"
+#include "json_tools.h"
+#include "json_util.h"
+#include "string_utils.h"
+#include "sample_metadata.h"
+#include "phenotype_metadata.h"
+#include "genotype_metadata.h"
+#include "files_metadata.h"
+#include "import_pipeline.h"
+#include "row_hashes.h"
+#include "pathogenomics_service.h"
+
+
+typedef const char *(*InsertRowFn) (ImportSession *session_p, json_t *values_p, const size_t row);
+
+typedef const char *(*ValidateRowFn) (json_t *values_p, DateNormaliser *normaliser_p);
+
+
+/*
+ * How to import each type of row. If a type can be split into separate
+ * prepare and store stages, then its rows can be prepared concurrently.
+ */
+typedef struct ImportFunctions
+{
+	InsertRowFn if_insert_fn;
+	PrepareRowFn if_prepare_fn;
+	StoreRowFn if_store_fn;
+	PrefetchRowsFn if_prefetch_fn;
+	ValidateRowFn if_validate_fn;
+} ImportFunctions;
+
+
+typedef struct PrefetchContext
+{
+	ImportSession *pc_session_p;
+	PrefetchRowsFn pc_prefetch_fn;
+} PrefetchContext;
+
+
+static bool GetImportFunctions (const PathogenomicsData collection_type, ImportFunctions *fns_p);
+
+static uint32 ImportRowsSequentially (ImportSession *session_p, RowSource *source_p, InsertRowFn insert_fn);
+
+static void AddGeocodeStatsToJob (ImportSession *session_p);
+
+static void AddRowError (ServiceJob *job_p, const json_t *row_p, const char *error_s, const size_t row);
+
+static void PrefetchBatch (const json_t *rows_p, void *data_p);
+
+static void PrefetchRowHashes (ImportSession *session_p, const json_t *rows_p);
+
+static bool GetRowLookup (const ImportSession *session_p, const json_t *row_p, const char **key_ss, const char **value_ss);
+
+static bool AddLookupValue (json_t *values_p, const char *key_s, const char *value_s);
+
+static const char *GetImportSectionName (const PathogenomicsData collection_type);
+
+static void AddRowHashToDocument (ImportSession *session_p, json_t *doc_p, const size_t row);
+
+static void AddRowCountsToJob (ImportSession *session_p);
+
+static void AddDateCountsToJob (ImportSession *session_p);
+
+static bool ResumeUpload (ImportSession *session_p, RowSource *source_p);
+
+static size_t SkipCommittedRows (ImportSession *session_p, RowSource *source_p, const size_t num_rows);
+
+static void FinishUpload (ImportSession *session_p, const bool completed_flag);
+
+static json_t *GetSectionUpdate (const json_t *doc_p, const char * const section_s, const char **id_keys_ss);
+
+static bool CanUseDottedPaths (const json_t *section_p);
+
+static const char *UpsertImportedDocument (ImportSession *session_p, const json_t *selector_p, const json_t *update_p, const size_t row, const char *id_s);
+
+
+ImportSession *AllocateImportSession (MongoTool *tool_p, ServiceJob *job_p, PathogenomicsServiceData *data_p, const PathogenomicsData collection_type, const uint32 stage_time, const char *upload_id_s, const DateOrder date_order)
+{
+	ImportSession *session_p = (ImportSession *) AllocMemory (sizeof (ImportSession));
+
+	if (session_p)
+		{
+			session_p -> is_tool_p = tool_p;
+			session_p -> is_job_p = job_p;
+			session_p -> is_data_p = data_p;
+			session_p -> is_collection_type = collection_type;
+			session_p -> is_stage_time = stage_time;
+			session_p -> is_writer_p = NULL;
+			session_p -> is_prefetched_p = NULL;
+			session_p -> is_changed_tiles_p = NULL;
+			session_p -> is_changed_ids_p = NULL;
+			session_p -> is_stored_hashes_p = NULL;
+			session_p -> is_pending_hashes_p = NULL;
+			session_p -> is_num_inserted = 0;
+			session_p -> is_num_updated = 0;
+			session_p -> is_num_unchanged = 0;
+			session_p -> is_upload_id_s = NULL;
+			session_p -> is_fingerprint = 0;
+			session_p -> is_date_normaliser_p = NULL;
+
+			memset (& (session_p -> is_resumed_checkpoint), 0, sizeof (UploadCheckpoint));
+			memset (& (session_p -> is_checkpoint), 0, sizeof (UploadCheckpoint));
+			memset (& (session_p -> is_geocode_stats), 0, sizeof (GeocodeCacheStats));
+
+			if (data_p -> psd_bulk_batch_size > 0)
+				{
+					session_p -> is_writer_p = AllocateBulkWriter (tool_p, job_p, data_p -> psd_bulk_batch_size, data_p -> psd_ordered_bulk_writes_flag);
+
+					if (!session_p -> is_writer_p)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate BulkWriter for " UINT32_FMT " operations", data_p -> psd_bulk_batch_size);
+
+							FreeMemory (session_p);
+							session_p = NULL;
+						}
+				}
+
+			/* Each upload can have its own order for the days and months in its dates */
+			if ((session_p) && (collection_type == PD_SAMPLE))
+				{
+					session_p -> is_date_normaliser_p = AllocateDateNormaliser (date_order);
+
+					if (!session_p -> is_date_normaliser_p)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate DateNormaliser");
+
+							FreeImportSession (session_p);
+							session_p = NULL;
+						}
+				}
+
+			if ((session_p) && (collection_type == PD_SAMPLE) && (data_p -> psd_map_tiles_p))
+				{
+					session_p -> is_changed_tiles_p = json_object ();
+
+					if (!session_p -> is_changed_tiles_p)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate changed map tiles, they will not be rebuilt until tomorrow");
+						}
+				}
+
+			/* Only the samples and their genetic groups are counted */
+			if ((session_p) && ((collection_type == PD_SAMPLE) || (collection_type == PD_GENOTYPE)) && (data_p -> psd_rollups_p))
+				{
+					session_p -> is_changed_ids_p = json_object ();
+
+					if (!session_p -> is_changed_ids_p)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate changed ids, the rollups will not be updated");
+						}
+				}
+
+			if ((session_p) && (upload_id_s))
+				{
+					if (data_p -> psd_upload_checkpoints_p)
+						{
+							session_p -> is_upload_id_s = upload_id_s;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No upload checkpoints collection, upload \"%s\" will not be resumable", upload_id_s);
+						}
+				}
+
+			/* The stored hashes are fetched along with each batch of rows */
+			if ((session_p) && (data_p -> psd_skip_unchanged_rows_flag) && (data_p -> psd_merge_prefetch_size > 0))
+				{
+					session_p -> is_stored_hashes_p = json_object ();
+					session_p -> is_pending_hashes_p = json_object ();
+
+					if (! ((session_p -> is_stored_hashes_p) && (session_p -> is_pending_hashes_p)))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate row hashes, unchanged rows will be stored again");
+
+							if (session_p -> is_stored_hashes_p)
+								{
+									json_decref (session_p -> is_stored_hashes_p);
+									session_p -> is_stored_hashes_p = NULL;
+								}
+
+							if (session_p -> is_pending_hashes_p)
+								{
+									json_decref (session_p -> is_pending_hashes_p);
+									session_p -> is_pending_hashes_p = NULL;
+								}
+						}
+				}
+
+		}		/* if (session_p) */
+
+	return session_p;
+}
+
+
+void FreeImportSession (ImportSession *session_p)
+{
+	if (session_p -> is_writer_p)
+		{
+			FreeBulkWriter (session_p -> is_writer_p);
+		}
+
+	if (session_p -> is_prefetched_p)
+		{
+			json_decref (session_p -> is_prefetched_p);
+		}
+
+	if (session_p -> is_changed_tiles_p)
+		{
+			json_decref (session_p -> is_changed_tiles_p);
+		}
+
+	if (session_p -> is_changed_ids_p)
+		{
+			json_decref (session_p -> is_changed_ids_p);
+		}
+
+	if (session_p -> is_stored_hashes_p)
+		{
+			json_decref (session_p -> is_stored_hashes_p);
+		}
+
+	if (session_p -> is_pending_hashes_p)
+		{
+			json_decref (session_p -> is_pending_hashes_p);
+		}
+
+	if (session_p -> is_date_normaliser_p)
+		{
+			FreeDateNormaliser (session_p -> is_date_normaliser_p);
+		}
+
+	FreeMemory (session_p);
+}
+
+
+uint32 ImportRows (ImportSession *session_p, RowSource *source_p)
+{
+	uint32 num_imports = 0;
+	ImportFunctions fns;
+
+	if (GetImportFunctions (session_p -> is_collection_type, &fns))
+		{
+			const uint32 num_workers = session_p -> is_data_p -> psd_num_import_workers;
+			const uint32 prefetch_size = session_p -> is_data_p -> psd_merge_prefetch_size;
+			RowSource *read_ahead_source_p = NULL;
+			PrefetchContext context;
+			uint32 num_failed_rows;
+			bool imported_flag = false;
+
+			/*
+			 * Carry on from where an earlier attempt at this upload got to. The
+			 * rows are skipped on the underlying RowSource, before it is wrapped
+			 * below, so that they aren't prefetched or have their dates normalised.
+			 */
+			if (!ResumeUpload (session_p, source_p))
+				{
+					return 0;
+				}
+
+			/*
+			 * Read the rows in batches so that the existing documents
+			 * needed to store them can be fetched together.
+			 */
+			if (((fns.if_prefetch_fn) || (session_p -> is_stored_hashes_p)) && (prefetch_size > 0))
+				{
+					context.pc_session_p = session_p;
+					context.pc_prefetch_fn = fns.if_prefetch_fn;
+
+					read_ahead_source_p = AllocateReadAheadRowSource (source_p, prefetch_size, PrefetchBatch, &context);
+
+					if (read_ahead_source_p)
+						{
+							source_p = read_ahead_source_p;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate read-ahead RowSource, existing documents will be fetched for each row");
+						}
+				}
+
+			if ((num_workers > 1) && (fns.if_prepare_fn) && (fns.if_store_fn))
+				{
+					imported_flag = RunImportPipeline (session_p, source_p, fns.if_prepare_fn, fns.if_store_fn, num_workers, &num_imports);
+
+					if (!imported_flag)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start import pipeline, importing rows sequentially");
+						}
+				}
+
+			if (!imported_flag)
+				{
+					num_imports = ImportRowsSequentially (session_p, source_p, fns.if_insert_fn);
+				}
+
+			if (read_ahead_source_p)
+				{
+					FreeRowSource (read_ahead_source_p);
+				}
+
+			/*
+			 * Send any remaining batched writes and discount any rows
+			 * that the database rejected.
+			 */
+			if (FinishImportSession (session_p))
+				{
+					imported_flag = true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Some batched writes failed");
+					imported_flag = false;
+				}
+
+			num_failed_rows = GetImportSessionNumberOfFailedRows (session_p);
+			num_imports = (num_failed_rows < num_imports) ? num_imports - num_failed_rows : 0;
+
+			if (session_p -> is_upload_id_s)
+				{
+					/* The rows imported before the upload was resumed count too */
+					num_imports += session_p -> is_resumed_checkpoint.uc_num_imports;
+
+					FinishUpload (session_p, imported_flag);
+				}
+
+			if ((session_p -> is_collection_type == PD_SAMPLE) && (session_p -> is_data_p -> psd_geocode_cache_p))
+				{
+					AddGeocodeStatsToJob (session_p);
+				}
+
+			if (session_p -> is_stored_hashes_p)
+				{
+					AddRowCountsToJob (session_p);
+				}
+
+			if (session_p -> is_date_normaliser_p)
+				{
+					AddDateCountsToJob (session_p);
+				}
+
+			/* Now that the samples are stored, the tiles that they are on can be rebuilt */
+			if ((session_p -> is_changed_tiles_p) && (json_object_size (session_p -> is_changed_tiles_p) > 0))
+				{
+					if (!InvalidateMapTiles (session_p -> is_data_p -> psd_map_tiles_p, session_p -> is_changed_tiles_p))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to invalidate the map tiles for the imported samples");
+						}
+
+					json_object_clear (session_p -> is_changed_tiles_p);
+				}
+
+			if ((session_p -> is_changed_ids_p) && (json_object_size (session_p -> is_changed_ids_p) > 0))
+				{
+					if (!UpdateRollups (session_p -> is_data_p -> psd_rollups_p, session_p -> is_tool_p, session_p -> is_changed_ids_p))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to update the rollups for the imported data");
+						}
+
+					json_object_clear (session_p -> is_changed_ids_p);
+				}
+		}		/* if (GetImportFunctions (session_p -> is_collection_type, &fns)) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "No import function for collection type %d", session_p -> is_collection_type);
+		}
+
+	return num_imports;
+}
+
+
+const char *SaveImportedDocument (ImportSession *session_p, json_t *doc_p, const char * const primary_key_s, const size_t row)
+{
+	const char *error_s = NULL;
+
+	AddRowHashToDocument (session_p, doc_p, row);
+
+	if (session_p -> is_writer_p)
+		{
+			json_t *id_p = json_object_get (doc_p, primary_key_s);
+
+			if (id_p)
+				{
+					json_error_t err;
+					json_t *selector_p = json_pack_ex (&err, 0, "{s:O}", primary_key_s, id_p);
+
+					if (selector_p)
+						{
+							json_t *update_p = json_pack_ex (&err, 0, "{s:O}", "$set", doc_p);
+
+							if (update_p)
+								{
+									error_s = AddUpsertToBulkWriter (session_p -> is_writer_p, selector_p, update_p, row, json_string_value (id_p));
+
+									json_decref (update_p);
+								}
+							else
+								{
+									error_s = "Failed to create update document";
+								}
+
+							json_decref (selector_p);
+						}
+					else
+						{
+							error_s = "Failed to create update selector";
+						}
+
+				}		/* if (id_p) */
+			else
+				{
+					error_s = "Failed to get primary key value";
+				}
+		}
+	else
+		{
+			error_s = EasyInsertOrUpdateMongoData (session_p -> is_tool_p, doc_p, primary_key_s);
+		}
+
+	return error_s;
+}
+
+
+const char *SaveImportedSection (ImportSession *session_p, json_t *doc_p, const char * const primary_key_s, const char * const section_s, const char **id_keys_ss, const size_t row)
+{
+	const char *error_s = NULL;
+	json_t *id_p = json_object_get (doc_p, primary_key_s);
+
+	AddRowHashToDocument (session_p, doc_p, row);
+
+	if (! ((session_p -> is_data_p -> psd_partial_upserts_flag) && (CanUseDottedPaths (json_object_get (doc_p, section_s)))))
+		{
+			return SaveImportedDocument (session_p, doc_p, primary_key_s, row);
+		}
+
+	if (id_p)
+		{
+			json_error_t err;
+			json_t *selector_p = json_pack_ex (&err, 0, "{s:O}", primary_key_s, id_p);
+
+			if (selector_p)
+				{
+					json_t *update_p = GetSectionUpdate (doc_p, section_s, id_keys_ss);
+
+					if (update_p)
+						{
+							error_s = UpsertImportedDocument (session_p, selector_p, update_p, row, json_string_value (id_p));
+
+							json_decref (update_p);
+						}
+					else
+						{
+							error_s = "Failed to create update document";
+						}
+
+					json_decref (selector_p);
+				}
+			else
+				{
+					error_s = "Failed to create update selector";
+				}
+
+		}		/* if (id_p) */
+	else
+		{
+			error_s = "Failed to get primary key value";
+		}
+
+	return error_s;
+}
+
+
+bool IsUnchangedImportRow (ImportSession *session_p, const json_t *row_p, const size_t row)
+{
+	bool unchanged_flag = false;
+	const char *key_s = NULL;
+	const char *value_s = NULL;
+
+	if ((session_p -> is_stored_hashes_p) && (GetRowLookup (session_p, row_p, &key_s, &value_s)))
+		{
+			char *hash_s = GetRowContentHash (row_p, session_p -> is_stage_time);
+
+			if (hash_s)
+				{
+					json_t *hashes_p = json_object_get (session_p -> is_stored_hashes_p, key_s);
+					const json_t *stored_p = json_object_get (hashes_p, value_s);
+
+					if (json_is_string (stored_p) && (strcmp (json_string_value (stored_p), hash_s) == 0))
+						{
+							unchanged_flag = true;
+
+							/*
+							 * A sample is merged with any separate document for its UKCPVS ID
+							 * so it can only be skipped if its own document is the only one.
+							 */
+							if (session_p -> is_collection_type == PD_SAMPLE)
+								{
+									const char *ukcpvs_id_s = GetJSONString (row_p, PG_UKCPVS_ID_S);
+
+									if (ukcpvs_id_s)
+										{
+											const json_t *ukcpvs_p = json_object_get (json_object_get (session_p -> is_stored_hashes_p, PG_UKCPVS_ID_S), ukcpvs_id_s);
+
+											unchanged_flag = json_is_string (ukcpvs_p);
+										}
+								}
+						}
+
+					if (unchanged_flag)
+						{
+							++ (session_p -> is_num_unchanged);
+						}
+					else
+						{
+							char row_s [32];
+							json_t *pending_p = json_pack ("{s:s,s:b}", "hash", hash_s, "exists", (stored_p != NULL));
+
+							sprintf (row_s, SIZET_FMT, row);
+
+							if ((!pending_p) || (json_object_set_new (session_p -> is_pending_hashes_p, row_s, pending_p) != 0))
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to keep the hash for row " SIZET_FMT, row);
+
+									if (pending_p)
+										{
+											json_decref (pending_p);
+										}
+								}
+
+							/*
+							 * Any later row for the same document in this upload has to be
+							 * stored too, as it isn't compared against this one.
+							 */
+							if (hashes_p)
+								{
+									json_object_set_new (hashes_p, value_s, json_string (""));
+								}
+						}
+
+					FreeCopiedString (hash_s);
+				}		/* if (hash_s) */
+
+		}
+
+	return unchanged_flag;
+}
+
+
+const char *RemoveImportedDocument (ImportSession *session_p, const json_t *selector_p, const size_t row)
+{
+	const char *error_s = NULL;
+
+	if (session_p -> is_writer_p)
+		{
+			error_s = AddRemoveToBulkWriter (session_p -> is_writer_p, selector_p, row, NULL);
+		}
+	else
+		{
+			if (!RemoveMongoDocuments (session_p -> is_tool_p, selector_p, true))
+				{
+					error_s = "Failed to remove existing document";
+				}
+		}
+
+	return error_s;
+}
+
+
+void CheckpointImportSession (ImportSession *session_p, const size_t num_rows, const uint32 num_imports)
+{
+	if (session_p -> is_upload_id_s)
+		{
+			const uint32 interval = session_p -> is_data_p -> psd_upload_checkpoint_interval;
+			const UploadCheckpoint *resumed_p = & (session_p -> is_resumed_checkpoint);
+
+			if ((interval > 0) && ((resumed_p -> uc_num_rows + num_rows) >= (session_p -> is_checkpoint.uc_num_rows + interval)))
+				{
+					/* Only rows that are in the database can be skipped if the upload is resumed */
+					if (FinishImportSession (session_p))
+						{
+							const uint32 num_failed_rows = GetImportSessionNumberOfFailedRows (session_p);
+							UploadCheckpoint checkpoint;
+
+							checkpoint.uc_num_rows = resumed_p -> uc_num_rows + (uint32) num_rows;
+							checkpoint.uc_num_batches = session_p -> is_checkpoint.uc_num_batches + 1;
+							checkpoint.uc_num_imports = resumed_p -> uc_num_imports + ((num_failed_rows < num_imports) ? num_imports - num_failed_rows : 0);
+							checkpoint.uc_fingerprint = session_p -> is_fingerprint;
+
+							if (SaveUploadCheckpoint (session_p -> is_data_p -> psd_upload_checkpoints_p, session_p -> is_upload_id_s, GetImportSectionName (session_p -> is_collection_type), &checkpoint))
+								{
+									session_p -> is_checkpoint = checkpoint;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to checkpoint upload \"%s\" at row " UINT32_FMT, session_p -> is_upload_id_s, checkpoint.uc_num_rows);
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Some batched writes failed, upload \"%s\" will not be checkpointed past row " UINT32_FMT, session_p -> is_upload_id_s, session_p -> is_checkpoint.uc_num_rows);
+						}
+				}
+		}
+}
+
+
+bool FinishImportSession (ImportSession *session_p)
+{
+	bool success_flag = true;
+
+	if (session_p -> is_writer_p)
+		{
+			success_flag = FlushBulkWriter (session_p -> is_writer_p);
+		}
+
+	return success_flag;
+}
+
+
+uint32 GetImportSessionNumberOfFailedRows (const ImportSession *session_p)
+{
+	return (session_p -> is_writer_p) ? GetBulkWriterNumberOfFailedRows (session_p -> is_writer_p) : 0;
+}
+
+
+void AddImportSessionRowError (ImportSession *session_p, const json_t *row_p, const char *error_s, const size_t row)
+{
+	AddRowError (session_p -> is_job_p, row_p, error_s, row);
+}
+
+
+uint64 GetImportRowFingerprint (const ImportSession *session_p, const json_t *row_p, const size_t row)
+{
+	return (session_p -> is_upload_id_s) ? GetRowFingerprint (row_p, row) : 0;
+}
+
+
+void AddImportRowFingerprint (ImportSession *session_p, const uint64 fingerprint)
+{
+	/* The sum wraps around so the order that the rows are added in doesn't matter */
+	session_p -> is_fingerprint += fingerprint;
+}
+
+
+uint32 ValidateRows (RowSource *source_p, const PathogenomicsData collection_type, const DateOrder date_order, ServiceJob *job_p)
+{
+	uint32 num_valid = 0;
+	ImportFunctions fns;
+
+	if (GetImportFunctions (collection_type, &fns))
+		{
+			json_t *row_p = NULL;
+			const char *error_s = NULL;
+			DateNormaliser *normaliser_p = AllocateDateNormaliser (date_order);
+
+			if (!normaliser_p)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate DateNormaliser");
+					return 0;
+				}
+
+			while (GetNextRow (source_p, &row_p, &error_s))
+				{
+					const size_t row = GetCurrentRowIndex (source_p);
+
+					if (row_p)
+						{
+							/* The checks may convert values in place so report the row as it was read */
+							json_t *copied_row_p = json_copy (row_p);
+
+							if (copied_row_p)
+								{
+									error_s = fns.if_validate_fn (copied_row_p, normaliser_p);
+									json_decref (copied_row_p);
+								}
+							else
+								{
+									error_s = "Failed to copy row";
+								}
+
+							if (error_s)
+								{
+									AddRowError (job_p, row_p, error_s, row);
+								}
+							else
+								{
+									++ num_valid;
+								}
+
+							json_decref (row_p);
+						}
+					else
+						{
+							AddRowError (job_p, NULL, error_s, row);
+						}
+
+				}		/* while (GetNextRow (source_p, &row_p, &error_s)) */
+
+			FreeDateNormaliser (normaliser_p);
+		}		/* if (GetImportFunctions (collection_type, &fns)) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "No validation function for collection type %d", collection_type);
+		}
+
+	return num_valid;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool GetImportFunctions (const PathogenomicsData collection_type, ImportFunctions *fns_p)
+{
+	fns_p -> if_prepare_fn = NULL;
+	fns_p -> if_store_fn = NULL;
+	fns_p -> if_prefetch_fn = NULL;
+
+	switch (collection_type)
+		{
+			case PD_SAMPLE:
+				fns_p -> if_insert_fn = InsertSampleData;
+				fns_p -> if_validate_fn = ValidateSampleRow;
+				fns_p -> if_prepare_fn = PrepareSampleRow;
+				fns_p -> if_store_fn = StoreSampleRow;
+				break;
+
+			case PD_PHENOTYPE:
+				fns_p -> if_insert_fn = InsertPhenotypeData;
+				fns_p -> if_validate_fn = ValidatePhenotypeRow;
+				break;
+
+			case PD_GENOTYPE:
+				fns_p -> if_insert_fn = InsertGenotypeData;
+				fns_p -> if_validate_fn = ValidateGenotypeRow;
+				break;
+
+			case PD_FILES:
+				fns_p -> if_insert_fn = InsertFilesData;
+				fns_p -> if_validate_fn = ValidateFilesRow;
+				break;
+
+			default:
+				fns_p -> if_insert_fn = NULL;
+				fns_p -> if_validate_fn = NULL;
+				break;
+		}
+
+	return (fns_p -> if_insert_fn != NULL);
+}
+
+
+static uint32 ImportRowsSequentially (ImportSession *session_p, RowSource *source_p, InsertRowFn insert_fn)
+{
+	uint32 num_imports = 0;
+	size_t num_rows = 0;
+	json_t *row_p = NULL;
+	const char *error_s = NULL;
+
+	while (GetNextRow (source_p, &row_p, &error_s))
+		{
+			const size_t row = GetCurrentRowIndex (source_p);
+			const uint64 fingerprint = GetImportRowFingerprint (session_p, row_p, row);
+
+			if (row_p)
+				{
+					error_s = IsUnchangedImportRow (session_p, row_p, row) ? NULL : insert_fn (session_p, row_p, row);
+
+					if (error_s)
+						{
+							AddImportSessionRowError (session_p, row_p, error_s, row);
+						}
+					else
+						{
+							++ num_imports;
+						}
+
+					json_decref (row_p);
+				}
+			else
+				{
+					AddImportSessionRowError (session_p, NULL, error_s, row);
+				}
+
+			++ num_rows;
+			AddImportRowFingerprint (session_p, fingerprint);
+			CheckpointImportSession (session_p, num_rows, num_imports);
+		}		/* while (GetNextRow (source_p, &row_p, &error_s)) */
+
+	return num_imports;
+}
+
+
+static void AddRowError (ServiceJob *job_p, const json_t *row_p, const char *error_s, const size_t row)
+{
+	if (row_p)
+		{
+			AddErrorMessage (job_p, row_p, error_s, (int) row);
+		}
+	else
+		{
+			json_t *empty_row_p = json_object ();
+
+			if (empty_row_p)
+				{
+					AddErrorMessage (job_p, empty_row_p, error_s, (int) row);
+					json_decref (empty_row_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to report error for row " SIZET_FMT ": %s", row, error_s);
+				}
+		}
+}
+
+
+static void AddGeocodeStatsToJob (ImportSession *session_p)
+{
+	ServiceJob *job_p = session_p -> is_job_p;
+
+	if (!job_p -> sj_metadata_p)
+		{
+			job_p -> sj_metadata_p = json_object ();
+		}
+
+	if (job_p -> sj_metadata_p)
+		{
+			if (!AddGeocodeCacheStatsToJSON (& (session_p -> is_geocode_stats), job_p -> sj_metadata_p))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add geocoding stats to job metadata");
+				}
+		}
+}
+
+
+static void PrefetchBatch (const json_t *rows_p, void *data_p)
+{
+	PrefetchContext *context_p = (PrefetchContext *) data_p;
+
+	if (context_p -> pc_session_p -> is_date_normaliser_p)
+		{
+			/*
+			 * The rows themselves are left alone, so that their hashes are of what
+			 * was uploaded, and each row's converted date is picked up from the
+			 * DateNormaliser when it is prepared.
+			 */
+			NormaliseDateColumn (context_p -> pc_session_p -> is_date_normaliser_p, rows_p, PG_DATE_S);
+		}
+
+	if (context_p -> pc_session_p -> is_stored_hashes_p)
+		{
+			PrefetchRowHashes (context_p -> pc_session_p, rows_p);
+		}
+
+	if (context_p -> pc_prefetch_fn)
+		{
+			context_p -> pc_prefetch_fn (context_p -> pc_session_p, rows_p);
+		}
+}
+
+
+/*
+ * Fetch the stored hashes for the documents that a batch of rows will be
+ * stored in. Each key's values are fetched with a single query and any
+ * values that are already known, such as those of earlier rows in the
+ * same upload, are kept as they are.
+ */
+static void PrefetchRowHashes (ImportSession *session_p, const json_t *rows_p)
+{
+	json_t *values_p = json_object ();
+
+	if (values_p)
+		{
+			char *hash_key_s = ConcatenateStrings (GetImportSectionName (session_p -> is_collection_type), PG_HASH_SUFFIX_S);
+
+			if (hash_key_s)
+				{
+					size_t i;
+					json_t *row_p;
+					const char *key_s;
+					json_t *key_values_p;
+
+					json_array_foreach (rows_p, i, row_p)
+						{
+							const char *value_s = NULL;
+
+							if (GetRowLookup (session_p, row_p, &key_s, &value_s))
+								{
+									if (!AddLookupValue (values_p, key_s, value_s))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add \"%s\" to the hashes to fetch", value_s);
+										}
+
+									/* See IsUnchangedImportRow () */
+									if (session_p -> is_collection_type == PD_SAMPLE)
+										{
+											value_s = GetJSONString (row_p, PG_UKCPVS_ID_S);
+
+											if (value_s && (!AddLookupValue (values_p, PG_UKCPVS_ID_S, value_s)))
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add \"%s\" to the hashes to fetch", value_s);
+												}
+										}
+								}
+						}
+
+					json_object_foreach (values_p, key_s, key_values_p)
+						{
+							json_t *hashes_p = FetchStoredRowHashes (session_p -> is_tool_p, key_s, key_values_p, hash_key_s);
+
+							if (hashes_p)
+								{
+									json_t *stored_p = json_object_get (session_p -> is_stored_hashes_p, key_s);
+
+									if (stored_p)
+										{
+											const char *value_s;
+											json_t *hash_p;
+
+											/* Keep any values that earlier rows have already been checked against */
+											json_object_foreach (hashes_p, value_s, hash_p)
+												{
+													if (!json_object_get (stored_p, value_s))
+														{
+															json_object_set (stored_p, value_s, hash_p);
+														}
+												}
+										}
+									else if (json_object_set (session_p -> is_stored_hashes_p, key_s, hashes_p) != 0)
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to store the hashes for \"%s\"", key_s);
+										}
+
+									json_decref (hashes_p);
+								}
+						}
+
+					FreeCopiedString (hash_key_s);
+				}		/* if (hash_key_s) */
+
+			json_decref (values_p);
+		}		/* if (values_p) */
+}
+
+
+/*
+ * Get the key and value that a row's document is found by. Phenotypes
+ * without an ID are stored by their isolate's UKCPVS ID.
+ */
+static bool GetRowLookup (const ImportSession *session_p, const json_t *row_p, const char **key_ss, const char **value_ss)
+{
+	*key_ss = PG_ID_S;
+	*value_ss = GetJSONString (row_p, PG_ID_S);
+
+	if ((! (*value_ss)) && (session_p -> is_collection_type == PD_PHENOTYPE))
+		{
+			*key_ss = PG_UKCPVS_ID_S;
+			*value_ss = GetJSONString (row_p, "Isolate");
+		}
+
+	return (*value_ss != NULL);
+}
+
+
+static bool AddLookupValue (json_t *values_p, const char *key_s, const char *value_s)
+{
+	bool success_flag = false;
+	json_t *key_values_p = json_object_get (values_p, key_s);
+
+	if (!key_values_p)
+		{
+			key_values_p = json_array ();
+
+			if (key_values_p)
+				{
+					if (json_object_set_new (values_p, key_s, key_values_p) != 0)
+						{
+							json_decref (key_values_p);
+							key_values_p = NULL;
+						}
+				}
+		}
+
+	if (key_values_p)
+		{
+			success_flag = (json_array_append_new (key_values_p, json_string (value_s)) == 0);
+		}
+
+	return success_flag;
+}
+
+
+static const char *GetImportSectionName (const PathogenomicsData collection_type)
+{
+	const char *section_s = NULL;
+
+	switch (collection_type)
+		{
+			case PD_SAMPLE:
+				section_s = PG_SAMPLE_S;
+				break;
+
+			case PD_PHENOTYPE:
+				section_s = PG_PHENOTYPE_S;
+				break;
+
+			case PD_GENOTYPE:
+				section_s = PG_GENOTYPE_S;
+				break;
+
+			case PD_FILES:
+				section_s = PG_FILES_S;
+				break;
+
+			default:
+				break;
+		}
+
+	return section_s;
+}
+
+
+/*
+ * Add the hash kept by IsUnchangedImportRow () to the document that
+ * is being stored for a row.
+ */
+static void AddRowHashToDocument (ImportSession *session_p, json_t *doc_p, const size_t row)
+{
+	if (session_p -> is_pending_hashes_p)
+		{
+			char row_s [32];
+			json_t *pending_p;
+
+			sprintf (row_s, SIZET_FMT, row);
+
+			pending_p = json_object_get (session_p -> is_pending_hashes_p, row_s);
+
+			if (pending_p)
+				{
+					char *hash_key_s = ConcatenateStrings (GetImportSectionName (session_p -> is_collection_type), PG_HASH_SUFFIX_S);
+
+					if (hash_key_s)
+						{
+							if (json_object_set (doc_p, hash_key_s, json_object_get (pending_p, "hash")) != 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add the hash for row " SIZET_FMT, row);
+								}
+
+							FreeCopiedString (hash_key_s);
+						}
+
+					if (json_is_true (json_object_get (pending_p, "exists")))
+						{
+							++ (session_p -> is_num_updated);
+						}
+					else
+						{
+							++ (session_p -> is_num_inserted);
+						}
+
+					json_object_del (session_p -> is_pending_hashes_p, row_s);
+				}
+		}
+}
+
+
+static void AddRowCountsToJob (ImportSession *session_p)
+{
+	ServiceJob *job_p = session_p -> is_job_p;
+	json_error_t err;
+	json_t *counts_p = json_pack_ex (&err, 0, "{s:i,s:i,s:i}",
+																	 "inserted", (int) (session_p -> is_num_inserted),
+																	 "updated", (int) (session_p -> is_num_updated),
+																	 "unchanged", (int) (session_p -> is_num_unchanged));
+
+	if (counts_p)
+		{
+			if (!job_p -> sj_metadata_p)
+				{
+					job_p -> sj_metadata_p = json_object ();
+				}
+
+			if ((job_p -> sj_metadata_p) && (json_object_set_new (job_p -> sj_metadata_p, "rows", counts_p) == 0))
+				{
+					return;
+				}
+
+			json_decref (counts_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create row counts: %s", err.text);
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add row counts to job metadata");
+}
+
+
+static void AddDateCountsToJob (ImportSession *session_p)
+{
+	size_t counts_p [DS_NUM_STATUSES];
+
+	GetDateStatusCounts (session_p -> is_date_normaliser_p, counts_p);
+
+	if ((* (counts_p + DS_CONVERTED)) + (* (counts_p + DS_MISSING)) + (* (counts_p + DS_INVALID)) > 0)
+		{
+			ServiceJob *job_p = session_p -> is_job_p;
+			json_error_t err;
+			json_t *dates_p = json_pack_ex (&err, 0, "{s:s,s:I,s:I,s:I}",
+																			"format", GetDateOrderName (GetDateNormaliserOrder (session_p -> is_date_normaliser_p)),
+																			"converted", (json_int_t) (* (counts_p + DS_CONVERTED)),
+																			"missing", (json_int_t) (* (counts_p + DS_MISSING)),
+																			"invalid", (json_int_t) (* (counts_p + DS_INVALID)));
+
+			if (dates_p)
+				{
+					if (!job_p -> sj_metadata_p)
+						{
+							job_p -> sj_metadata_p = json_object ();
+						}
+
+					if ((job_p -> sj_metadata_p) && (json_object_set_new (job_p -> sj_metadata_p, "dates", dates_p) == 0))
+						{
+							return;
+						}
+
+					json_decref (dates_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create date counts: %s", err.text);
+				}
+
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add date counts to job metadata");
+		}
+}
+
+
+/*
+ * If the upload has a checkpoint from an earlier attempt, skip the rows
+ * that were committed then, as long as they are the same rows.
+ */
+static bool ResumeUpload (ImportSession *session_p, RowSource *source_p)
+{
+	bool success_flag = true;
+
+	if (session_p -> is_upload_id_s)
+		{
+			const char *error_s = NULL;
+			UploadCheckpoint *resumed_p = & (session_p -> is_resumed_checkpoint);
+
+			if (GetUploadCheckpoint (session_p -> is_data_p -> psd_upload_checkpoints_p, session_p -> is_upload_id_s, GetImportSectionName (session_p -> is_collection_type), resumed_p, &error_s))
+				{
+					if (resumed_p -> uc_num_rows > 0)
+						{
+							const size_t num_skipped = SkipCommittedRows (session_p, source_p, resumed_p -> uc_num_rows);
+
+							if (num_skipped != resumed_p -> uc_num_rows)
+								{
+									error_s = "The upload has fewer rows than were imported before under the same upload id";
+									success_flag = false;
+								}
+							else if (session_p -> is_fingerprint != resumed_p -> uc_fingerprint)
+								{
+									error_s = "The upload's rows are different to those imported before under the same upload id";
+									success_flag = false;
+								}
+							else
+								{
+									session_p -> is_checkpoint = *resumed_p;
+
+									PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Resuming upload \"%s\" after row " UINT32_FMT, session_p -> is_upload_id_s, resumed_p -> uc_num_rows);
+								}
+						}
+				}
+			else
+				{
+					success_flag = false;
+				}
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Can't resume upload \"%s\": %s", session_p -> is_upload_id_s, error_s);
+					AddGeneralErrorMessageToServiceJob (session_p -> is_job_p, error_s);
+				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Read past the rows that an earlier attempt at the upload committed,
+ * adding up their fingerprints so that they can be checked against
+ * those of the rows that were committed.
+ */
+static size_t SkipCommittedRows (ImportSession *session_p, RowSource *source_p, const size_t num_rows)
+{
+	size_t num_skipped = 0;
+	json_t *row_p = NULL;
+	const char *error_s = NULL;
+
+	while ((num_skipped < num_rows) && (GetNextRow (source_p, &row_p, &error_s)))
+		{
+			AddImportRowFingerprint (session_p, GetImportRowFingerprint (session_p, row_p, GetCurrentRowIndex (source_p)));
+
+			if (row_p)
+				{
+					json_decref (row_p);
+				}
+
+			++ num_skipped;
+		}
+
+	return num_skipped;
+}
+
+
+/*
+ * Once all of an upload's rows have been stored, its checkpoint isn't
+ * needed any more. If some of the last writes failed, the checkpoint is
+ * left as it was so that the upload can be sent again.
+ */
+static void FinishUpload (ImportSession *session_p, const bool completed_flag)
+{
+	ServiceJob *job_p = session_p -> is_job_p;
+	json_error_t err;
+	json_t *upload_p;
+
+	if (completed_flag)
+		{
+			if (!RemoveUploadCheckpoint (session_p -> is_data_p -> psd_upload_checkpoints_p, session_p -> is_upload_id_s))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to remove the checkpoint for upload \"%s\"", session_p -> is_upload_id_s);
+				}
+		}
+
+	upload_p = json_pack_ex (&err, 0, "{s:s,s:i,s:i,s:b}",
+													 "id", session_p -> is_upload_id_s,
+													 "resumed from row", (int) (session_p -> is_resumed_checkpoint.uc_num_rows),
+													 "checkpoints", (int) (session_p -> is_checkpoint.uc_num_batches),
+													 "completed", completed_flag);
+
+	if (upload_p)
+		{
+			if (!job_p -> sj_metadata_p)
+				{
+					job_p -> sj_metadata_p = json_object ();
+				}
+
+			if ((job_p -> sj_metadata_p) && (json_object_set_new (job_p -> sj_metadata_p, "upload", upload_p) == 0))
+				{
+					return;
+				}
+
+			json_decref (upload_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create upload details: %s", err.text);
+		}
+
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add upload details to job metadata");
+}
+
+
+/*
+ * Make the update for SaveImportedSection (). The section's values go into
+ * the $set using their dotted paths, e.g. "genotype.Genetic group", the ID
+ * fields into the $setOnInsert and everything else, such as the live dates,
+ * into the $set as it is.
+ */
+static json_t *GetSectionUpdate (const json_t *doc_p, const char * const section_s, const char **id_keys_ss)
+{
+	json_t *set_p = json_object ();
+
+	if (set_p)
+		{
+			json_t *set_on_insert_p = json_object ();
+
+			if (set_on_insert_p)
+				{
+					bool success_flag = true;
+					const char *key_s;
+					json_t *value_p;
+
+					json_object_foreach ((json_t *) doc_p, key_s, value_p)
+						{
+							const char **id_key_ss = id_keys_ss;
+							json_t *dest_p = set_p;
+
+							while (*id_key_ss && (strcmp (*id_key_ss, key_s) != 0))
+								{
+									++ id_key_ss;
+								}
+
+							if (*id_key_ss)
+								{
+									dest_p = set_on_insert_p;
+								}
+							else if ((strcmp (key_s, section_s) == 0) && (json_object_size (value_p) > 0))
+								{
+									const char *field_s;
+									json_t *field_p;
+
+									json_object_foreach (value_p, field_s, field_p)
+										{
+											char *path_s = ConcatenateVarargsStrings (section_s, ".", field_s, NULL);
+
+											if (path_s)
+												{
+													if (json_object_set (set_p, path_s, field_p) != 0)
+														{
+															success_flag = false;
+														}
+
+													FreeCopiedString (path_s);
+												}
+											else
+												{
+													success_flag = false;
+												}
+										}
+
+									dest_p = NULL;
+								}
+
+							if (dest_p)
+								{
+									if (json_object_set (dest_p, key_s, value_p) != 0)
+										{
+											success_flag = false;
+										}
+								}
+
+						}		/* json_object_foreach ((json_t *) doc_p, key_s, value_p) */
+
+					if (success_flag)
+						{
+							json_t *update_p = json_object ();
+
+							if (update_p)
+								{
+									/* MongoDB rejects empty update operators */
+									if ((json_object_size (set_p) == 0) || (json_object_set (update_p, "$set", set_p) == 0))
+										{
+											if ((json_object_size (set_on_insert_p) == 0) || (json_object_set (update_p, "$setOnInsert", set_on_insert_p) == 0))
+												{
+													json_decref (set_on_insert_p);
+													json_decref (set_p);
+
+													return update_p;
+												}
+										}
+
+									json_decref (update_p);
+								}
+						}
+
+					json_decref (set_on_insert_p);
+				}		/* if (set_on_insert_p) */
+
+			json_decref (set_p);
+		}		/* if (set_p) */
+
+	return NULL;
+}
+
+
+/*
+ * Keys containing a '.' or starting with a '$' would be read as
+ * paths or operators so such sections have to be set as a whole.
+ */
+static bool CanUseDottedPaths (const json_t *section_p)
+{
+	bool can_use_flag = json_is_object (section_p);
+
+	if (can_use_flag)
+		{
+			const char *key_s;
+			json_t *value_p;
+
+			json_object_foreach ((json_t *) section_p, key_s, value_p)
+				{
+					if ((*key_s == '$') || (strchr (key_s, '.')))
+						{
+							return false;
+						}
+				}
+		}
+
+	return can_use_flag;
+}
+
+
+static const char *UpsertImportedDocument (ImportSession *session_p, const json_t *selector_p, const json_t *update_p, const size_t row, const char *id_s)
+{
+	const char *error_s = NULL;
+
+	if (session_p -> is_writer_p)
+		{
+			error_s = AddUpsertToBulkWriter (session_p -> is_writer_p, selector_p, update_p, row, id_s);
+		}
+	else
+		{
+			bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+			error_s = "Failed to convert update to BSON";
+
+			if (selector_bson_p)
+				{
+					bson_t *update_bson_p = ConvertJSONToBSON (update_p);
+
+					if (update_bson_p)
+						{
+							bson_t opts;
+							bson_error_t error;
+
+							bson_init (&opts);
+							BSON_APPEND_BOOL (&opts, "upsert", true);
+
+							if (mongoc_collection_update_one (session_p -> is_tool_p -> mt_collection_p, selector_bson_p, update_bson_p, &opts, NULL, &error))
+								{
+									error_s = NULL;
+								}
+							else
+								{
+									error_s = "Failed to update document";
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to upsert \"%s\": %s", id_s ? id_s : "", error.message);
+								}
+
+							bson_destroy (&opts);
+							bson_destroy (update_bson_p);
+						}
+
+					bson_destroy (selector_bson_p);
+				}
+		}
+
+	return error_s;
+}
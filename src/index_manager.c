@@ -0,0 +1,428 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * index_manager.c
+ *
+ */
+
+#include <string.h>
+
+#include "index_manager.h"
+#include "memory_allocations.h"
+#include "json_tools.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define INDEX_MANAGER_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define INDEX_MANAGER_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static const char * const S_NAME_S = "name";
+
+static const char * const S_KEY_S = "key";
+
+static const char * const S_UNIQUE_S = "unique";
+
+static const char * const S_SPARSE_S = "sparse";
+
+static const char * const S_COLLECTIONS_S = "collections";
+
+/* The index on _id that MongoDB creates for every collection */
+static const char * const S_ID_INDEX_S = "_id_";
+
+
+/*
+ * The indexes used when the service configuration doesn't specify any.
+ * The ID is unique but sparse as phenotype and genotype documents may
+ * not have one, the sample fields are those that the searches and the
+ * imports look up, and the live dates are those that the public view
+ * is filtered by.
+ */
+static const char * const S_DEFAULT_INDEXES_S =
+	"["
+		"{ \"name\": \"id\", \"key\": { \"ID\": 1 }, \"unique\": true, \"sparse\": true, \"collections\": [ \"sample\", \"phenotype\", \"genotype\", \"files\" ] },"
+		"{ \"name\": \"ukcpvs_id\", \"key\": { \"UKCPVS ID\": 1 }, \"sparse\": true, \"collections\": [ \"sample\", \"phenotype\", \"genotype\", \"files\" ] },"
+		"{ \"name\": \"date\", \"key\": { \"sample.Date collected (compact)\": 1 }, \"collections\": [ \"sample\" ] },"
+		"{ \"name\": \"disease\", \"key\": { \"sample.Disease\": 1 }, \"collections\": [ \"sample\" ] },"
+		"{ \"name\": \"geo\", \"key\": { \"sample.geo\": \"2dsphere\" }, \"collections\": [ \"sample\" ] },"
+		"{ \"name\": \"sample_live_date\", \"key\": { \"sample_live_date.datetime\": 1 }, \"collections\": [ \"sample\" ] },"
+		"{ \"name\": \"phenotype_live_date\", \"key\": { \"phenotype_live_date.datetime\": 1 }, \"collections\": [ \"phenotype\" ] },"
+		"{ \"name\": \"genotype_live_date\", \"key\": { \"genotype_live_date.datetime\": 1 }, \"collections\": [ \"genotype\" ] },"
+		"{ \"name\": \"tile\", \"key\": { \"tile\": 1, \"view\": 1 }, \"unique\": true, \"collections\": [ \"tiles\" ] },"
+		"{ \"name\": \"rollup\", \"key\": { \"Disease\": 1, \"Genetic group\": 1, \"Country\": 1, \"County\": 1, \"week\": 1, \"live\": 1 }, \"unique\": true, \"collections\": [ \"rollups\" ] },"
+		"{ \"name\": \"rollup_stale\", \"key\": { \"stale\": 1 }, \"sparse\": true, \"collections\": [ \"rollups\" ] },"
+		"{ \"name\": \"rollup_source\", \"key\": { \"ID\": 1 }, \"unique\": true, \"collections\": [ \"rollup_sources\" ] },"
+		"{ \"name\": \"rollup_source_counter\", \"key\": { \"rollups.Disease\": 1, \"rollups.Country\": 1, \"rollups.County\": 1, \"rollups.week\": 1 }, \"collections\": [ \"rollup_sources\" ] },"
+		"{ \"name\": \"upload\", \"key\": { \"upload_id\": 1 }, \"unique\": true, \"collections\": [ \"upload_checkpoints\" ] }"
+	"]";
+
+
+static json_t *GetExistingIndexes (MongoTool *tool_p, const char *collection_s);
+
+static bool IsSpecForDataNames (const json_t *spec_p, const char **data_names_ss);
+
+static const char *FindIndexWithKey (const json_t *existing_p, const json_t *key_p);
+
+static bool AreIndexKeysEqual (const json_t *key_p, const json_t *existing_key_p);
+
+static bool IsIndexFlagSet (const json_t *index_p, const char *flag_s);
+
+static bool CreateIndex (MongoTool *tool_p, const char *collection_s, const char *name_s, const json_t *key_p, const bool unique_flag, const bool sparse_flag);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+json_t *GetDefaultIndexSpecs (void)
+{
+	json_error_t err;
+	json_t *specs_p = json_loads (S_DEFAULT_INDEXES_S, 0, &err);
+
+	if (!specs_p)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to load default index specifications: %s", err.text);
+		}
+
+	return specs_p;
+}
+
+
+bool ReconcileIndexes (MongoTool *tool_p, const char *database_s, const char *collection_s, const json_t *specs_p, const char **data_names_ss, uint32 *num_drifts_p)
+{
+	bool success_flag = false;
+	uint32 num_drifts = 0;
+
+	if (SetMongoToolDatabaseAndCollection (tool_p, database_s, collection_s))
+		{
+			json_t *existing_p = GetExistingIndexes (tool_p, collection_s);
+
+			if (existing_p)
+				{
+					size_t i;
+					json_t *spec_p;
+					const char *name_s;
+					json_t *index_p;
+
+					json_array_foreach (specs_p, i, spec_p)
+						{
+							if (IsSpecForDataNames (spec_p, data_names_ss))
+								{
+									const json_t *key_p = json_object_get (spec_p, S_KEY_S);
+
+									name_s = GetJSONString (spec_p, S_NAME_S);
+
+									if (name_s && json_is_object (key_p) && (json_object_size (key_p) > 0))
+										{
+											bool unique_flag = false;
+											bool sparse_flag = false;
+											const json_t *existing_index_p = json_object_get (existing_p, name_s);
+
+											GetJSONBoolean (spec_p, S_UNIQUE_S, &unique_flag);
+											GetJSONBoolean (spec_p, S_SPARSE_S, &sparse_flag);
+
+											if (existing_index_p)
+												{
+													if ((!AreIndexKeysEqual (key_p, json_object_get (existing_index_p, S_KEY_S))) ||
+															(IsIndexFlagSet (existing_index_p, S_UNIQUE_S) != unique_flag) ||
+															(IsIndexFlagSet (existing_index_p, S_SPARSE_S) != sparse_flag))
+														{
+															PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Index \"%s\" on \"%s\" differs from its specification, drop it to have it recreated", name_s, collection_s);
+															++ num_drifts;
+														}
+
+													json_object_del (existing_p, name_s);
+												}
+											else
+												{
+													/*
+													 * MongoDB won't create an index with the same key as an
+													 * existing one so check whether it is just named differently.
+													 */
+													const char *existing_name_s = FindIndexWithKey (existing_p, key_p);
+
+													if (existing_name_s)
+														{
+															PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Index \"%s\" on \"%s\" has the key specified for \"%s\"", existing_name_s, collection_s, name_s);
+															++ num_drifts;
+
+															json_object_del (existing_p, existing_name_s);
+														}
+													else if (!CreateIndex (tool_p, collection_s, name_s, key_p, unique_flag, sparse_flag))
+														{
+															++ num_drifts;
+														}
+												}
+
+										}		/* if (name_s && json_is_object (key_p) && (json_object_size (key_p) > 0)) */
+									else
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Ignoring index specification " SIZET_FMT " for \"%s\" as it needs a name and a key", i, collection_s);
+										}
+
+								}		/* if (IsSpecForDataNames (spec_p, data_names_ss)) */
+
+						}		/* json_array_foreach (specs_p, i, spec_p) */
+
+					/* Anything left over isn't in the specification */
+					json_object_foreach (existing_p, name_s, index_p)
+						{
+							if (strcmp (name_s, S_ID_INDEX_S) != 0)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Index \"%s\" on \"%s\" is not in the index specification", name_s, collection_s);
+									++ num_drifts;
+								}
+						}
+
+					json_decref (existing_p);
+					success_flag = true;
+				}		/* if (existing_p) */
+
+		}		/* if (SetMongoToolDatabaseAndCollection (tool_p, database_s, collection_s)) */
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set collection to \"%s\".\"%s\" to check its indexes", database_s, collection_s);
+		}
+
+	if (num_drifts_p)
+		{
+			*num_drifts_p = num_drifts;
+		}
+
+	return success_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+/*
+ * Get the existing indexes of the tool's current collection as a JSON
+ * object keyed by index name.
+ */
+static json_t *GetExistingIndexes (MongoTool *tool_p, const char *collection_s)
+{
+	json_t *indexes_p = json_object ();
+
+	if (indexes_p)
+		{
+			mongoc_cursor_t *cursor_p = mongoc_collection_find_indexes_with_opts (tool_p -> mt_collection_p, NULL);
+
+			if (cursor_p)
+				{
+					const bson_t *doc_p;
+					bson_error_t error;
+
+					while (indexes_p && mongoc_cursor_next (cursor_p, &doc_p))
+						{
+							json_t *index_p = ConvertBSONToJSON (doc_p);
+
+							if (index_p)
+								{
+									const char *name_s = GetJSONString (index_p, S_NAME_S);
+
+									if (name_s)
+										{
+											#if INDEX_MANAGER_DEBUG >= STM_LEVEL_FINE
+											PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Found index \"%s\" on \"%s\"", name_s, collection_s);
+											#endif
+
+											if (json_object_set (indexes_p, name_s, index_p) != 0)
+												{
+													json_decref (indexes_p);
+													indexes_p = NULL;
+												}
+										}
+
+									json_decref (index_p);
+								}
+
+						}		/* while (indexes_p && mongoc_cursor_next (cursor_p, &doc_p)) */
+
+					if (mongoc_cursor_error (cursor_p, &error))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to list the indexes on \"%s\": %s", collection_s, error.message);
+
+							if (indexes_p)
+								{
+									json_decref (indexes_p);
+									indexes_p = NULL;
+								}
+						}
+
+					mongoc_cursor_destroy (cursor_p);
+				}		/* if (cursor_p) */
+			else
+				{
+					json_decref (indexes_p);
+					indexes_p = NULL;
+				}
+
+		}		/* if (indexes_p) */
+
+	return indexes_p;
+}
+
+
+static bool IsSpecForDataNames (const json_t *spec_p, const char **data_names_ss)
+{
+	const json_t *collections_p = json_object_get (spec_p, S_COLLECTIONS_S);
+
+	if (json_is_array (collections_p))
+		{
+			size_t i;
+			const json_t *collection_p;
+
+			json_array_foreach (collections_p, i, collection_p)
+				{
+					if (json_is_string (collection_p))
+						{
+							const char **data_name_ss;
+
+							for (data_name_ss = data_names_ss; *data_name_ss; ++ data_name_ss)
+								{
+									if (strcmp (*data_name_ss, json_string_value (collection_p)) == 0)
+										{
+											return true;
+										}
+								}
+						}
+				}
+
+			return false;
+		}
+
+	return true;
+}
+
+
+static const char *FindIndexWithKey (const json_t *existing_p, const json_t *key_p)
+{
+	const char *name_s;
+	json_t *index_p;
+
+	json_object_foreach ((json_t *) existing_p, name_s, index_p)
+		{
+			if (AreIndexKeysEqual (key_p, json_object_get (index_p, S_KEY_S)))
+				{
+					return name_s;
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Index keys are equal if they have the same fields in the same order
+ * with the same types. The numeric directions may be stored as integers
+ * or doubles depending upon which client created the index.
+ */
+static bool AreIndexKeysEqual (const json_t *key_p, const json_t *existing_key_p)
+{
+	bool equal_flag = false;
+
+	if (json_is_object (existing_key_p) && (json_object_size (key_p) == json_object_size (existing_key_p)))
+		{
+			void *iter_p = json_object_iter ((json_t *) key_p);
+			void *existing_iter_p = json_object_iter ((json_t *) existing_key_p);
+
+			equal_flag = true;
+
+			while (equal_flag && iter_p && existing_iter_p)
+				{
+					if (strcmp (json_object_iter_key (iter_p), json_object_iter_key (existing_iter_p)) == 0)
+						{
+							const json_t *value_p = json_object_iter_value (iter_p);
+							const json_t *existing_value_p = json_object_iter_value (existing_iter_p);
+
+							if (json_is_number (value_p) && json_is_number (existing_value_p))
+								{
+									equal_flag = (json_number_value (value_p) == json_number_value (existing_value_p));
+								}
+							else
+								{
+									equal_flag = json_equal (value_p, existing_value_p);
+								}
+						}
+					else
+						{
+							equal_flag = false;
+						}
+
+					iter_p = json_object_iter_next ((json_t *) key_p, iter_p);
+					existing_iter_p = json_object_iter_next ((json_t *) existing_key_p, existing_iter_p);
+				}
+		}
+
+	return equal_flag;
+}
+
+
+static bool IsIndexFlagSet (const json_t *index_p, const char *flag_s)
+{
+	const json_t *value_p = json_object_get (index_p, flag_s);
+
+	if (json_is_number (value_p))
+		{
+			return (json_number_value (value_p) != 0.0);
+		}
+
+	return json_is_true (value_p);
+}
+
+
+static bool CreateIndex (MongoTool *tool_p, const char *collection_s, const char *name_s, const json_t *key_p, const bool unique_flag, const bool sparse_flag)
+{
+	bool success_flag = false;
+	bson_t *keys_p = ConvertJSONToBSON (key_p);
+
+	if (keys_p)
+		{
+			mongoc_index_opt_t opt;
+			bson_error_t error;
+
+			mongoc_index_opt_init (&opt);
+			opt.name = name_s;
+			opt.unique = unique_flag;
+			opt.sparse = sparse_flag;
+
+			if (mongoc_collection_create_index_with_opts (tool_p -> mt_collection_p, keys_p, &opt, NULL, NULL, &error))
+				{
+					PrintLog (STM_LEVEL_INFO, __FILE__, __LINE__, "Created index \"%s\" on \"%s\"", name_s, collection_s);
+					success_flag = true;
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create index \"%s\" on \"%s\": %s", name_s, collection_s, error.message);
+				}
+
+			bson_destroy (keys_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to convert the key for index \"%s\" on \"%s\"", name_s, collection_s);
+		}
+
+	return success_flag;
+}
@@ -0,0 +1,623 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * live_dates.c
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "live_dates.h"
+#include "aggregation_utils.h"
+#include "row_hashes.h"
+#include "pathogenomics_service.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "time_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define LIVE_DATES_DEBUG	(STM_LEVEL_FINER)
+#else
+	#define LIVE_DATES_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static json_t *GetLiveDateStages (const char **group_names_ss, const char **fields_ss, const bool preview_flag, const SearchPage *page_p);
+
+static json_t *GetFieldsProjection (const char **group_names_ss, const char **fields_ss, const bool preview_flag, const SearchPage *page_p);
+
+static json_t *GetEmbargoedSections (const char **group_names_ss, const json_t *today_p);
+
+static json_t *GetLiveDateCondition (const char *group_name_s, const json_t *today_p);
+
+static json_t *GetToday (void);
+
+static bool IsFieldIncluded (const char **fields_ss, const char *key_s);
+
+static bson_t *MakePipeline (const json_t *query_p, const bool filter_flag, const json_t *stages_p);
+
+static bool ForEachDocument (MongoTool *tool_p, const json_t *query_p, const bool filter_flag, const char **fields_ss, const bool preview_flag, const SearchPage *page_p, LiveDocumentCallback doc_fn, void *data_p);
+
+static bool RunPipeline (MongoTool *tool_p, const json_t *query_p, const bool filter_flag, const json_t *stages_p, LiveDocumentCallback doc_fn, void *data_p);
+
+static bool ProcessCursorDocuments (mongoc_cursor_t *cursor_p, LiveDocumentCallback doc_fn, void *data_p);
+
+static bool AddDocumentToArray (json_t *doc_p, void *data_p);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+json_t *FindLiveDocuments (MongoTool *tool_p, const json_t *query_p, const char **fields_ss, const bool preview_flag, const SearchPage *page_p)
+{
+	json_t *docs_p = json_array ();
+
+	if (docs_p)
+		{
+			if (!ForEachLiveDocument (tool_p, query_p, fields_ss, preview_flag, page_p, AddDocumentToArray, docs_p))
+				{
+					json_decref (docs_p);
+					docs_p = NULL;
+				}
+		}
+
+	return docs_p;
+}
+
+
+bool ForEachLiveDocument (MongoTool *tool_p, const json_t *query_p, const char **fields_ss, const bool preview_flag, const SearchPage *page_p, LiveDocumentCallback doc_fn, void *data_p)
+{
+	return ForEachDocument (tool_p, query_p, false, fields_ss, preview_flag, page_p, doc_fn, data_p);
+}
+
+
+bool ForEachLiveDocumentMatchingFilter (MongoTool *tool_p, const json_t *filter_p, const char **fields_ss, const bool preview_flag, LiveDocumentCallback doc_fn, void *data_p)
+{
+	return ForEachDocument (tool_p, filter_p, true, fields_ss, preview_flag, NULL, doc_fn, data_p);
+}
+
+
+json_t *AggregateLiveDocuments (MongoTool *tool_p, const json_t *query_p, const bool preview_flag, const json_t *extra_stages_p)
+{
+	json_t *results_p = NULL;
+	const char *group_names_ss [] = { PG_SAMPLE_S, PG_PHENOTYPE_S, PG_GENOTYPE_S, PG_FILES_S, NULL };
+	json_t *stages_p = GetLiveDateStages (group_names_ss, NULL, preview_flag, NULL);
+
+	if (stages_p)
+		{
+			/* The caller's stages only ever see the live data */
+			if (json_array_extend (stages_p, (json_t *) extra_stages_p) == 0)
+				{
+					results_p = json_array ();
+
+					if (results_p)
+						{
+							if (!RunPipeline (tool_p, query_p, false, stages_p, AddDocumentToArray, results_p))
+								{
+									json_decref (results_p);
+									results_p = NULL;
+								}
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add aggregation stages");
+				}
+
+			json_decref (stages_p);
+		}		/* if (stages_p) */
+
+	return results_p;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+/*
+ * Get the stages that follow the query's $match stage.
+ */
+static json_t *GetLiveDateStages (const char **group_names_ss, const char **fields_ss, const bool preview_flag, const SearchPage *page_p)
+{
+	json_t *stages_p = json_array ();
+
+	if (stages_p)
+		{
+			bool success_flag = true;
+
+			if (page_p)
+				{
+					success_flag = AddSearchPageStartStages (page_p, stages_p);
+				}
+
+			if ((success_flag) && (fields_ss))
+				{
+					success_flag = AddAggregationStage (stages_p, "$project", GetFieldsProjection (group_names_ss, fields_ss, preview_flag, page_p));
+				}
+
+			if (success_flag)
+				{
+					if (!preview_flag)
+						{
+							json_t *today_p = GetToday ();
+
+							success_flag = false;
+
+							if (today_p)
+								{
+									/* Remove the sections that aren't live yet */
+									if (AddAggregationStage (stages_p, "$addFields", GetEmbargoedSections (group_names_ss, today_p)))
+										{
+											json_t *exclusions_p = json_pack ("{s:i}", MONGO_ID_S, 0);
+
+											/* The live dates and row hashes themselves aren't returned */
+											if (exclusions_p)
+												{
+													const char **group_name_ss;
+
+													for (group_name_ss = group_names_ss; *group_name_ss; ++ group_name_ss)
+														{
+															char *key_s = ConcatenateStrings (*group_name_ss, PG_LIVE_DATE_SUFFIX_S);
+
+															if (key_s)
+																{
+																	json_object_set_new (exclusions_p, key_s, json_integer (0));
+																	FreeCopiedString (key_s);
+																}
+
+															key_s = ConcatenateStrings (*group_name_ss, PG_HASH_SUFFIX_S);
+
+															if (key_s)
+																{
+																	json_object_set_new (exclusions_p, key_s, json_integer (0));
+																	FreeCopiedString (key_s);
+																}
+														}
+												}
+
+											if (AddAggregationStage (stages_p, "$project", exclusions_p))
+												{
+													/*
+													 * Only keep the records that still have at least one of the sample,
+													 * phenotype or genotype.
+													 */
+													json_t *match_p = json_pack ("{s:[{s:{s:b}},{s:{s:b}},{s:{s:b}}]}", "$or",
+														PG_SAMPLE_S, "$exists", true,
+														PG_PHENOTYPE_S, "$exists", true,
+														PG_GENOTYPE_S, "$exists", true);
+
+													success_flag = AddAggregationStage (stages_p, "$match", match_p);
+												}
+										}
+
+									json_decref (today_p);
+								}		/* if (today_p) */
+
+						}		/* if (!preview_flag) */
+					else if (!fields_ss)
+						{
+							success_flag = AddAggregationStage (stages_p, "$project", json_pack ("{s:i}", MONGO_ID_S, 0));
+						}
+				}
+
+			/* Only page the documents that are left after the filtering */
+			if ((success_flag) && (page_p))
+				{
+					success_flag = AddSearchPageEndStages (page_p, stages_p);
+				}
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create live date aggregation stages");
+					json_decref (stages_p);
+					stages_p = NULL;
+				}
+
+		}		/* if (stages_p) */
+
+	return stages_p;
+}
+
+
+/*
+ * Project the requested fields along with the live dates needed
+ * to filter them.
+ */
+static json_t *GetFieldsProjection (const char **group_names_ss, const char **fields_ss, const bool preview_flag, const SearchPage *page_p)
+{
+	json_t *projection_p = json_pack ("{s:i}", MONGO_ID_S, 0);
+
+	if (projection_p)
+		{
+			const char **field_ss;
+
+			for (field_ss = fields_ss; *field_ss; ++ field_ss)
+				{
+					if (json_object_set_new (projection_p, *field_ss, json_integer (1)) != 0)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add \"%s\" to projection", *field_ss);
+						}
+				}
+
+			if (!preview_flag)
+				{
+					const char **group_name_ss;
+
+					for (group_name_ss = group_names_ss; *group_name_ss; ++ group_name_ss)
+						{
+							char *key_s = ConcatenateStrings (*group_name_ss, PG_LIVE_DATE_SUFFIX_S);
+
+							if (key_s)
+								{
+									if (!IsFieldIncluded (fields_ss, key_s))
+										{
+											json_object_set_new (projection_p, key_s, json_integer (1));
+										}
+
+									FreeCopiedString (key_s);
+								}
+						}
+				}
+
+			/* Keep the sort keys needed for the continuation token */
+			if (page_p)
+				{
+					json_object_set_new (projection_p, GetSearchPageKeyField (), json_integer (1));
+				}
+		}
+
+	return projection_p;
+}
+
+
+static json_t *GetEmbargoedSections (const char **group_names_ss, const json_t *today_p)
+{
+	json_t *sections_p = json_object ();
+
+	if (sections_p)
+		{
+			const char **group_name_ss;
+
+			for (group_name_ss = group_names_ss; *group_name_ss; ++ group_name_ss)
+				{
+					json_t *condition_p = GetLiveDateCondition (*group_name_ss, today_p);
+
+					if ((!condition_p) || (json_object_set_new (sections_p, *group_name_ss, condition_p) != 0))
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add live date condition for \"%s\"", *group_name_ss);
+
+							json_decref (sections_p);
+							return NULL;
+						}
+				}
+		}
+
+	return sections_p;
+}
+
+
+/*
+ * Keep a section if its live date is today or earlier, or if it doesn't
+ * have one. Documents stored before the live dates were saved as BSON dates
+ * only have the date strings so these are converted instead. A date string
+ * that can't be parsed is treated as missing, as it was when each record
+ * was checked on its own, rather than failing the whole aggregation.
+ *
+ * 	{ "$cond": [
+ * 		{ "$lte": [ { "$ifNull": [ "$<group>_live_date.datetime", { "$dateFromString": { "dateString": "$<group>_live_date.date", "onError": null, "onNull": null } } ] }, <today> ] },
+ * 		"$<group>",
+ * 		"$$REMOVE"
+ * 	] }
+ */
+static json_t *GetLiveDateCondition (const char *group_name_s, const json_t *today_p)
+{
+	json_t *condition_p = NULL;
+	char *value_path_s = ConcatenateStrings ("$", group_name_s);
+
+	if (value_path_s)
+		{
+			char *datetime_path_s = ConcatenateVarargsStrings (value_path_s, PG_LIVE_DATE_SUFFIX_S, ".", PG_LIVE_DATE_TIME_S, NULL);
+
+			if (datetime_path_s)
+				{
+					char *date_path_s = ConcatenateVarargsStrings (value_path_s, PG_LIVE_DATE_SUFFIX_S, ".date", NULL);
+
+					if (date_path_s)
+						{
+							json_error_t err;
+
+							condition_p = json_pack_ex (&err, 0, "{s:[{s:[{s:[s,{s:{s:s,s:n,s:n}}]},O]},s,s]}", "$cond",
+								"$lte", "$ifNull", datetime_path_s, "$dateFromString", "dateString", date_path_s, "onError", "onNull", today_p,
+								value_path_s, "$$REMOVE");
+
+							if (!condition_p)
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create live date condition for \"%s\": %s", group_name_s, err.text);
+								}
+
+							FreeCopiedString (date_path_s);
+						}
+
+					FreeCopiedString (datetime_path_s);
+				}
+
+			FreeCopiedString (value_path_s);
+		}
+
+	return condition_p;
+}
+
+
+/*
+ * Get the start of today as a BSON date in extended JSON. The live dates
+ * don't have times so anything that goes live today is public.
+ */
+static json_t *GetToday (void)
+{
+	json_t *today_p = NULL;
+	struct tm current_time;
+
+	if (GetPresentTime (&current_time))
+		{
+			char *date_s = GetTimeAsString (&current_time, false, NULL);
+
+			if (date_s)
+				{
+					char *datetime_s = ConcatenateStrings (date_s, "T00:00:00Z");
+
+					if (datetime_s)
+						{
+							today_p = json_pack ("{s:s}", "$date", datetime_s);
+							FreeCopiedString (datetime_s);
+						}
+
+					FreeCopiedString (date_s);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to convert time to a string");
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get current time");
+		}
+
+	return today_p;
+}
+
+
+/*
+ * Is key_s, or any part of it, already in the projection? MongoDB
+ * rejects projections with overlapping paths.
+ */
+static bool IsFieldIncluded (const char **fields_ss, const char *key_s)
+{
+	const size_t key_length = strlen (key_s);
+
+	for ( ; *fields_ss; ++ fields_ss)
+		{
+			if (strncmp (*fields_ss, key_s, key_length) == 0)
+				{
+					const char c = * ((*fields_ss) + key_length);
+
+					if ((c == '\0') || (c == '.'))
+						{
+							return true;
+						}
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * The query is converted in the same way as for a find so that
+ * searches match the same documents as before. If filter_flag is
+ * true, query_p is already a MongoDB filter and is used as it is.
+ */
+static bson_t *MakePipeline (const json_t *query_p, const bool filter_flag, const json_t *stages_p)
+{
+	bson_t *pipeline_p = bson_new ();
+
+	if (pipeline_p)
+		{
+			bson_t *match_p = NULL;
+
+			if (query_p)
+				{
+					match_p = filter_flag ? ConvertJSONToBSON (query_p) : GenerateQuery (query_p);
+				}
+			else
+				{
+					match_p = bson_new ();
+				}
+
+			if (match_p)
+				{
+					bson_t stages;
+					bson_t stage;
+					bool success_flag = false;
+
+					if (BSON_APPEND_ARRAY_BEGIN (pipeline_p, "pipeline", &stages))
+						{
+							if (BSON_APPEND_DOCUMENT_BEGIN (&stages, "0", &stage))
+								{
+									if (BSON_APPEND_DOCUMENT (&stage, "$match", match_p))
+										{
+											size_t i;
+											json_t *stage_p;
+
+											success_flag = bson_append_document_end (&stages, &stage);
+
+											json_array_foreach (stages_p, i, stage_p)
+												{
+													if (success_flag)
+														{
+															bson_t *stage_bson_p = ConvertJSONToBSON (stage_p);
+
+															success_flag = false;
+
+															if (stage_bson_p)
+																{
+																	char key_s [32];
+
+																	sprintf (key_s, SIZET_FMT, i + 1);
+																	success_flag = BSON_APPEND_DOCUMENT (&stages, key_s, stage_bson_p);
+
+																	bson_destroy (stage_bson_p);
+																}
+														}
+												}
+										}
+								}
+
+							if (!bson_append_array_end (pipeline_p, &stages))
+								{
+									success_flag = false;
+								}
+						}
+
+					if (!success_flag)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create live date aggregation pipeline");
+
+							bson_destroy (pipeline_p);
+							pipeline_p = NULL;
+						}
+
+					bson_destroy (match_p);
+				}		/* if (match_p) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create query for live date aggregation");
+
+					bson_destroy (pipeline_p);
+					pipeline_p = NULL;
+				}
+
+		}		/* if (pipeline_p) */
+
+	return pipeline_p;
+}
+
+
+static bool ForEachDocument (MongoTool *tool_p, const json_t *query_p, const bool filter_flag, const char **fields_ss, const bool preview_flag, const SearchPage *page_p, LiveDocumentCallback doc_fn, void *data_p)
+{
+	bool success_flag = false;
+	const char *group_names_ss [] = { PG_SAMPLE_S, PG_PHENOTYPE_S, PG_GENOTYPE_S, PG_FILES_S, NULL };
+	json_t *stages_p = GetLiveDateStages (group_names_ss, fields_ss, preview_flag, page_p);
+
+	if (stages_p)
+		{
+			success_flag = RunPipeline (tool_p, query_p, filter_flag, stages_p, doc_fn, data_p);
+			json_decref (stages_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Run the query's $match stage followed by the given stages and pass
+ * each of the resulting documents to doc_fn.
+ */
+static bool RunPipeline (MongoTool *tool_p, const json_t *query_p, const bool filter_flag, const json_t *stages_p, LiveDocumentCallback doc_fn, void *data_p)
+{
+	bool success_flag = false;
+	bson_t *pipeline_p = MakePipeline (query_p, filter_flag, stages_p);
+
+	#if LIVE_DATES_DEBUG >= STM_LEVEL_FINER
+	PrintJSONToLog (STM_LEVEL_FINER, __FILE__, __LINE__, stages_p, "live date stages: ");
+	#endif
+
+	if (pipeline_p)
+		{
+			mongoc_cursor_t *cursor_p = mongoc_collection_aggregate (tool_p -> mt_collection_p, MONGOC_QUERY_NONE, pipeline_p, NULL, NULL);
+
+			if (cursor_p)
+				{
+					success_flag = ProcessCursorDocuments (cursor_p, doc_fn, data_p);
+					mongoc_cursor_destroy (cursor_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to run live date aggregation");
+				}
+
+			bson_destroy (pipeline_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Pass each document from the cursor to doc_fn, one at a time, so only
+ * the current document is held in memory.
+ */
+static bool ProcessCursorDocuments (mongoc_cursor_t *cursor_p, LiveDocumentCallback doc_fn, void *data_p)
+{
+	bool success_flag = true;
+	const bson_t *doc_p;
+	bson_error_t error;
+
+	while (success_flag && mongoc_cursor_next (cursor_p, &doc_p))
+		{
+			json_t *doc_json_p = ConvertBSONToJSON (doc_p);
+
+			if (doc_json_p)
+				{
+					success_flag = doc_fn (doc_json_p, data_p);
+					json_decref (doc_json_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to convert document to json");
+				}
+		}
+
+	if (mongoc_cursor_error (cursor_p, &error))
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Live date aggregation failed: %s", error.message);
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+static bool AddDocumentToArray (json_t *doc_p, void *data_p)
+{
+	json_t *docs_p = (json_t *) data_p;
+
+	if (json_array_append (docs_p, doc_p) != 0)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add document to results");
+			return false;
+		}
+
+	return true;
+}
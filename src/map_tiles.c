@@ -0,0 +1,832 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * map_tiles.c
+ *
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "map_tiles.h"
+#include "live_dates.h"
+#include "pathogenomics_service.h"
+#include "pathogenomics_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define MAP_TILES_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define MAP_TILES_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/* The furthest latitude north or south that web map tiles cover */
+static const double64 S_MAX_LATITUDE = 85.0511287798;
+
+/* The number of points along each east-west edge of a tile's query polygon */
+static const uint32 S_NUM_EDGE_POINTS = 16;
+
+/* The number of tiles removed by each delete */
+static const size_t S_INVALIDATE_BATCH_SIZE = 1000;
+
+static const char * const S_TILE_S = "tile";
+
+static const char * const S_VIEW_S = "view";
+
+static const char * const S_BUILT_S = "built";
+
+static const char * const S_CLUSTERS_S = "clusters";
+
+
+struct MapTiles
+{
+	/* The connection to the collection of stored tiles */
+	MongoTool *mts_tiles_tool_p;
+
+	/* The connection to the collection of samples that the tiles are built from */
+	MongoTool *mts_samples_tool_p;
+
+	/* The MongoTools aren't thread-safe so only one thread can use them at a time */
+	pthread_mutex_t mts_mutex;
+
+	uint32 mts_max_zoom;
+
+	uint32 mts_grid_size;
+};
+
+
+typedef struct TileCell
+{
+	uint32 tc_count;
+	double64 tc_longitude_sum;
+	double64 tc_latitude_sum;
+} TileCell;
+
+
+/*
+ * The tile being built along with the running totals for each of
+ * its grid cells.
+ */
+typedef struct TileBuilder
+{
+	uint32 tb_zoom;
+	uint32 tb_x;
+	uint32 tb_y;
+	uint32 tb_grid_size;
+	TileCell *tb_cells_p;
+} TileBuilder;
+
+
+/*
+ * The tiles to add the changes for each document to.
+ */
+typedef struct ChangedTiles
+{
+	const MapTiles *ct_tiles_p;
+	json_t *ct_changed_tiles_p;
+} ChangedTiles;
+
+
+static bool AddChangedMapTilesForDocument (json_t *doc_p, void *data_p);
+
+static bool ParseTile (const char *tile_s, const uint32 max_zoom, uint32 *zoom_p, uint32 *x_p, uint32 *y_p);
+
+static json_t *FindStoredTile (MapTiles *tiles_p, const char *key_s, const char *view_s, const char *today_s);
+
+static json_t *BuildTile (MapTiles *tiles_p, const uint32 zoom, const uint32 x, const uint32 y, const bool preview_flag);
+
+static bool StoreTile (MapTiles *tiles_p, const char *key_s, const char *view_s, const char *today_s, json_t *tile_p);
+
+static json_t *GetTileFilter (const uint32 zoom, const uint32 x, const uint32 y);
+
+static bool AddSampleToTile (json_t *doc_p, void *data_p);
+
+static json_t *GetTileClusters (const TileBuilder *builder_p);
+
+static bool GetPointCoordinates (const json_t *sample_p, double64 *longitude_p, double64 *latitude_p);
+
+static void GetTilePosition (const double64 longitude, const double64 latitude, const uint32 zoom, double64 *x_p, double64 *y_p);
+
+static uint32 GetTileIndex (const double64 position, const uint32 zoom);
+
+static double64 GetTileLatitude (const double64 y, const uint32 zoom);
+
+static char *GetTileKey (const uint32 zoom, const uint32 x, const uint32 y);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+MapTiles *AllocateMapTiles (MongoClientManager *mongo_manager_p, const char *database_s, const char *tiles_collection_s, const char *samples_collection_s, const uint32 max_zoom, const uint32 grid_size)
+{
+	MongoTool *tiles_tool_p = AllocateMongoTool (NULL, mongo_manager_p);
+
+	if (tiles_tool_p)
+		{
+			if (SetMongoToolDatabaseAndCollection (tiles_tool_p, database_s, tiles_collection_s))
+				{
+					MongoTool *samples_tool_p = AllocateMongoTool (NULL, mongo_manager_p);
+
+					if (samples_tool_p)
+						{
+							if (SetMongoToolDatabaseAndCollection (samples_tool_p, database_s, samples_collection_s))
+								{
+									MapTiles *tiles_p = (MapTiles *) AllocMemory (sizeof (MapTiles));
+
+									if (tiles_p)
+										{
+											tiles_p -> mts_tiles_tool_p = tiles_tool_p;
+											tiles_p -> mts_samples_tool_p = samples_tool_p;
+											tiles_p -> mts_max_zoom = max_zoom;
+											tiles_p -> mts_grid_size = (grid_size > 0) ? grid_size : 1;
+
+											pthread_mutex_init (& (tiles_p -> mts_mutex), NULL);
+
+											return tiles_p;
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set map tiles samples collection to \"%s\".\"%s\"", database_s, samples_collection_s);
+								}
+
+							FreeMongoTool (samples_tool_p);
+						}		/* if (samples_tool_p) */
+
+				}		/* if (SetMongoToolDatabaseAndCollection (tiles_tool_p, database_s, tiles_collection_s)) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set map tiles collection to \"%s\".\"%s\"", database_s, tiles_collection_s);
+				}
+
+			FreeMongoTool (tiles_tool_p);
+		}		/* if (tiles_tool_p) */
+
+	return NULL;
+}
+
+
+void FreeMapTiles (MapTiles *tiles_p)
+{
+	pthread_mutex_destroy (& (tiles_p -> mts_mutex));
+
+	FreeMongoTool (tiles_p -> mts_samples_tool_p);
+	FreeMongoTool (tiles_p -> mts_tiles_tool_p);
+	FreeMemory (tiles_p);
+}
+
+
+json_t *GetMapTile (MapTiles *tiles_p, const char *tile_s, const bool preview_flag, const char **error_ss)
+{
+	json_t *tile_p = NULL;
+	uint32 zoom;
+	uint32 x;
+	uint32 y;
+
+	if (ParseTile (tile_s, tiles_p -> mts_max_zoom, &zoom, &x, &y))
+		{
+			char *key_s = GetTileKey (zoom, x, y);
+
+			if (key_s)
+				{
+					char *today_s = GetTodayAsString ();
+
+					if (today_s)
+						{
+							const char *view_s = preview_flag ? "preview" : "public";
+
+							pthread_mutex_lock (& (tiles_p -> mts_mutex));
+
+							tile_p = FindStoredTile (tiles_p, key_s, view_s, today_s);
+
+							if (!tile_p)
+								{
+									tile_p = BuildTile (tiles_p, zoom, x, y, preview_flag);
+
+									if (tile_p)
+										{
+											/* The tile can still be returned even if it couldn't be kept */
+											if (!StoreTile (tiles_p, key_s, view_s, today_s, tile_p))
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to store map tile %s for the %s view", key_s, view_s);
+												}
+										}
+									else
+										{
+											*error_ss = "Failed to build the map tile";
+										}
+								}
+
+							pthread_mutex_unlock (& (tiles_p -> mts_mutex));
+
+							FreeCopiedString (today_s);
+						}		/* if (today_s) */
+					else
+						{
+							*error_ss = "Failed to get the current date";
+						}
+
+					FreeCopiedString (key_s);
+				}		/* if (key_s) */
+			else
+				{
+					*error_ss = "Failed to make the map tile key";
+				}
+
+		}		/* if (ParseTile (tile_s, tiles_p -> mts_max_zoom, &zoom, &x, &y)) */
+	else
+		{
+			*error_ss = "Invalid map tile, it must be z/x/y within the configured zoom levels";
+		}
+
+	return tile_p;
+}
+
+
+bool AddChangedMapTiles (const MapTiles *tiles_p, json_t *changed_tiles_p, const json_t *sample_p)
+{
+	bool success_flag = true;
+	double64 longitude;
+	double64 latitude;
+
+	if (GetPointCoordinates (sample_p, &longitude, &latitude))
+		{
+			uint32 zoom;
+
+			for (zoom = 0; zoom <= tiles_p -> mts_max_zoom; ++ zoom)
+				{
+					double64 x;
+					double64 y;
+					char *key_s;
+
+					GetTilePosition (longitude, latitude, zoom, &x, &y);
+
+					key_s = GetTileKey (zoom, GetTileIndex (x, zoom), GetTileIndex (y, zoom));
+
+					if (key_s)
+						{
+							if (json_object_set_new (changed_tiles_p, key_s, json_true ()) != 0)
+								{
+									success_flag = false;
+								}
+
+							FreeCopiedString (key_s);
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+		}
+
+	return success_flag;
+}
+
+
+bool AddChangedMapTilesForFilter (const MapTiles *tiles_p, MongoTool *tool_p, const json_t *filter_p, json_t *changed_tiles_p)
+{
+	bool success_flag = false;
+	char *geo_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_GEO_S, NULL);
+
+	if (geo_s)
+		{
+			const char *fields_ss [] = { geo_s, NULL };
+			ChangedTiles changed;
+
+			changed.ct_tiles_p = tiles_p;
+			changed.ct_changed_tiles_p = changed_tiles_p;
+
+			/* Embargoed samples are on the preview tiles so get every matching sample */
+			success_flag = ForEachLiveDocumentMatchingFilter (tool_p, filter_p, fields_ss, true, AddChangedMapTilesForDocument, &changed);
+
+			FreeCopiedString (geo_s);
+		}		/* if (geo_s) */
+
+	return success_flag;
+}
+
+
+bool InvalidateMapTiles (MapTiles *tiles_p, const json_t *changed_tiles_p)
+{
+	bool success_flag = true;
+	const char *key_s;
+	json_t *value_p;
+	json_t *keys_p = json_array ();
+	size_t num_keys = json_object_size (changed_tiles_p);
+	size_t i = 0;
+
+	if (!keys_p)
+		{
+			return false;
+		}
+
+	pthread_mutex_lock (& (tiles_p -> mts_mutex));
+
+	json_object_foreach ((json_t *) changed_tiles_p, key_s, value_p)
+		{
+			if (json_array_append_new (keys_p, json_string (key_s)) != 0)
+				{
+					success_flag = false;
+				}
+
+			++ i;
+
+			/* Remove the tiles in batches to keep each delete a reasonable size */
+			if ((json_array_size (keys_p) == S_INVALIDATE_BATCH_SIZE) || (i == num_keys))
+				{
+					json_t *selector_p = json_pack ("{s:{s:O}}", S_TILE_S, "$in", keys_p);
+
+					if (selector_p)
+						{
+							bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+							if (selector_bson_p)
+								{
+									bson_error_t error;
+
+									if (!mongoc_collection_delete_many (tiles_p -> mts_tiles_tool_p -> mt_collection_p, selector_bson_p, NULL, NULL, &error))
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to remove changed map tiles: %s", error.message);
+											success_flag = false;
+										}
+
+									bson_destroy (selector_bson_p);
+								}
+							else
+								{
+									success_flag = false;
+								}
+
+							json_decref (selector_p);
+						}
+					else
+						{
+							success_flag = false;
+						}
+
+					json_array_clear (keys_p);
+				}
+		}		/* json_object_foreach ((json_t *) changed_tiles_p, key_s, value_p) */
+
+	pthread_mutex_unlock (& (tiles_p -> mts_mutex));
+
+	json_decref (keys_p);
+
+	return success_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool AddChangedMapTilesForDocument (json_t *doc_p, void *data_p)
+{
+	ChangedTiles *changed_p = (ChangedTiles *) data_p;
+	const json_t *sample_p = json_object_get (doc_p, PG_SAMPLE_S);
+
+	if (sample_p)
+		{
+			return AddChangedMapTiles (changed_p -> ct_tiles_p, changed_p -> ct_changed_tiles_p, sample_p);
+		}
+
+	return true;
+}
+
+
+static bool ParseTile (const char *tile_s, const uint32 max_zoom, uint32 *zoom_p, uint32 *x_p, uint32 *y_p)
+{
+	char extra;
+
+	if (sscanf (tile_s, "%u/%u/%u%c", zoom_p, x_p, y_p, &extra) == 3)
+		{
+			if (*zoom_p <= max_zoom)
+				{
+					const uint32 num_tiles = 1 << *zoom_p;
+
+					return ((*x_p < num_tiles) && (*y_p < num_tiles));
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * Get a stored tile if it was built today.
+ */
+static json_t *FindStoredTile (MapTiles *tiles_p, const char *key_s, const char *view_s, const char *today_s)
+{
+	json_t *tile_p = NULL;
+	json_t *selector_p = json_pack ("{s:s,s:s,s:s}", S_TILE_S, key_s, S_VIEW_S, view_s, S_BUILT_S, today_s);
+
+	if (selector_p)
+		{
+			bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+			if (selector_bson_p)
+				{
+					bson_t opts;
+					bson_t projection;
+
+					bson_init (&opts);
+					BSON_APPEND_INT64 (&opts, "limit", 1);
+
+					if (BSON_APPEND_DOCUMENT_BEGIN (&opts, "projection", &projection))
+						{
+							mongoc_cursor_t *cursor_p;
+
+							BSON_APPEND_INT32 (&projection, MONGO_ID_S, 0);
+							bson_append_document_end (&opts, &projection);
+
+							cursor_p = mongoc_collection_find_with_opts (tiles_p -> mts_tiles_tool_p -> mt_collection_p, selector_bson_p, &opts, NULL);
+
+							if (cursor_p)
+								{
+									const bson_t *doc_p;
+									bson_error_t error;
+
+									if (mongoc_cursor_next (cursor_p, &doc_p))
+										{
+											tile_p = ConvertBSONToJSON (doc_p);
+										}
+									else if (mongoc_cursor_error (cursor_p, &error))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to look up map tile %s: %s", key_s, error.message);
+										}
+
+									mongoc_cursor_destroy (cursor_p);
+								}
+						}
+
+					bson_destroy (&opts);
+
+					bson_destroy (selector_bson_p);
+				}
+
+			json_decref (selector_p);
+		}		/* if (selector_p) */
+
+	return tile_p;
+}
+
+
+static json_t *BuildTile (MapTiles *tiles_p, const uint32 zoom, const uint32 x, const uint32 y, const bool preview_flag)
+{
+	json_t *tile_p = NULL;
+	const uint32 grid_size = tiles_p -> mts_grid_size;
+	TileCell *cells_p = (TileCell *) AllocMemoryArray (grid_size * grid_size, sizeof (TileCell));
+
+	if (cells_p)
+		{
+			char *geo_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_GEO_S, NULL);
+
+			if (geo_s)
+				{
+					/* The tiles at the lowest zoom levels cover too much of the globe for a polygon */
+					json_t *filter_p = (zoom >= 2) ? GetTileFilter (zoom, x, y) : json_pack ("{s:{s:b}}", geo_s, "$exists", true);
+
+					if (filter_p)
+						{
+							const char *fields_ss [] = { geo_s, NULL };
+							TileBuilder builder;
+
+							memset (cells_p, 0, grid_size * grid_size * sizeof (TileCell));
+
+							builder.tb_zoom = zoom;
+							builder.tb_x = x;
+							builder.tb_y = y;
+							builder.tb_grid_size = grid_size;
+							builder.tb_cells_p = cells_p;
+
+							if (ForEachLiveDocumentMatchingFilter (tiles_p -> mts_samples_tool_p, filter_p, fields_ss, preview_flag, AddSampleToTile, &builder))
+								{
+									json_t *clusters_p = GetTileClusters (&builder);
+
+									if (clusters_p)
+										{
+											tile_p = json_pack ("{s:i,s:i,s:i,s:o}", "z", (int) zoom, "x", (int) x, "y", (int) y, S_CLUSTERS_S, clusters_p);
+										}
+								}
+
+							json_decref (filter_p);
+						}		/* if (filter_p) */
+
+					FreeCopiedString (geo_s);
+				}		/* if (geo_s) */
+
+			FreeMemory (cells_p);
+		}		/* if (cells_p) */
+
+	return tile_p;
+}
+
+
+static bool StoreTile (MapTiles *tiles_p, const char *key_s, const char *view_s, const char *today_s, json_t *tile_p)
+{
+	bool success_flag = false;
+	json_t *selector_p = json_pack ("{s:s,s:s}", S_TILE_S, key_s, S_VIEW_S, view_s);
+
+	if (selector_p)
+		{
+			json_t *doc_p = json_deep_copy (tile_p);
+
+			if (doc_p)
+				{
+					if ((json_object_update (doc_p, selector_p) == 0) && (json_object_set_new (doc_p, S_BUILT_S, json_string (today_s)) == 0))
+						{
+							bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+							if (selector_bson_p)
+								{
+									bson_t *doc_bson_p = ConvertJSONToBSON (doc_p);
+
+									if (doc_bson_p)
+										{
+											bson_t opts;
+											bson_error_t error;
+
+											bson_init (&opts);
+											BSON_APPEND_BOOL (&opts, "upsert", true);
+
+											if (mongoc_collection_replace_one (tiles_p -> mts_tiles_tool_p -> mt_collection_p, selector_bson_p, doc_bson_p, &opts, NULL, &error))
+												{
+													success_flag = true;
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store map tile %s: %s", key_s, error.message);
+												}
+
+											bson_destroy (&opts);
+
+											bson_destroy (doc_bson_p);
+										}
+
+									bson_destroy (selector_bson_p);
+								}
+						}
+
+					json_decref (doc_p);
+				}		/* if (doc_p) */
+
+			json_decref (selector_p);
+		}		/* if (selector_p) */
+
+	return success_flag;
+}
+
+
+/*
+ * Get a geospatial query for the samples in a tile. The polygon's edges
+ * are geodesics rather than lines of latitude, so the east-west edges
+ * are split into short sections and the whole polygon is padded out
+ * to make sure that it covers the tile. Samples outside of the tile
+ * itself are then skipped when the clusters are counted.
+ */
+static json_t *GetTileFilter (const uint32 zoom, const uint32 x, const uint32 y)
+{
+	json_t *filter_p = NULL;
+	json_t *ring_p = json_array ();
+
+	if (ring_p)
+		{
+			const double64 num_tiles = (double64) (1 << zoom);
+			const double64 tile_width = 360.0 / num_tiles;
+			double64 west = (x / num_tiles) * 360.0 - 180.0;
+			double64 east = west + tile_width;
+			double64 north = GetTileLatitude ((double64) y, zoom);
+			double64 south = GetTileLatitude ((double64) (y + 1), zoom);
+			const double64 lon_padding = tile_width / 8.0;
+			const double64 lat_padding = (north - south) / 8.0;
+			bool success_flag = true;
+			uint32 i;
+
+			west = (west - lon_padding < -180.0) ? -180.0 : west - lon_padding;
+			east = (east + lon_padding > 180.0) ? 180.0 : east + lon_padding;
+			north = (north + lat_padding > 89.0) ? 89.0 : north + lat_padding;
+			south = (south - lat_padding < -89.0) ? -89.0 : south - lat_padding;
+
+			/* Go anticlockwise along the south edge then back along the north edge */
+			for (i = 0; (i <= S_NUM_EDGE_POINTS) && success_flag; ++ i)
+				{
+					const double64 longitude = west + (east - west) * i / S_NUM_EDGE_POINTS;
+
+					success_flag = (json_array_append_new (ring_p, json_pack ("[f,f]", longitude, south)) == 0);
+				}
+
+			for (i = 0; (i <= S_NUM_EDGE_POINTS) && success_flag; ++ i)
+				{
+					const double64 longitude = east - (east - west) * i / S_NUM_EDGE_POINTS;
+
+					success_flag = (json_array_append_new (ring_p, json_pack ("[f,f]", longitude, north)) == 0);
+				}
+
+			/* Close the ring */
+			if (success_flag)
+				{
+					success_flag = (json_array_append_new (ring_p, json_pack ("[f,f]", west, south)) == 0);
+				}
+
+			if (success_flag)
+				{
+					char *geo_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_GEO_S, NULL);
+
+					if (geo_s)
+						{
+							filter_p = json_pack ("{s:{s:{s:{s:s,s:[O]}}}}", geo_s, "$geoWithin", "$geometry", "type", "Polygon", "coordinates", ring_p);
+							FreeCopiedString (geo_s);
+						}
+				}
+
+			json_decref (ring_p);
+		}		/* if (ring_p) */
+
+	return filter_p;
+}
+
+
+static bool AddSampleToTile (json_t *doc_p, void *data_p)
+{
+	TileBuilder *builder_p = (TileBuilder *) data_p;
+	double64 longitude;
+	double64 latitude;
+
+	if (GetPointCoordinates (json_object_get (doc_p, PG_SAMPLE_S), &longitude, &latitude))
+		{
+			double64 x;
+			double64 y;
+
+			GetTilePosition (longitude, latitude, builder_p -> tb_zoom, &x, &y);
+
+			if ((GetTileIndex (x, builder_p -> tb_zoom) == builder_p -> tb_x) && (GetTileIndex (y, builder_p -> tb_zoom) == builder_p -> tb_y))
+				{
+					const uint32 grid_size = builder_p -> tb_grid_size;
+					uint32 col = (uint32) ((x - builder_p -> tb_x) * grid_size);
+					uint32 row = (uint32) ((y - builder_p -> tb_y) * grid_size);
+					TileCell *cell_p;
+
+					if (col >= grid_size)
+						{
+							col = grid_size - 1;
+						}
+
+					if (row >= grid_size)
+						{
+							row = grid_size - 1;
+						}
+
+					cell_p = builder_p -> tb_cells_p + (row * grid_size) + col;
+
+					++ (cell_p -> tc_count);
+					cell_p -> tc_longitude_sum += longitude;
+					cell_p -> tc_latitude_sum += latitude;
+				}
+		}
+
+	return true;
+}
+
+
+static json_t *GetTileClusters (const TileBuilder *builder_p)
+{
+	json_t *clusters_p = json_array ();
+
+	if (clusters_p)
+		{
+			const uint32 num_cells = builder_p -> tb_grid_size * builder_p -> tb_grid_size;
+			const TileCell *cell_p = builder_p -> tb_cells_p;
+			uint32 i;
+
+			for (i = 0; i < num_cells; ++ i, ++ cell_p)
+				{
+					if (cell_p -> tc_count > 0)
+						{
+							json_t *cluster_p = json_pack ("{s:[f,f],s:i}", "coordinates", cell_p -> tc_longitude_sum / cell_p -> tc_count, cell_p -> tc_latitude_sum / cell_p -> tc_count, "count", (int) (cell_p -> tc_count));
+
+							if ((!cluster_p) || (json_array_append_new (clusters_p, cluster_p) != 0))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add cluster to map tile");
+									json_decref (clusters_p);
+
+									return NULL;
+								}
+						}
+				}
+		}
+
+	return clusters_p;
+}
+
+
+static bool GetPointCoordinates (const json_t *sample_p, double64 *longitude_p, double64 *latitude_p)
+{
+	const json_t *geo_p = json_object_get (sample_p, PG_GEO_S);
+
+	if (geo_p)
+		{
+			const json_t *coordinates_p = json_object_get (geo_p, "coordinates");
+
+			if (json_is_array (coordinates_p) && (json_array_size (coordinates_p) == 2))
+				{
+					const json_t *longitude_value_p = json_array_get (coordinates_p, 0);
+					const json_t *latitude_value_p = json_array_get (coordinates_p, 1);
+
+					if (json_is_number (longitude_value_p) && json_is_number (latitude_value_p))
+						{
+							*longitude_p = json_number_value (longitude_value_p);
+							*latitude_p = json_number_value (latitude_value_p);
+
+							return true;
+						}
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * Get the position of a point in the web map tiles at a zoom level. The
+ * whole part of each value is the tile index and the fraction is where
+ * the point is within that tile.
+ */
+static void GetTilePosition (const double64 longitude, const double64 latitude, const uint32 zoom, double64 *x_p, double64 *y_p)
+{
+	const double64 num_tiles = (double64) (1 << zoom);
+	double64 radians;
+
+	if (latitude > S_MAX_LATITUDE)
+		{
+			radians = S_MAX_LATITUDE * M_PI / 180.0;
+		}
+	else if (latitude < -S_MAX_LATITUDE)
+		{
+			radians = -S_MAX_LATITUDE * M_PI / 180.0;
+		}
+	else
+		{
+			radians = latitude * M_PI / 180.0;
+		}
+
+	*x_p = ((longitude + 180.0) / 360.0) * num_tiles;
+	*y_p = ((1.0 - log (tan (radians) + (1.0 / cos (radians))) / M_PI) / 2.0) * num_tiles;
+}
+
+
+static uint32 GetTileIndex (const double64 position, const uint32 zoom)
+{
+	const uint32 num_tiles = 1 << zoom;
+
+	if (position <= 0.0)
+		{
+			return 0;
+		}
+	else if (position >= (double64) num_tiles)
+		{
+			return num_tiles - 1;
+		}
+
+	return (uint32) position;
+}
+
+
+static double64 GetTileLatitude (const double64 y, const uint32 zoom)
+{
+	const double64 n = M_PI * (1.0 - (2.0 * y / (double64) (1 << zoom)));
+
+	return atan (sinh (n)) * 180.0 / M_PI;
+}
+
+
+static char *GetTileKey (const uint32 zoom, const uint32 x, const uint32 y)
+{
+	char buffer_s [64];
+
+	sprintf (buffer_s, UINT32_FMT "/" UINT32_FMT "/" UINT32_FMT, zoom, x, y);
+
+	return EasyCopyToNewString (buffer_s);
+}
@@ -0,0 +1,342 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * mongo_tool_pool.c
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mongo_tool_pool.h"
+#include "memory_allocations.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define MONGO_TOOL_POOL_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define MONGO_TOOL_POOL_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+struct MongoToolPool
+{
+	MongoClientManager *mtp_mongo_manager_p;
+
+	/* The MongoTools that have been created so far */
+	MongoTool **mtp_tools_pp;
+
+	/* Whether each of the created MongoTools is checked out */
+	bool *mtp_in_use_p;
+
+	uint32 mtp_size;
+
+	uint32 mtp_num_tools;
+
+	uint32 mtp_num_in_use;
+
+	/* The number of milliseconds to wait for a free MongoTool, 0 for no limit */
+	uint32 mtp_wait_timeout;
+
+	pthread_mutex_t mtp_mutex;
+
+	/* Signalled when a MongoTool is checked back in */
+	pthread_cond_t mtp_free_cond;
+
+	/* Utilisation counts since the pool was created */
+	json_int_t mtp_num_checkouts;
+
+	json_int_t mtp_num_waits;
+
+	json_int_t mtp_num_timeouts;
+
+	json_int_t mtp_total_wait_time;
+
+	uint32 mtp_peak_in_use;
+};
+
+
+static MongoTool *GetFreeMongoTool (MongoToolPool *pool_p);
+
+static json_int_t GetElapsedMilliseconds (const struct timespec *start_p);
+
+
+MongoToolPool *AllocateMongoToolPool (MongoClientManager *mongo_manager_p, const uint32 size, const uint32 wait_timeout)
+{
+	if (size > 0)
+		{
+			MongoToolPool *pool_p = (MongoToolPool *) AllocMemory (sizeof (MongoToolPool));
+
+			if (pool_p)
+				{
+					pool_p -> mtp_tools_pp = (MongoTool **) AllocMemoryArray (size, sizeof (MongoTool *));
+
+					if (pool_p -> mtp_tools_pp)
+						{
+							pool_p -> mtp_in_use_p = (bool *) AllocMemoryArray (size, sizeof (bool));
+
+							if (pool_p -> mtp_in_use_p)
+								{
+									pool_p -> mtp_mongo_manager_p = mongo_manager_p;
+									pool_p -> mtp_size = size;
+									pool_p -> mtp_num_tools = 0;
+									pool_p -> mtp_num_in_use = 0;
+									pool_p -> mtp_wait_timeout = wait_timeout;
+									pool_p -> mtp_num_checkouts = 0;
+									pool_p -> mtp_num_waits = 0;
+									pool_p -> mtp_num_timeouts = 0;
+									pool_p -> mtp_total_wait_time = 0;
+									pool_p -> mtp_peak_in_use = 0;
+
+									pthread_mutex_init (& (pool_p -> mtp_mutex), NULL);
+									pthread_cond_init (& (pool_p -> mtp_free_cond), NULL);
+
+									return pool_p;
+								}
+
+							FreeMemory (pool_p -> mtp_tools_pp);
+						}
+
+					FreeMemory (pool_p);
+				}		/* if (pool_p) */
+		}
+
+	return NULL;
+}
+
+
+void FreeMongoToolPool (MongoToolPool *pool_p)
+{
+	uint32 i;
+
+	if (pool_p -> mtp_num_in_use > 0)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, UINT32_FMT " MongoTools are still checked out as the pool is freed", pool_p -> mtp_num_in_use);
+		}
+
+	for (i = 0; i < pool_p -> mtp_num_tools; ++ i)
+		{
+			FreeMongoTool (* ((pool_p -> mtp_tools_pp) + i));
+		}
+
+	pthread_cond_destroy (& (pool_p -> mtp_free_cond));
+	pthread_mutex_destroy (& (pool_p -> mtp_mutex));
+
+	FreeMemory (pool_p -> mtp_in_use_p);
+	FreeMemory (pool_p -> mtp_tools_pp);
+	FreeMemory (pool_p);
+}
+
+
+MongoTool *CheckOutMongoTool (MongoToolPool *pool_p)
+{
+	MongoTool *tool_p = NULL;
+
+	pthread_mutex_lock (& (pool_p -> mtp_mutex));
+
+	tool_p = GetFreeMongoTool (pool_p);
+
+	if ((!tool_p) && (pool_p -> mtp_num_in_use == pool_p -> mtp_size))
+		{
+			struct timespec start;
+			struct timespec deadline;
+			int res = 0;
+
+			clock_gettime (CLOCK_REALTIME, &start);
+
+			deadline = start;
+			deadline.tv_sec += pool_p -> mtp_wait_timeout / 1000;
+			deadline.tv_nsec += (long) (pool_p -> mtp_wait_timeout % 1000) * 1000000L;
+
+			if (deadline.tv_nsec >= 1000000000L)
+				{
+					++ (deadline.tv_sec);
+					deadline.tv_nsec -= 1000000000L;
+				}
+
+			++ (pool_p -> mtp_num_waits);
+
+			/*
+			 * Another thread may take the tool that was returned before we
+			 * wake up so keep waiting until one is free or we run out of time.
+			 */
+			while ((pool_p -> mtp_num_in_use == pool_p -> mtp_size) && (res != ETIMEDOUT))
+				{
+					if (pool_p -> mtp_wait_timeout > 0)
+						{
+							res = pthread_cond_timedwait (& (pool_p -> mtp_free_cond), & (pool_p -> mtp_mutex), &deadline);
+						}
+					else
+						{
+							pthread_cond_wait (& (pool_p -> mtp_free_cond), & (pool_p -> mtp_mutex));
+						}
+				}
+
+			pool_p -> mtp_total_wait_time += GetElapsedMilliseconds (&start);
+
+			if (pool_p -> mtp_num_in_use < pool_p -> mtp_size)
+				{
+					tool_p = GetFreeMongoTool (pool_p);
+				}
+			else
+				{
+					++ (pool_p -> mtp_num_timeouts);
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Timed out after " UINT32_FMT " ms waiting for one of the " UINT32_FMT " MongoTools to be returned", pool_p -> mtp_wait_timeout, pool_p -> mtp_size);
+				}
+		}
+
+	pthread_mutex_unlock (& (pool_p -> mtp_mutex));
+
+	return tool_p;
+}
+
+
+void CheckInMongoTool (MongoToolPool *pool_p, MongoTool *tool_p)
+{
+	uint32 i;
+	bool found_flag = false;
+
+	pthread_mutex_lock (& (pool_p -> mtp_mutex));
+
+	for (i = 0; (i < pool_p -> mtp_num_tools) && (!found_flag); ++ i)
+		{
+			if (* ((pool_p -> mtp_tools_pp) + i) == tool_p)
+				{
+					if (* ((pool_p -> mtp_in_use_p) + i))
+						{
+							* ((pool_p -> mtp_in_use_p) + i) = false;
+							-- (pool_p -> mtp_num_in_use);
+
+							pthread_cond_signal (& (pool_p -> mtp_free_cond));
+						}
+
+					found_flag = true;
+				}
+		}
+
+	pthread_mutex_unlock (& (pool_p -> mtp_mutex));
+
+	if (!found_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "MongoTool %p is not from this pool", (void *) tool_p);
+		}
+}
+
+
+bool AddMongoToolPoolStatsToJSON (MongoToolPool *pool_p, json_t *json_p)
+{
+	bool success_flag = false;
+	json_error_t err;
+	json_t *stats_json_p;
+
+	pthread_mutex_lock (& (pool_p -> mtp_mutex));
+
+	stats_json_p = json_pack_ex (&err, 0, "{s:i,s:i,s:i,s:i,s:I,s:I,s:I,s:I}",
+															 "size", (int) pool_p -> mtp_size,
+															 "connections", (int) pool_p -> mtp_num_tools,
+															 "in use", (int) pool_p -> mtp_num_in_use,
+															 "peak in use", (int) pool_p -> mtp_peak_in_use,
+															 "checkouts", pool_p -> mtp_num_checkouts,
+															 "waits", pool_p -> mtp_num_waits,
+															 "timeouts", pool_p -> mtp_num_timeouts,
+															 "total wait ms", pool_p -> mtp_total_wait_time);
+
+	pthread_mutex_unlock (& (pool_p -> mtp_mutex));
+
+	if (stats_json_p)
+		{
+			if (json_object_set_new (json_p, "connection pool", stats_json_p) == 0)
+				{
+					success_flag = true;
+				}
+			else
+				{
+					json_decref (stats_json_p);
+				}
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create connection pool stats: %s", err.text);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Take the first MongoTool that isn't in use, creating a new one if they
+ * are all taken and the pool isn't full yet. This must be called with
+ * the pool's mutex held.
+ */
+static MongoTool *GetFreeMongoTool (MongoToolPool *pool_p)
+{
+	MongoTool *tool_p = NULL;
+	uint32 i;
+
+	for (i = 0; (i < pool_p -> mtp_num_tools) && (!tool_p); ++ i)
+		{
+			if (! (* ((pool_p -> mtp_in_use_p) + i)))
+				{
+					tool_p = * ((pool_p -> mtp_tools_pp) + i);
+					* ((pool_p -> mtp_in_use_p) + i) = true;
+				}
+		}
+
+	if ((!tool_p) && (pool_p -> mtp_num_tools < pool_p -> mtp_size))
+		{
+			tool_p = AllocateMongoTool (NULL, pool_p -> mtp_mongo_manager_p);
+
+			if (tool_p)
+				{
+					* ((pool_p -> mtp_tools_pp) + (pool_p -> mtp_num_tools)) = tool_p;
+					* ((pool_p -> mtp_in_use_p) + (pool_p -> mtp_num_tools)) = true;
+					++ (pool_p -> mtp_num_tools);
+
+					#if MONGO_TOOL_POOL_DEBUG >= STM_LEVEL_FINE
+					PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Created MongoTool " UINT32_FMT " of " UINT32_FMT, pool_p -> mtp_num_tools, pool_p -> mtp_size);
+					#endif
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create MongoTool for the pool");
+				}
+		}
+
+	if (tool_p)
+		{
+			++ (pool_p -> mtp_num_in_use);
+			++ (pool_p -> mtp_num_checkouts);
+
+			if (pool_p -> mtp_num_in_use > pool_p -> mtp_peak_in_use)
+				{
+					pool_p -> mtp_peak_in_use = pool_p -> mtp_num_in_use;
+				}
+		}
+
+	return tool_p;
+}
+
+
+static json_int_t GetElapsedMilliseconds (const struct timespec *start_p)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+
+	return ((json_int_t) (now.tv_sec - start_p -> tv_sec)) * 1000 + (now.tv_nsec - start_p -> tv_nsec) / 1000000L;
+}
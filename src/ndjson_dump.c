@@ -0,0 +1,225 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * ndjson_dump.c
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "ndjson_dump.h"
+#include "live_dates.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "streams.h"
+#include "jansson.h"
+
+
+typedef struct NDJSONWriter
+{
+	FILE *nw_out_f;
+	uint32 nw_num_docs;
+} NDJSONWriter;
+
+
+static bool WriteNDJSONLine (json_t *doc_p, void *data_p);
+
+static char *GetDumpFilename (const char *directory_s, const char *name_s);
+
+static bool IsDumpFilename (const char *name_s);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+bool WriteNDJSONDump (MongoTool *tool_p, const bool preview_flag, FILE *out_f, uint32 *num_docs_p)
+{
+	NDJSONWriter writer;
+	bool success_flag;
+
+	writer.nw_out_f = out_f;
+	writer.nw_num_docs = 0;
+
+	success_flag = ForEachLiveDocument (tool_p, NULL, NULL, preview_flag, NULL, WriteNDJSONLine, &writer);
+
+	if (num_docs_p)
+		{
+			*num_docs_p = writer.nw_num_docs;
+		}
+
+	return success_flag;
+}
+
+
+char *SpoolNDJSONDump (MongoTool *tool_p, const bool preview_flag, const char *directory_s, const char *name_s, uint32 *num_docs_p)
+{
+	char *filename_s = GetDumpFilename (directory_s, name_s);
+
+	if (filename_s)
+		{
+			char *part_filename_s = ConcatenateStrings (filename_s, ".part");
+
+			if (part_filename_s)
+				{
+					bool success_flag = false;
+					FILE *out_f = fopen (part_filename_s, "w");
+
+					if (out_f)
+						{
+							success_flag = WriteNDJSONDump (tool_p, preview_flag, out_f, num_docs_p);
+
+							if (fclose (out_f) != 0)
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to close \"%s\": %s", part_filename_s, strerror (errno));
+									success_flag = false;
+								}
+
+							if (success_flag)
+								{
+									if (rename (part_filename_s, filename_s) != 0)
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to rename \"%s\" to \"%s\": %s", part_filename_s, filename_s, strerror (errno));
+											success_flag = false;
+										}
+								}
+
+							if (!success_flag)
+								{
+									remove (part_filename_s);
+								}
+
+						}		/* if (out_f) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to open \"%s\" for writing: %s", part_filename_s, strerror (errno));
+						}
+
+					FreeCopiedString (part_filename_s);
+
+					if (success_flag)
+						{
+							return filename_s;
+						}
+
+				}		/* if (part_filename_s) */
+
+			FreeCopiedString (filename_s);
+		}		/* if (filename_s) */
+
+	return NULL;
+}
+
+
+bool RemoveExpiredNDJSONDumps (const char *directory_s, const uint32 retention_time)
+{
+	bool success_flag = true;
+	DIR *dir_p = opendir (directory_s);
+
+	if (dir_p)
+		{
+			const time_t now = time (NULL);
+			const size_t l = strlen (directory_s);
+			const char *sep_s = ((l > 0) && (directory_s [l - 1] == '/')) ? "" : "/";
+			struct dirent *entry_p;
+
+			while ((entry_p = readdir (dir_p)) != NULL)
+				{
+					if (IsDumpFilename (entry_p -> d_name))
+						{
+							char *filename_s = ConcatenateVarargsStrings (directory_s, sep_s, entry_p -> d_name, NULL);
+
+							if (filename_s)
+								{
+									struct stat info;
+
+									if ((stat (filename_s, &info) == 0) && (S_ISREG (info.st_mode)) && (difftime (now, info.st_mtime) >= (double) retention_time))
+										{
+											if (remove (filename_s) != 0)
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to remove expired dump \"%s\": %s", filename_s, strerror (errno));
+													success_flag = false;
+												}
+										}
+
+									FreeCopiedString (filename_s);
+								}
+							else
+								{
+									success_flag = false;
+								}
+						}
+
+				}		/* while ((entry_p = readdir (dir_p)) != NULL) */
+
+			closedir (dir_p);
+		}		/* if (dir_p) */
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open \"%s\" to remove expired dumps: %s", directory_s, strerror (errno));
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool WriteNDJSONLine (json_t *doc_p, void *data_p)
+{
+	NDJSONWriter *writer_p = (NDJSONWriter *) data_p;
+
+	if ((json_dumpf (doc_p, writer_p -> nw_out_f, JSON_COMPACT) == 0) && (fputc ('\n', writer_p -> nw_out_f) != EOF))
+		{
+			++ (writer_p -> nw_num_docs);
+			return true;
+		}
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write document " UINT32_FMT " of dump", writer_p -> nw_num_docs);
+	return false;
+}
+
+
+static char *GetDumpFilename (const char *directory_s, const char *name_s)
+{
+	const size_t l = strlen (directory_s);
+	const char *sep_s = ((l > 0) && (directory_s [l - 1] == '/')) ? "" : "/";
+
+	return ConcatenateVarargsStrings (directory_s, sep_s, name_s, PG_NDJSON_EXTENSION_S, NULL);
+}
+
+
+/*
+ * Only the files that dumps write, either complete or partial, are removed
+ * so that anything else kept in the directory is left alone.
+ */
+static bool IsDumpFilename (const char *name_s)
+{
+	const char * const part_s = PG_NDJSON_EXTENSION_S ".part";
+	const char *extension_s = strstr (name_s, PG_NDJSON_EXTENSION_S);
+
+	return ((extension_s != NULL) && (extension_s != name_s) && ((strcmp (extension_s, PG_NDJSON_EXTENSION_S) == 0) || (strcmp (extension_s, part_s) == 0)));
+}
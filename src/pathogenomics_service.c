@@ -37,6 +37,21 @@
 #include "io_utils.h"
 #include "audit.h"
 #include "uuid_util.h"
+#include "import_session.h"
+#include "row_source.h"
+#include "async_jobs.h"
+#include "index_manager.h"
+#include "live_dates.h"
+#include "search_page.h"
+#include "ndjson_dump.h"
+#include "geojson_results.h"
+#include "aggregate_counts.h"
+#include "map_tiles.h"
+#include "rollups.h"
+#include "mongo_tool_pool.h"
+#include "upload_checkpoints.h"
+#include "column_schema.h"
+#include "date_normaliser.h"
 
 
 #include "char_parameter.h"
@@ -55,6 +70,9 @@
 
 static NamedParameterType PGS_UPDATE = { "Update", PT_JSON };
 static NamedParameterType PGS_QUERY = { "Search", PT_JSON };
+static NamedParameterType PGS_AGGREGATE = { "Aggregate", PT_JSON };
+static NamedParameterType PGS_MAP_TILE = { "Map tile", PT_STRING };
+static NamedParameterType PGS_SUMMARY = { "Summary", PT_JSON };
 static NamedParameterType PGS_REMOVE = { "Delete", PT_JSON };
 static NamedParameterType PGS_DUMP = { "Dump data", PT_BOOLEAN };
 static NamedParameterType PGS_PREVIEW = { "Preview", PT_BOOLEAN };
@@ -62,15 +80,135 @@ static NamedParameterType PGS_COLLECTION = { "Collection", PT_STRING };
 static NamedParameterType PGS_DELIMITER = { "Data delimiter", PT_CHAR };
 static NamedParameterType PGS_FILE = { "Upload", PT_TABLE};
 static NamedParameterType PGS_STAGE_TIME = { "Days to stage", PT_SIGNED_INT };
-
-
-static const char *s_data_names_pp [PD_NUM_TYPES];
+static NamedParameterType PGS_ASYNC = { "Run in background", PT_BOOLEAN };
+static NamedParameterType PGS_JOB_ID = { "Job id", PT_STRING };
+static NamedParameterType PGS_UPLOAD_ID = { "Upload id", PT_STRING };
+static NamedParameterType PGS_VALIDATE_ONLY = { "Validate only", PT_BOOLEAN };
+static NamedParameterType PGS_DATE_FORMAT = { "Date format", PT_STRING };
 
 
 static const char S_DEFAULT_COLUMN_DELIMITER =  '|';
 
 static const int32 S_DEFAULT_STAGE_TIME = 30;
 
+static const uint32 S_DEFAULT_BULK_BATCH_SIZE = 1000;
+
+static const uint32 S_DEFAULT_NUM_IMPORT_WORKERS = 1;
+
+static const uint32 S_DEFAULT_MERGE_PREFETCH_SIZE = 1000;
+
+/* By default, searches return all of their results in one go */
+static const uint32 S_DEFAULT_SEARCH_PAGE_LIMIT = 0;
+
+/* Background jobs are opt-in so by default every request runs synchronously */
+static const uint32 S_DEFAULT_NUM_ASYNC_WORKERS = 0;
+
+/* Keep the results of background jobs for a day */
+static const uint32 S_DEFAULT_ASYNC_RETENTION_TIME = 86400;
+
+/* Keep dump files for a day */
+static const uint32 S_DEFAULT_DUMP_RETENTION_TIME = 86400;
+
+static const uint32 S_DEFAULT_GEOCODE_CACHE_SIZE = 10000;
+
+/*
+ * Retry addresses that the geocoder couldn't find after 15 minutes. The
+ * geocoder doesn't say whether an address wasn't found or whether it
+ * hit a quota, rate limit or network error so this has to be short
+ * enough for the temporary failures to clear.
+ */
+static const uint32 S_DEFAULT_GEOCODE_NEGATIVE_TTL = 900;
+
+static const uint32 S_DEFAULT_MAP_TILES_MAX_ZOOM = 12;
+
+static const uint32 S_DEFAULT_MAP_TILES_GRID_SIZE = 8;
+
+static const uint32 S_DEFAULT_MONGO_POOL_SIZE = 8;
+
+/* Wait for up to 30 seconds for a database connection to be returned to the pool */
+static const uint32 S_DEFAULT_MONGO_POOL_WAIT_TIMEOUT = 30000;
+
+/* The number of rows of a checkpointed upload between each checkpoint */
+static const uint32 S_DEFAULT_UPLOAD_CHECKPOINT_INTERVAL = 1000;
+
+/* Beyond this, the tile coordinates no longer fit into 32 bits */
+static const uint32 S_MAX_MAP_TILES_ZOOM = 24;
+
+/* The names used to select the index specifications for the service's own collections */
+static const char * const S_MAP_TILES_DATA_NAME_S = "tiles";
+
+static const char * const S_ROLLUPS_DATA_NAME_S = "rollups";
+
+static const char * const S_ROLLUP_SOURCES_DATA_NAME_S = "rollup_sources";
+
+static const char * const S_UPLOAD_CHECKPOINTS_DATA_NAME_S = "upload_checkpoints";
+
+/* The key that must be set for a Delete to use a selector that matches every document */
+static const char * const S_ALLOW_UNBOUNDED_S = "allow_unbounded";
+
+/* The key in the metadata of the jobs that are run in the background */
+static const char * const S_BACKGROUND_S = "background";
+
+
+/*
+ * The operations that a request can run.
+ */
+typedef enum
+{
+	PO_NONE,
+	PO_DUMP,
+	PO_IMPORT_TABLE,
+	PO_UPDATE,
+	PO_SEARCH,
+	PO_AGGREGATE,
+	PO_MAP_TILE,
+	PO_SUMMARY,
+	PO_DELETE
+} PathogenomicsOperation;
+
+
+/*
+ * The details of a request taken from its ParameterSet so that it can
+ * be run either straight away or later on by a background job.
+ */
+typedef struct PathogenomicsRequest
+{
+	PathogenomicsOperation pr_operation;
+
+	PathogenomicsData pr_collection_type;
+
+	const char *pr_collection_name_s;
+
+	bool pr_preview_flag;
+
+	char pr_delimiter;
+
+	int32 pr_stage_time;
+
+	/* The uploaded table for PO_IMPORT_TABLE or the tile for PO_MAP_TILE */
+	char *pr_table_s;
+
+	/* The json value for PO_UPDATE, PO_SEARCH, PO_AGGREGATE, PO_SUMMARY and PO_DELETE */
+	json_t *pr_json_p;
+
+	/* The id to checkpoint PO_IMPORT_TABLE and PO_UPDATE under so that they can be resumed */
+	char *pr_upload_id_s;
+
+	/* Should PO_IMPORT_TABLE and PO_UPDATE just check their rows rather than store them? */
+	bool pr_validate_flag;
+
+	/* The order of the day and month in the numeric dates of PO_IMPORT_TABLE and PO_UPDATE */
+	DateOrder pr_date_order;
+
+	/* The id of the job that the client was given, which is used to name any dump file */
+	uuid_t pr_job_id;
+
+	/* Are pr_table_s, pr_json_p and pr_upload_id_s our own copies? */
+	bool pr_owns_values_flag;
+
+	PathogenomicsServiceData *pr_data_p;
+} PathogenomicsRequest;
+
 /*
  * STATIC PROTOTYPES
  */
@@ -97,36 +235,102 @@ static bool GetPathogenomicsServiceParameterTypesForNamedParameters (const Servi
 
 static PathogenomicsServiceData *AllocatePathogenomicsServiceData (void);
 
-static json_t *GetPathogenomicsServiceResults (Service *service_p, const uuid_t job_id);
-
 static bool ConfigurePathogenomicsService (PathogenomicsServiceData *data_p, GrassrootsServer *grassroots_p);
 
+static void ReconcileServiceIndexes (PathogenomicsServiceData *data_p, const json_t *specs_p, const char **extra_collections_ss);
+
+static void ReconcileCollectionIndexes (PathogenomicsServiceData *data_p, const json_t *specs_p, const char *collection_s, const char **data_names_ss);
+
 
 static void FreePathogenomicsServiceData (PathogenomicsServiceData *data_p);
 
 static bool ClosePathogenomicsService (Service *service_p);
 
 
-static uint32 InsertData (MongoTool *tool_p, ServiceJob *job_p, const json_t *values_p, const PathogenomicsData collection_type, const uint32 stage_time, PathogenomicsServiceData *service_data_p);
+static uint32 InsertData (MongoTool *tool_p, ServiceJob *job_p, RowSource *source_p, const PathogenomicsData collection_type, const uint32 stage_time, const char *upload_id_s, const DateOrder date_order, PathogenomicsServiceData *service_data_p);
+
+static uint32 ImportRowSource (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p, RowSource *source_p);
+
+static uint32 ValidateData (ServiceJob *job_p, RowSource *source_p, const PathogenomicsData collection_type, const DateOrder date_order);
+
+static int32 GetStageTime (ParameterSet *param_set_p, PathogenomicsServiceData *data_p);
+
+static void SetImportStatus (ServiceJob *job_p, const uint32 num_successes, const size_t num_rows);
 
 
 static OperationStatus SearchData (MongoTool *tool_p, ServiceJob *job_p, const json_t *data_p, const PathogenomicsData collection_type, PathogenomicsServiceData *service_data_p, const bool preview_flag);
 
+static bool AddContinuationTokenToJob (ServiceJob *job_p, const char *token_s);
+
+static OperationStatus AggregateData (MongoTool *tool_p, ServiceJob *job_p, const json_t *aggregate_p, PathogenomicsServiceData *service_data_p, const bool preview_flag);
+
+static OperationStatus MapTileData (ServiceJob *job_p, const char *tile_s, PathogenomicsServiceData *service_data_p, const bool preview_flag);
+
+static OperationStatus SummaryData (ServiceJob *job_p, const json_t *summary_p, PathogenomicsServiceData *service_data_p, const bool preview_flag);
+
+static bool AddSearchResults (ServiceJob *job_p, const json_t *raw_results_p, const uint32 offset);
+
+static bool AddGeoJSONSearchResults (ServiceJob *job_p, const json_t *raw_results_p, const char **properties_ss);
+
+static const char **GetFieldNames (const json_t *fields_p);
+
+
+static uint32 DeleteData (MongoTool *tool_p, ServiceJob *job_p, const json_t *data_p, const PathogenomicsData collection_type, PathogenomicsServiceData *service_data_p, uint32 *num_selectors_p);
+
+static json_t *GetDeleteSelectors (const json_t *data_p);
 
-static uint32 DeleteData (MongoTool *tool_p, ServiceJob *job_p, const json_t *data_p, const PathogenomicsData collection_type, PathogenomicsServiceData *service_data_p);
+static bool AddDeleteSelector (json_t *entries_p, const json_t *selector_p, const bool allow_flag);
+
+static bool IsBoundedSelector (const json_t *selector_p);
+
+static bool IsIdMatch (const json_t *value_p);
+
+static json_int_t GetDeletedCount (const bson_t *reply_p);
+
+static void AddDeleteResultsToJob (ServiceJob *job_p, json_t *results_p, const json_int_t num_deleted);
 
 static bool AddUploadParams (ServiceData *data_p, ParameterSet *param_set_p);
 
-static bool GetCollectionName (ParameterSet *param_set_p, PathogenomicsServiceData *data_p, const char **collection_name_ss, PathogenomicsData *collection_type_p);
+static bool AddBackgroundJobParams (ServiceData *data_p, ParameterSet *param_set_p);
+
+static bool InitPathogenomicsRequest (PathogenomicsRequest *request_p, ParameterSet *param_set_p, PathogenomicsServiceData *data_p);
+
+static PathogenomicsRequest *CopyPathogenomicsRequest (const PathogenomicsRequest *src_p);
+
+static void ClearPathogenomicsRequest (PathogenomicsRequest *request_p);
+
+static void FreePathogenomicsRequest (PathogenomicsRequest *request_p);
+
+static bool IsLongRunningOperation (const PathogenomicsOperation op);
+
+static void RunPathogenomicsRequest (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p);
+
+static void DumpData (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p);
+
+static void DumpDataToSpoolFile (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p);
+
+static uint32 ImportTable (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p);
+
+static void StartBackgroundJob (const PathogenomicsRequest *request_p, ServiceJob *job_p);
+
+static void AddBackgroundFlagToJob (ServiceJob *job_p);
 
-static bool AddLiveDateFiltering (json_t *record_p, const char * const date_s);
+static void RunBackgroundJob (void *task_p, ServiceJob *job_p);
 
+static void FreeBackgroundJob (void *task_p);
 
-static json_t *ConvertToResource (const size_t i, json_t *src_record_p);
+static void AddToolPoolStatsToJob (PathogenomicsServiceData *data_p, ServiceJob *job_p);
 
-static json_t *CopyValidRecord (const size_t i, json_t *src_record_p);
+static MongoTool *GetRequestMongoTool (PathogenomicsServiceData *data_p);
+
+static void ReleaseRequestMongoTool (PathogenomicsServiceData *data_p, MongoTool *tool_p, ServiceJob *job_p);
+
+static const char *GetPathogenomicsDataName (const PathogenomicsData data);
+
+static void GetBackgroundJob (PathogenomicsServiceData *data_p, const char *job_id_s, ServiceJob *job_p);
+
+static bool GetCollectionName (ParameterSet *param_set_p, PathogenomicsServiceData *data_p, const char **collection_name_ss, PathogenomicsData *collection_type_p);
 
-static json_t *FilterResultsByDate (json_t *src_results_p, const bool preview_flag, json_t *(convert_record_fn) (const size_t i, json_t *src_record_p));
 
 
 static ServiceMetadata *GetPathogenomicsServiceMetadata (Service *service_p);
@@ -164,27 +368,6 @@ void ReleaseServices (ServicesArray *services_p)
 }
 
 
-static json_t *GetPathogenomicsServiceResults (Service *service_p, const uuid_t job_id)
-{
-	PathogenomicsServiceData *data_p = (PathogenomicsServiceData *) (service_p -> se_data_p);
-	ServiceJob *job_p = GetServiceJobFromServiceJobSetById (service_p -> se_jobs_p, job_id);
-	json_t *res_p = NULL;
-
-	if (job_p)
-		{
-			if (job_p -> sj_status == OS_SUCCEEDED)
-				{
-					json_error_t error;
-					//const char *buffer_data_p = GetCurlToolData (data_p -> wsd_curl_data_p);
-					//res_p = json_loads (buffer_data_p, 0, &error);
-				}
-		}		/* if (job_p) */
-
-	return res_p;
-}
-
-
-
 static Service *GetPathogenomicsService (GrassrootsServer *grassroots_p)
 {
 
@@ -215,13 +398,6 @@ static Service *GetPathogenomicsService (GrassrootsServer *grassroots_p)
 																 NULL,
 																 grassroots_p))
 						{
-
-							*s_data_names_pp = PG_SAMPLE_S;
-							* (s_data_names_pp + 1) = PG_PHENOTYPE_S;
-							* (s_data_names_pp + 2) = PG_GENOTYPE_S;
-							* (s_data_names_pp + 3) = PG_FILES_S;
-
-
 							if (ConfigurePathogenomicsService (data_p, grassroots_p))
 								{
 									return service_p;
@@ -281,1249 +457,2750 @@ static bool ConfigurePathogenomicsService (PathogenomicsServiceData *data_p, Gra
 				} /* if (data_p -> psd_database_s) */
 
 			GetJSONInteger (service_config_p, "stage_time", & (data_p -> psd_default_stage_time));
-		}
-
-	return success_flag;
-}
-
 
-static PathogenomicsServiceData *AllocatePathogenomicsServiceData (void)
-{
-	PathogenomicsServiceData *data_p = (PathogenomicsServiceData *) AllocMemory (sizeof (PathogenomicsServiceData));
+			/*
+			 * Imports are sent as bulk operations of this many writes, a value of 0
+			 * writes each row individually.
+			 */
+			{
+				int batch_size;
 
-	if (data_p)
-		{
-			data_p -> psd_tool_p = NULL;
-			data_p -> psd_database_s = NULL;
-			data_p -> psd_default_stage_time = S_DEFAULT_STAGE_TIME;
+				if (GetJSONInteger (service_config_p, "bulk_batch_size", &batch_size))
+					{
+						data_p -> psd_bulk_batch_size = (batch_size > 0) ? (uint32) batch_size : 0;
+					}
+			}
 
-			memset (data_p -> psd_collection_ss, 0, PD_NUM_TYPES * sizeof (const char *));
+			GetJSONBoolean (service_config_p, "ordered_bulk_writes", & (data_p -> psd_ordered_bulk_writes_flag));
+			GetJSONBoolean (service_config_p, "partial_upserts", & (data_p -> psd_partial_upserts_flag));
+			GetJSONBoolean (service_config_p, "skip_unchanged_rows", & (data_p -> psd_skip_unchanged_rows_flag));
 
-			data_p -> psd_files_download_root_uri_s = NULL;
-		}
+			/*
+			 * Compile the column types and the columns that each data type
+			 * requires once rather than for every upload.
+			 */
+			if (success_flag)
+				{
+					data_p -> psd_column_schema_p = AllocateColumnSchema (json_object_get (service_config_p, "field_defs"));
 
-	return data_p;
-}
+					if (data_p -> psd_column_schema_p)
+						{
+							if (! (SetSampleRequiredColumns (data_p -> psd_column_schema_p) &&
+										 SetPhenotypeRequiredColumns (data_p -> psd_column_schema_p) &&
+										 SetGenotypeRequiredColumns (data_p -> psd_column_schema_p)))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set the required columns");
+									success_flag = false;
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to compile the column definitions");
+							success_flag = false;
+						}
+				}
 
+			/*
+			 * Cache the geocoded locations of sample addresses if we have
+			 * a collection to store them in.
+			 */
+			if (success_flag)
+				{
+					const char *cache_collection_s = GetJSONString (service_config_p, "geocode_cache_collection");
 
-static bool AddIndexes (PathogenomicsServiceData *data_p)
-{
-	bool success_flag = true;
-	bson_t keys;
-	bson_error_t error;
-	mongoc_index_opt_t opt;
+					if (cache_collection_s)
+						{
+							int cache_size = (int) S_DEFAULT_GEOCODE_CACHE_SIZE;
+							int negative_ttl = (int) S_DEFAULT_GEOCODE_NEGATIVE_TTL;
 
-	mongoc_index_opt_init (&opt);
+							GetJSONInteger (service_config_p, "geocode_cache_size", &cache_size);
+							GetJSONInteger (service_config_p, "geocode_cache_negative_ttl", &negative_ttl);
 
-	bson_init (&keys);
-	BSON_APPEND_UTF8 (&keys, PG_VARIETY_S, "text");
+							data_p -> psd_geocode_cache_p = AllocateGeocodeCache (grassroots_p -> gs_mongo_manager_p, data_p -> psd_database_s, cache_collection_s, (cache_size > 0) ? (uint32) cache_size : 0, (negative_ttl > 0) ? (uint32) negative_ttl : 0);
 
-	bson_reinit (&keys);
-	BSON_APPEND_UTF8 (&keys, PG_DISEASE_S, "text");
+							if (!data_p -> psd_geocode_cache_p)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set up geocode cache in \"%s\", all addresses will be sent to the geocoder", cache_collection_s);
+								}
+						}
+				}
 
-	return success_flag;
-}
+			/*
+			 * Look up sample addresses in an offline gazetteer before
+			 * falling back to the geocoder.
+			 */
+			if (success_flag)
+				{
+					const char *gazetteer_s = GetJSONString (service_config_p, "gazetteer_index");
 
+					if (gazetteer_s)
+						{
+							data_p -> psd_gazetteer_p = OpenGazetteer (gazetteer_s);
 
-static void FreePathogenomicsServiceData (PathogenomicsServiceData *data_p)
-{
-	FreeMongoTool (data_p -> psd_tool_p);
+							if (!data_p -> psd_gazetteer_p)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to open gazetteer \"%s\", all addresses will be sent to the geocoder", gazetteer_s);
+								}
+						}
+				}
 
-	FreeMemory (data_p);
-}
+			/*
+			 * Build clustered map tiles of the samples' locations if we have
+			 * a collection to keep them in.
+			 */
+			if (success_flag)
+				{
+					const char *tiles_collection_s = GetJSONString (service_config_p, "tiles_collection");
 
+					if (tiles_collection_s)
+						{
+							int max_zoom = (int) S_DEFAULT_MAP_TILES_MAX_ZOOM;
+							int grid_size = (int) S_DEFAULT_MAP_TILES_GRID_SIZE;
 
-static const char *GetPathogenomicsServiceName (const Service * UNUSED_PARAM (service_p))
-{
-	return "Field Pathogenomics";
-}
+							GetJSONInteger (service_config_p, "map_tiles_max_zoom", &max_zoom);
+							GetJSONInteger (service_config_p, "map_tiles_grid_size", &grid_size);
 
+							if (max_zoom < 0)
+								{
+									max_zoom = 0;
+								}
+							else if (max_zoom > (int) S_MAX_MAP_TILES_ZOOM)
+								{
+									max_zoom = (int) S_MAX_MAP_TILES_ZOOM;
+								}
 
-static const char *GetPathogenomicsServiceAlias (const Service * UNUSED_PARAM (service_p))
-{
-	return "field_pathogenomics" SERVICE_GROUP_ALIAS_SEPARATOR "search";
-}
+							data_p -> psd_map_tiles_p = AllocateMapTiles (grassroots_p -> gs_mongo_manager_p, data_p -> psd_database_s, tiles_collection_s, data_p -> psd_collection_ss [PD_SAMPLE], (uint32) max_zoom, (grid_size > 0) ? (uint32) grid_size : 1);
 
+							if (!data_p -> psd_map_tiles_p)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set up map tiles in \"%s\", map tiles will not be available", tiles_collection_s);
+								}
+						}
+				}
 
-static const char *GetPathogenomicsServiceDescription (const Service * UNUSED_PARAM (service_p))
-{
-	return "Analyse the spread of Wheat-related diseases both geographically and over time";
-}
+			/*
+			 * Keep sample counters for summaries up to date as data is
+			 * imported and deleted if we have collections for them.
+			 */
+			if (success_flag)
+				{
+					const char *rollups_collection_s = GetJSONString (service_config_p, "rollups_collection");
+					const char *sources_collection_s = GetJSONString (service_config_p, "rollup_sources_collection");
 
+					if (rollups_collection_s && sources_collection_s)
+						{
+							data_p -> psd_rollups_p = AllocateRollups (grassroots_p -> gs_mongo_manager_p, data_p -> psd_database_s, rollups_collection_s, sources_collection_s);
 
-static const char *GetPathogenomicsServiceInformationUri (const Service * UNUSED_PARAM (service_p))
-{
-	return NULL;
-}
+							if (!data_p -> psd_rollups_p)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set up rollups in \"%s\", summaries will not be available", rollups_collection_s);
+								}
+						}
+					else if (rollups_collection_s || sources_collection_s)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Both rollups_collection and rollup_sources_collection are needed for summaries");
+						}
+				}
 
+			/*
+			 * Record the progress of uploads that are given an upload id
+			 * so that they can be resumed if we have a collection for them.
+			 */
+			if (success_flag)
+				{
+					const char *checkpoints_collection_s = GetJSONString (service_config_p, "upload_checkpoints_collection");
 
-static ParameterSet *GetPathogenomicsServiceParameters (Service *service_p, DataResource * UNUSED_PARAM (resource_p), User * UNUSED_PARAM (user_p))
-{
-	ParameterSet *params_p  = AllocateParameterSet ("Pathogenomics service parameters", "The parameters used for the Pathogenomics service");
+					if (checkpoints_collection_s)
+						{
+							data_p -> psd_upload_checkpoints_p = AllocateUploadCheckpoints (grassroots_p -> gs_mongo_manager_p, data_p -> psd_database_s, checkpoints_collection_s);
 
-	if (params_p)
-		{
-			ServiceData *service_data_p = service_p -> se_data_p;
-			Parameter *param_p = NULL;
+							if (!data_p -> psd_upload_checkpoints_p)
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set up upload checkpoints in \"%s\", uploads will not be resumable", checkpoints_collection_s);
+								}
+						}
+				}
 
-			if ((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_UPDATE.npt_type, PGS_UPDATE.npt_name_s, "Update", "Add data to the system", NULL, PL_ADVANCED)) != NULL)
+			/*
+			 * Make sure that the collections have the indexes that the searches
+			 * and imports rely on, using the built-in ones if none are configured.
+			 */
+			if (success_flag)
 				{
-					if ((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_QUERY.npt_type, PGS_QUERY.npt_name_s, "Search", "Find data to the system", NULL, PL_ALL)) != NULL)
-						{
-							if ((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_REMOVE.npt_type, PGS_REMOVE.npt_name_s, "Delete", "Delete data to the system", NULL, PL_ADVANCED)) != NULL)
-								{
-									bool b = false;
+					const json_t *specs_p = json_object_get (service_config_p, "indexes");
+					const char *extra_collections_ss [9];
+					uint32 num_extra = 0;
 
-									if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (service_data_p, params_p, NULL, PGS_DUMP.npt_name_s, "Dump", "Get all of the data in the system", &b, PL_ADVANCED)) != NULL)
-										{
-											if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (service_data_p, params_p, NULL, PGS_PREVIEW.npt_name_s, "Preview", "Ignore the live dates", &b, PL_ADVANCED)) != NULL)
-												{
-													int32 *l_p = & (((PathogenomicsServiceData *) service_data_p) -> psd_default_stage_time);
+					if (data_p -> psd_map_tiles_p)
+						{
+							extra_collections_ss [num_extra ++] = GetJSONString (service_config_p, "tiles_collection");
+							extra_collections_ss [num_extra ++] = S_MAP_TILES_DATA_NAME_S;
+						}
 
-													if ((param_p = EasyCreateAndAddSignedIntParameterToParameterSet (service_data_p, params_p, NULL, PGS_STAGE_TIME.npt_type, PGS_STAGE_TIME.npt_name_s, "Publish Delay", "Number of days before the data is publically accessible", l_p, PL_ADVANCED)) != NULL)
-														{
-															if ((param_p = EasyCreateAndAddStringParameterToParameterSet (service_data_p, params_p, NULL, PGS_COLLECTION.npt_type, PGS_COLLECTION.npt_name_s, "Collection", "The collection to act upon", *s_data_names_pp, PL_ALL)) != NULL)
-																{
-																	bool success_flag = true;
-																	uint32 i;
+					if (data_p -> psd_rollups_p)
+						{
+							extra_collections_ss [num_extra ++] = GetJSONString (service_config_p, "rollups_collection");
+							extra_collections_ss [num_extra ++] = S_ROLLUPS_DATA_NAME_S;
+							extra_collections_ss [num_extra ++] = GetJSONString (service_config_p, "rollup_sources_collection");
+							extra_collections_ss [num_extra ++] = S_ROLLUP_SOURCES_DATA_NAME_S;
+						}
 
-																	for (i = 0; i < PD_NUM_TYPES; ++ i)
-																		{
-																			if (!CreateAndAddStringParameterOption (param_p, s_data_names_pp [i], NULL))
-																				{
-																					i = PD_NUM_TYPES;
-																					success_flag = false;
-																				}
-																		}
+					if (data_p -> psd_upload_checkpoints_p)
+						{
+							extra_collections_ss [num_extra ++] = GetJSONString (service_config_p, "upload_checkpoints_collection");
+							extra_collections_ss [num_extra ++] = S_UPLOAD_CHECKPOINTS_DATA_NAME_S;
+						}
 
-																	if (success_flag)
-																		{
-																			if (AddUploadParams (service_p -> se_data_p, params_p))
-																				{
-																					return params_p;
-																				}
+					extra_collections_ss [num_extra] = NULL;
 
-																		}
-																}
-														}
-												}
-										}
+					if (specs_p)
+						{
+							if (json_is_array (specs_p))
+								{
+									ReconcileServiceIndexes (data_p, specs_p, extra_collections_ss);
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "\"indexes\" must be an array, the collection indexes will not be checked");
 								}
 						}
-				}
+					else
+						{
+							json_t *default_specs_p = GetDefaultIndexSpecs ();
 
-			FreeParameterSet (params_p);
+							if (default_specs_p)
+								{
+									ReconcileServiceIndexes (data_p, default_specs_p, extra_collections_ss);
+									json_decref (default_specs_p);
+								}
+						}
+				}
+
+			/*
+			 * The rows of sample uploads can be prepared by a pool of
+			 * worker threads.
+			 */
+			{
+				int num_workers;
+
+				if (GetJSONInteger (service_config_p, "import_workers", &num_workers))
+					{
+						data_p -> psd_num_import_workers = (num_workers > 1) ? (uint32) num_workers : 1;
+					}
+			}
+
+			/*
+			 * The existing documents that sample rows may need to be merged
+			 * with are fetched for this many rows at a time, a value of 0
+			 * looks them up for each row individually.
+			 */
+			{
+				int prefetch_size;
+
+				if (GetJSONInteger (service_config_p, "merge_prefetch_size", &prefetch_size))
+					{
+						data_p -> psd_merge_prefetch_size = (prefetch_size > 0) ? (uint32) prefetch_size : 0;
+					}
+			}
+
+			/*
+			 * Uploads with an upload id are checkpointed after this many
+			 * rows, a value of 0 never checkpoints them.
+			 */
+			{
+				int interval;
+
+				if (GetJSONInteger (service_config_p, "upload_checkpoint_interval", &interval))
+					{
+						data_p -> psd_upload_checkpoint_interval = (interval > 0) ? (uint32) interval : 0;
+					}
+			}
+
+			/*
+			 * Searches return at most this many results at a time with a
+			 * continuation token to get the rest, a value of 0 returns all
+			 * of them unless the search has its own limit.
+			 */
+			{
+				int page_limit;
+
+				if (GetJSONInteger (service_config_p, "search_page_limit", &page_limit))
+					{
+						data_p -> psd_search_page_limit = (page_limit > 0) ? (uint32) page_limit : 0;
+					}
+			}
+
+			/*
+			 * The fields that are used as the properties of each feature
+			 * when searches ask for GeoJSON.
+			 */
+			{
+				const json_t *properties_p = json_object_get (service_config_p, "geojson_properties");
+
+				if (properties_p)
+					{
+						data_p -> psd_geojson_properties_ss = GetFieldNames (properties_p);
+
+						if (!data_p -> psd_geojson_properties_ss)
+							{
+								PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get geojson_properties, using the defaults");
+							}
+					}
+			}
+
+			/*
+			 * The names that aggregations can group by, mapped to the
+			 * fields that they use.
+			 */
+			data_p -> psd_aggregate_keys_p = json_object_get (service_config_p, "aggregate_keys");
+
+			if ((data_p -> psd_aggregate_keys_p) && (!json_is_object (data_p -> psd_aggregate_keys_p)))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "aggregate_keys is not an object, using the defaults");
+					data_p -> psd_aggregate_keys_p = NULL;
+				}
+
+			/*
+			 * Dumps are written as newline-delimited JSON files to this
+			 * directory, which can be served from the given host, rather
+			 * than returned within the job. They are removed once they
+			 * are older than the retention time, a value of 0 keeps them.
+			 */
+			data_p -> psd_dump_directory_s = GetJSONString (service_config_p, "dump_directory");
+			data_p -> psd_dump_host_s = GetJSONString (service_config_p, "dump_host");
+
+			{
+				int retention_time;
+
+				if (GetJSONInteger (service_config_p, "dump_retention", &retention_time))
+					{
+						data_p -> psd_dump_retention_time = (retention_time > 0) ? (uint32) retention_time : 0;
+					}
+			}
+
+			/*
+			 * Long-running requests can be run by a pool of background workers
+			 * with their results kept for a while after they finish.
+			 */
+			{
+				int num_workers = (int) S_DEFAULT_NUM_ASYNC_WORKERS;
+				int retention_time = (int) S_DEFAULT_ASYNC_RETENTION_TIME;
+
+				GetJSONInteger (service_config_p, "async_workers", &num_workers);
+				GetJSONInteger (service_config_p, "async_results_retention", &retention_time);
+
+				if (num_workers > 0)
+					{
+						data_p -> psd_async_manager_p = AllocateAsyncJobManager (data_p -> psd_base_data.sd_service_p, (uint32) num_workers, (retention_time > 0) ? (uint32) retention_time : 0);
+
+						if (!data_p -> psd_async_manager_p)
+							{
+								PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to start background job workers, all requests will be run synchronously");
+							}
+					}
+			}
+
+			/*
+			 * Each request checks out its own MongoTool from a bounded pool
+			 * so that concurrent requests don't share a connection.
+			 */
+			{
+				int pool_size = (int) S_DEFAULT_MONGO_POOL_SIZE;
+				int wait_timeout = (int) S_DEFAULT_MONGO_POOL_WAIT_TIMEOUT;
+
+				GetJSONInteger (service_config_p, "mongo_pool_size", &pool_size);
+				GetJSONInteger (service_config_p, "mongo_pool_wait_timeout", &wait_timeout);
+
+				if (pool_size > 0)
+					{
+						data_p -> psd_tool_pool_p = AllocateMongoToolPool (grassroots_p -> gs_mongo_manager_p, (uint32) pool_size, (wait_timeout > 0) ? (uint32) wait_timeout : 0);
+
+						if (!data_p -> psd_tool_pool_p)
+							{
+								PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate MongoTool pool, each request will open its own connection");
+							}
+					}
+			}
 		}
 
-	return NULL;
+	return success_flag;
 }
 
 
-static bool GetPathogenomicsServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p)
+static PathogenomicsServiceData *AllocatePathogenomicsServiceData (void)
 {
-	bool success_flag = true;
+	PathogenomicsServiceData *data_p = (PathogenomicsServiceData *) AllocMemory (sizeof (PathogenomicsServiceData));
 
-	if (strcmp (param_name_s, PGS_UPDATE.npt_name_s) == 0)
+	if (data_p)
 		{
-			*pt_p = PGS_UPDATE.npt_type;
+			data_p -> psd_tool_p = NULL;
+			data_p -> psd_database_s = NULL;
+			data_p -> psd_default_stage_time = S_DEFAULT_STAGE_TIME;
+
+			memset (data_p -> psd_collection_ss, 0, PD_NUM_TYPES * sizeof (const char *));
+
+			data_p -> psd_files_download_root_uri_s = NULL;
+
+			data_p -> psd_bulk_batch_size = S_DEFAULT_BULK_BATCH_SIZE;
+			data_p -> psd_ordered_bulk_writes_flag = true;
+			data_p -> psd_partial_upserts_flag = true;
+			data_p -> psd_skip_unchanged_rows_flag = true;
+			data_p -> psd_num_import_workers = S_DEFAULT_NUM_IMPORT_WORKERS;
+			data_p -> psd_merge_prefetch_size = S_DEFAULT_MERGE_PREFETCH_SIZE;
+			data_p -> psd_upload_checkpoint_interval = S_DEFAULT_UPLOAD_CHECKPOINT_INTERVAL;
+			data_p -> psd_search_page_limit = S_DEFAULT_SEARCH_PAGE_LIMIT;
+			data_p -> psd_dump_directory_s = NULL;
+			data_p -> psd_dump_host_s = NULL;
+			data_p -> psd_dump_retention_time = S_DEFAULT_DUMP_RETENTION_TIME;
+			data_p -> psd_geojson_properties_ss = NULL;
+			data_p -> psd_aggregate_keys_p = NULL;
+			data_p -> psd_async_manager_p = NULL;
+			data_p -> psd_geocode_cache_p = NULL;
+			data_p -> psd_gazetteer_p = NULL;
+			data_p -> psd_map_tiles_p = NULL;
+			data_p -> psd_rollups_p = NULL;
+			data_p -> psd_tool_pool_p = NULL;
+			data_p -> psd_upload_checkpoints_p = NULL;
+			data_p -> psd_column_schema_p = NULL;
 		}
-	else if (strcmp (param_name_s, PGS_QUERY.npt_name_s) == 0)
+
+	return data_p;
+}
+
+
+/*
+ * Check the indexes of each distinct collection against the specifications
+ * for the types of data that are stored in it, along with those of the
+ * service's own collections. These are given as pairs of the collection
+ * and the name that selects its specifications.
+ */
+static void ReconcileServiceIndexes (PathogenomicsServiceData *data_p, const json_t *specs_p, const char **extra_collections_ss)
+{
+	uint32 i;
+
+	for (i = 0; i < PD_NUM_TYPES; ++ i)
 		{
-			*pt_p = PGS_QUERY.npt_type;
+			const char *collection_s = * (data_p -> psd_collection_ss + i);
+			const char *data_names_ss [PD_NUM_TYPES + 1];
+			uint32 num_names = 0;
+			uint32 j;
+
+			/* Several types of data may share a collection so only check it once */
+			for (j = 0; j < i; ++ j)
+				{
+					if (strcmp (collection_s, * (data_p -> psd_collection_ss + j)) == 0)
+						{
+							break;
+						}
+				}
+
+			if (j == i)
+				{
+					for (j = i; j < PD_NUM_TYPES; ++ j)
+						{
+							if (strcmp (collection_s, * (data_p -> psd_collection_ss + j)) == 0)
+								{
+									data_names_ss [num_names ++] = GetPathogenomicsDataName ((PathogenomicsData) j);
+								}
+						}
+
+					data_names_ss [num_names] = NULL;
+
+					ReconcileCollectionIndexes (data_p, specs_p, collection_s, data_names_ss);
+				}
+
+		}		/* for (i = 0; i < PD_NUM_TYPES; ++ i) */
+
+	for ( ; *extra_collections_ss; extra_collections_ss += 2)
+		{
+			const char *data_names_ss [] = { * (extra_collections_ss + 1), NULL };
+
+			ReconcileCollectionIndexes (data_p, specs_p, *extra_collections_ss, data_names_ss);
 		}
-	else if (strcmp (param_name_s, PGS_REMOVE.npt_name_s) == 0)
+}
+
+
+static void ReconcileCollectionIndexes (PathogenomicsServiceData *data_p, const json_t *specs_p, const char *collection_s, const char **data_names_ss)
+{
+	uint32 num_drifts = 0;
+
+	if (ReconcileIndexes (data_p -> psd_tool_p, data_p -> psd_database_s, collection_s, specs_p, data_names_ss, &num_drifts))
 		{
-			*pt_p = PGS_REMOVE.npt_type;
+			if (num_drifts > 0)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, UINT32_FMT " indexes on \"%s\" differ from their specifications", num_drifts, collection_s);
+				}
 		}
-	else if (strcmp (param_name_s, PGS_DUMP.npt_name_s) == 0)
+	else
 		{
-			*pt_p = PGS_DUMP.npt_type;
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to check the indexes on \"%s\"", collection_s);
 		}
-	else if (strcmp (param_name_s, PGS_PREVIEW.npt_name_s) == 0)
+}
+
+
+static void FreePathogenomicsServiceData (PathogenomicsServiceData *data_p)
+{
+	/* Let any running background jobs finish before the MongoTool is freed */
+	if (data_p -> psd_async_manager_p)
 		{
-			*pt_p = PGS_PREVIEW.npt_type;
+			FreeAsyncJobManager (data_p -> psd_async_manager_p);
 		}
-	else if (strcmp (param_name_s, PGS_STAGE_TIME.npt_name_s) == 0)
+
+	if (data_p -> psd_geocode_cache_p)
 		{
-			*pt_p = PGS_STAGE_TIME.npt_type;
+			FreeGeocodeCache (data_p -> psd_geocode_cache_p);
 		}
-	else if (strcmp (param_name_s, PGS_COLLECTION.npt_name_s) == 0)
+
+	if (data_p -> psd_gazetteer_p)
 		{
-			*pt_p = PGS_COLLECTION.npt_type;
+			CloseGazetteer (data_p -> psd_gazetteer_p);
 		}
-	else if (strcmp (param_name_s, PGS_DELIMITER.npt_name_s) == 0)
+
+	if (data_p -> psd_geojson_properties_ss)
 		{
-			*pt_p = PGS_DELIMITER.npt_type;
+			FreeMemory (data_p -> psd_geojson_properties_ss);
 		}
-	else if (strcmp (param_name_s, PGS_FILE.npt_name_s) == 0)
+
+	if (data_p -> psd_map_tiles_p)
 		{
-			*pt_p = PGS_FILE.npt_type;
+			FreeMapTiles (data_p -> psd_map_tiles_p);
 		}
-	else
+
+	if (data_p -> psd_rollups_p)
 		{
-			success_flag = false;
+			FreeRollups (data_p -> psd_rollups_p);
 		}
 
-	return success_flag;
+	if (data_p -> psd_tool_pool_p)
+		{
+			FreeMongoToolPool (data_p -> psd_tool_pool_p);
+		}
+
+	if (data_p -> psd_upload_checkpoints_p)
+		{
+			FreeUploadCheckpoints (data_p -> psd_upload_checkpoints_p);
+		}
+
+	if (data_p -> psd_column_schema_p)
+		{
+			FreeColumnSchema (data_p -> psd_column_schema_p);
+		}
+
+	FreeMongoTool (data_p -> psd_tool_p);
+
+	FreeMemory (data_p);
 }
 
 
-static bool AddUploadParams (ServiceData *data_p, ParameterSet *param_set_p)
+static const char *GetPathogenomicsServiceName (const Service * UNUSED_PARAM (service_p))
 {
-	bool success_flag = false;
-	Parameter *param_p = NULL;
-	ParameterGroup *group_p = CreateAndAddParameterGroupToParameterSet ("Spreadsheet Import Parameters", false, data_p, param_set_p);
+	return "Field Pathogenomics";
+}
 
-	if ((param_p = EasyCreateAndAddCharParameterToParameterSet (data_p, param_set_p, group_p, PGS_DELIMITER.npt_name_s, "Delimiter", "The character delimiting columns", &S_DEFAULT_COLUMN_DELIMITER, PL_ALL)) != NULL)
+
+static const char *GetPathogenomicsServiceAlias (const Service * UNUSED_PARAM (service_p))
+{
+	return "field_pathogenomics" SERVICE_GROUP_ALIAS_SEPARATOR "search";
+}
+
+
+static const char *GetPathogenomicsServiceDescription (const Service * UNUSED_PARAM (service_p))
+{
+	return "Analyse the spread of Wheat-related diseases both geographically and over time";
+}
+
+
+static const char *GetPathogenomicsServiceInformationUri (const Service * UNUSED_PARAM (service_p))
+{
+	return NULL;
+}
+
+
+static ParameterSet *GetPathogenomicsServiceParameters (Service *service_p, DataResource * UNUSED_PARAM (resource_p), User * UNUSED_PARAM (user_p))
+{
+	ParameterSet *params_p  = AllocateParameterSet ("Pathogenomics service parameters", "The parameters used for the Pathogenomics service");
+
+	if (params_p)
 		{
-			if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, PGS_FILE.npt_type, PGS_FILE.npt_name_s, "Data to upload", "The data to upload", NULL, PL_ALL)) != NULL)
+			ServiceData *service_data_p = service_p -> se_data_p;
+			Parameter *param_p = NULL;
+
+			if ((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_UPDATE.npt_type, PGS_UPDATE.npt_name_s, "Update", "Add data to the system", NULL, PL_ADVANCED)) != NULL)
 				{
-					success_flag = true;
+					if (((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_QUERY.npt_type, PGS_QUERY.npt_name_s, "Search", "Find data to the system", NULL, PL_ALL)) != NULL) &&
+						((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_AGGREGATE.npt_type, PGS_AGGREGATE.npt_name_s, "Aggregate", "Count the samples in each group of values", NULL, PL_ALL)) != NULL) &&
+						((param_p = EasyCreateAndAddStringParameterToParameterSet (service_data_p, params_p, NULL, PGS_MAP_TILE.npt_type, PGS_MAP_TILE.npt_name_s, "Map tile", "Get the clustered samples for a z/x/y map tile", NULL, PL_ALL)) != NULL) &&
+						((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_SUMMARY.npt_type, PGS_SUMMARY.npt_name_s, "Summary", "Get the precomputed sample counts for each group of values", NULL, PL_ALL)) != NULL))
+						{
+							if ((param_p = EasyCreateAndAddJSONParameterToParameterSet (service_data_p, params_p, NULL, PGS_REMOVE.npt_type, PGS_REMOVE.npt_name_s, "Delete", "Delete data to the system", NULL, PL_ADVANCED)) != NULL)
+								{
+									bool b = false;
+
+									if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (service_data_p, params_p, NULL, PGS_DUMP.npt_name_s, "Dump", "Get all of the data in the system", &b, PL_ADVANCED)) != NULL)
+										{
+											if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (service_data_p, params_p, NULL, PGS_PREVIEW.npt_name_s, "Preview", "Ignore the live dates", &b, PL_ADVANCED)) != NULL)
+												{
+													int32 *l_p = & (((PathogenomicsServiceData *) service_data_p) -> psd_default_stage_time);
+
+													if ((param_p = EasyCreateAndAddSignedIntParameterToParameterSet (service_data_p, params_p, NULL, PGS_STAGE_TIME.npt_type, PGS_STAGE_TIME.npt_name_s, "Publish Delay", "Number of days before the data is publically accessible", l_p, PL_ADVANCED)) != NULL)
+														{
+															if ((param_p = EasyCreateAndAddStringParameterToParameterSet (service_data_p, params_p, NULL, PGS_COLLECTION.npt_type, PGS_COLLECTION.npt_name_s, "Collection", "The collection to act upon", GetPathogenomicsDataName (PD_SAMPLE), PL_ALL)) != NULL)
+																{
+																	bool success_flag = true;
+																	uint32 i;
+
+																	for (i = 0; i < PD_NUM_TYPES; ++ i)
+																		{
+																			if (!CreateAndAddStringParameterOption (param_p, GetPathogenomicsDataName ((PathogenomicsData) i), NULL))
+																				{
+																					i = PD_NUM_TYPES;
+																					success_flag = false;
+																				}
+																		}
+
+																	if (success_flag)
+																		{
+																			if (AddUploadParams (service_p -> se_data_p, params_p))
+																				{
+																					if (AddBackgroundJobParams (service_p -> se_data_p, params_p))
+																						{
+																							return params_p;
+																						}
+																				}
+
+																		}
+																}
+														}
+												}
+										}
+								}
+						}
 				}
+
+			FreeParameterSet (params_p);
 		}
 
-	return success_flag;
+	return NULL;
 }
 
 
-static void ReleasePathogenomicsServiceParameters (Service * UNUSED_PARAM (service_p), ParameterSet *params_p)
+static bool GetPathogenomicsServiceParameterTypesForNamedParameters (const Service *service_p, const char *param_name_s, ParameterType *pt_p)
 {
-	FreeParameterSet (params_p);
-}
+	bool success_flag = true;
+
+	if (strcmp (param_name_s, PGS_UPDATE.npt_name_s) == 0)
+		{
+			*pt_p = PGS_UPDATE.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_QUERY.npt_name_s) == 0)
+		{
+			*pt_p = PGS_QUERY.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_AGGREGATE.npt_name_s) == 0)
+		{
+			*pt_p = PGS_AGGREGATE.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_MAP_TILE.npt_name_s) == 0)
+		{
+			*pt_p = PGS_MAP_TILE.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_SUMMARY.npt_name_s) == 0)
+		{
+			*pt_p = PGS_SUMMARY.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_REMOVE.npt_name_s) == 0)
+		{
+			*pt_p = PGS_REMOVE.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_DUMP.npt_name_s) == 0)
+		{
+			*pt_p = PGS_DUMP.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_PREVIEW.npt_name_s) == 0)
+		{
+			*pt_p = PGS_PREVIEW.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_STAGE_TIME.npt_name_s) == 0)
+		{
+			*pt_p = PGS_STAGE_TIME.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_COLLECTION.npt_name_s) == 0)
+		{
+			*pt_p = PGS_COLLECTION.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_DELIMITER.npt_name_s) == 0)
+		{
+			*pt_p = PGS_DELIMITER.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_FILE.npt_name_s) == 0)
+		{
+			*pt_p = PGS_FILE.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_ASYNC.npt_name_s) == 0)
+		{
+			*pt_p = PGS_ASYNC.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_JOB_ID.npt_name_s) == 0)
+		{
+			*pt_p = PGS_JOB_ID.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_UPLOAD_ID.npt_name_s) == 0)
+		{
+			*pt_p = PGS_UPLOAD_ID.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_VALIDATE_ONLY.npt_name_s) == 0)
+		{
+			*pt_p = PGS_VALIDATE_ONLY.npt_type;
+		}
+	else if (strcmp (param_name_s, PGS_DATE_FORMAT.npt_name_s) == 0)
+		{
+			*pt_p = PGS_DATE_FORMAT.npt_type;
+		}
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+static bool AddUploadParams (ServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+	Parameter *param_p = NULL;
+	ParameterGroup *group_p = CreateAndAddParameterGroupToParameterSet ("Spreadsheet Import Parameters", false, data_p, param_set_p);
+
+	if ((param_p = EasyCreateAndAddCharParameterToParameterSet (data_p, param_set_p, group_p, PGS_DELIMITER.npt_name_s, "Delimiter", "The character delimiting columns", &S_DEFAULT_COLUMN_DELIMITER, PL_ALL)) != NULL)
+		{
+			if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, PGS_FILE.npt_type, PGS_FILE.npt_name_s, "Data to upload", "The data to upload", NULL, PL_ALL)) != NULL)
+				{
+					if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, PGS_UPLOAD_ID.npt_type, PGS_UPLOAD_ID.npt_name_s, "Upload id", "An id for the upload so that, if it is interrupted, sending it again with the same id carries on from where it got to", NULL, PL_ADVANCED)) != NULL)
+						{
+							bool b = false;
+
+							if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (data_p, param_set_p, group_p, PGS_VALIDATE_ONLY.npt_name_s, "Validate only", "Check every row of the upload and report any problems without storing anything", &b, PL_ALL)) != NULL)
+								{
+									if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, PGS_DATE_FORMAT.npt_type, PGS_DATE_FORMAT.npt_name_s, "Date format", "The order of the day and month in dates such as 03/04/2020. ISO 8601 dates, Excel day numbers and dates with month names are recognised whichever is chosen", GetDateOrderName (DO_DAY_FIRST), PL_ADVANCED)) != NULL)
+										{
+											uint32 i;
+
+											success_flag = true;
+
+											for (i = 0; i < DO_NUM_ORDERS; ++ i)
+												{
+													if (!CreateAndAddStringParameterOption (param_p, GetDateOrderName ((DateOrder) i), NULL))
+														{
+															i = DO_NUM_ORDERS;
+															success_flag = false;
+														}
+												}
+										}
+								}
+						}
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool AddBackgroundJobParams (ServiceData *data_p, ParameterSet *param_set_p)
+{
+	bool success_flag = false;
+	Parameter *param_p = NULL;
+	ParameterGroup *group_p = CreateAndAddParameterGroupToParameterSet ("Background Job Parameters", false, data_p, param_set_p);
+	bool b = false;
+
+	if ((param_p = EasyCreateAndAddBooleanParameterToParameterSet (data_p, param_set_p, group_p, PGS_ASYNC.npt_name_s, "Run in background", "Return straight away and run the update, dump or search as a background job", &b, PL_ADVANCED)) != NULL)
+		{
+			if ((param_p = EasyCreateAndAddStringParameterToParameterSet (data_p, param_set_p, group_p, PGS_JOB_ID.npt_type, PGS_JOB_ID.npt_name_s, "Job id", "Get the status and results of an earlier background job", NULL, PL_ADVANCED)) != NULL)
+				{
+					success_flag = true;
+				}
+		}
+
+	return success_flag;
+}
+
+
+static void ReleasePathogenomicsServiceParameters (Service * UNUSED_PARAM (service_p), ParameterSet *params_p)
+{
+	FreeParameterSet (params_p);
+}
+
+
+
+
+static bool ClosePathogenomicsService (Service *service_p)
+{
+	bool success_flag = true;
+
+	FreePathogenomicsServiceData ((PathogenomicsServiceData *) (service_p -> se_data_p));;
+
+	return success_flag;
+}
+
+
+static json_type GetPathogenomicsJSONFieldType (const char *name_s, const void *data_p)
+{
+	const PathogenomicsServiceData *service_data_p = (const PathogenomicsServiceData *) (data_p);
+
+	return GetColumnType (service_data_p -> psd_column_schema_p, name_s);
+}
+
+
+static bool GetCollectionName (ParameterSet *param_set_p, PathogenomicsServiceData *data_p, const char **collection_name_ss, PathogenomicsData *collection_type_p)
+{
+	const char *collection_s = NULL;
+
+	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_COLLECTION.npt_name_s, &collection_s))
+		{
+			if (collection_s)
+				{
+					uint32 i;
+
+					for (i = 0; i < PD_NUM_TYPES; ++ i)
+						{
+							if (strcmp (collection_s, GetPathogenomicsDataName ((PathogenomicsData) i)) == 0)
+								{
+									*collection_name_ss = * ((data_p -> psd_collection_ss) + i);
+									*collection_type_p = (PathogenomicsData) i;
+
+									return true;
+								}
+						}		/* for (i = 0; i < PD_NUM_TYPES; ++ i) */
+				}
+		}
+
+	return false;
+}
+
+
+static ServiceJobSet *RunPathogenomicsService (Service *service_p, ParameterSet *param_set_p, User * UNUSED_PARAM (user_p), ProvidersStateTable * UNUSED_PARAM (providers_p))
+{
+	PathogenomicsServiceData *data_p = (PathogenomicsServiceData *) (service_p -> se_data_p);
+
+	/*
+	 * The job set belongs to this call and is returned to the caller
+	 * without being stored on the Service, so that overlapping calls
+	 * never see or overwrite each other's jobs.
+	 */
+	ServiceJobSet *jobs_p = AllocateSimpleServiceJobSet (service_p, NULL, "Pathogenomics");
+
+	if (jobs_p)
+		{
+			ServiceJob *job_p = GetServiceJobFromServiceJobSet (jobs_p, 0);
+
+			LogParameterSet (param_set_p, job_p);
+
+			SetServiceJobStatus (job_p, OS_FAILED_TO_START);
+
+			if (param_set_p)
+				{
+					const char *job_id_s = NULL;
+
+					/* Are we getting the results of an earlier background job? */
+					if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_JOB_ID.npt_name_s, &job_id_s) && (!IsStringEmpty (job_id_s)))
+						{
+							GetBackgroundJob (data_p, job_id_s, job_p);
+						}
+					else
+						{
+							PathogenomicsRequest request;
+
+							if (InitPathogenomicsRequest (&request, param_set_p, data_p))
+								{
+									const bool *b_p = NULL;
+									bool async_flag = false;
+
+									uuid_copy (request.pr_job_id, job_p -> sj_id);
+
+									GetCurrentBooleanParameterValueFromParameterSet (param_set_p, PGS_ASYNC.npt_name_s, &b_p);
+									if (b_p)
+										{
+											async_flag = *b_p;
+										}
+
+									if (async_flag && (data_p -> psd_async_manager_p) && (IsLongRunningOperation (request.pr_operation)))
+										{
+											StartBackgroundJob (&request, job_p);
+										}
+									else
+										{
+											MongoTool *tool_p = GetRequestMongoTool (data_p);
+
+											if (tool_p)
+												{
+													RunPathogenomicsRequest (&request, tool_p, job_p);
+													ReleaseRequestMongoTool (data_p, tool_p, job_p);
+												}
+											else
+												{
+													AddGeneralErrorMessageToServiceJob (job_p, "All database connections are busy, please try again later");
+												}
+										}
+
+									ClearPathogenomicsRequest (&request);
+								}
+
+						}
+
+				}		/* if (param_set_p) */
+
+#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
+			PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_metadata_p, "metadata 3: ");
+#endif
+
+			LogServiceJob (job_p);
+		}		/* if (jobs_p) */
+
+	return jobs_p;
+}
+
+
+/*
+ * Get the details of the operation to run from the parameters. The
+ * values are not copied so the request is only valid for as long as
+ * param_set_p is.
+ */
+static bool InitPathogenomicsRequest (PathogenomicsRequest *request_p, ParameterSet *param_set_p, PathogenomicsServiceData *data_p)
+{
+	request_p -> pr_operation = PO_NONE;
+	request_p -> pr_collection_type = PD_NUM_TYPES;
+	request_p -> pr_collection_name_s = NULL;
+	request_p -> pr_preview_flag = false;
+	request_p -> pr_delimiter = S_DEFAULT_COLUMN_DELIMITER;
+	request_p -> pr_stage_time = GetStageTime (param_set_p, data_p);
+	request_p -> pr_table_s = NULL;
+	request_p -> pr_json_p = NULL;
+	request_p -> pr_upload_id_s = NULL;
+	request_p -> pr_validate_flag = false;
+	request_p -> pr_date_order = DO_DAY_FIRST;
+	uuid_clear (request_p -> pr_job_id);
+	request_p -> pr_owns_values_flag = false;
+	request_p -> pr_data_p = data_p;
+
+	/* get the collection to work on */
+	if (GetCollectionName (param_set_p, data_p, & (request_p -> pr_collection_name_s), & (request_p -> pr_collection_type)))
+		{
+			const bool *b_p = NULL;
+			const char *delim_p = NULL;
+			const char *data_s = NULL;
+			const json_t *json_param_p = NULL;
+			Parameter *param_p = NULL;
+
+			GetCurrentBooleanParameterValueFromParameterSet (param_set_p, PGS_PREVIEW.npt_name_s, &b_p);
+			if (b_p)
+				{
+					request_p -> pr_preview_flag = *b_p;
+				}
+
+			/* Get the current delimiter */
+			GetCurrentCharParameterValueFromParameterSet (param_set_p, PGS_DELIMITER.npt_name_s, &delim_p);
+			if (delim_p)
+				{
+					request_p -> pr_delimiter = *delim_p;
+				}
+
+			b_p = NULL;
+			GetCurrentBooleanParameterValueFromParameterSet (param_set_p, PGS_VALIDATE_ONLY.npt_name_s, &b_p);
+			if (b_p)
+				{
+					request_p -> pr_validate_flag = *b_p;
+				}
+
+			if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_DATE_FORMAT.npt_name_s, &data_s) && (!IsStringEmpty (data_s)))
+				{
+					if (!GetDateOrderFromName (data_s, & (request_p -> pr_date_order)))
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Unknown date format \"%s\", using %s", data_s, GetDateOrderName (DO_DAY_FIRST));
+						}
+				}
+
+			data_s = NULL;
+
+			/* Uploads can be given an id so that they can be resumed */
+			if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_UPLOAD_ID.npt_name_s, &data_s) && (!IsStringEmpty (data_s)))
+				{
+					request_p -> pr_upload_id_s = (char *) data_s;
+				}
+
+			b_p = NULL;
+			GetCurrentBooleanParameterValueFromParameterSet (param_set_p, PGS_DUMP.npt_name_s, &b_p);
+
+			/* Do we want to get a dump of the entire collection? */
+			if ((b_p != NULL) && (*b_p == true))
+				{
+					request_p -> pr_operation = PO_DUMP;
+				}
+			/*
+			 * Data can be updated either from the table or as a json insert statement
+			 *
+			 * Has a tabular dataset been uploaded...
+			 */
+			else if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_FILE.npt_name_s, &data_s) && (!IsStringEmpty (data_s)))
+				{
+					request_p -> pr_operation = PO_IMPORT_TABLE;
+					request_p -> pr_table_s = (char *) data_s;
+				}
+			/* ... or do we have an insert statement? */
+			else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_UPDATE.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
+				{
+					request_p -> pr_operation = PO_UPDATE;
+					request_p -> pr_json_p = (json_t *) json_param_p;
+				}
+			else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_QUERY.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
+				{
+					request_p -> pr_operation = PO_SEARCH;
+					request_p -> pr_json_p = (json_t *) json_param_p;
+				}
+			else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_AGGREGATE.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
+				{
+					request_p -> pr_operation = PO_AGGREGATE;
+					request_p -> pr_json_p = (json_t *) json_param_p;
+				}
+			else if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_MAP_TILE.npt_name_s, &data_s) && (!IsStringEmpty (data_s)))
+				{
+					request_p -> pr_operation = PO_MAP_TILE;
+					request_p -> pr_table_s = (char *) data_s;
+				}
+			else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_SUMMARY.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
+				{
+					request_p -> pr_operation = PO_SUMMARY;
+					request_p -> pr_json_p = (json_t *) json_param_p;
+				}
+			else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_REMOVE.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
+				{
+					request_p -> pr_operation = PO_DELETE;
+					request_p -> pr_json_p = (json_t *) json_param_p;
+				}
+
+			return true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "no collection specified");
+		}
+
+	return false;
+}
+
+
+/*
+ * Make a copy of a request, including its values, that can outlive
+ * the ParameterSet that it came from.
+ */
+static PathogenomicsRequest *CopyPathogenomicsRequest (const PathogenomicsRequest *src_p)
+{
+	PathogenomicsRequest *dest_p = (PathogenomicsRequest *) AllocMemory (sizeof (PathogenomicsRequest));
+
+	if (dest_p)
+		{
+			bool success_flag = true;
+
+			*dest_p = *src_p;
+			dest_p -> pr_owns_values_flag = true;
+
+			if (src_p -> pr_table_s)
+				{
+					if ((dest_p -> pr_table_s = EasyCopyToNewString (src_p -> pr_table_s)) == NULL)
+						{
+							success_flag = false;
+						}
+				}
+
+			if (src_p -> pr_json_p)
+				{
+					if ((dest_p -> pr_json_p = json_deep_copy (src_p -> pr_json_p)) == NULL)
+						{
+							success_flag = false;
+						}
+				}
+
+			if (src_p -> pr_upload_id_s)
+				{
+					if ((dest_p -> pr_upload_id_s = EasyCopyToNewString (src_p -> pr_upload_id_s)) == NULL)
+						{
+							success_flag = false;
+						}
+				}
+
+			if (success_flag)
+				{
+					return dest_p;
+				}
+
+			FreePathogenomicsRequest (dest_p);
+		}		/* if (dest_p) */
+
+	return NULL;
+}
+
+
+static void ClearPathogenomicsRequest (PathogenomicsRequest *request_p)
+{
+	if (request_p -> pr_owns_values_flag)
+		{
+			if (request_p -> pr_table_s)
+				{
+					FreeCopiedString (request_p -> pr_table_s);
+				}
+
+			if (request_p -> pr_json_p)
+				{
+					json_decref (request_p -> pr_json_p);
+				}
+
+			if (request_p -> pr_upload_id_s)
+				{
+					FreeCopiedString (request_p -> pr_upload_id_s);
+				}
+		}
+
+	request_p -> pr_table_s = NULL;
+	request_p -> pr_json_p = NULL;
+	request_p -> pr_upload_id_s = NULL;
+}
+
+
+static void FreePathogenomicsRequest (PathogenomicsRequest *request_p)
+{
+	ClearPathogenomicsRequest (request_p);
+	FreeMemory (request_p);
+}
+
+
+static bool IsLongRunningOperation (const PathogenomicsOperation op)
+{
+	return ((op == PO_DUMP) || (op == PO_IMPORT_TABLE) || (op == PO_UPDATE) || (op == PO_SEARCH) || (op == PO_AGGREGATE) || (op == PO_MAP_TILE));
+}
+
+
+static void RunPathogenomicsRequest (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p)
+{
+	PathogenomicsServiceData *data_p = request_p -> pr_data_p;
+
+	if (tool_p && SetMongoToolDatabaseAndCollection (tool_p, data_p -> psd_database_s, request_p -> pr_collection_name_s))
+		{
+			if (request_p -> pr_operation == PO_DUMP)
+				{
+					DumpData (request_p, tool_p, job_p);
+				}
+			else
+				{
+					uint32 num_successes = 0;
+					bool run_flag = true;
+
+					switch (request_p -> pr_operation)
+						{
+							case PO_IMPORT_TABLE:
+								num_successes = ImportTable (request_p, tool_p, job_p);
+								break;
+
+							case PO_UPDATE:
+								{
+									RowSource *source_p = AllocateJSONRowSource (request_p -> pr_json_p);
+
+									if (source_p)
+										{
+											num_successes = ImportRowSource (request_p, tool_p, job_p, source_p);
+
+											SetImportStatus (job_p, num_successes, source_p -> rs_num_rows);
+
+											FreeRowSource (source_p);
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate json row source");
+											SetServiceJobStatus (job_p, OS_FAILED);
+										}
+								}
+								break;
+
+							case PO_SEARCH:
+								{
+									OperationStatus search_status = SearchData (tool_p, job_p, request_p -> pr_json_p, request_p -> pr_collection_type, data_p, request_p -> pr_preview_flag);
+
+									if (search_status == OS_SUCCEEDED || search_status == OS_PARTIALLY_SUCCEEDED)
+										{
+#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINER
+											PrintJSONToLog (STM_LEVEL_FINER, __FILE__, __LINE__, job_p -> sj_result_p, "initial results");
+#endif
+
+											num_successes = GetNumberOfServiceJobResults (job_p);
+										}
+								}
+								break;
+
+							case PO_AGGREGATE:
+								{
+									OperationStatus aggregate_status = AggregateData (tool_p, job_p, request_p -> pr_json_p, data_p, request_p -> pr_preview_flag);
+
+									if (aggregate_status == OS_SUCCEEDED)
+										{
+											num_successes = GetNumberOfServiceJobResults (job_p);
+										}
+								}
+								break;
+
+							case PO_MAP_TILE:
+								{
+									OperationStatus tile_status = MapTileData (job_p, request_p -> pr_table_s, data_p, request_p -> pr_preview_flag);
+
+									if (tile_status == OS_SUCCEEDED)
+										{
+											num_successes = GetNumberOfServiceJobResults (job_p);
+										}
+								}
+								break;
+
+							case PO_SUMMARY:
+								{
+									OperationStatus summary_status = SummaryData (job_p, request_p -> pr_json_p, data_p, request_p -> pr_preview_flag);
+
+									if (summary_status == OS_SUCCEEDED)
+										{
+											num_successes = GetNumberOfServiceJobResults (job_p);
+										}
+								}
+								break;
+
+							case PO_DELETE:
+								{
+									uint32 size = 0;
+									OperationStatus status;
+
+									num_successes = DeleteData (tool_p, job_p, request_p -> pr_json_p, request_p -> pr_collection_type, data_p, &size);
+
+									if (num_successes == 0)
+										{
+											status = OS_FAILED;
+										}
+									else if (num_successes == size)
+										{
+											status = OS_SUCCEEDED;
+										}
+									else
+										{
+											status = OS_PARTIALLY_SUCCEEDED;
+										}
+
+									SetServiceJobStatus (job_p, status);
+								}
+								break;
+
+							default:
+								run_flag = false;
+								break;
+						}
+
+					if (run_flag)
+						{
+							json_error_t error;
+							json_t *metadata_p = NULL;
+
+							metadata_p = json_pack_ex (&error, 0, "{s:i}", "successful entries", num_successes);
+
+
+#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
+							{
+								PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_errors_p, "errors: ");
+								PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, metadata_p, "metadata 1: ");
+							}
+#endif
+
+							if (metadata_p)
+								{
+									/* Keep any metadata, such as the geocoding counts, that the operation added */
+									if (job_p -> sj_metadata_p)
+										{
+											json_object_update (job_p -> sj_metadata_p, metadata_p);
+											json_decref (metadata_p);
+										}
+									else
+										{
+											job_p -> sj_metadata_p = metadata_p;
+										}
+								}
+
+#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
+							PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_errors_p, "job errors: ");
+							PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_metadata_p, "job metadata: ");
+							PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_result_p, "job results: ");
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "job status %d", job_p -> sj_status);
+#endif
+						}		/* if (run_flag) */
+					else
+						{
+							SetServiceJobStatus (job_p, OS_FAILED);
+						}
+
+				}		/* if (request_p -> pr_operation == PO_DUMP) else */
+
+		}		/* if (tool_p && SetMongoToolDatabaseAndCollection (...)) */
+
+}
+
+
+/*
+ * Dumps are always spooled to a file since adding each document to the
+ * job's results would need memory for the whole collection.
+ */
+static void DumpData (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p)
+{
+	PathogenomicsServiceData *data_p = request_p -> pr_data_p;
+
+	if (data_p -> psd_dump_directory_s)
+		{
+			DumpDataToSpoolFile (request_p, tool_p, job_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Can't dump \"%s\".\"%s\" without a dump_directory", data_p -> psd_database_s, request_p -> pr_collection_name_s);
+
+			if (!AddGeneralErrorMessageToServiceJob (job_p, "Dumps are not available since the service has no dump_directory"))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add job error value");
+				}
+
+			SetServiceJobStatus (job_p, OS_FAILED);
+		}
+}
+
+
+/*
+ * Write the dump to a newline-delimited JSON file named after the job and
+ * give the job a single result that refers to it.
+ */
+static void DumpDataToSpoolFile (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p)
+{
+	PathogenomicsServiceData *data_p = request_p -> pr_data_p;
+	char uuid_s [UUID_STRING_BUFFER_SIZE];
+	uint32 num_docs = 0;
+	char *filename_s;
+	bool success_flag = false;
+
+	/*
+	 * Use the id that the client was given rather than that of the
+	 * background job so that the dump can be found from it.
+	 */
+	ConvertUUIDToString (request_p -> pr_job_id, uuid_s);
+
+	if (data_p -> psd_dump_retention_time > 0)
+		{
+			RemoveExpiredNDJSONDumps (data_p -> psd_dump_directory_s, data_p -> psd_dump_retention_time);
+		}
+
+	filename_s = SpoolNDJSONDump (tool_p, request_p -> pr_preview_flag, data_p -> psd_dump_directory_s, uuid_s, &num_docs);
+
+	if (filename_s)
+		{
+			json_t *data_json_p = json_pack ("{s:I}", "records", (json_int_t) num_docs);
+
+			if (data_json_p)
+				{
+					json_t *resource_p = NULL;
+
+					if (data_p -> psd_dump_host_s)
+						{
+							const size_t l = strlen (data_p -> psd_dump_host_s);
+							const char *sep_s = ((l > 0) && (data_p -> psd_dump_host_s [l - 1] == '/')) ? "" : "/";
+							char *uri_s = ConcatenateVarargsStrings (data_p -> psd_dump_host_s, sep_s, uuid_s, PG_NDJSON_EXTENSION_S, NULL);
+
+							if (uri_s)
+								{
+									resource_p = GetDataResourceAsJSONByParts (PROTOCOL_HTTP_S, uri_s, uuid_s, data_json_p);
+									FreeCopiedString (uri_s);
+								}
+						}
+					else
+						{
+							resource_p = GetDataResourceAsJSONByParts (PROTOCOL_FILE_S, filename_s, uuid_s, data_json_p);
+						}
+
+					if (resource_p)
+						{
+							if (AddResultToServiceJob (job_p, resource_p))
+								{
+									success_flag = true;
+								}
+							else
+								{
+									json_decref (resource_p);
+								}
+						}
+
+					json_decref (data_json_p);
+				}		/* if (data_json_p) */
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add dump file \"%s\" to job %s", filename_s, uuid_s);
+				}
+
+			FreeCopiedString (filename_s);
+		}		/* if (filename_s) */
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to dump \"%s\".\"%s\" to \"%s\"", data_p -> psd_database_s, request_p -> pr_collection_name_s, data_p -> psd_dump_directory_s);
+		}
+
+	if (!success_flag)
+		{
+			if (!AddGeneralErrorMessageToServiceJob (job_p, "Failed to write dump file"))
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add job error value");
+				}
+		}
+
+	SetServiceJobStatus (job_p, success_flag ? OS_SUCCEEDED : OS_FAILED);
+}
+
+
+static uint32 ImportTable (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p)
+{
+	PathogenomicsServiceData *data_p = request_p -> pr_data_p;
+	const char *data_s = request_p -> pr_table_s;
+	uint32 num_successes = 0;
+	LinkedList *headers_p = GetTabularHeaders (&data_s, request_p -> pr_delimiter, '\n', GetPathogenomicsJSONFieldType, data_p);
+
+	if (headers_p)
+		{
+			bool success_flag = false;
+
+			/* Check that all of the required columns are present */
+			switch (request_p -> pr_collection_type)
+			{
+				case PD_SAMPLE:
+					success_flag = CheckSampleData (headers_p, job_p, data_p);
+					break;
+
+				case PD_PHENOTYPE:
+					success_flag = CheckPhenotypeData (headers_p, job_p, data_p);
+					break;
+
+				case PD_GENOTYPE:
+					success_flag = CheckGenotypeData (headers_p, job_p, data_p);
+					break;
+
+				case PD_FILES:
+					break;
+
+				default:
+					break;
+			}
+
+			if (success_flag)
+				{
+					/*
+					 * Rather than converting the whole table into a json array, the
+					 * rows are parsed and stored one at a time so the memory needed
+					 * doesn't grow with the size of the upload.
+					 */
+					RowSource *source_p = AllocateTabularRowSource (data_s, request_p -> pr_delimiter, '\n', headers_p);
+
+					if (source_p)
+						{
+							num_successes = ImportRowSource (request_p, tool_p, job_p, source_p);
+
+							SetImportStatus (job_p, num_successes, source_p -> rs_num_rows);
+
+							FreeRowSource (source_p);
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate tabular row source");
+							SetServiceJobStatus (job_p, OS_FAILED);
+						}
+				}
+			else
+				{
+					SetServiceJobStatus (job_p, OS_FAILED);
+				}
+
+			FreeLinkedList (headers_p);
+		}		/* if (headers_p) */
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Failed to get the column headings");
+			SetServiceJobStatus (job_p, OS_FAILED);
+		}
+
+	return num_successes;
+}
+
+
+/*
+ * Queue a copy of the request to run on the background executor. The
+ * job is returned straight away with its id so that the caller can
+ * collect the results later.
+ */
+static void StartBackgroundJob (const PathogenomicsRequest *request_p, ServiceJob *job_p)
+{
+	PathogenomicsRequest *copied_request_p = CopyPathogenomicsRequest (request_p);
+
+	if (copied_request_p)
+		{
+			if (SubmitAsyncJob (request_p -> pr_data_p -> psd_async_manager_p, job_p -> sj_id, RunBackgroundJob, FreeBackgroundJob, copied_request_p))
+				{
+					SetServiceJobStatus (job_p, OS_PENDING);
+					AddBackgroundFlagToJob (job_p);
+				}
+			else
+				{
+					FreePathogenomicsRequest (copied_request_p);
+					AddGeneralErrorMessageToServiceJob (job_p, "Failed to queue background job");
+				}
+		}
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Failed to copy request for background job");
+		}
+}
+
+
+/*
+ * The service itself is synchronous since most requests still run
+ * inline, so each job that is handed to the job manager is flagged
+ * to tell the caller to come back for its results.
+ */
+static void AddBackgroundFlagToJob (ServiceJob *job_p)
+{
+	if (!job_p -> sj_metadata_p)
+		{
+			job_p -> sj_metadata_p = json_object ();
+		}
+
+	if (! ((job_p -> sj_metadata_p) && (json_object_set_new (job_p -> sj_metadata_p, S_BACKGROUND_S, json_true ()) == 0)))
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add background flag to job metadata");
+		}
+}
+
+
+/*
+ * Background jobs run alongside other requests so each one uses
+ * its own MongoTool rather than the service's shared one.
+ */
+static void RunBackgroundJob (void *task_p, ServiceJob *job_p)
+{
+	PathogenomicsRequest *request_p = (PathogenomicsRequest *) task_p;
+	MongoTool *tool_p = GetRequestMongoTool (request_p -> pr_data_p);
+
+	SetServiceJobStatus (job_p, OS_STARTED);
+
+	if (tool_p)
+		{
+			RunPathogenomicsRequest (request_p, tool_p, job_p);
+			ReleaseRequestMongoTool (request_p -> pr_data_p, tool_p, job_p);
+		}
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Failed to connect to database");
+			SetServiceJobStatus (job_p, OS_FAILED);
+		}
+}
+
+
+static void FreeBackgroundJob (void *task_p)
+{
+	FreePathogenomicsRequest ((PathogenomicsRequest *) task_p);
+}
+
+
+/*
+ * The names are fixed so, unlike a table filled in when the service
+ * is created, they can be read by any number of calls at once.
+ */
+static const char *GetPathogenomicsDataName (const PathogenomicsData data)
+{
+	const char *name_s = NULL;
+
+	switch (data)
+		{
+			case PD_SAMPLE:
+				name_s = PG_SAMPLE_S;
+				break;
+
+			case PD_PHENOTYPE:
+				name_s = PG_PHENOTYPE_S;
+				break;
+
+			case PD_GENOTYPE:
+				name_s = PG_GENOTYPE_S;
+				break;
+
+			case PD_FILES:
+				name_s = PG_FILES_S;
+				break;
+
+			default:
+				break;
+		}
+
+	return name_s;
+}
+
+
+/*
+ * Get a MongoTool for a single request. The service's own MongoTool is
+ * never used for requests since calls can overlap, so if there isn't a
+ * pool, each request gets a new one.
+ */
+static MongoTool *GetRequestMongoTool (PathogenomicsServiceData *data_p)
+{
+	MongoTool *tool_p = NULL;
+
+	if (data_p -> psd_tool_pool_p)
+		{
+			tool_p = CheckOutMongoTool (data_p -> psd_tool_pool_p);
+		}
+	else
+		{
+			GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (data_p -> psd_base_data.sd_service_p);
 
+			tool_p = AllocateMongoTool (NULL, grassroots_p -> gs_mongo_manager_p);
+		}
 
+	return tool_p;
+}
 
 
-static bool ClosePathogenomicsService (Service *service_p)
+static void ReleaseRequestMongoTool (PathogenomicsServiceData *data_p, MongoTool *tool_p, ServiceJob *job_p)
 {
-	bool success_flag = true;
-
-	FreePathogenomicsServiceData ((PathogenomicsServiceData *) (service_p -> se_data_p));;
-
-	return success_flag;
+	if (data_p -> psd_tool_pool_p)
+		{
+			CheckInMongoTool (data_p -> psd_tool_pool_p, tool_p);
+			AddToolPoolStatsToJob (data_p, job_p);
+		}
+	else
+		{
+			FreeMongoTool (tool_p);
+		}
 }
 
 
-static json_type GetPathogenomicsJSONFieldType (const char *name_s, const void *data_p)
+static void AddToolPoolStatsToJob (PathogenomicsServiceData *data_p, ServiceJob *job_p)
 {
-	json_type t = JSON_STRING;
-	PathogenomicsServiceData *service_data_p = (PathogenomicsServiceData *) (data_p);
-	const json_t *config_p = service_data_p -> psd_base_data.sd_config_p;
-
-	if (config_p)
+	if (!job_p -> sj_metadata_p)
 		{
-			const json_t *field_defs_p = json_object_get (config_p, "field_defs");
+			job_p -> sj_metadata_p = json_object ();
+		}
 
-			if (field_defs_p)
+	if (job_p -> sj_metadata_p)
+		{
+			if (!AddMongoToolPoolStatsToJSON (data_p -> psd_tool_pool_p, job_p -> sj_metadata_p))
 				{
-					const char *field_def_s = GetJSONString (field_defs_p, name_s);
-
-					if (field_def_s)
-						{
-							if (strcmp (field_def_s, "int") == 0)
-								{
-									t = JSON_INTEGER;
-								}
-							else if (strcmp (field_def_s, "real") == 0)
-								{
-									t = JSON_REAL;
-								}
-							else if (strcmp (field_def_s, "bool") == 0)
-								{
-									t = JSON_TRUE;
-								}
-						}
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add connection pool stats to job metadata");
 				}
 		}
-
-	return t;
 }
 
 
-static bool GetCollectionName (ParameterSet *param_set_p, PathogenomicsServiceData *data_p, const char **collection_name_ss, PathogenomicsData *collection_type_p)
+static void GetBackgroundJob (PathogenomicsServiceData *data_p, const char *job_id_s, ServiceJob *job_p)
 {
-	const char *collection_s = NULL;
+	uuid_t job_id;
 
-	if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_COLLECTION.npt_name_s, &collection_s))
+	if (ConvertStringToUUID (job_id_s, job_id))
 		{
-			if (collection_s)
+			if (! ((data_p -> psd_async_manager_p) && (CopyAsyncJobToServiceJob (data_p -> psd_async_manager_p, job_id, job_p))))
 				{
-					uint32 i;
-
-					for (i = 0; i < PD_NUM_TYPES; ++ i)
-						{
-							if (strcmp (collection_s, * (s_data_names_pp + i)) == 0)
-								{
-									*collection_name_ss = * ((data_p -> psd_collection_ss) + i);
-									*collection_type_p = (PathogenomicsData) i;
-
-									return true;
-								}
-						}		/* for (i = 0; i < PD_NUM_TYPES; ++ i) */
+					AddGeneralErrorMessageToServiceJob (job_p, "Unknown job id, its results may have expired");
+					SetServiceJobStatus (job_p, OS_FAILED);
 				}
 		}
-
-	return false;
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Invalid job id");
+			SetServiceJobStatus (job_p, OS_FAILED);
+		}
 }
 
 
-static ServiceJobSet *RunPathogenomicsService (Service *service_p, ParameterSet *param_set_p, User * UNUSED_PARAM (user_p), ProvidersStateTable * UNUSED_PARAM (providers_p))
+static OperationStatus SearchData (MongoTool *tool_p, ServiceJob *job_p, const json_t *data_p, const PathogenomicsData UNUSED_PARAM (collection_type), PathogenomicsServiceData *service_data_p, const bool preview_flag)
 {
-	PathogenomicsServiceData *data_p = (PathogenomicsServiceData *) (service_p -> se_data_p);
-
-	service_p -> se_jobs_p = AllocateSimpleServiceJobSet (service_p, NULL, "Pathogenomics");
+	OperationStatus status = OS_FAILED;
+	json_t *values_p = json_object_get (data_p, MONGO_OPERATION_DATA_S);
 
-	if (service_p -> se_jobs_p)
+	if (values_p)
 		{
-			ServiceJob *job_p = GetServiceJobFromServiceJobSet (service_p -> se_jobs_p, 0);
-
-			LogParameterSet (param_set_p, job_p);
+			const char **fields_ss = NULL;
+			const char **properties_ss = NULL;
+			bool free_properties_flag = false;
+			json_t *fields_p = json_object_get (data_p, MONGO_OPERATION_FIELDS_S);
+			const bool geojson_flag = IsGeoJSONSearch (data_p);
+			json_t *raw_results_p;
+			SearchPage page;
+			const char *error_s = NULL;
 
-			SetServiceJobStatus (job_p, OS_FAILED_TO_START);
+			if (fields_p)
+				{
+					fields_ss = GetFieldNames (fields_p);
+				}
 
-			if (param_set_p)
+			/*
+			 * For GeoJSON, the requested fields become the properties of each
+			 * feature and the fields to get are those plus the location.
+			 */
+			if (geojson_flag)
 				{
-					/* get the collection to work on */
-					const char *collection_name_s = NULL;
-					bool preview_flag = false;
-					PathogenomicsData collection_type = PD_NUM_TYPES;
-					const bool *b_p = NULL;
-					Parameter *param_p = NULL;
+					properties_ss = fields_ss;
 
-					GetCurrentBooleanParameterValueFromParameterSet (param_set_p, PGS_PREVIEW.npt_name_s, &b_p);
-					if (b_p)
+					if (properties_ss)
 						{
-							preview_flag = *b_p;
+							free_properties_flag = true;
 						}
-
-					if (GetCollectionName (param_set_p, data_p, &collection_name_s, &collection_type))
+					else
 						{
-							MongoTool *tool_p = data_p -> psd_tool_p;
-
-							if (tool_p)
-								{
-									GetCurrentBooleanParameterValueFromParameterSet (param_set_p, PGS_DUMP.npt_name_s, &b_p);
-
-									/* Do we want to get a dump of the entire collection? */
-									if ((b_p != NULL) && (*b_p == true))
-										{
-											json_t *raw_results_p = GetAllMongoResultsAsJSON (tool_p, NULL, NULL);
-
-											if (raw_results_p)
-												{
-													if (!preview_flag)
-														{
-															raw_results_p = FilterResultsByDate (raw_results_p, preview_flag, CopyValidRecord);
-														}
-
-													PrintJSONToLog (STM_LEVEL_FINER, __FILE__, __LINE__, raw_results_p, "dump: ");
-
-													if (raw_results_p)
-														{
-															size_t i;
-															json_t *src_record_p;
-															char uuid_s [UUID_STRING_BUFFER_SIZE];
-
-															ConvertUUIDToString (job_p -> sj_id, uuid_s);
-
-															json_array_foreach (raw_results_p, i, src_record_p)
-															{
-																char *title_s = ConvertUnsignedIntegerToString (i);
-																json_t *dest_record_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, title_s, src_record_p);
-
-																if (dest_record_p)
-																	{
-																		if (!AddResultToServiceJob (job_p, dest_record_p))
-																			{
-																				PrintJSONToErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, dest_record_p, "Failed to add job to %s", uuid_s);
-
-																				if (!AddGeneralErrorMessageToServiceJob (job_p, "Failed to add document to result"))
-																					{
-																						PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set job error data");
-																					}
+							properties_ss = service_data_p -> psd_geojson_properties_ss ? service_data_p -> psd_geojson_properties_ss : GetDefaultGeoJSONProperties ();
+						}
 
-																				json_decref (dest_record_p);
-																			}
+					fields_ss = GetGeoJSONFields (properties_ss);
 
-																	}		/* if (dest_record_p) */
-																else
-																	{
-																		PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetResourceAsJSONByParts failed");
+					if (!fields_ss)
+						{
+							error_s = "Failed to get the fields for the GeoJSON results";
+						}
+				}
 
-																		if (!AddGeneralErrorMessageToServiceJob (job_p, "Failed to get document to add to result"))
-																			{
-																				PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set job error data");
-																			}
-																	}
+			if ((!error_s) && (InitSearchPage (&page, data_p, service_data_p -> psd_search_page_limit, &error_s)))
+				{
+					/*
+					 * The database removes anything that hasn't reached its live
+					 * date unless this is the private view.
+					 */
+					raw_results_p = FindLiveDocuments (tool_p, values_p, fields_ss, preview_flag, &page);
 
-																if (title_s)
-																	{
-																		FreeCopiedString (title_s);
-																	}
+					if (raw_results_p)
+						{
+							char *token_s = FinishSearchPage (&page, raw_results_p);
+							bool success_flag;
 
-															}		/* json_array_foreach (raw_results_p, i, src_record_p) */
+							if (geojson_flag)
+								{
+									success_flag = AddGeoJSONSearchResults (job_p, raw_results_p, properties_ss);
+								}
+							else
+								{
+									success_flag = AddSearchResults (job_p, raw_results_p, page.sp_skip);
+								}
 
+							status = success_flag ? OS_SUCCEEDED : OS_PARTIALLY_SUCCEEDED;
 
-															i = GetNumberOfServiceJobResults (job_p);
+							/* Let the caller know how to get the next page */
+							if (token_s)
+								{
+									if (!AddContinuationTokenToJob (job_p, token_s))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add continuation token to job metadata");
+										}
 
-															if (i > 0)
-																{
-																	SetServiceJobStatus (job_p, (i == json_array_size (raw_results_p)) ? OS_SUCCEEDED : OS_PARTIALLY_SUCCEEDED);
-																}
-															else
-																{
-																	SetServiceJobStatus (job_p, OS_FAILED);
-																}
+									FreeCopiedString (token_s);
+								}
 
-															json_decref (raw_results_p);
-														}		/* if (raw_results_p) */
-													else
-														{
-															/* The call succeeded but all results were filtered out */
-															SetServiceJobStatus (job_p, OS_SUCCEEDED);
-														}
+							json_decref (raw_results_p);
+						}		/* if (raw_results_p) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Couldn't get raw results from search");
+						}
 
+					ClearSearchPage (&page);
+				}		/* if ((!error_s) && (InitSearchPage (&page, data_p, service_data_p -> psd_search_page_limit, &error_s))) */
+			else
+				{
+					AddGeneralErrorMessageToServiceJob (job_p, error_s);
+				}
 
-												}		/* if (dump_p) */
-											else
-												{
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "GetAllMongoResultsAsJSON for \"%s\".\"%s\" failed", data_p -> psd_database_s, collection_name_s);
+			if (fields_ss)
+				{
+					FreeMemory (fields_ss);
+				}
 
-													if (!AddGeneralErrorMessageToServiceJob (job_p, "Search failed to get results"))
-														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add job error value");
-														}
-												}
+			/* The properties are only ours to free if they came from the request */
+			if (free_properties_flag)
+				{
+					FreeMemory (properties_ss);
+				}
+		}		/* if (values_p) */
 
-										}		/* if (param_p && (param_p -> pa_type == PT_BOOLEAN) && (param_p -> pa_current_value.st_boolean_value == true)) */
-									else
-										{
-											const json_t *json_param_p = NULL;
-											char delimiter = S_DEFAULT_COLUMN_DELIMITER;
-											uint32 num_successes = 0;
-											bool free_json_param_flag = false;
-											const char *delim_p = NULL;
-											const char *data_s = NULL;
-
-											/* Get the current delimiter */
-											GetCurrentCharParameterValueFromParameterSet (param_set_p, PGS_DELIMITER.npt_name_s, &delim_p);
-											if (delim_p)
-												{
-													delimiter = *delim_p;
-												}
 
-											/*
-											 * Data can be updated either from the table or as a json insert statement
-											 *
-											 * Has a tabular dataset been uploaded...
-											 */
-											if (GetCurrentStringParameterValueFromParameterSet (param_set_p, PGS_DELIMITER.npt_name_s, &data_s))
-												{
-													if (!IsStringEmpty (data_s))
-														{
-															LinkedList *headers_p = GetTabularHeaders (&data_s, delimiter, '\n', GetPathogenomicsJSONFieldType, data_p);
+#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
+	PrintJSONToLog (STM_LEVEL_SEVERE, __FILE__, __LINE__, job_p -> sj_result_p, "results_p: ");
+#endif
 
-															if (headers_p)
-																{
-																	bool success_flag = false;
+	SetServiceJobStatus (job_p, status);
 
-																	/* Check that all of the required columns are present */
-																	switch (collection_type)
-																	{
-																		case PD_SAMPLE:
-																			success_flag = CheckSampleData (headers_p, job_p, data_p);
-																			break;
+	return status;
+}
 
-																		case PD_PHENOTYPE:
-																			success_flag = CheckPhenotypeData (headers_p, job_p, data_p);
-																			break;
 
-																		case PD_GENOTYPE:
-																			success_flag = CheckGenotypeData (headers_p, job_p, data_p);
-																			break;
+static bool AddContinuationTokenToJob (ServiceJob *job_p, const char *token_s)
+{
+	bool success_flag = false;
 
-																		case PD_FILES:
-																			break;
+	if (!job_p -> sj_metadata_p)
+		{
+			job_p -> sj_metadata_p = json_object ();
+		}
 
-																		default:
-																			break;
-																	}
+	if (job_p -> sj_metadata_p)
+		{
+			success_flag = (json_object_set_new (job_p -> sj_metadata_p, PG_CONTINUATION_S, json_string (token_s)) == 0);
+		}
 
-																	if (success_flag)
-																		{
-																			json_param_p = ConvertTabularDataToJSON (data_s, delimiter, '\n', headers_p);
-																		}
+	return success_flag;
+}
 
-																	FreeLinkedList (headers_p);
-																}		/* if (headers_p) */
 
+static OperationStatus AggregateData (MongoTool *tool_p, ServiceJob *job_p, const json_t *aggregate_p, PathogenomicsServiceData *service_data_p, const bool preview_flag)
+{
+	OperationStatus status = OS_FAILED;
+	const char *error_s = NULL;
 
-															if (json_param_p)
-																{
-		#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-																	PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, json_param_p, "table");
-		#endif
+	/*
+	 * The database removes anything that hasn't reached its live
+	 * date before counting unless this is the private view.
+	 */
+	json_t *counts_p = GetAggregateCounts (tool_p, aggregate_p, service_data_p -> psd_aggregate_keys_p, preview_flag, &error_s);
 
-																	free_json_param_flag = true;
-																}
-														}
-												}
-											/* ... or do we have an insert statement? */
-											else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_UPDATE.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
-												{
-													uint32 size = 1;
-													OperationStatus status;
-													int32 stage_time = data_p -> psd_default_stage_time;
-													const int32 *stage_time_p = NULL;
+	if (counts_p)
+		{
+			json_t *resource_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, PG_COUNT_S, counts_p);
 
-													if (GetCurrentSignedIntParameterValueFromParameterSet (param_set_p, PGS_STAGE_TIME.npt_name_s, &stage_time_p))
-														{
-															if (stage_time_p)
-																{
-																	stage_time = *stage_time_p;
-																}
-														}
+			if (resource_p)
+				{
+					if (AddResultToServiceJob (job_p, resource_p))
+						{
+							status = OS_SUCCEEDED;
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result data");
 
-													if (json_is_array (json_param_p))
-														{
-															size = json_array_size (json_param_p);
-														}
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add aggregated counts to results array");
+							json_decref (resource_p);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create aggregated counts resource");
+				}
 
-													num_successes = InsertData (tool_p, job_p, json_param_p, collection_type, stage_time, data_p);
+			json_decref (counts_p);
+		}		/* if (counts_p) */
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, error_s);
+		}
 
+	SetServiceJobStatus (job_p, status);
 
-													if (num_successes == 0)
-														{
-															status = OS_FAILED;
-														}
-													else if (num_successes == size)
-														{
-															status = OS_SUCCEEDED;
-														}
-													else
-														{
-															status = OS_PARTIALLY_SUCCEEDED;
-														}
+	return status;
+}
 
-													SetServiceJobStatus (job_p, status);
-												}
-											else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_QUERY.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
-												{
-													json_t *results_p = NULL;
-													OperationStatus search_status;
 
-													search_status = SearchData (tool_p, job_p, json_param_p, collection_type, data_p, preview_flag);
+static OperationStatus MapTileData (ServiceJob *job_p, const char *tile_s, PathogenomicsServiceData *service_data_p, const bool preview_flag)
+{
+	OperationStatus status = OS_FAILED;
 
-													if (search_status == OS_SUCCEEDED || search_status == OS_PARTIALLY_SUCCEEDED)
-														{
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINER
-															PrintJSONToLog (STM_LEVEL_FINER, __FILE__, __LINE__, job_p -> sj_result_p, "initial results");
-#endif
+	if (service_data_p -> psd_map_tiles_p)
+		{
+			const char *error_s = NULL;
 
-															num_successes = GetNumberOfServiceJobResults (job_p);
-														}
-												}
-											else if (((param_p = GetParameterFromParameterSetByName (param_set_p, PGS_REMOVE.npt_name_s)) != NULL) && (!IsJSONEmpty (json_param_p = GetJSONParameterCurrentValue ((JSONParameter *) param_p))))
-												{
-													uint32 size = 1;
-													OperationStatus status;
+			/*
+			 * The tile is built from just the public samples
+			 * unless this is the private view.
+			 */
+			json_t *tile_p = GetMapTile (service_data_p -> psd_map_tiles_p, tile_s, preview_flag, &error_s);
 
-													if (json_is_array (json_param_p))
-														{
-															size = json_array_size (json_param_p);
-														}
+			if (tile_p)
+				{
+					json_t *resource_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, tile_s, tile_p);
 
-													num_successes = DeleteData (tool_p, job_p, json_param_p, collection_type, data_p);
+					if (resource_p)
+						{
+							if (AddResultToServiceJob (job_p, resource_p))
+								{
+									status = OS_SUCCEEDED;
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result data");
 
-													if (num_successes == 0)
-														{
-															status = OS_FAILED;
-														}
-													else if (num_successes == size)
-														{
-															status = OS_SUCCEEDED;
-														}
-													else
-														{
-															status = OS_PARTIALLY_SUCCEEDED;
-														}
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add map tile %s to results array", tile_s);
+									json_decref (resource_p);
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create map tile %s resource", tile_s);
+						}
 
-													SetServiceJobStatus (job_p, status);
-												}
+					json_decref (tile_p);
+				}		/* if (tile_p) */
+			else
+				{
+					AddGeneralErrorMessageToServiceJob (job_p, error_s ? error_s : "Failed to get the map tile");
+				}
 
-											if (json_param_p)
-												{
-													json_error_t error;
-													json_t *metadata_p = NULL;
+		}		/* if (service_data_p -> psd_map_tiles_p) */
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Map tiles are not available");
+		}
 
-													metadata_p = json_pack_ex (&error, 0, "{s:i}", "successful entries", num_successes);
+	SetServiceJobStatus (job_p, status);
 
+	return status;
+}
 
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-													{
-														PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_errors_p, "errors: ");
-														PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, metadata_p, "metadata 1: ");
-													}
-#endif
 
-													if (metadata_p)
-														{
-															job_p -> sj_metadata_p = metadata_p;
-														}
+static OperationStatus SummaryData (ServiceJob *job_p, const json_t *summary_p, PathogenomicsServiceData *service_data_p, const bool preview_flag)
+{
+	OperationStatus status = OS_FAILED;
 
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-													PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_errors_p, "job errors: ");
-													PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_metadata_p, "job metadata: ");
-													PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_result_p, "job results: ");
-													PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "job status %d", job_p -> sj_status);
-#endif
+	if (service_data_p -> psd_rollups_p)
+		{
+			const char *error_s = NULL;
 
+			/*
+			 * The counters for samples that haven't reached their live
+			 * date are left out unless this is the private view.
+			 */
+			json_t *counts_p = GetRollupCounts (service_data_p -> psd_rollups_p, summary_p, preview_flag, &error_s);
 
-													/*
-													if (json_param_p != value.st_json_p)
-														{
-															WipeJSON (json_param_p);
-														}
-													 */
-												}		/* if (json_param_p) */
-											else
-												{
-													SetServiceJobStatus (job_p, OS_FAILED);
-												}
+			if (counts_p)
+				{
+					json_t *resource_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, PG_COUNT_S, counts_p);
 
-										}		/* if (param_p && (param_p -> pa_type == PT_BOOLEAN) && (param_p -> pa_current_value.st_boolean_value == true)) else */
+					if (resource_p)
+						{
+							if (AddResultToServiceJob (job_p, resource_p))
+								{
+									status = OS_SUCCEEDED;
+								}
+							else
+								{
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result data");
 
-								}		/* if (tool_p) */
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add summary counts to results array");
+									json_decref (resource_p);
+								}
 						}
 					else
 						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "no collection specified");
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create summary counts resource");
 						}
 
-				}		/* if (param_set_p) */
+					json_decref (counts_p);
+				}		/* if (counts_p) */
+			else
+				{
+					AddGeneralErrorMessageToServiceJob (job_p, error_s ? error_s : "Failed to get the summary");
+				}
 
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-			PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, job_p -> sj_metadata_p, "metadata 3: ");
-#endif
+		}		/* if (service_data_p -> psd_rollups_p) */
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Summaries are not available");
+		}
 
-			LogServiceJob (job_p);
-		}		/* if (service_p -> se_jobs_p) */
+	SetServiceJobStatus (job_p, status);
 
-	return service_p -> se_jobs_p;
+	return status;
 }
 
 
-static bool AddLiveDateFiltering (json_t *record_p, const char * const date_s)
+/*
+ * Add each document as an inline resource, numbering them from the
+ * start of the search rather than the page.
+ */
+static bool AddSearchResults (ServiceJob *job_p, const json_t *raw_results_p, const uint32 offset)
 {
-	bool success_flag = false;
-	uint32 i;
+	size_t i;
+	json_t *raw_result_p;
 
-	for (i = 0; i < PD_NUM_TYPES; ++ i)
+	json_array_foreach (raw_results_p, i, raw_result_p)
 		{
-			const char * const group_name_s = * (s_data_names_pp + i);
-			char *key_s = ConcatenateStrings (group_name_s, PG_LIVE_DATE_SUFFIX_S);
+			char *title_s = ConvertUnsignedIntegerToString (offset + i + 1);
 
-			if (key_s)
+			if (title_s)
 				{
-					json_t *date_p = json_object_get (record_p, key_s);
+					json_t *resource_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, title_s, raw_result_p);
 
-					if (date_p)
+					if (resource_p)
 						{
-							const char *live_date_s = GetJSONString (date_p, "date");
-
-							if (live_date_s)
+							if (!AddResultToServiceJob (job_p, resource_p))
 								{
-									/*
-									 * Although both values are dates as strings, we don't need to convert
-									 * them as they are both in YYYY-MM-DD format. So strcmp is enough to
-									 * see if the "go live" date has been met.
-									 */
-									if (strcmp (live_date_s, date_s) > 0)
-										{
-											if (json_object_del (record_p, group_name_s) == 0)
-												{
-													success_flag = true;
-												}
-											else
-												{
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to remove %s from record", group_name_s);
-												}
-										}
-									else
-										{
-											success_flag = true;
-										}
-								}
+									AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result data");
 
-							/* Remove the "_live_date" object as any */
-							if (json_object_del (record_p, key_s) != 0)
-								{
-									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to remove %s from record", key_s);
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add json resource for " SIZET_FMT " to results array", i);
+									json_decref (resource_p);
 								}
-						}		/* if (date_p) */
+						}		/* if (resource_p) */
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create json resource for " SIZET_FMT, i);
+						}
 
-					FreeCopiedString (key_s);
-				}		/* if (key_s) */
+					FreeCopiedString (title_s);
+				}
 			else
 				{
-					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create key from  \"%s\" and \"%s\"", group_name_s, PG_LIVE_DATE_SUFFIX_S);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to convert " SIZET_FMT " to string for title", i + 1);
 				}
 
-		}		/* for (i = 0; i < PD_NUM_TYPES; ++ i) */
+		}		/* json_array_foreach (raw_results_p, i, raw_result_p) */
 
-	return success_flag;
+	return (GetNumberOfServiceJobResults (job_p) == json_array_size (raw_results_p));
 }
 
 
-static char *GetCurrentDateAsString (void)
+/*
+ * Add all of the documents as a single inline resource holding a
+ * GeoJSON FeatureCollection.
+ */
+static bool AddGeoJSONSearchResults (ServiceJob *job_p, const json_t *raw_results_p, const char **properties_ss)
 {
-	char *date_s = NULL;
-	struct tm current_time;
+	bool success_flag = false;
+	json_t *collection_p = GetDocumentsAsGeoJSON (raw_results_p, properties_ss);
 
-	if (GetPresentTime (&current_time))
+	if (collection_p)
 		{
-			date_s = GetTimeAsString (&current_time, false, NULL);
+			json_t *resource_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, PG_GEOJSON_FORMAT_S, collection_p);
+
+			if (resource_p)
+				{
+					if (AddResultToServiceJob (job_p, resource_p))
+						{
+							success_flag = true;
+						}
+					else
+						{
+							AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result data");
 
-			if (!date_s)
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add GeoJSON resource to results array");
+							json_decref (resource_p);
+						}
+				}
+			else
 				{
-					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to convert time to a string");
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create GeoJSON resource");
 				}
-		}
+
+			json_decref (collection_p);
+		}		/* if (collection_p) */
 	else
 		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get current time");
+			AddGeneralErrorMessageToServiceJob (job_p, "Failed to convert the results to GeoJSON");
 		}
 
-	return date_s;
+	return success_flag;
 }
 
 
-static json_t *ConvertToResource (const size_t i, json_t *src_record_p)
+/*
+ * Get the strings from a JSON array of field names. The strings are not
+ * copied so the array must outlive the returned value, which must be
+ * freed with FreeMemory ().
+ */
+static const char **GetFieldNames (const json_t *fields_p)
 {
-	json_t *resource_p = NULL;
-	char *title_s = ConvertUnsignedIntegerToString (i);
+	const char **fields_ss = NULL;
 
-	if (title_s)
+	if (json_is_array (fields_p))
 		{
-			resource_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, title_s, src_record_p);
+			size_t size = json_array_size (fields_p);
 
-			FreeCopiedString (title_s);
-		}		/* if (raw_result_p) */
+			fields_ss = (const char **) AllocMemoryArray (size + 1, sizeof (const char *));
 
-	return resource_p;
-}
+			if (fields_ss)
+				{
+					const char **field_ss = fields_ss;
+					size_t i;
+					json_t *field_p;
+
+					json_array_foreach (fields_p, i, field_p)
+					{
+						if (json_is_string (field_p))
+							{
+								*field_ss = json_string_value (field_p);
+								++ field_ss;
+							}
+						else
+							{
+								char *dump_s = json_dumps (field_p, JSON_INDENT (2));
 
+								PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get field from %s", dump_s);
+								free (dump_s);
+							}
+					}
 
-static json_t *CopyValidRecord (const size_t UNUSED_PARAM (i), json_t *src_record_p)
-{
-	return json_deep_copy (src_record_p);
+					*field_ss = NULL;
+				}		/* if (fields_ss) */
+
+		}		/* if (json_is_array (fields_p)) */
+
+	return fields_ss;
 }
 
 
-static json_t *FilterResultsByDate (json_t *src_results_p, const bool preview_flag, json_t *(convert_record_fn) (const size_t i, json_t *src_record_p))
+static char *CheckDataIsValid (const json_t *row_p, PathogenomicsServiceData *data_p)
 {
-	json_t *results_p = json_array ();
+	char *errors_s = NULL;
+	ByteBuffer *buffer_p = AllocateByteBuffer (1024);
 
-	if (results_p)
+	if (buffer_p)
 		{
-			char *date_s = GetCurrentDateAsString ();
+			/*
+			 * Each row the pathogenmics must contain an ID field
+			 * not the mongo _id, and the ability to get a geojson
+			 * stub and a date.
+			 */
 
-			if (date_s)
+			if (!json_object_get (row_p, PG_ID_S))
 				{
-					const size_t size = json_array_size (src_results_p);
-					size_t i = 0;
-
-					for (i = 0; i < size; ++ i)
+					if (!AppendStringsToByteBuffer (buffer_p, "The row does not have an ",  PG_ID_S,  " field", NULL))
 						{
-							json_t *src_result_p = json_array_get (src_results_p, i);
-							json_t *dest_result_p = NULL;
+						}
+				}
 
-							/* We don't need to return the internal mongo id so remove it */
-							json_object_del (src_result_p, MONGO_ID_S);
+			// http://api.opencagedata.com/geocode/v1/geojson?pretty=1&key=1a9d04b5e924fd52d1f306d924d023a5&query=Osisek,+Croatia'
 
-							if (!preview_flag)
-								{
-									if (AddLiveDateFiltering (src_result_p, date_s))
-										{
-											/*
-											 * If the result is non-trivial i.e. has at least one of the sample,
-											 * genotype or phenotype, then keep it
-											 */
-											if ((json_object_get (src_result_p, PG_SAMPLE_S) != NULL) ||
-													(json_object_get (src_result_p, PG_PHENOTYPE_S) != NULL) ||
-													(json_object_get (src_result_p, PG_GENOTYPE_S) != NULL))
-												{
-													dest_result_p = convert_record_fn (i, src_result_p);
 
-													if (!dest_result_p)
-														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to convert src json \"%s\" " SIZET_FMT " to results array", i);
-														}
 
-												}
-											else
-												{
+			if (GetByteBufferSize (buffer_p) > 0)
+				{
+					errors_s = DetachByteBufferData (buffer_p);
+				}
+		}		/* if (buffer_p) */
+
+	return errors_s;
+}
+
+
+/*
+bool AddErrorMessage (json_t *errors_p, const json_t *values_p, const size_t row, const char * const error_s)
+{
+	bool success_flag = false;
+	const char *pathogenomics_id_s = GetJSONString (values_p, PG_ID_S);
+
+	if (pathogenomics_id_s)
+		{
+			json_error_t error;
+			json_t *error_p = json_pack_ex (&error, 0, "{s:s,s:i,s:s}", "ID", pathogenomics_id_s, "row", row, "error", error_s);
+
+			if (error_p)
+				{
+					if (json_array_append_new (errors_p, error_p) == 0)
+						{
+							success_flag = true;
+						}
+				}
+		}
+
 #if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-													const char *id_s = GetJSONString (src_result_p, PG_ID_S);
-													PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Discarding %s after filtering", id_s ? id_s : "");
+	PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, errors_p, "errors data: ");
 #endif
-												}
-										}
-									else
-										{
-											const char *id_s = GetJSONString (src_result_p, PG_ID_S);
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add date filtering for %s", id_s ? id_s : "");
-										}		/* if (!AddLiveDateFiltering (values_p, collection_type)) */
 
-								}		/* if (!private_view_flag) */
-							else
-								{
-									dest_result_p = convert_record_fn (i, src_result_p);
+	return success_flag;
+}
+ */
 
-									if (!dest_result_p)
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to convert src json \"%s\" " SIZET_FMT " to results array", i);
-										}
-								}
 
+static uint32 InsertData (MongoTool *tool_p, ServiceJob *job_p, RowSource *source_p, const PathogenomicsData collection_type, const uint32 stage_time, const char *upload_id_s, const DateOrder date_order, PathogenomicsServiceData *data_p)
+{
+	uint32 num_imports = 0;
+	ImportSession *session_p = AllocateImportSession (tool_p, job_p, data_p, collection_type, stage_time, upload_id_s, date_order);
 
-							if (dest_result_p)
-								{
-									if (json_array_append_new (results_p, dest_result_p) != 0)
-										{
-											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add json resource for " SIZET_FMT " to results array", i);
-											json_decref (dest_result_p);
-										}
-								}
+	if (session_p)
+		{
+			num_imports = ImportRows (session_p, source_p);
+
+			FreeImportSession (session_p);
+		}		/* if (session_p) */
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "Failed to start import");
+		}
+
+	return num_imports;
+}
 
-						}		/* for (i = 0; i < size; ++ i) */
 
-					FreeCopiedString (date_s);
-				}		/* if (date_s) */
+/*
+ * Either store or just validate the rows of an upload, depending
+ * upon what the request asked for.
+ */
+static uint32 ImportRowSource (PathogenomicsRequest *request_p, MongoTool *tool_p, ServiceJob *job_p, RowSource *source_p)
+{
+	uint32 num_successes;
 
-		}		/* if (results_p) */
+	if (request_p -> pr_validate_flag)
+		{
+			num_successes = ValidateData (job_p, source_p, request_p -> pr_collection_type, request_p -> pr_date_order);
+		}
 	else
 		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create results object");
+			num_successes = InsertData (tool_p, job_p, source_p, request_p -> pr_collection_type, request_p -> pr_stage_time, request_p -> pr_upload_id_s, request_p -> pr_date_order, request_p -> pr_data_p);
 		}
 
-	return results_p;
+	return num_successes;
 }
 
 
-static OperationStatus SearchData (MongoTool *tool_p, ServiceJob *job_p, const json_t *data_p, const PathogenomicsData collection_type, PathogenomicsServiceData * UNUSED_PARAM (service_data_p), const bool preview_flag)
+static uint32 ValidateData (ServiceJob *job_p, RowSource *source_p, const PathogenomicsData collection_type, const DateOrder date_order)
 {
-	OperationStatus status = OS_FAILED;
-	json_t *values_p = json_object_get (data_p, MONGO_OPERATION_DATA_S);
+	const uint32 num_valid = ValidateRows (source_p, collection_type, date_order, job_p);
+	json_error_t err;
+	json_t *validation_p = json_pack_ex (&err, 0, "{s:I,s:I,s:I}",
+																			 "rows", (json_int_t) (source_p -> rs_num_rows),
+																			 "valid", (json_int_t) num_valid,
+																			 "invalid", (json_int_t) (source_p -> rs_num_rows - num_valid));
+
+	if (validation_p)
+		{
+			if (!job_p -> sj_metadata_p)
+				{
+					job_p -> sj_metadata_p = json_object ();
+				}
 
-	if (values_p)
+			if ((!job_p -> sj_metadata_p) || (json_object_set_new (job_p -> sj_metadata_p, "validation", validation_p) != 0))
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add validation counts to job metadata");
+					json_decref (validation_p);
+				}
+		}
+	else
 		{
-			const char **fields_ss = NULL;
-			json_t *fields_p = json_object_get (data_p, MONGO_OPERATION_FIELDS_S);
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create validation counts: %s", err.text);
+		}
 
-			if (fields_p)
+	return num_valid;
+}
+
+
+static int32 GetStageTime (ParameterSet *param_set_p, PathogenomicsServiceData *data_p)
+{
+	int32 stage_time = data_p -> psd_default_stage_time;
+	const int32 *stage_time_p = NULL;
+
+	if (GetCurrentSignedIntParameterValueFromParameterSet (param_set_p, PGS_STAGE_TIME.npt_name_s, &stage_time_p))
+		{
+			if (stage_time_p)
+				{
+					stage_time = *stage_time_p;
+				}
+		}
+
+	return stage_time;
+}
+
+
+static void SetImportStatus (ServiceJob *job_p, const uint32 num_successes, const size_t num_rows)
+{
+	OperationStatus status;
+
+	if (num_successes == 0)
+		{
+			status = OS_FAILED;
+		}
+	else if (num_successes == num_rows)
+		{
+			status = OS_SUCCEEDED;
+		}
+	else
+		{
+			status = OS_PARTIALLY_SUCCEEDED;
+		}
+
+	SetServiceJobStatus (job_p, status);
+}
+
+
+bool AddErrorMessage (ServiceJob *job_p, const json_t *value_p, const char *error_s, const int index)
+{
+	char *dump_s = json_dumps (value_p, JSON_INDENT (2) | JSON_PRESERVE_ORDER);
+	const char *id_s = GetJSONString (value_p, PG_ID_S);
+	bool added_error_flag = false;
+
+	if (!id_s)
+		{
+			id_s = GetJSONString (value_p, PG_UKCPVS_ID_S);
+		}
+
+	if (id_s)
+		{
+			char *row_s = ConcatenateVarargsStrings ("row ", id_s, " ", error_s, NULL);
+
+			if (row_s)
+				{
+					added_error_flag = AddGeneralErrorMessageToServiceJob (job_p, row_s);
+
+					FreeCopiedString (row_s);
+				}
+		}
+	else
+		{
+			char *index_s = GetIntAsString (index);
+
+			if (index_s)
 				{
-					if (json_is_array (fields_p))
+					char *row_s = ConcatenateVarargsStrings ("row ", index_s, " ", error_s, NULL);
+
+					if (row_s)
 						{
-							size_t size = json_array_size (fields_p);
+							added_error_flag = AddGeneralErrorMessageToServiceJob (job_p, row_s);
+
+							FreeCopiedString (row_s);
+						}
+
+					FreeCopiedString (index_s);
+				}
+
+		}
+
+	if (!added_error_flag)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "failed to add %s to client feedback messsage", error_s);
+		}
+
+
+	if (dump_s)
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to import \"%s\": error=%s", dump_s, error_s);
+			free (dump_s);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to import error=%s", dump_s, error_s);
+		}
+
+	return added_error_flag;
+}
 
-							fields_ss = (const char **) AllocMemoryArray (size + 1, sizeof (const char *));
 
-							if (fields_ss)
-								{
-									const char **field_ss = fields_ss;
-									size_t i;
-									json_t *field_p;
+/*
+ * Remove the documents matching one or more selectors, carrying on with
+ * the rest if any of them fail. The request can be a single selector, an
+ * array of them in its "data" value or an array of requests. The number of
+ * documents that each selector matched and the number that it deleted are
+ * added to the job's metadata. Selectors that don't pick out documents by
+ * their ids are refused unless their request has "allow_unbounded" set.
+ *
+ * Each selector is counted, scanned for its map tiles and rollups and
+ * deleted on its own rather than in a single bulk operation, as a bulk
+ * operation's reply only has the total number of documents removed.
+ */
+static uint32 DeleteData (MongoTool *tool_p, ServiceJob *job_p, const json_t *data_p, const PathogenomicsData collection_type, PathogenomicsServiceData *service_data_p, uint32 *num_selectors_p)
+{
+	uint32 num_successes = 0;
+	json_t *entries_p = GetDeleteSelectors (data_p);
 
-									json_array_foreach (fields_p, i, field_p)
-									{
-										if (json_is_string (field_p))
-											{
-												*field_ss = json_string_value (field_p);
-												++ field_ss;
-											}
-										else
-											{
-												char *dump_s = json_dumps (field_p, JSON_INDENT (2));
+	*num_selectors_p = 0;
 
-												PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get field from %s", dump_s);
-												free (dump_s);
-											}
-									}
+	if (entries_p)
+		{
+			const size_t num_entries = json_array_size (entries_p);
+			json_t *results_p = json_array ();
 
-								}		/* if (fields_ss) */
+			*num_selectors_p = (uint32) num_entries;
 
-						}		/* if (json_is_array (fields_p)) */
+			if (results_p)
+				{
+					json_t *changed_tiles_p = NULL;
+					json_t *changed_ids_p = NULL;
+					json_int_t num_deleted = 0;
+					size_t i;
+					json_t *entry_p;
 
-				}		/* if (fields_p) */
+					/*
+					 * Find which map tiles the samples are on before they are
+					 * removed so that they can be rebuilt without them.
+					 */
+					if ((service_data_p -> psd_map_tiles_p) && (strcmp (service_data_p -> psd_collection_ss [collection_type], service_data_p -> psd_collection_ss [PD_SAMPLE]) == 0))
+						{
+							changed_tiles_p = json_object ();
+						}
 
-			if (FindMatchingMongoDocumentsByJSON (tool_p, values_p, fields_ss, NULL))
-				{
-					json_t *raw_results_p = GetAllExistingMongoResultsAsJSON (tool_p);
+					/* Likewise for the documents whose counters need taking off */
+					if (service_data_p -> psd_rollups_p)
+						{
+							changed_ids_p = json_object ();
+						}
 
-					if (raw_results_p)
+					json_array_foreach (entries_p, i, entry_p)
 						{
-							if (json_is_array (raw_results_p))
+							const json_t *selector_p = json_object_get (entry_p, MONGO_OPERATION_DATA_S);
+							json_t *result_p = json_pack ("{s:i}", "index", (int) i);
+							const char *error_s = NULL;
+
+							if (!json_is_object (selector_p))
 								{
-									const size_t size = json_array_size (raw_results_p);
-									size_t i = 0;
-									json_t *raw_result_p = NULL;
-									char *date_s = NULL;
-									bool success_flag = true;
-
-									/*
-									 * If we are on the public view, we need to filter
-									 * out entries that don't meet the live dates.
-									 */
-									if (!preview_flag)
+									error_s = "The selector must be a JSON object";
+								}
+							else if ((!IsBoundedSelector (selector_p)) && (!json_is_true (json_object_get (entry_p, S_ALLOW_UNBOUNDED_S))))
+								{
+									error_s = "Refusing to delete without an exact or \"$in\" match on \"_id\", \"ID\" or \"UKCPVS ID\" unless \"allow_unbounded\" is set";
+								}
+							else
+								{
+									bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+									error_s = "Failed to convert the selector to BSON";
+
+									if (selector_bson_p)
 										{
-											struct tm current_time;
+											bson_error_t error;
+											bson_t reply;
+											int64_t num_matched = mongoc_collection_count_documents (tool_p -> mt_collection_p, selector_bson_p, NULL, NULL, NULL, &error);
 
-											if (GetPresentTime (&current_time))
+											if (num_matched >= 0)
 												{
-													date_s = GetTimeAsString (&current_time, false, NULL);
-
-													if (!date_s)
+													if (result_p)
 														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to convert time to a string");
-															success_flag = false;
+															json_object_set_new (result_p, "matched", json_integer (num_matched));
 														}
-												}
-											else
-												{
-													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get current time");
-													success_flag = false;
-												}
-
-										}		/* if (!private_view_flag) */
-
-									if (success_flag)
-										{
-											for (i = 0; i < size; ++ i)
-												{
-													raw_result_p = json_array_get (raw_results_p, i);
-													char *title_s = ConvertUnsignedIntegerToString (i + 1);
 
-													if (!title_s)
+													if (changed_tiles_p)
 														{
-															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to convert " SIZET_FMT " to string for title", i + 1);
+															if (!AddChangedMapTilesForFilter (service_data_p -> psd_map_tiles_p, tool_p, selector_p, changed_tiles_p))
+																{
+																	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to find all of the map tiles for the samples being deleted");
+																}
 														}
 
-													/* We don't need to return the internal mongo id so remove it */
-													json_object_del (raw_result_p, MONGO_ID_S);
-
-													if (!preview_flag)
+													if (changed_ids_p)
 														{
-															if (AddLiveDateFiltering (raw_result_p, date_s))
+															if (!AddRollupIdsForFilter (tool_p, selector_p, changed_ids_p))
 																{
-																	/*
-																	 * If the result is non-trivial i.e. has at least one of the sample,
-																	 * genotype or phenotype, then keep it
-																	 */
-																	if ((json_object_get (raw_result_p, PG_SAMPLE_S) == NULL) &&
-																			(json_object_get (raw_result_p, PG_PHENOTYPE_S) == NULL) &&
-																			(json_object_get (raw_result_p, PG_GENOTYPE_S) == NULL))
-																		{
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-																			const char *id_s = GetJSONString (raw_result_p, PG_ID_S);
-																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Discarding %s after filtering", id_s ? id_s : "");
-#endif
-
-																			raw_result_p = NULL;
-																		}
+																	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to find all of the documents being deleted for the rollups");
 																}
-															else
-																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add date filtering for %d", collection_type);
-																	raw_result_p = NULL;
-																}		/* if (!AddLiveDateFiltering (values_p, collection_type)) */
-														}		/* if (!private_view_flag) */
+														}
 
-													if (raw_result_p)
+													/*
+													 * Each selector is run on its own so that its reply has
+													 * the number of documents that it actually removed.
+													 */
+													if (mongoc_collection_delete_many (tool_p -> mt_collection_p, selector_bson_p, NULL, &reply, &error))
 														{
-															json_t *resource_p = GetDataResourceAsJSONByParts (PROTOCOL_INLINE_S, NULL, title_s, raw_result_p);
-
-															if (resource_p)
-																{
-																	if (!AddResultToServiceJob (job_p, resource_p))
-																		{
-																			AddGeneralErrorMessageToServiceJob (job_p, "Failed to add result data");
+															const json_int_t num_selector_deleted = GetDeletedCount (&reply);
 
-																			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add json resource for " SIZET_FMT " to results array", i);
-																			json_decref (resource_p);
-																		}
-																}		/* if (resource_p) */
-															else
+															if (result_p)
 																{
-																	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create json resource for " SIZET_FMT, i);
+																	json_object_set_new (result_p, "deleted", json_integer (num_selector_deleted));
 																}
 
-														}		/* if (raw_result_p) */
-
-													if (title_s)
+															num_deleted += num_selector_deleted;
+															++ num_successes;
+															error_s = NULL;
+														}
+													else
 														{
-															FreeCopiedString (title_s);
+															error_s = "Failed to delete the matching documents";
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to run delete " SIZET_FMT ": %s", i, error.message);
 														}
-												}		/* for (i = 0; i < size; ++ i) */
 
+													bson_destroy (&reply);
+												}
+											else
+												{
+													error_s = "Failed to count the matching documents";
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to count the documents for delete " SIZET_FMT ": %s", i, error.message);
+												}
 
-											i = GetNumberOfServiceJobResults (job_p);
-											status = (i == json_array_size (raw_results_p)) ? OS_SUCCEEDED : OS_PARTIALLY_SUCCEEDED;
-										}		/* if (success_flag) */
+											bson_destroy (selector_bson_p);
+										}		/* if (selector_bson_p) */
+								}
 
-									if (date_s)
+							if (result_p)
+								{
+									if (error_s)
 										{
-											FreeCopiedString (date_s);
+											json_object_set_new (result_p, "error", json_string (error_s));
 										}
 
-								}		/* if (json_is_array (raw_results_p)) */
-							else
+									if (json_array_append_new (results_p, result_p) != 0)
+										{
+											json_decref (result_p);
+										}
+								}
+
+						}		/* json_array_foreach (entries_p, i, entry_p) */
+
+					if (changed_ids_p)
+						{
+							if (num_successes > 0)
 								{
-									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Search results is not an array");
+									if (!UpdateRollups (service_data_p -> psd_rollups_p, tool_p, changed_ids_p))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to update the rollups for the deleted documents");
+										}
 								}
 
-							json_decref (raw_results_p);
-						}		/* if (raw_results_p) */
-					else
+							json_decref (changed_ids_p);
+						}
+
+					if (changed_tiles_p)
 						{
-							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Couldn't get raw results from search");
+							if (num_successes > 0)
+								{
+									if (!InvalidateMapTiles (service_data_p -> psd_map_tiles_p, changed_tiles_p))
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to invalidate the map tiles for the deleted samples");
+										}
+								}
+
+							json_decref (changed_tiles_p);
 						}
-				}		/* if (FindMatchingMongoDocumentsByJSON (tool_p, values_p, fields_ss)) */
+
+					AddDeleteResultsToJob (job_p, results_p, num_deleted);
+				}
 			else
 				{
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-					PrintJSONToLog (STM_LEVEL_SEVERE, __FILE__, __LINE__, values_p, "No results found for ");
-#endif
+					AddGeneralErrorMessageToServiceJob (job_p, "Failed to allocate memory for the delete results");
 				}
 
-			if (fields_ss)
+			if (results_p)
 				{
-					FreeMemory (fields_ss);
+					json_decref (results_p);
 				}
-		}		/* if (values_p) */
-
 
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-	PrintJSONToLog (STM_LEVEL_SEVERE, __FILE__, __LINE__, job_p -> sj_result_p, "results_p: ");
-#endif
-
-	SetServiceJobStatus (job_p, status);
+			json_decref (entries_p);
+		}		/* if (entries_p) */
+	else
+		{
+			AddGeneralErrorMessageToServiceJob (job_p, "The Delete parameter needs a \"" MONGO_OPERATION_DATA_S "\" selector or an array of them");
+		}
 
-	return status;
+	return num_successes;
 }
 
 
-static char *CheckDataIsValid (const json_t *row_p, PathogenomicsServiceData *data_p)
+/*
+ * Get each of the selectors in a Delete request as an array of
+ * { "data": selector, "allow_unbounded": flag } objects.
+ */
+static json_t *GetDeleteSelectors (const json_t *data_p)
 {
-	char *errors_s = NULL;
-	ByteBuffer *buffer_p = AllocateByteBuffer (1024);
+	json_t *entries_p = NULL;
 
-	if (buffer_p)
+	if (json_is_array (data_p))
 		{
-			/*
-			 * Each row the pathogenmics must contain an ID field
-			 * not the mongo _id, and the ability to get a geojson
-			 * stub and a date.
-			 */
+			entries_p = json_array ();
 
-			if (!json_object_get (row_p, PG_ID_S))
+			if (entries_p)
 				{
-					if (!AppendStringsToByteBuffer (buffer_p, "The row does not have an ",  PG_ID_S,  " field", NULL))
+					size_t i;
+					const json_t *request_p;
+
+					json_array_foreach (data_p, i, request_p)
 						{
+							if (!AddDeleteSelector (entries_p, json_object_get (request_p, MONGO_OPERATION_DATA_S), json_is_true (json_object_get (request_p, S_ALLOW_UNBOUNDED_S))))
+								{
+									json_decref (entries_p);
+									return NULL;
+								}
 						}
 				}
+		}
+	else if (json_is_object (data_p))
+		{
+			const json_t *selectors_p = json_object_get (data_p, MONGO_OPERATION_DATA_S);
 
-			// http://api.opencagedata.com/geocode/v1/geojson?pretty=1&key=1a9d04b5e924fd52d1f306d924d023a5&query=Osisek,+Croatia'
+			if (selectors_p)
+				{
+					const bool allow_flag = json_is_true (json_object_get (data_p, S_ALLOW_UNBOUNDED_S));
 
+					entries_p = json_array ();
 
+					if (entries_p)
+						{
+							if (json_is_array (selectors_p))
+								{
+									size_t i;
+									const json_t *selector_p;
 
-			if (GetByteBufferSize (buffer_p) > 0)
-				{
-					errors_s = DetachByteBufferData (buffer_p);
+									json_array_foreach (selectors_p, i, selector_p)
+										{
+											if (!AddDeleteSelector (entries_p, selector_p, allow_flag))
+												{
+													json_decref (entries_p);
+													return NULL;
+												}
+										}
+								}
+							else if (!AddDeleteSelector (entries_p, selectors_p, allow_flag))
+								{
+									json_decref (entries_p);
+									entries_p = NULL;
+								}
+						}
 				}
-		}		/* if (buffer_p) */
+		}
 
-	return errors_s;
+	return entries_p;
 }
 
 
-/*
-bool AddErrorMessage (json_t *errors_p, const json_t *values_p, const size_t row, const char * const error_s)
+static bool AddDeleteSelector (json_t *entries_p, const json_t *selector_p, const bool allow_flag)
 {
-	bool success_flag = false;
-	const char *pathogenomics_id_s = GetJSONString (values_p, PG_ID_S);
+	json_t *entry_p = json_pack ("{s:O?,s:b}", MONGO_OPERATION_DATA_S, selector_p, S_ALLOW_UNBOUNDED_S, allow_flag);
 
-	if (pathogenomics_id_s)
+	if (entry_p)
 		{
-			json_error_t error;
-			json_t *error_p = json_pack_ex (&error, 0, "{s:s,s:i,s:s}", "ID", pathogenomics_id_s, "row", row, "error", error_s);
-
-			if (error_p)
+			if (json_array_append_new (entries_p, entry_p) == 0)
 				{
-					if (json_array_append_new (errors_p, error_p) == 0)
-						{
-							success_flag = true;
-						}
+					return true;
 				}
-		}
 
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-	PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, errors_p, "errors data: ");
-#endif
+			json_decref (entry_p);
+		}
 
-	return success_flag;
+	return false;
 }
- */
 
 
-static uint32 InsertData (MongoTool *tool_p, ServiceJob *job_p, const json_t *values_p, const PathogenomicsData collection_type, const uint32 stage_time, PathogenomicsServiceData *data_p)
+/*
+ * A selector is bounded if it can only match the documents with the ids
+ * that it lists, i.e. it has an exact or $in match on one of the id keys,
+ * an $and with a bounded clause or an $or whose clauses are all bounded.
+ * Anything else, such as { "ID": { "$exists": true } }, could match the
+ * whole collection.
+ */
+static bool IsBoundedSelector (const json_t *selector_p)
 {
-	uint32 num_imports = 0;
-	const char *(*insert_fn) (MongoTool *tool_p, json_t *values_p, const uint32 stage_time, PathogenomicsServiceData *data_p) = NULL;
-
-#if PATHOGENOMICS_SERVICE_DEBUG >= STM_LEVEL_FINE
-	PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, values_p, "values_p: ");
-#endif
-
-	switch (collection_type)
-	{
-		case PD_SAMPLE:
-			insert_fn = InsertSampleData;
-			break;
-
-		case PD_PHENOTYPE:
-			insert_fn = InsertPhenotypeData;
-			break;
-
-		case PD_GENOTYPE:
-			insert_fn = InsertGenotypeData;
-			break;
-
-		case PD_FILES:
-			insert_fn = InsertFilesData;
-			break;
-
-		default:
-			break;
-	}
-
+	const char *key_s;
+	json_t *value_p;
 
-	if (insert_fn)
+	json_object_foreach ((json_t *) selector_p, key_s, value_p)
 		{
-			if (json_is_array (values_p))
+			if ((strcmp (key_s, MONGO_ID_S) == 0) || (strcmp (key_s, PG_ID_S) == 0) || (strcmp (key_s, PG_UKCPVS_ID_S) == 0))
+				{
+					if (IsIdMatch (value_p))
+						{
+							return true;
+						}
+				}
+			else if (strcmp (key_s, "$and") == 0)
 				{
-					json_t *value_p;
 					size_t i;
+					json_t *clause_p;
 
-					json_array_foreach (values_p, i, value_p)
-					{
-						const char *error_s = insert_fn (tool_p, value_p, stage_time, data_p);
-
-						if (error_s)
-							{
-								AddErrorMessage (job_p, value_p, error_s, i);
-							}
-						else
-							{
-								++ num_imports;
-							}
-					}
+					json_array_foreach (value_p, i, clause_p)
+						{
+							if (json_is_object (clause_p) && IsBoundedSelector (clause_p))
+								{
+									return true;
+								}
+						}
 				}
-			else
+			else if ((strcmp (key_s, "$or") == 0) && (json_array_size (value_p) > 0))
 				{
-					const char *error_s = insert_fn (tool_p, values_p, stage_time, data_p);
+					bool bounded_flag = true;
+					size_t i;
+					json_t *clause_p;
 
-					if (error_s)
+					json_array_foreach (value_p, i, clause_p)
 						{
-							AddErrorMessage (job_p, values_p, error_s, 0);
-
-							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "%s", error_s);
+							if (! (json_is_object (clause_p) && IsBoundedSelector (clause_p)))
+								{
+									bounded_flag = false;
+									break;
+								}
 						}
-					else
+
+					if (bounded_flag)
 						{
-							++ num_imports;
+							return true;
 						}
 				}
 		}
 
-
-	return num_imports;
+	return false;
 }
 
 
-bool AddErrorMessage (ServiceJob *job_p, const json_t *value_p, const char *error_s, const int index)
+/*
+ * Check whether the value for an id key in a selector only matches the
+ * given ids. This is a plain value, an extended JSON value such as
+ * { "$oid": ... }, an $eq of either of them or an $in.
+ */
+static bool IsIdMatch (const json_t *value_p)
 {
-	char *dump_s = json_dumps (value_p, JSON_INDENT (2) | JSON_PRESERVE_ORDER);
-	const char *id_s = GetJSONString (value_p, PG_ID_S);
-	bool added_error_flag = false;
-
-	if (!id_s)
-		{
-			id_s = GetJSONString (value_p, PG_UKCPVS_ID_S);
-		}
+	bool match_flag = false;
 
-	if (id_s)
+	if (json_is_object (value_p))
 		{
-			char *row_s = ConcatenateVarargsStrings ("row ", id_s, " ", error_s, NULL);
+			const json_t *in_p = json_object_get (value_p, "$in");
 
-			if (row_s)
+			if (json_is_array (in_p))
 				{
-					added_error_flag = AddGeneralErrorMessageToServiceJob (job_p, row_s);
-
-					FreeCopiedString (row_s);
+					match_flag = true;
 				}
-		}
-	else
-		{
-			char *index_s = GetIntAsString (index);
-
-			if (index_s)
+			else if (json_object_get (value_p, "$oid"))
 				{
-					char *row_s = ConcatenateVarargsStrings ("row ", index_s, " ", error_s, NULL);
+					match_flag = true;
+				}
+			else
+				{
+					const json_t *eq_p = json_object_get (value_p, "$eq");
 
-					if (row_s)
+					if (eq_p)
 						{
-							added_error_flag = AddGeneralErrorMessageToServiceJob (job_p, row_s);
-
-							FreeCopiedString (row_s);
+							match_flag = IsIdMatch (eq_p);
 						}
-
-					FreeCopiedString (index_s);
 				}
-
 		}
-
-	if (!added_error_flag)
+	else
 		{
-			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "failed to add %s to client feedback messsage", error_s);
+			/* null also matches the documents without the key */
+			match_flag = ((value_p != NULL) && (!json_is_null (value_p)));
 		}
 
+	return match_flag;
+}
 
-	if (dump_s)
-		{
-			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to import \"%s\": error=%s", dump_s, error_s);
-			free (dump_s);
-		}
-	else
+
+/*
+ * Get the number of documents that a delete removed from its reply.
+ */
+static json_int_t GetDeletedCount (const bson_t *reply_p)
+{
+	json_int_t num_deleted = 0;
+	bson_iter_t iter;
+
+	if (bson_iter_init_find (&iter, reply_p, "deletedCount"))
 		{
-			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to import error=%s", dump_s, error_s);
+			num_deleted = (json_int_t) bson_iter_as_int64 (&iter);
 		}
 
-	return added_error_flag;
+	return num_deleted;
 }
 
 
-static uint32 DeleteData (MongoTool *tool_p, ServiceJob * UNUSED_PARAM (job_p), const json_t *data_p, const PathogenomicsData UNUSED_PARAM (collection_type), PathogenomicsServiceData * UNUSED_PARAM (service_data_p))
+static void AddDeleteResultsToJob (ServiceJob *job_p, json_t *results_p, const json_int_t num_deleted)
 {
-	bool success_flag = false;
-	const json_t *selector_p = json_object_get (data_p, MONGO_OPERATION_DATA_S);
+	json_t *deletions_p = json_pack ("{s:O,s:I}", "selectors", results_p, "deleted", num_deleted);
 
-	if (selector_p)
+	if (deletions_p)
 		{
-			success_flag = RemoveMongoDocuments (tool_p, selector_p, false);
-		}		/* if (values_p) */
+			if (!job_p -> sj_metadata_p)
+				{
+					job_p -> sj_metadata_p = json_object ();
+				}
+
+			if ((job_p -> sj_metadata_p) && (json_object_set_new (job_p -> sj_metadata_p, "deletions", deletions_p) == 0))
+				{
+					return;
+				}
+
+			json_decref (deletions_p);
+		}
 
-	return success_flag ? 1 : 0;
+	PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add the delete results to the job metadata");
 }
 
 
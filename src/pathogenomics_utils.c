@@ -23,6 +23,7 @@
 #include <string.h>
 
 #include "pathogenomics_utils.h"
+#include "pathogenomics_service.h"
 #include "time_util.h"
 #include "streams.h"
 #include "json_tools.h"
@@ -50,7 +51,39 @@ bool AddPublishDateToJSON (json_t *json_p, const char * const key_s, const int32
 				{
 					if (SetDateForSchemaOrg (json_p, key_s, date_s))
 						{
-							success_flag = true;
+							/*
+							 * Also store the date as a BSON date so that the database
+							 * can do the comparisons for the public view.
+							 */
+							char *datetime_s = ConcatenateStrings (date_s, "T00:00:00Z");
+
+							if (datetime_s)
+								{
+									json_error_t err;
+									json_t *datetime_p = json_pack_ex (&err, 0, "{s:s}", "$date", datetime_s);
+
+									if (datetime_p)
+										{
+											if (json_object_set_new (json_object_get (json_p, key_s), PG_LIVE_DATE_TIME_S, datetime_p) == 0)
+												{
+													success_flag = true;
+												}
+											else
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add %s to %s", datetime_s, key_s);
+												}
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create BSON date for %s: %s", datetime_s, err.text);
+										}
+
+									FreeCopiedString (datetime_s);
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create BSON date string for %s", date_s);
+								}
 						}
 
 					FreeCopiedString (date_s);
@@ -108,58 +141,45 @@ bool SetDateForSchemaOrg (json_t *values_p, const char * const key_s, const char
 }
 
 
-bool CheckForFields (const LinkedList *column_headers_p, const char **headers_ss, ServiceJob *job_p)
+bool FindLocationCoordinates (const json_t *value_p, double64 *latitude_p, double64 *longitude_p)
 {
-	bool success_flag = true;
-
-
-	while (*headers_ss)
+	if (json_is_object (value_p))
 		{
-			FieldNode *node_p = (FieldNode *) (column_headers_p -> ll_head_p);
-			bool found_flag = false;
+			const json_t *latitude_value_p = json_object_get (value_p, "latitude");
+			const json_t *longitude_value_p = json_object_get (value_p, "longitude");
+			const char *key_s;
+			json_t *child_p;
 
-			while ((node_p) && (!found_flag))
+			if (json_is_number (latitude_value_p) && json_is_number (longitude_value_p))
 				{
-					if (strcmp (node_p -> fn_base_node.sln_string_s, *headers_ss) == 0)
-						{
-							found_flag = true;
-						}
-					else
-						{
-							node_p = (FieldNode *) (node_p -> fn_base_node.sln_node.ln_next_p);
-						}
-
-				}		/* while ((node_p) && (!found_flag)) */
+					*latitude_p = json_number_value (latitude_value_p);
+					*longitude_p = json_number_value (longitude_value_p);
 
+					return true;
+				}
 
-			if (!found_flag)
+			json_object_foreach ((json_t *) value_p, key_s, child_p)
 				{
-					char *key_s = ConcatenateVarargsStrings ("Missing column \"", *headers_ss, "\"", NULL);
-
-					if (key_s)
+					if (FindLocationCoordinates (child_p, latitude_p, longitude_p))
 						{
-							if (!AddGeneralErrorMessageToServiceJob (job_p, key_s))
-								{
-									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add error for %s to job response", key_s);
-								}
-
-							FreeCopiedString (key_s);
-						}		/* if (key_s) */
-					else
-						{
-							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add error for %s to job response", key_s);
+							return true;
 						}
+				}
+		}
 
-					if (success_flag)
-						{
-							success_flag = false;
-						}
+	return false;
+}
 
-				}		/* if (!found_flag) */
 
-			++ headers_ss;
-		}		/* while (*headers_ss) */
+char *GetTodayAsString (void)
+{
+	char *today_s = NULL;
+	struct tm current_time;
 
+	if (GetPresentTime (&current_time))
+		{
+			today_s = GetTimeAsString (&current_time, false, NULL);
+		}
 
-	return success_flag;
+	return today_s;
 }
@@ -22,6 +22,7 @@
 
 #include "phenotype_metadata.h"
 #include "pathogenomics_utils.h"
+#include "column_schema.h"
 #include "json_tools.h"
 #include "string_utils.h"
 
@@ -72,7 +73,7 @@ static int GetAndRemoveJSONKeyValuePair (json_t *doc_to_add_to_p, const char *ad
 }
 
 
-const char *InsertPhenotypeData (MongoTool *tool_p, json_t *values_p, const uint32 stage_time, PathogenomicsServiceData * UNUSED_PARAM (data_p))
+const char *InsertPhenotypeData (ImportSession *session_p, json_t *values_p, const size_t row)
 {
 	const char *error_s = NULL;
 
@@ -108,9 +109,11 @@ const char *InsertPhenotypeData (MongoTool *tool_p, json_t *values_p, const uint
 
 											if (date_s)
 												{
-													if (AddPublishDateToJSON (doc_p, date_s, stage_time, true))
+													if (AddPublishDateToJSON (doc_p, date_s, session_p -> is_stage_time, true))
 														{
-															error_s = EasyInsertOrUpdateMongoData (tool_p, doc_p, primary_key_s);
+															const char *id_keys_ss [] = { PG_ID_S, PG_UKCPVS_ID_S, NULL };
+
+															error_s = SaveImportedSection (session_p, doc_p, primary_key_s, PG_PHENOTYPE_S, id_keys_ss, row);
 														}
 													else
 														{
@@ -160,7 +163,21 @@ const char *InsertPhenotypeData (MongoTool *tool_p, json_t *values_p, const uint
 }
 
 
-bool CheckPhenotypeData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p)
+const char *ValidatePhenotypeRow (json_t *values_p, DateNormaliser * UNUSED_PARAM (normaliser_p))
+{
+	const char *error_s = NULL;
+
+	/* The same keys that InsertPhenotypeData () takes the primary key from */
+	if ((!GetJSONString (values_p, PG_ID_S)) && (!GetJSONString (values_p, PM_ISOLATE_S)))
+		{
+			error_s = "Failed to get primary key from phenotype values";
+		}
+
+	return error_s;
+}
+
+
+bool SetPhenotypeRequiredColumns (ColumnSchema *schema_p)
 {
 	const char *headers_ss [] = {
 		PG_ID_S,
@@ -169,6 +186,12 @@ bool CheckPhenotypeData (const LinkedList *headers_p, ServiceJob *job_p, Pathoge
 		NULL
 	};
 
-	return CheckForFields (headers_p, headers_ss, job_p);
+	return SetRequiredColumns (schema_p, PD_PHENOTYPE, headers_ss);
+}
+
+
+bool CheckPhenotypeData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p)
+{
+	return CheckRequiredColumns (data_p -> psd_column_schema_p, PD_PHENOTYPE, headers_p, job_p);
 }
 
@@ -0,0 +1,1660 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * rollups.c
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rollups.h"
+#include "live_dates.h"
+#include "aggregate_counts.h"
+#include "pathogenomics_service.h"
+#include "pathogenomics_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define ROLLUPS_DEBUG	(STM_LEVEL_FINER)
+#else
+	#define ROLLUPS_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/* The number of documents whose counters are updated together */
+static const size_t S_UPDATE_BATCH_SIZE = 1000;
+
+/* The key for the date that a counter's samples become public */
+static const char * const S_LIVE_S = "live";
+
+/* The key for the counters that a document has added to */
+static const char * const S_ROLLUPS_S = "rollups";
+
+/* The key for the flag on counters that need to be recalculated */
+static const char * const S_STALE_S = "stale";
+
+/* The number of counters that are recalculated together */
+static const size_t S_RECOUNT_BATCH_SIZE = 100;
+
+/*
+ * The names that the counters are kept for, apart from the live
+ * date, and that summaries can group by.
+ */
+static const char *S_COUNTER_KEYS_SS [] =
+{
+	"Disease",
+	"Genetic group",
+	"Country",
+	"County",
+	PG_ROLLUP_WEEK_S,
+	NULL
+};
+
+
+struct Rollups
+{
+	/* The connection to the collection of counters */
+	MongoTool *rs_counters_tool_p;
+
+	/* The connection to the collection of the counters that each document has added to */
+	MongoTool *rs_sources_tool_p;
+
+	/*
+	 * The MongoTools aren't thread-safe and a document's counters need to be
+	 * read and replaced in one go, so only one thread can update at a time.
+	 */
+	pthread_mutex_t rs_mutex;
+};
+
+
+static bool UpdateRollupsBatch (Rollups *rollups_p, MongoTool *tool_p, const json_t *ids_p);
+
+static json_t *GetIdsFilter (const json_t *ids_p);
+
+static bool AddCurrentRollups (json_t *doc_p, void *data_p);
+
+static json_t *GetStoredRollups (Rollups *rollups_p, const json_t *ids_p);
+
+static json_t *GetDocumentRollups (const json_t *doc_p);
+
+static bool AddRollup (json_t *rollups_p, const json_t *key_p, const json_t *genetic_group_p, const char *live_s, const json_int_t count);
+
+static const char *GetLiveDate (const json_t *doc_p, const char *group_s);
+
+static json_t *GetCollectionWeek (const json_t *sample_p);
+
+static bool AddRollupsToDeltas (json_t *deltas_p, const json_t *rollups_p, const json_int_t sign);
+
+static bool MarkCountersStale (Rollups *rollups_p, const json_t *deltas_p);
+
+static bool RecountStaleCounters (Rollups *rollups_p);
+
+static json_t *GetStaleCounterKeys (Rollups *rollups_p);
+
+static bool RecountCounters (Rollups *rollups_p, const json_t *keys_p);
+
+static json_t *GetRecountStages (const json_t *keys_p);
+
+static json_t *GetCounterTotals (Rollups *rollups_p, const json_t *keys_p);
+
+static bool WriteCounterTotals (Rollups *rollups_p, const json_t *keys_p, const json_t *totals_p);
+
+static bool WriteDocumentRollups (Rollups *rollups_p, const json_t *ids_p, const json_t *old_p, const json_t *new_p);
+
+static bool ExecuteBulkOperation (mongoc_bulk_operation_t *bulk_p, const char *name_s);
+
+static json_t *GetSummaryStages (const json_t *summary_p, const bool preview_flag, const char **error_ss);
+
+static bool IsCounterKey (const char *name_s);
+
+static bool AddIdToSet (json_t *doc_p, void *data_p);
+
+static bool AddDocumentToCounts (json_t *doc_p, void *data_p);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+Rollups *AllocateRollups (MongoClientManager *mongo_manager_p, const char *database_s, const char *counters_collection_s, const char *sources_collection_s)
+{
+	MongoTool *counters_tool_p = AllocateMongoTool (NULL, mongo_manager_p);
+
+	if (counters_tool_p)
+		{
+			if (SetMongoToolDatabaseAndCollection (counters_tool_p, database_s, counters_collection_s))
+				{
+					MongoTool *sources_tool_p = AllocateMongoTool (NULL, mongo_manager_p);
+
+					if (sources_tool_p)
+						{
+							if (SetMongoToolDatabaseAndCollection (sources_tool_p, database_s, sources_collection_s))
+								{
+									Rollups *rollups_p = (Rollups *) AllocMemory (sizeof (Rollups));
+
+									if (rollups_p)
+										{
+											rollups_p -> rs_counters_tool_p = counters_tool_p;
+											rollups_p -> rs_sources_tool_p = sources_tool_p;
+
+											pthread_mutex_init (& (rollups_p -> rs_mutex), NULL);
+
+											return rollups_p;
+										}
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set rollup sources collection to \"%s\".\"%s\"", database_s, sources_collection_s);
+								}
+
+							FreeMongoTool (sources_tool_p);
+						}		/* if (sources_tool_p) */
+
+				}		/* if (SetMongoToolDatabaseAndCollection (counters_tool_p, database_s, counters_collection_s)) */
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set rollups collection to \"%s\".\"%s\"", database_s, counters_collection_s);
+				}
+
+			FreeMongoTool (counters_tool_p);
+		}		/* if (counters_tool_p) */
+
+	return NULL;
+}
+
+
+void FreeRollups (Rollups *rollups_p)
+{
+	pthread_mutex_destroy (& (rollups_p -> rs_mutex));
+
+	FreeMongoTool (rollups_p -> rs_sources_tool_p);
+	FreeMongoTool (rollups_p -> rs_counters_tool_p);
+	FreeMemory (rollups_p);
+}
+
+
+bool UpdateRollups (Rollups *rollups_p, MongoTool *tool_p, const json_t *ids_p)
+{
+	bool success_flag = true;
+	json_t *batch_p = json_array ();
+
+	if (batch_p)
+		{
+			const size_t num_ids = json_object_size (ids_p);
+			size_t i = 0;
+			const char *id_s;
+			json_t *value_p;
+
+			pthread_mutex_lock (& (rollups_p -> rs_mutex));
+
+			json_object_foreach ((json_t *) ids_p, id_s, value_p)
+				{
+					if (json_array_append_new (batch_p, json_string (id_s)) != 0)
+						{
+							success_flag = false;
+						}
+
+					++ i;
+
+					if ((json_array_size (batch_p) == S_UPDATE_BATCH_SIZE) || (i == num_ids))
+						{
+							if (!UpdateRollupsBatch (rollups_p, tool_p, batch_p))
+								{
+									success_flag = false;
+								}
+
+							json_array_clear (batch_p);
+						}
+				}
+
+			pthread_mutex_unlock (& (rollups_p -> rs_mutex));
+
+			json_decref (batch_p);
+		}		/* if (batch_p) */
+	else
+		{
+			success_flag = false;
+		}
+
+	return success_flag;
+}
+
+
+bool AddRollupIdsForFilter (MongoTool *tool_p, const json_t *filter_p, json_t *ids_p)
+{
+	const char *fields_ss [] = { PG_ID_S, NULL };
+
+	return ForEachLiveDocumentMatchingFilter (tool_p, filter_p, fields_ss, true, AddIdToSet, ids_p);
+}
+
+
+json_t *GetRollupCounts (Rollups *rollups_p, const json_t *summary_p, const bool preview_flag, const char **error_ss)
+{
+	json_t *counts_p = NULL;
+	json_t *stages_p = GetSummaryStages (summary_p, preview_flag, error_ss);
+
+	if (stages_p)
+		{
+			json_t *pipeline_p;
+
+			#if ROLLUPS_DEBUG >= STM_LEVEL_FINER
+			PrintJSONToLog (STM_LEVEL_FINER, __FILE__, __LINE__, stages_p, "summary stages: ");
+			#endif
+
+			pipeline_p = json_pack ("{s:o}", "pipeline", stages_p);
+
+			if (pipeline_p)
+				{
+					bson_t *pipeline_bson_p = ConvertJSONToBSON (pipeline_p);
+
+					if (pipeline_bson_p)
+						{
+							counts_p = json_array ();
+
+							if (counts_p)
+								{
+									mongoc_cursor_t *cursor_p;
+
+									pthread_mutex_lock (& (rollups_p -> rs_mutex));
+
+									cursor_p = mongoc_collection_aggregate (rollups_p -> rs_counters_tool_p -> mt_collection_p, MONGOC_QUERY_NONE, pipeline_bson_p, NULL, NULL);
+
+									if (cursor_p)
+										{
+											const bson_t *doc_p;
+											bson_error_t error;
+											bool success_flag = true;
+
+											while (success_flag && mongoc_cursor_next (cursor_p, &doc_p))
+												{
+													json_t *doc_json_p = ConvertBSONToJSON (doc_p);
+
+													if (doc_json_p)
+														{
+															success_flag = AddDocumentToCounts (doc_json_p, counts_p);
+															json_decref (doc_json_p);
+														}
+													else
+														{
+															success_flag = false;
+														}
+												}
+
+											if (mongoc_cursor_error (cursor_p, &error))
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read rollups: %s", error.message);
+													success_flag = false;
+												}
+
+											mongoc_cursor_destroy (cursor_p);
+
+											if (!success_flag)
+												{
+													json_decref (counts_p);
+													counts_p = NULL;
+												}
+										}
+									else
+										{
+											json_decref (counts_p);
+											counts_p = NULL;
+										}
+
+									pthread_mutex_unlock (& (rollups_p -> rs_mutex));
+								}		/* if (counts_p) */
+
+							bson_destroy (pipeline_bson_p);
+						}		/* if (pipeline_bson_p) */
+
+					json_decref (pipeline_p);
+				}		/* if (pipeline_p) */
+
+			if (!counts_p)
+				{
+					*error_ss = "Failed to get the summary";
+				}
+		}		/* if (stages_p) */
+
+	return counts_p;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool UpdateRollupsBatch (Rollups *rollups_p, MongoTool *tool_p, const json_t *ids_p)
+{
+	bool success_flag = false;
+	json_t *filter_p = GetIdsFilter (ids_p);
+
+	if (filter_p)
+		{
+			json_t *new_p = json_object ();
+
+			if (new_p)
+				{
+					char *disease_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_DISEASE_S, NULL);
+					char *country_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_COUNTRY_S, NULL);
+					char *county_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_COUNTY_S, NULL);
+					char *date_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_RAW_DATE_S, NULL);
+					char *sample_live_date_s = ConcatenateStrings (PG_SAMPLE_S, PG_LIVE_DATE_SUFFIX_S);
+					char *genetic_group_s = ConcatenateVarargsStrings (PG_GENOTYPE_S, ".", PG_GENETIC_GROUP_S, NULL);
+					char *genotype_live_date_s = ConcatenateStrings (PG_GENOTYPE_S, PG_LIVE_DATE_SUFFIX_S);
+
+					if (disease_s && country_s && county_s && date_s && sample_live_date_s && genetic_group_s && genotype_live_date_s)
+						{
+							const char *fields_ss [] = { PG_ID_S, disease_s, country_s, county_s, date_s, sample_live_date_s, genetic_group_s, genotype_live_date_s, NULL };
+
+							/* Get the documents as they are stored, embargoed sections and all */
+							if (ForEachLiveDocumentMatchingFilter (tool_p, filter_p, fields_ss, true, AddCurrentRollups, new_p))
+								{
+									json_t *old_p = GetStoredRollups (rollups_p, ids_p);
+
+									if (old_p)
+										{
+											json_t *deltas_p = json_object ();
+
+											if (deltas_p)
+												{
+													size_t i;
+													json_t *id_p;
+
+													success_flag = true;
+
+													json_array_foreach (ids_p, i, id_p)
+														{
+															const char *id_s = json_string_value (id_p);
+
+															if (!AddRollupsToDeltas (deltas_p, json_object_get (old_p, id_s), -1))
+																{
+																	success_flag = false;
+																}
+
+															if (!AddRollupsToDeltas (deltas_p, json_object_get (new_p, id_s), 1))
+																{
+																	success_flag = false;
+																}
+														}
+
+													/*
+													 * Adding the deltas to the counters and storing the documents'
+													 * rollups can't be done atomically, and if only one of them was
+													 * written, every later update would be applied to the wrong base.
+													 * So the counters that change are marked as stale, the documents'
+													 * rollups are stored and then each stale counter is recalculated
+													 * from the stored rollups. If any of these fail, the counters stay
+													 * marked and are recalculated on the next update.
+													 */
+													if (success_flag)
+														{
+															success_flag = MarkCountersStale (rollups_p, deltas_p);
+
+															if (success_flag)
+																{
+																	success_flag = WriteDocumentRollups (rollups_p, ids_p, old_p, new_p);
+
+																	if (success_flag)
+																		{
+																			success_flag = RecountStaleCounters (rollups_p);
+																		}
+																}
+														}
+
+													json_decref (deltas_p);
+												}		/* if (deltas_p) */
+
+											json_decref (old_p);
+										}		/* if (old_p) */
+
+								}		/* if (ForEachLiveDocumentMatchingFilter (tool_p, filter_p, fields_ss, true, AddCurrentRollups, new_p)) */
+
+						}
+
+					if (genotype_live_date_s)
+						{
+							FreeCopiedString (genotype_live_date_s);
+						}
+
+					if (genetic_group_s)
+						{
+							FreeCopiedString (genetic_group_s);
+						}
+
+					if (sample_live_date_s)
+						{
+							FreeCopiedString (sample_live_date_s);
+						}
+
+					if (date_s)
+						{
+							FreeCopiedString (date_s);
+						}
+
+					if (county_s)
+						{
+							FreeCopiedString (county_s);
+						}
+
+					if (country_s)
+						{
+							FreeCopiedString (country_s);
+						}
+
+					if (disease_s)
+						{
+							FreeCopiedString (disease_s);
+						}
+
+					json_decref (new_p);
+				}		/* if (new_p) */
+
+			json_decref (filter_p);
+		}		/* if (filter_p) */
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to update the rollups for " SIZET_FMT " documents", json_array_size (ids_p));
+		}
+
+	return success_flag;
+}
+
+
+static json_t *GetIdsFilter (const json_t *ids_p)
+{
+	return json_pack ("{s:{s:O}}", PG_ID_S, "$in", ids_p);
+}
+
+
+/*
+ * Store the rollups for a document's current values by its ID.
+ */
+static bool AddCurrentRollups (json_t *doc_p, void *data_p)
+{
+	json_t *new_p = (json_t *) data_p;
+	const char *id_s = GetJSONString (doc_p, PG_ID_S);
+
+	if (id_s)
+		{
+			json_t *rollups_p = GetDocumentRollups (doc_p);
+
+			if (rollups_p)
+				{
+					if (json_object_set_new (new_p, id_s, rollups_p) != 0)
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store rollups for \"%s\"", id_s);
+							return false;
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get rollups for \"%s\"", id_s);
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * Get the rollups that each of the documents was last counted in, by their IDs.
+ */
+static json_t *GetStoredRollups (Rollups *rollups_p, const json_t *ids_p)
+{
+	json_t *old_p = json_object ();
+
+	if (old_p)
+		{
+			bool success_flag = false;
+			json_t *filter_p = GetIdsFilter (ids_p);
+
+			if (filter_p)
+				{
+					bson_t *filter_bson_p = ConvertJSONToBSON (filter_p);
+
+					if (filter_bson_p)
+						{
+							mongoc_cursor_t *cursor_p = mongoc_collection_find_with_opts (rollups_p -> rs_sources_tool_p -> mt_collection_p, filter_bson_p, NULL, NULL);
+
+							if (cursor_p)
+								{
+									const bson_t *doc_p;
+									bson_error_t error;
+
+									success_flag = true;
+
+									while (success_flag && mongoc_cursor_next (cursor_p, &doc_p))
+										{
+											json_t *doc_json_p = ConvertBSONToJSON (doc_p);
+
+											success_flag = false;
+
+											if (doc_json_p)
+												{
+													const char *id_s = GetJSONString (doc_json_p, PG_ID_S);
+													json_t *rollups_p = json_object_get (doc_json_p, S_ROLLUPS_S);
+
+													if (id_s && rollups_p)
+														{
+															success_flag = (json_object_set (old_p, id_s, rollups_p) == 0);
+														}
+													else
+														{
+															PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Ignoring stored rollups without an ID or rollups");
+															success_flag = true;
+														}
+
+													json_decref (doc_json_p);
+												}
+										}
+
+									if (mongoc_cursor_error (cursor_p, &error))
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get stored rollups: %s", error.message);
+											success_flag = false;
+										}
+
+									mongoc_cursor_destroy (cursor_p);
+								}
+
+							bson_destroy (filter_bson_p);
+						}
+
+					json_decref (filter_p);
+				}		/* if (filter_p) */
+
+			if (!success_flag)
+				{
+					json_decref (old_p);
+					old_p = NULL;
+				}
+		}		/* if (old_p) */
+
+	return old_p;
+}
+
+
+/*
+ * Get the rollups for a document. A document is counted once for its
+ * sample, from the sample's live date. If it has a genetic group that
+ * becomes public later than the sample, it is counted without the group
+ * until then, so it is taken off that counter and added to the one with
+ * the group from the genotype's live date.
+ */
+static json_t *GetDocumentRollups (const json_t *doc_p)
+{
+	json_t *rollups_p = json_array ();
+
+	if (rollups_p)
+		{
+			const json_t *sample_p = json_object_get (doc_p, PG_SAMPLE_S);
+
+			if (json_is_object (sample_p))
+				{
+					json_t *key_p = json_object ();
+					bool success_flag = false;
+
+					if (key_p)
+						{
+							const char *keys_ss [] = { PG_DISEASE_S, PG_COUNTRY_S, PG_COUNTY_S, NULL };
+							const char **key_ss;
+							json_t *week_p = GetCollectionWeek (sample_p);
+
+							success_flag = (json_object_set_new (key_p, PG_ROLLUP_WEEK_S, week_p ? week_p : json_null ()) == 0);
+
+							for (key_ss = keys_ss; *key_ss && success_flag; ++ key_ss)
+								{
+									json_t *value_p = json_object_get (sample_p, *key_ss);
+
+									success_flag = (json_object_set_new (key_p, *key_ss, value_p ? json_deep_copy (value_p) : json_null ()) == 0);
+								}
+
+							if (success_flag)
+								{
+									const char *sample_live_s = GetLiveDate (doc_p, PG_SAMPLE_S);
+									const json_t *genotype_p = json_object_get (doc_p, PG_GENOTYPE_S);
+									const json_t *genetic_group_p = json_object_get (genotype_p, PG_GENETIC_GROUP_S);
+
+									if (json_is_string (genetic_group_p) && (!IsStringEmpty (json_string_value (genetic_group_p))))
+										{
+											const char *genotype_live_s = GetLiveDate (doc_p, PG_GENOTYPE_S);
+
+											if (strcmp (genotype_live_s, sample_live_s) <= 0)
+												{
+													success_flag = AddRollup (rollups_p, key_p, genetic_group_p, sample_live_s, 1);
+												}
+											else
+												{
+													success_flag = AddRollup (rollups_p, key_p, NULL, sample_live_s, 1) &&
+														AddRollup (rollups_p, key_p, NULL, genotype_live_s, -1) &&
+														AddRollup (rollups_p, key_p, genetic_group_p, genotype_live_s, 1);
+												}
+										}
+									else
+										{
+											success_flag = AddRollup (rollups_p, key_p, NULL, sample_live_s, 1);
+										}
+								}
+
+							json_decref (key_p);
+						}		/* if (key_p) */
+
+					if (!success_flag)
+						{
+							json_decref (rollups_p);
+							rollups_p = NULL;
+						}
+
+				}		/* if (json_is_object (sample_p)) */
+
+		}		/* if (rollups_p) */
+
+	return rollups_p;
+}
+
+
+static bool AddRollup (json_t *rollups_p, const json_t *key_p, const json_t *genetic_group_p, const char *live_s, const json_int_t count)
+{
+	json_t *rollup_p = json_deep_copy (key_p);
+
+	if (rollup_p)
+		{
+			if ((json_object_set_new (rollup_p, PG_GENETIC_GROUP_S, genetic_group_p ? json_deep_copy (genetic_group_p) : json_null ()) == 0) &&
+				(json_object_set_new (rollup_p, S_LIVE_S, json_string (live_s)) == 0) &&
+				(json_object_set_new (rollup_p, PG_COUNT_S, json_integer (count)) == 0))
+				{
+					if (json_array_append_new (rollups_p, rollup_p) == 0)
+						{
+							return true;
+						}
+				}
+			else
+				{
+					json_decref (rollup_p);
+				}
+		}
+
+	return false;
+}
+
+
+/*
+ * Get a section's live date as YYYY-MM-DD. Sections without a live date
+ * are always public so get an empty string, which is before every date.
+ */
+static const char *GetLiveDate (const json_t *doc_p, const char *group_s)
+{
+	const char *live_s = NULL;
+	char *key_s = ConcatenateStrings (group_s, PG_LIVE_DATE_SUFFIX_S);
+
+	if (key_s)
+		{
+			live_s = GetJSONString (json_object_get (doc_p, key_s), "date");
+			FreeCopiedString (key_s);
+		}
+
+	return live_s ? live_s : "";
+}
+
+
+/*
+ * Get the ISO week, as YYYY-Www, that a sample was collected in from
+ * its compact collection date, which is stored as YYYYMMDD.
+ */
+static json_t *GetCollectionWeek (const json_t *sample_p)
+{
+	const char *date_s = GetJSONString (sample_p, PG_RAW_DATE_S);
+
+	if (date_s)
+		{
+			struct tm date;
+			int year;
+			int month;
+			int day;
+			char extra;
+
+			if ((strlen (date_s) == 8) && (sscanf (date_s, "%4d%2d%2d%c", &year, &month, &day, &extra) == 3))
+				{
+					memset (&date, 0, sizeof (struct tm));
+
+					date.tm_year = year - 1900;
+					date.tm_mon = month - 1;
+					date.tm_mday = day;
+
+					/* Midday keeps any daylight saving change on the same day */
+					date.tm_hour = 12;
+					date.tm_isdst = -1;
+
+					if (mktime (&date) != (time_t) -1)
+						{
+							char week_s [16];
+
+							if (strftime (week_s, sizeof (week_s), "%G-W%V", &date) > 0)
+								{
+									return json_string (week_s);
+								}
+						}
+				}
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Add the counts of some rollups, multiplied by sign, to the net
+ * changes for each counter.
+ */
+static bool AddRollupsToDeltas (json_t *deltas_p, const json_t *rollups_p, const json_int_t sign)
+{
+	size_t i;
+	json_t *rollup_p;
+
+	json_array_foreach ((json_t *) rollups_p, i, rollup_p)
+		{
+			json_t *key_p = json_deep_copy (rollup_p);
+			bool success_flag = false;
+
+			if (key_p)
+				{
+					const json_int_t count = sign * json_integer_value (json_object_get (rollup_p, PG_COUNT_S));
+					char *key_s;
+
+					json_object_del (key_p, PG_COUNT_S);
+					key_s = json_dumps (key_p, JSON_COMPACT | JSON_SORT_KEYS);
+
+					if (key_s)
+						{
+							json_t *delta_p = json_object_get (deltas_p, key_s);
+
+							if (delta_p)
+								{
+									json_t *count_p = json_object_get (delta_p, PG_COUNT_S);
+
+									success_flag = (json_integer_set (count_p, json_integer_value (count_p) + count) == 0);
+								}
+							else
+								{
+									if (json_object_set_new (key_p, PG_COUNT_S, json_integer (count)) == 0)
+										{
+											success_flag = (json_object_set (deltas_p, key_s, key_p) == 0);
+										}
+								}
+
+							free (key_s);
+						}
+
+					json_decref (key_p);
+				}		/* if (key_p) */
+
+			if (!success_flag)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add rollup changes");
+					return false;
+				}
+		}		/* json_array_foreach ((json_t *) rollups_p, i, rollup_p) */
+
+	return true;
+}
+
+
+/*
+ * Flag each counter that has a net change as stale with an upsert so
+ * that new counters are created as needed.
+ */
+static bool MarkCountersStale (Rollups *rollups_p, const json_t *deltas_p)
+{
+	bool success_flag = true;
+	mongoc_bulk_operation_t *bulk_p = NULL;
+	const char *key_s;
+	json_t *delta_p;
+	bson_t opts;
+
+	bson_init (&opts);
+	BSON_APPEND_BOOL (&opts, "upsert", true);
+
+	json_object_foreach ((json_t *) deltas_p, key_s, delta_p)
+		{
+			const json_int_t count = json_integer_value (json_object_get (delta_p, PG_COUNT_S));
+
+			/* A document whose values haven't changed cancels itself out */
+			if (count != 0)
+				{
+					json_t *selector_p = json_deep_copy (delta_p);
+					json_t *update_p = json_pack ("{s:{s:b}}", "$set", S_STALE_S, true);
+
+					success_flag = false;
+
+					if (selector_p && update_p)
+						{
+							bson_t *selector_bson_p;
+
+							json_object_del (selector_p, PG_COUNT_S);
+
+							selector_bson_p = ConvertJSONToBSON (selector_p);
+
+							if (selector_bson_p)
+								{
+									bson_t *update_bson_p = ConvertJSONToBSON (update_p);
+
+									if (update_bson_p)
+										{
+											if (!bulk_p)
+												{
+													bulk_p = mongoc_collection_create_bulk_operation_with_opts (rollups_p -> rs_counters_tool_p -> mt_collection_p, NULL);
+												}
+
+											if (bulk_p)
+												{
+													bson_error_t error;
+
+													if (mongoc_bulk_operation_update_one_with_opts (bulk_p, selector_bson_p, update_bson_p, &opts, &error))
+														{
+															success_flag = true;
+														}
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add stale rollup counter: %s", error.message);
+														}
+												}
+
+											bson_destroy (update_bson_p);
+										}
+
+									bson_destroy (selector_bson_p);
+								}
+						}
+
+					if (update_p)
+						{
+							json_decref (update_p);
+						}
+
+					if (selector_p)
+						{
+							json_decref (selector_p);
+						}
+
+					if (!success_flag)
+						{
+							break;
+						}
+				}		/* if (count != 0) */
+
+		}		/* json_object_foreach ((json_t *) deltas_p, key_s, delta_p) */
+
+	bson_destroy (&opts);
+
+	if (bulk_p)
+		{
+			if (success_flag)
+				{
+					success_flag = ExecuteBulkOperation (bulk_p, "stale rollup counters");
+				}
+
+			mongoc_bulk_operation_destroy (bulk_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Store the rollups that each changed document is now counted in, removing
+ * the entries for those that no longer have any.
+ */
+static bool WriteDocumentRollups (Rollups *rollups_p, const json_t *ids_p, const json_t *old_p, const json_t *new_p)
+{
+	bool success_flag = true;
+	mongoc_bulk_operation_t *bulk_p = NULL;
+	size_t i;
+	json_t *id_p;
+	bson_t opts;
+
+	bson_init (&opts);
+	BSON_APPEND_BOOL (&opts, "upsert", true);
+
+	json_array_foreach ((json_t *) ids_p, i, id_p)
+		{
+			const char *id_s = json_string_value (id_p);
+			const json_t *old_rollups_p = json_object_get (old_p, id_s);
+			const json_t *new_rollups_p = json_object_get (new_p, id_s);
+			const bool has_new_flag = (new_rollups_p) && (json_array_size (new_rollups_p) > 0);
+
+			if ((old_rollups_p || has_new_flag) && (!json_equal ((json_t *) old_rollups_p, (json_t *) new_rollups_p)))
+				{
+					json_t *selector_p = json_pack ("{s:s}", PG_ID_S, id_s);
+
+					success_flag = false;
+
+					if (selector_p)
+						{
+							bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+							if (selector_bson_p)
+								{
+									if (!bulk_p)
+										{
+											bulk_p = mongoc_collection_create_bulk_operation_with_opts (rollups_p -> rs_sources_tool_p -> mt_collection_p, NULL);
+										}
+
+									if (bulk_p)
+										{
+											bson_error_t error;
+
+											if (has_new_flag)
+												{
+													json_t *doc_p = json_pack ("{s:s,s:O}", PG_ID_S, id_s, S_ROLLUPS_S, new_rollups_p);
+
+													if (doc_p)
+														{
+															bson_t *doc_bson_p = ConvertJSONToBSON (doc_p);
+
+															if (doc_bson_p)
+																{
+																	success_flag = mongoc_bulk_operation_replace_one_with_opts (bulk_p, selector_bson_p, doc_bson_p, &opts, &error);
+																	bson_destroy (doc_bson_p);
+																}
+
+															json_decref (doc_p);
+														}
+												}
+											else
+												{
+													success_flag = mongoc_bulk_operation_remove_one_with_opts (bulk_p, selector_bson_p, NULL, &error);
+												}
+
+											if (!success_flag)
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add rollups update for \"%s\"", id_s);
+												}
+										}
+
+									bson_destroy (selector_bson_p);
+								}
+
+							json_decref (selector_p);
+						}		/* if (selector_p) */
+
+					if (!success_flag)
+						{
+							break;
+						}
+				}
+
+		}		/* json_array_foreach ((json_t *) ids_p, i, id_p) */
+
+	bson_destroy (&opts);
+
+	if (bulk_p)
+		{
+			if (success_flag)
+				{
+					success_flag = ExecuteBulkOperation (bulk_p, "document rollups");
+				}
+
+			mongoc_bulk_operation_destroy (bulk_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Recalculate every counter that is marked as stale, including any left
+ * over from earlier updates that failed part way through.
+ */
+static bool RecountStaleCounters (Rollups *rollups_p)
+{
+	bool success_flag = false;
+	json_t *keys_p = GetStaleCounterKeys (rollups_p);
+
+	if (keys_p)
+		{
+			json_t *batch_p = json_array ();
+
+			if (batch_p)
+				{
+					const size_t num_keys = json_array_size (keys_p);
+					size_t i;
+					json_t *key_p;
+
+					success_flag = true;
+
+					json_array_foreach (keys_p, i, key_p)
+						{
+							if (json_array_append (batch_p, key_p) != 0)
+								{
+									success_flag = false;
+								}
+
+							if ((json_array_size (batch_p) == S_RECOUNT_BATCH_SIZE) || (i == num_keys - 1))
+								{
+									if (!RecountCounters (rollups_p, batch_p))
+										{
+											success_flag = false;
+										}
+
+									json_array_clear (batch_p);
+								}
+						}
+
+					json_decref (batch_p);
+				}		/* if (batch_p) */
+
+			json_decref (keys_p);
+		}		/* if (keys_p) */
+
+	return success_flag;
+}
+
+
+/*
+ * Get the counter values, without their counts, of each stale counter.
+ */
+static json_t *GetStaleCounterKeys (Rollups *rollups_p)
+{
+	json_t *keys_p = json_array ();
+
+	if (keys_p)
+		{
+			bool success_flag = false;
+			json_t *filter_p = json_pack ("{s:b}", S_STALE_S, true);
+			json_t *opts_p = json_pack ("{s:{s:i,s:i,s:i}}", "projection", MONGO_ID_S, 0, PG_COUNT_S, 0, S_STALE_S, 0);
+
+			if (filter_p && opts_p)
+				{
+					bson_t *filter_bson_p = ConvertJSONToBSON (filter_p);
+
+					if (filter_bson_p)
+						{
+							bson_t *opts_bson_p = ConvertJSONToBSON (opts_p);
+
+							if (opts_bson_p)
+								{
+									mongoc_cursor_t *cursor_p = mongoc_collection_find_with_opts (rollups_p -> rs_counters_tool_p -> mt_collection_p, filter_bson_p, opts_bson_p, NULL);
+
+									if (cursor_p)
+										{
+											const bson_t *doc_p;
+											bson_error_t error;
+
+											success_flag = true;
+
+											while (success_flag && mongoc_cursor_next (cursor_p, &doc_p))
+												{
+													json_t *doc_json_p = ConvertBSONToJSON (doc_p);
+
+													if (doc_json_p)
+														{
+															success_flag = (json_array_append_new (keys_p, doc_json_p) == 0);
+														}
+													else
+														{
+															success_flag = false;
+														}
+												}
+
+											if (mongoc_cursor_error (cursor_p, &error))
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to get stale rollup counters: %s", error.message);
+													success_flag = false;
+												}
+
+											mongoc_cursor_destroy (cursor_p);
+										}
+
+									bson_destroy (opts_bson_p);
+								}
+
+							bson_destroy (filter_bson_p);
+						}
+				}
+
+			if (opts_p)
+				{
+					json_decref (opts_p);
+				}
+
+			if (filter_p)
+				{
+					json_decref (filter_p);
+				}
+
+			if (!success_flag)
+				{
+					json_decref (keys_p);
+					keys_p = NULL;
+				}
+		}		/* if (keys_p) */
+
+	return keys_p;
+}
+
+
+/*
+ * Set each of the counters to the sum of the stored rollups that
+ * match it and clear its stale flag.
+ */
+static bool RecountCounters (Rollups *rollups_p, const json_t *keys_p)
+{
+	bool success_flag = false;
+	json_t *totals_p = GetCounterTotals (rollups_p, keys_p);
+
+	if (totals_p)
+		{
+			success_flag = WriteCounterTotals (rollups_p, keys_p, totals_p);
+			json_decref (totals_p);
+		}
+
+	if (!success_flag)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to recalculate " SIZET_FMT " rollup counters", json_array_size (keys_p));
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Get the stages that pull out each stored rollup that matches one
+ * of the counters.
+ */
+static json_t *GetRecountStages (const json_t *keys_p)
+{
+	json_t *element_matches_p = json_array ();
+
+	if (element_matches_p)
+		{
+			json_t *rollup_matches_p = json_array ();
+
+			if (rollup_matches_p)
+				{
+					bool success_flag = true;
+					size_t i;
+					json_t *key_p;
+
+					json_array_foreach ((json_t *) keys_p, i, key_p)
+						{
+							json_t *rollup_match_p = json_object ();
+
+							success_flag = false;
+
+							if (rollup_match_p)
+								{
+									const char *name_s;
+									json_t *value_p;
+
+									success_flag = true;
+
+									json_object_foreach (key_p, name_s, value_p)
+										{
+											char *field_s = ConcatenateVarargsStrings (S_ROLLUPS_S, ".", name_s, NULL);
+
+											success_flag = false;
+
+											if (field_s)
+												{
+													success_flag = (json_object_set (rollup_match_p, field_s, value_p) == 0);
+													FreeCopiedString (field_s);
+												}
+
+											if (!success_flag)
+												{
+													break;
+												}
+										}
+
+									if (success_flag)
+										{
+											success_flag = (json_array_append (element_matches_p, key_p) == 0) && (json_array_append (rollup_matches_p, rollup_match_p) == 0);
+										}
+
+									json_decref (rollup_match_p);
+								}
+
+							if (!success_flag)
+								{
+									break;
+								}
+						}		/* json_array_foreach ((json_t *) keys_p, i, key_p) */
+
+					if (success_flag)
+						{
+							/*
+							 * The first stage uses the index on the sources and the
+							 * second picks out the matching rollups from each of them.
+							 */
+							json_t *stages_p = json_pack ("[{s:{s:{s:{s:O}}}},{s:s},{s:{s:O}},{s:{s:s}}]",
+								"$match", S_ROLLUPS_S, "$elemMatch", "$or", element_matches_p,
+								"$unwind", "$rollups",
+								"$match", "$or", rollup_matches_p,
+								"$replaceRoot", "newRoot", "$rollups");
+
+							if (stages_p)
+								{
+									json_decref (rollup_matches_p);
+									json_decref (element_matches_p);
+
+									return stages_p;
+								}
+						}
+
+					json_decref (rollup_matches_p);
+				}		/* if (rollup_matches_p) */
+
+			json_decref (element_matches_p);
+		}		/* if (element_matches_p) */
+
+	PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create rollup recount stages");
+
+	return NULL;
+}
+
+
+/*
+ * Sum the stored rollups that match each of the counters, keyed in the
+ * same way as the deltas.
+ */
+static json_t *GetCounterTotals (Rollups *rollups_p, const json_t *keys_p)
+{
+	json_t *totals_p = NULL;
+	json_t *stages_p = GetRecountStages (keys_p);
+
+	if (stages_p)
+		{
+			json_t *pipeline_p = json_pack ("{s:o}", "pipeline", stages_p);
+
+			if (pipeline_p)
+				{
+					bson_t *pipeline_bson_p = ConvertJSONToBSON (pipeline_p);
+
+					if (pipeline_bson_p)
+						{
+							json_t *matches_p = json_array ();
+
+							if (matches_p)
+								{
+									mongoc_cursor_t *cursor_p = mongoc_collection_aggregate (rollups_p -> rs_sources_tool_p -> mt_collection_p, MONGOC_QUERY_NONE, pipeline_bson_p, NULL, NULL);
+
+									if (cursor_p)
+										{
+											const bson_t *doc_p;
+											bson_error_t error;
+											bool success_flag = true;
+
+											while (success_flag && mongoc_cursor_next (cursor_p, &doc_p))
+												{
+													json_t *doc_json_p = ConvertBSONToJSON (doc_p);
+
+													if (doc_json_p)
+														{
+															success_flag = (json_array_append_new (matches_p, doc_json_p) == 0);
+														}
+													else
+														{
+															success_flag = false;
+														}
+												}
+
+											if (mongoc_cursor_error (cursor_p, &error))
+												{
+													PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to read stored rollups: %s", error.message);
+													success_flag = false;
+												}
+
+											mongoc_cursor_destroy (cursor_p);
+
+											if (success_flag)
+												{
+													totals_p = json_object ();
+
+													if (totals_p)
+														{
+															if (!AddRollupsToDeltas (totals_p, matches_p, 1))
+																{
+																	json_decref (totals_p);
+																	totals_p = NULL;
+																}
+														}
+												}
+										}
+
+									json_decref (matches_p);
+								}		/* if (matches_p) */
+
+							bson_destroy (pipeline_bson_p);
+						}
+
+					json_decref (pipeline_p);
+				}		/* if (pipeline_p) */
+
+		}		/* if (stages_p) */
+
+	return totals_p;
+}
+
+
+/*
+ * Replace the count of each counter with its total, or 0 if no stored
+ * rollups match it any more, and clear its stale flag.
+ */
+static bool WriteCounterTotals (Rollups *rollups_p, const json_t *keys_p, const json_t *totals_p)
+{
+	bool success_flag = true;
+	mongoc_bulk_operation_t *bulk_p = NULL;
+	size_t i;
+	json_t *key_p;
+
+	json_array_foreach ((json_t *) keys_p, i, key_p)
+		{
+			char *key_s = json_dumps (key_p, JSON_COMPACT | JSON_SORT_KEYS);
+
+			success_flag = false;
+
+			if (key_s)
+				{
+					const json_int_t count = json_integer_value (json_object_get (json_object_get (totals_p, key_s), PG_COUNT_S));
+					json_t *update_p = json_pack ("{s:{s:I},s:{s:s}}", "$set", PG_COUNT_S, count, "$unset", S_STALE_S, "");
+
+					if (update_p)
+						{
+							bson_t *selector_bson_p = ConvertJSONToBSON (key_p);
+
+							if (selector_bson_p)
+								{
+									bson_t *update_bson_p = ConvertJSONToBSON (update_p);
+
+									if (update_bson_p)
+										{
+											if (!bulk_p)
+												{
+													bulk_p = mongoc_collection_create_bulk_operation_with_opts (rollups_p -> rs_counters_tool_p -> mt_collection_p, NULL);
+												}
+
+											if (bulk_p)
+												{
+													bson_error_t error;
+
+													if (mongoc_bulk_operation_update_one_with_opts (bulk_p, selector_bson_p, update_bson_p, NULL, &error))
+														{
+															success_flag = true;
+														}
+													else
+														{
+															PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add rollup counter update: %s", error.message);
+														}
+												}
+
+											bson_destroy (update_bson_p);
+										}
+
+									bson_destroy (selector_bson_p);
+								}
+
+							json_decref (update_p);
+						}
+
+					free (key_s);
+				}		/* if (key_s) */
+
+			if (!success_flag)
+				{
+					break;
+				}
+		}		/* json_array_foreach ((json_t *) keys_p, i, key_p) */
+
+	if (bulk_p)
+		{
+			if (success_flag)
+				{
+					success_flag = ExecuteBulkOperation (bulk_p, "rollup counters");
+				}
+
+			mongoc_bulk_operation_destroy (bulk_p);
+		}
+
+	return success_flag;
+}
+
+
+static bool ExecuteBulkOperation (mongoc_bulk_operation_t *bulk_p, const char *name_s)
+{
+	bool success_flag = false;
+	bson_t reply;
+	bson_error_t error;
+
+	if (mongoc_bulk_operation_execute (bulk_p, &reply, &error) != 0)
+		{
+			success_flag = true;
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to write %s: %s", name_s, error.message);
+		}
+
+	bson_destroy (&reply);
+
+	return success_flag;
+}
+
+
+/*
+ * Get the stages that sum the counters in each group. For the public
+ * view, only the counters whose samples have reached their live
+ * dates are included.
+ */
+static json_t *GetSummaryStages (const json_t *summary_p, const bool preview_flag, const char **error_ss)
+{
+	const json_t *group_p = json_object_get (summary_p, PG_GROUP_S);
+	const json_t *data_p = json_object_get (summary_p, MONGO_OPERATION_DATA_S);
+
+	if (!json_is_array (group_p))
+		{
+			*error_ss = "The summary needs a \"" PG_GROUP_S "\" array";
+		}
+	else if (data_p && (!json_is_object (data_p)))
+		{
+			*error_ss = "The summary's \"" MONGO_OPERATION_DATA_S "\" must be an object";
+		}
+	else
+		{
+			json_t *match_p = json_object ();
+			json_t *id_p = json_object ();
+			json_t *projection_p = json_pack ("{s:i,s:i}", MONGO_ID_S, 0, PG_COUNT_S, 1);
+
+			if (match_p && id_p && projection_p)
+				{
+					bool success_flag = true;
+					size_t i;
+					json_t *name_p;
+					const char *name_s;
+					json_t *value_p;
+
+					json_array_foreach ((json_t *) group_p, i, name_p)
+						{
+							name_s = json_string_value (name_p);
+
+							if (name_s && IsCounterKey (name_s))
+								{
+									char *field_s = ConcatenateStrings ("$", name_s);
+									char *id_value_s = ConcatenateVarargsStrings ("$", MONGO_ID_S, ".", name_s, NULL);
+
+									success_flag = field_s && id_value_s &&
+										(json_object_set_new (id_p, name_s, json_string (field_s)) == 0) &&
+										(json_object_set_new (projection_p, name_s, json_string (id_value_s)) == 0);
+
+									if (id_value_s)
+										{
+											FreeCopiedString (id_value_s);
+										}
+
+									if (field_s)
+										{
+											FreeCopiedString (field_s);
+										}
+								}
+							else
+								{
+									*error_ss = "Unknown group name";
+									success_flag = false;
+								}
+
+							if (!success_flag)
+								{
+									break;
+								}
+						}
+
+					if (success_flag && data_p)
+						{
+							json_object_foreach ((json_t *) data_p, name_s, value_p)
+								{
+									if (IsCounterKey (name_s) && (!json_is_object (value_p)) && (!json_is_array (value_p)))
+										{
+											success_flag = (json_object_set (match_p, name_s, value_p) == 0);
+										}
+									else
+										{
+											*error_ss = "The summary data must be single values for the names that can be grouped by";
+											success_flag = false;
+										}
+
+									if (!success_flag)
+										{
+											break;
+										}
+								}
+						}
+
+					if (success_flag && (!preview_flag))
+						{
+							char *today_s = GetTodayAsString ();
+
+							success_flag = false;
+
+							if (today_s)
+								{
+									success_flag = (json_object_set_new (match_p, S_LIVE_S, json_pack ("{s:s}", "$lte", today_s)) == 0);
+									FreeCopiedString (today_s);
+								}
+						}
+
+					if (success_flag)
+						{
+							json_t *stages_p = json_pack ("[{s:O},{s:{s:O,s:{s:s}}},{s:{s:{s:i}}},{s:{s:i,s:i}},{s:O}]",
+								"$match", match_p,
+								"$group", MONGO_ID_S, id_p, PG_COUNT_S, "$sum", "$" PG_COUNT_S,
+								"$match", PG_COUNT_S, "$gt", 0,
+								"$sort", PG_COUNT_S, -1, MONGO_ID_S, 1,
+								"$project", projection_p);
+
+							json_decref (projection_p);
+							json_decref (id_p);
+							json_decref (match_p);
+
+							if (!stages_p)
+								{
+									*error_ss = "Failed to create the summary";
+								}
+
+							return stages_p;
+						}
+				}		/* if (match_p && id_p && projection_p) */
+
+			if (!*error_ss)
+				{
+					*error_ss = "Failed to create the summary";
+				}
+
+			if (projection_p)
+				{
+					json_decref (projection_p);
+				}
+
+			if (id_p)
+				{
+					json_decref (id_p);
+				}
+
+			if (match_p)
+				{
+					json_decref (match_p);
+				}
+		}
+
+	return NULL;
+}
+
+
+static bool IsCounterKey (const char *name_s)
+{
+	const char **key_ss;
+
+	for (key_ss = S_COUNTER_KEYS_SS; *key_ss; ++ key_ss)
+		{
+			if (strcmp (*key_ss, name_s) == 0)
+				{
+					return true;
+				}
+		}
+
+	return false;
+}
+
+
+static bool AddIdToSet (json_t *doc_p, void *data_p)
+{
+	json_t *ids_p = (json_t *) data_p;
+	const char *id_s = GetJSONString (doc_p, PG_ID_S);
+
+	if (id_s)
+		{
+			if (json_object_set_new (ids_p, id_s, json_true ()) != 0)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add \"%s\" to the changed documents", id_s);
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+static bool AddDocumentToCounts (json_t *doc_p, void *data_p)
+{
+	json_t *counts_p = (json_t *) data_p;
+
+	if (json_array_append (counts_p, doc_p) != 0)
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to add count to summary");
+			return false;
+		}
+
+	return true;
+}
@@ -0,0 +1,189 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * row_hashes.c
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "row_hashes.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define ROW_HASHES_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define ROW_HASHES_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+/* 64-bit FNV-1a, as used for the gazetteer keys */
+#define S_FNV_OFFSET_BASIS (14695981039346656037ULL)
+
+#define S_FNV_PRIME (1099511628211ULL)
+
+
+static void HashString (const char *value_s, uint64 *hash_p);
+
+
+char *GetRowContentHash (const json_t *row_p, const uint32 stage_time)
+{
+	char *hash_s = NULL;
+	char *row_s = json_dumps (row_p, JSON_COMPACT | JSON_SORT_KEYS);
+
+	if (row_s)
+		{
+			uint64 hash = S_FNV_OFFSET_BASIS;
+			char stage_s [16];
+
+			sprintf (stage_s, "|" UINT32_FMT, stage_time);
+
+			HashString (row_s, &hash);
+			HashString (stage_s, &hash);
+
+			hash_s = (char *) AllocMemory (17 * sizeof (char));
+
+			if (hash_s)
+				{
+					sprintf (hash_s, "%016llx", (unsigned long long) hash);
+				}
+
+			free (row_s);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to serialise row for hashing");
+		}
+
+	return hash_s;
+}
+
+
+uint64 GetRowFingerprint (const json_t *row_p, const size_t row)
+{
+	uint64 hash = S_FNV_OFFSET_BASIS;
+	char row_s [32];
+
+	sprintf (row_s, SIZET_FMT "|", row);
+	HashString (row_s, &hash);
+
+	if (row_p)
+		{
+			char *value_s = json_dumps (row_p, JSON_COMPACT | JSON_SORT_KEYS);
+
+			if (value_s)
+				{
+					HashString (value_s, &hash);
+					free (value_s);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to serialise row " SIZET_FMT " for its fingerprint", row);
+				}
+		}
+
+	return hash;
+}
+
+
+json_t *FetchStoredRowHashes (MongoTool *tool_p, const char *key_s, json_t *values_p, const char *hash_key_s)
+{
+	json_t *hashes_p = NULL;
+	json_error_t err;
+	json_t *query_p = json_pack_ex (&err, 0, "{s:{s:O}}", key_s, "$in", values_p);
+
+	if (query_p)
+		{
+			const char *fields_ss [] = { key_s, hash_key_s, NULL };
+
+			if (FindMatchingMongoDocumentsByJSON (tool_p, query_p, fields_ss, NULL))
+				{
+					json_t *docs_p = GetAllExistingMongoResultsAsJSON (tool_p);
+
+					hashes_p = json_object ();
+
+					if (hashes_p && docs_p)
+						{
+							size_t i;
+							json_t *doc_p;
+
+							json_array_foreach (docs_p, i, doc_p)
+								{
+									const char *value_s = GetJSONString (doc_p, key_s);
+
+									if (value_s)
+										{
+											json_t *hash_p = NULL;
+
+											/* The hash can't be trusted if more than one document has the value */
+											if (json_object_get (hashes_p, value_s))
+												{
+													hash_p = json_null ();
+												}
+											else
+												{
+													const char *hash_s = GetJSONString (doc_p, hash_key_s);
+
+													hash_p = json_string (hash_s ? hash_s : "");
+												}
+
+											if (json_object_set_new (hashes_p, value_s, hash_p) != 0)
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to store the hash for \"%s\"", value_s);
+												}
+										}
+								}
+
+							#if ROW_HASHES_DEBUG >= STM_LEVEL_FINE
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Fetched " SIZET_FMT " stored hashes for " SIZET_FMT " values of \"%s\"", json_object_size (hashes_p), json_array_size (values_p), key_s);
+							#endif
+						}
+
+					if (docs_p)
+						{
+							json_decref (docs_p);
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to find the stored hashes by \"%s\"", key_s);
+				}
+
+			json_decref (query_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create query for \"%s\": %s", key_s, err.text);
+		}
+
+	return hashes_p;
+}
+
+
+static void HashString (const char *value_s, uint64 *hash_p)
+{
+	while (*value_s)
+		{
+			*hash_p ^= (unsigned char) *value_s;
+			*hash_p *= S_FNV_PRIME;
+			++ value_s;
+		}
+}
@@ -0,0 +1,685 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * row_source.c
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "row_source.h"
+#include "column_schema.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+
+
+typedef struct JSONRowSource
+{
+	RowSource jrs_base;
+
+	const json_t *jrs_values_p;
+
+	size_t jrs_index;
+} JSONRowSource;
+
+
+typedef struct TabularRowSource
+{
+	RowSource trs_base;
+
+	/* The start of the next row to parse */
+	const char *trs_current_s;
+
+	char trs_column_delimiter;
+
+	char trs_row_delimiter;
+
+	/* The column headings, indexed by column */
+	const FieldNode **trs_columns_pp;
+
+	/* The converter for each column's values, indexed by column */
+	ColumnConverter *trs_converters_p;
+
+	size_t trs_num_columns;
+
+	/* Scratch space used to unquote each value */
+	char *trs_value_s;
+
+	size_t trs_value_size;
+
+	/* Used to build row-specific error messages */
+	char trs_error_s [256];
+} TabularRowSource;
+
+
+typedef struct ReadAheadRowSource
+{
+	RowSource rars_base;
+
+	RowSource *rars_source_p;
+
+	RowBatchCallback rars_batch_fn;
+
+	void *rars_batch_data_p;
+
+	size_t rars_batch_size;
+
+	/* The buffered rows, which are NULL for any that couldn't be read */
+	json_t **rars_rows_pp;
+
+	/* Copies of the read errors for any rows that couldn't be read */
+	char **rars_errors_ss;
+
+	size_t rars_num_buffered;
+
+	/* The index of the next buffered row to return */
+	size_t rars_next;
+} ReadAheadRowSource;
+
+
+static bool GetNextJSONRow (RowSource *source_p, json_t **row_pp, const char **error_ss);
+
+static void FreeJSONRowSource (RowSource *source_p);
+
+static bool GetNextTabularRow (RowSource *source_p, json_t **row_pp, const char **error_ss);
+
+static void FreeTabularRowSource (RowSource *source_p);
+
+static bool ReadTabularValue (TabularRowSource *source_p, const char **data_ss);
+
+static bool EnsureValueSpace (TabularRowSource *source_p, const size_t length);
+
+static bool IsRowEnd (const TabularRowSource *source_p, const char c);
+
+static bool GetNextReadAheadRow (RowSource *source_p, json_t **row_pp, const char **error_ss);
+
+static void FreeReadAheadRowSource (RowSource *source_p);
+
+static bool FillReadAheadBuffer (ReadAheadRowSource *source_p);
+
+static void ClearReadAheadBuffer (ReadAheadRowSource *source_p);
+
+
+RowSource *AllocateJSONRowSource (const json_t *values_p)
+{
+	JSONRowSource *source_p = (JSONRowSource *) AllocMemory (sizeof (JSONRowSource));
+
+	if (source_p)
+		{
+			source_p -> jrs_base.rs_get_next_row_fn = GetNextJSONRow;
+			source_p -> jrs_base.rs_free_fn = FreeJSONRowSource;
+			source_p -> jrs_base.rs_num_rows = 0;
+
+			source_p -> jrs_values_p = values_p;
+			source_p -> jrs_index = 0;
+		}
+
+	return (source_p ? & (source_p -> jrs_base) : NULL);
+}
+
+
+RowSource *AllocateTabularRowSource (const char *data_s, const char column_delimiter, const char row_delimiter, const LinkedList *headers_p)
+{
+	const size_t num_columns = headers_p -> ll_size;
+	const FieldNode **columns_pp = (const FieldNode **) AllocMemoryArray (num_columns > 0 ? num_columns : 1, sizeof (const FieldNode *));
+	ColumnConverter *converters_p = (ColumnConverter *) AllocMemoryArray (num_columns > 0 ? num_columns : 1, sizeof (ColumnConverter));
+
+	if (columns_pp && converters_p)
+		{
+			TabularRowSource *source_p = (TabularRowSource *) AllocMemory (sizeof (TabularRowSource));
+
+			if (source_p)
+				{
+					const FieldNode *node_p = (const FieldNode *) (headers_p -> ll_head_p);
+					const FieldNode **column_pp = columns_pp;
+					ColumnConverter *converter_p = converters_p;
+
+					/* Work out each column's converter once rather than for every value */
+					while (node_p)
+						{
+							*column_pp = node_p;
+							++ column_pp;
+
+							*converter_p = GetColumnConverter (node_p -> fn_type);
+							++ converter_p;
+
+							node_p = (const FieldNode *) (node_p -> fn_base_node.sln_node.ln_next_p);
+						}
+
+					source_p -> trs_base.rs_get_next_row_fn = GetNextTabularRow;
+					source_p -> trs_base.rs_free_fn = FreeTabularRowSource;
+					source_p -> trs_base.rs_num_rows = 0;
+
+					source_p -> trs_current_s = data_s;
+					source_p -> trs_column_delimiter = column_delimiter;
+					source_p -> trs_row_delimiter = row_delimiter;
+					source_p -> trs_columns_pp = columns_pp;
+					source_p -> trs_converters_p = converters_p;
+					source_p -> trs_num_columns = num_columns;
+					source_p -> trs_value_s = NULL;
+					source_p -> trs_value_size = 0;
+					* (source_p -> trs_error_s) = '\0';
+
+					return & (source_p -> trs_base);
+				}		/* if (source_p) */
+		}		/* if (columns_pp && converters_p) */
+
+	if (columns_pp)
+		{
+			FreeMemory (columns_pp);
+		}
+
+	if (converters_p)
+		{
+			FreeMemory (converters_p);
+		}
+
+	return NULL;
+}
+
+
+RowSource *AllocateReadAheadRowSource (RowSource *source_p, const size_t batch_size, RowBatchCallback batch_fn, void *data_p)
+{
+	json_t **rows_pp = (json_t **) AllocMemoryArray (batch_size, sizeof (json_t *));
+
+	if (rows_pp)
+		{
+			char **errors_ss = (char **) AllocMemoryArray (batch_size, sizeof (char *));
+
+			if (errors_ss)
+				{
+					ReadAheadRowSource *read_ahead_source_p = (ReadAheadRowSource *) AllocMemory (sizeof (ReadAheadRowSource));
+
+					if (read_ahead_source_p)
+						{
+							read_ahead_source_p -> rars_base.rs_get_next_row_fn = GetNextReadAheadRow;
+							read_ahead_source_p -> rars_base.rs_free_fn = FreeReadAheadRowSource;
+							read_ahead_source_p -> rars_base.rs_num_rows = source_p -> rs_num_rows;
+
+							read_ahead_source_p -> rars_source_p = source_p;
+							read_ahead_source_p -> rars_batch_fn = batch_fn;
+							read_ahead_source_p -> rars_batch_data_p = data_p;
+							read_ahead_source_p -> rars_batch_size = batch_size;
+							read_ahead_source_p -> rars_rows_pp = rows_pp;
+							read_ahead_source_p -> rars_errors_ss = errors_ss;
+							read_ahead_source_p -> rars_num_buffered = 0;
+							read_ahead_source_p -> rars_next = 0;
+
+							return & (read_ahead_source_p -> rars_base);
+						}
+
+					FreeMemory (errors_ss);
+				}		/* if (errors_ss) */
+
+			FreeMemory (rows_pp);
+		}		/* if (rows_pp) */
+
+	return NULL;
+}
+
+
+bool GetNextRow (RowSource *source_p, json_t **row_pp, const char **error_ss)
+{
+	bool row_flag;
+
+	*row_pp = NULL;
+	*error_ss = NULL;
+
+	row_flag = source_p -> rs_get_next_row_fn (source_p, row_pp, error_ss);
+
+	if (row_flag)
+		{
+			++ (source_p -> rs_num_rows);
+		}
+
+	return row_flag;
+}
+
+
+size_t GetCurrentRowIndex (const RowSource *source_p)
+{
+	return (source_p -> rs_num_rows > 0) ? source_p -> rs_num_rows - 1 : 0;
+}
+
+
+void FreeRowSource (RowSource *source_p)
+{
+	source_p -> rs_free_fn (source_p);
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool GetNextJSONRow (RowSource *source_p, json_t **row_pp, const char **error_ss)
+{
+	JSONRowSource *json_source_p = (JSONRowSource *) source_p;
+	const json_t *values_p = json_source_p -> jrs_values_p;
+	json_t *row_p = NULL;
+
+	if (json_is_array (values_p))
+		{
+			if (json_source_p -> jrs_index < json_array_size (values_p))
+				{
+					row_p = json_array_get (values_p, json_source_p -> jrs_index);
+				}
+		}
+	else if (json_source_p -> jrs_index == 0)
+		{
+			row_p = (json_t *) values_p;
+		}
+
+	if (row_p)
+		{
+			++ (json_source_p -> jrs_index);
+
+			if (json_is_object (row_p))
+				{
+					*row_pp = json_incref (row_p);
+				}
+			else
+				{
+					*error_ss = "Row is not a JSON object";
+				}
+
+			return true;
+		}
+
+	return false;
+}
+
+
+static void FreeJSONRowSource (RowSource *source_p)
+{
+	FreeMemory (source_p);
+}
+
+
+static bool GetNextTabularRow (RowSource *source_p, json_t **row_pp, const char **error_ss)
+{
+	TabularRowSource *tabular_source_p = (TabularRowSource *) source_p;
+	const char *data_s = tabular_source_p -> trs_current_s;
+	json_t *row_p = NULL;
+
+	/* Skip any blank rows */
+	while ((*data_s == tabular_source_p -> trs_row_delimiter) || (*data_s == '\r'))
+		{
+			++ data_s;
+		}
+
+	if (*data_s == '\0')
+		{
+			tabular_source_p -> trs_current_s = data_s;
+			return false;
+		}
+
+	row_p = json_object ();
+
+	if (row_p)
+		{
+			size_t column = 0;
+			bool loop_flag = true;
+
+			while (loop_flag)
+				{
+					if (ReadTabularValue (tabular_source_p, &data_s))
+						{
+							const char *value_s = tabular_source_p -> trs_value_s;
+
+							/* Missing values are simply left out of the row */
+							if (!IsStringEmpty (value_s))
+								{
+									if (column < tabular_source_p -> trs_num_columns)
+										{
+											const FieldNode *column_p = * ((tabular_source_p -> trs_columns_pp) + column);
+											const char *key_s = column_p -> fn_base_node.sln_string_s;
+											json_t *value_p = (* ((tabular_source_p -> trs_converters_p) + column)) (value_s);
+
+											if (value_p)
+												{
+													if (json_object_set_new (row_p, key_s, value_p) != 0)
+														{
+															*error_ss = "Failed to add value to row";
+														}
+												}
+											else
+												{
+													snprintf (tabular_source_p -> trs_error_s, sizeof (tabular_source_p -> trs_error_s), "Invalid value \"%s\" for \"%s\"", value_s, key_s);
+													*error_ss = tabular_source_p -> trs_error_s;
+												}
+										}
+									else
+										{
+											*error_ss = "The row has more values than there are column headings";
+										}
+								}
+
+							if (*data_s == tabular_source_p -> trs_column_delimiter)
+								{
+									++ data_s;
+									++ column;
+								}
+							else
+								{
+									/* We're at the end of the row */
+									loop_flag = false;
+								}
+						}
+					else
+						{
+							*error_ss = "Failed to read value";
+							loop_flag = false;
+						}
+
+				}		/* while (loop_flag) */
+
+			/* Move to the start of the next row */
+			while ((*data_s != '\0') && (*data_s != tabular_source_p -> trs_row_delimiter))
+				{
+					++ data_s;
+				}
+
+			if (*error_ss)
+				{
+					json_decref (row_p);
+				}
+			else
+				{
+					*row_pp = row_p;
+				}
+
+		}		/* if (row_p) */
+	else
+		{
+			*error_ss = "Failed to allocate row";
+
+			while ((*data_s != '\0') && (*data_s != tabular_source_p -> trs_row_delimiter))
+				{
+					++ data_s;
+				}
+		}
+
+	tabular_source_p -> trs_current_s = data_s;
+
+	return true;
+}
+
+
+static void FreeTabularRowSource (RowSource *source_p)
+{
+	TabularRowSource *tabular_source_p = (TabularRowSource *) source_p;
+
+	if (tabular_source_p -> trs_value_s)
+		{
+			FreeMemory (tabular_source_p -> trs_value_s);
+		}
+
+	FreeMemory (tabular_source_p -> trs_columns_pp);
+	FreeMemory (tabular_source_p -> trs_converters_p);
+	FreeMemory (tabular_source_p);
+}
+
+
+/*
+ * Read the value starting at *data_ss into the source's scratch buffer,
+ * leaving *data_ss on the delimiter that ended it. Values may be enclosed
+ * in double quotes, in which case they can contain delimiters and a pair
+ * of double quotes stands for a single one.
+ */
+static bool ReadTabularValue (TabularRowSource *source_p, const char **data_ss)
+{
+	const char *data_s = *data_ss;
+	size_t length = 0;
+
+	if (*data_s == '"')
+		{
+			bool loop_flag = true;
+
+			++ data_s;
+
+			while (loop_flag)
+				{
+					if (*data_s == '\0')
+						{
+							loop_flag = false;
+						}
+					else if (*data_s == '"')
+						{
+							if (* (data_s + 1) == '"')
+								{
+									if (!EnsureValueSpace (source_p, length + 1))
+										{
+											return false;
+										}
+
+									* ((source_p -> trs_value_s) + length) = '"';
+									++ length;
+									data_s += 2;
+								}
+							else
+								{
+									++ data_s;
+									loop_flag = false;
+								}
+						}
+					else
+						{
+							if (!EnsureValueSpace (source_p, length + 1))
+								{
+									return false;
+								}
+
+							* ((source_p -> trs_value_s) + length) = *data_s;
+							++ length;
+							++ data_s;
+						}
+				}
+
+			/* Ignore anything between the closing quote and the next delimiter */
+			while ((*data_s != '\0') && (*data_s != source_p -> trs_column_delimiter) && (!IsRowEnd (source_p, *data_s)))
+				{
+					++ data_s;
+				}
+		}
+	else
+		{
+			const char *start_s = data_s;
+
+			while ((*data_s != '\0') && (*data_s != source_p -> trs_column_delimiter) && (!IsRowEnd (source_p, *data_s)))
+				{
+					++ data_s;
+				}
+
+			length = data_s - start_s;
+
+			if (!EnsureValueSpace (source_p, length))
+				{
+					return false;
+				}
+
+			memcpy (source_p -> trs_value_s, start_s, length * sizeof (char));
+		}
+
+	* ((source_p -> trs_value_s) + length) = '\0';
+	*data_ss = data_s;
+
+	return true;
+}
+
+
+static bool EnsureValueSpace (TabularRowSource *source_p, const size_t length)
+{
+	if (length + 1 > source_p -> trs_value_size)
+		{
+			size_t new_size = (source_p -> trs_value_size > 0) ? source_p -> trs_value_size : 256;
+			char *new_value_s;
+
+			while (new_size < length + 1)
+				{
+					new_size <<= 1;
+				}
+
+			new_value_s = (char *) AllocMemory (new_size * sizeof (char));
+
+			if (!new_value_s)
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate " SIZET_FMT " bytes for tabular value", new_size);
+					return false;
+				}
+
+			if (source_p -> trs_value_s)
+				{
+					memcpy (new_value_s, source_p -> trs_value_s, source_p -> trs_value_size * sizeof (char));
+					FreeMemory (source_p -> trs_value_s);
+				}
+
+			source_p -> trs_value_s = new_value_s;
+			source_p -> trs_value_size = new_size;
+		}
+
+	return true;
+}
+
+
+static bool IsRowEnd (const TabularRowSource *source_p, const char c)
+{
+	return ((c == source_p -> trs_row_delimiter) || (c == '\r'));
+}
+
+
+static bool GetNextReadAheadRow (RowSource *source_p, json_t **row_pp, const char **error_ss)
+{
+	ReadAheadRowSource *read_ahead_source_p = (ReadAheadRowSource *) source_p;
+
+	if (read_ahead_source_p -> rars_next == read_ahead_source_p -> rars_num_buffered)
+		{
+			if (!FillReadAheadBuffer (read_ahead_source_p))
+				{
+					return false;
+				}
+		}
+
+	*row_pp = * ((read_ahead_source_p -> rars_rows_pp) + (read_ahead_source_p -> rars_next));
+
+	if (*row_pp)
+		{
+			/* The caller now owns this reference */
+			* ((read_ahead_source_p -> rars_rows_pp) + (read_ahead_source_p -> rars_next)) = NULL;
+		}
+	else
+		{
+			/* This stays valid until the next batch is read */
+			const char *error_s = * ((read_ahead_source_p -> rars_errors_ss) + (read_ahead_source_p -> rars_next));
+
+			*error_ss = error_s ? error_s : "Failed to read row";
+		}
+
+	++ (read_ahead_source_p -> rars_next);
+
+	return true;
+}
+
+
+static void FreeReadAheadRowSource (RowSource *source_p)
+{
+	ReadAheadRowSource *read_ahead_source_p = (ReadAheadRowSource *) source_p;
+
+	ClearReadAheadBuffer (read_ahead_source_p);
+
+	FreeMemory (read_ahead_source_p -> rars_rows_pp);
+	FreeMemory (read_ahead_source_p -> rars_errors_ss);
+	FreeMemory (read_ahead_source_p);
+}
+
+
+static bool FillReadAheadBuffer (ReadAheadRowSource *source_p)
+{
+	json_t *batch_p = json_array ();
+	json_t *row_p = NULL;
+	const char *error_s = NULL;
+
+	ClearReadAheadBuffer (source_p);
+
+	while ((source_p -> rars_num_buffered < source_p -> rars_batch_size) && (GetNextRow (source_p -> rars_source_p, &row_p, &error_s)))
+		{
+			const size_t i = source_p -> rars_num_buffered;
+
+			* ((source_p -> rars_rows_pp) + i) = row_p;
+			* ((source_p -> rars_errors_ss) + i) = NULL;
+
+			if (row_p)
+				{
+					if (batch_p)
+						{
+							if (json_array_append (batch_p, row_p) != 0)
+								{
+									/* The rows can still be imported, just without the batch callback */
+									json_decref (batch_p);
+									batch_p = NULL;
+								}
+						}
+				}
+			else
+				{
+					* ((source_p -> rars_errors_ss) + i) = EasyCopyToNewString (error_s);
+				}
+
+			++ (source_p -> rars_num_buffered);
+		}
+
+	if (batch_p)
+		{
+			if (json_array_size (batch_p) > 0)
+				{
+					source_p -> rars_batch_fn (batch_p, source_p -> rars_batch_data_p);
+				}
+
+			json_decref (batch_p);
+		}
+
+	return (source_p -> rars_num_buffered > 0);
+}
+
+
+static void ClearReadAheadBuffer (ReadAheadRowSource *source_p)
+{
+	size_t i;
+
+	for (i = 0; i < source_p -> rars_num_buffered; ++ i)
+		{
+			json_t **row_pp = (source_p -> rars_rows_pp) + i;
+			char **error_ss = (source_p -> rars_errors_ss) + i;
+
+			if (*row_pp)
+				{
+					json_decref (*row_pp);
+					*row_pp = NULL;
+				}
+
+			if (*error_ss)
+				{
+					FreeCopiedString (*error_ss);
+					*error_ss = NULL;
+				}
+		}
+
+	source_p -> rars_num_buffered = 0;
+	source_p -> rars_next = 0;
+}
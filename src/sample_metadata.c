@@ -28,8 +28,10 @@
 #include "json_tools.h"
 #include "math_utils.h"
 #include "pathogenomics_utils.h"
+#include "column_schema.h"
 #include "address.h"
 #include "geocoder_util.h"
+#include "coordinate_parser.h"
 
 
 #ifdef _DEBUG
@@ -43,6 +45,10 @@
 
 static bool ReplacePathogen (json_t *data_p);
 
+static const char *GetPathogenName (const char *pathogen_s);
+
+static bool HasLocationDetails (const json_t *row_p);
+
 static bool ParseCollector (json_t *values_p);
 
 static bool ParseCompany (json_t *values_p);
@@ -51,9 +57,52 @@ static bool ParseCompany (json_t *values_p);
 static bool ConvertToSchemaOrgRepresentation (json_t *values_p, const char * const input_key_s, const char * const type_s, const char * const output_subkey_s);
 
 
-static const char *PrepareSampleData (MongoTool *tool_p, json_t *values_p, PathogenomicsServiceData *data_p, const char *pathogenomics_id_s);
+static const char *PrepareSampleData (json_t *values_p, PathogenomicsServiceData *data_p, const char *pathogenomics_id_s, GeocodeCacheStats *geocode_stats_p, DateNormaliser *normaliser_p);
+
+static const char *MergeData (ImportSession *session_p, json_t *values_p, const char * const pathogenomics_id_s, const char * const ukcpvs_id_s, json_t **selector_pp);
+
+static int32 GetUKCPVSMatch (ImportSession *session_p, const char * const ukcpvs_id_s, json_t **doc_pp);
+
+static int32 GetIdMatchCount (ImportSession *session_p, const char * const pathogenomics_id_s);
+
+static json_t *GetPrefetchedEntry (ImportSession *session_p, const char * const key_s, const char * const value_s);
+
+static void ForgetPrefetchedSample (ImportSession *session_p, const char * const pathogenomics_id_s, const char * const ukcpvs_id_s);
+
+static bool InitPrefetchedSamples (ImportSession *session_p);
+
+static void PrefetchStoredLocations (ImportSession *session_p, const json_t *rows_p);
+
+static bool AddStoredMapTiles (ImportSession *session_p, const char * const pathogenomics_id_s);
+
+static json_t *FetchStoredLocations (MongoTool *tool_p, json_t *ids_p);
+
+static json_t *GetMergeableRowValues (const json_t *rows_p, const char * const key_s, const json_t *ukcpvs_matches_p);
+
+static json_t *FetchUKCPVSMatches (MongoTool *tool_p, json_t *ukcpvs_ids_p);
+
+static json_t *FetchIdCounts (MongoTool *tool_p, json_t *ids_p);
+
+static json_t *FindDocumentsWithValues (MongoTool *tool_p, const char * const key_s, json_t *values_p, const char **fields_ss);
+
+static bool SetLocationFromCoordinates (json_t *row_p, const char * const id_s, const char *town_s, const char *county_s, const char *country_s, const char *postcode_s, const double64 latitude, const double64 longitude);
 
-static const char *MergeData (MongoTool *tool_p, json_t *values_p, const char * const pathogenomics_id_s, const char * const ukcpvs_id_s, json_t **selector_pp);
+static bool AddGeoPoint (json_t *row_p, const char * const id_s);
+
+
+/*
+ * The keys used for each prefetched UKCPVS ID, with the number of
+ * matching documents and the document itself if there is just one.
+ */
+static const char * const S_PREFETCH_COUNT_S = "count";
+
+static const char * const S_PREFETCH_DOC_S = "doc";
+
+/*
+ * The key for the stored sample of each prefetched ID, with just its
+ * location, or null if there isn't one.
+ */
+static const char * const S_PREFETCH_LOCATIONS_S = "locations";
 
 
 /****************************************/
@@ -61,7 +110,7 @@ static const char *MergeData (MongoTool *tool_p, json_t *values_p, const char *
 /****************************************/
 
 
-bool CheckSampleData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p)
+bool SetSampleRequiredColumns (ColumnSchema *schema_p)
 {
 	const char *headers_ss [] = {
 		PG_ID_S,
@@ -80,153 +129,215 @@ bool CheckSampleData (const LinkedList *headers_p, ServiceJob *job_p, Pathogenom
 		NULL
 	};
 
-	return CheckForFields (headers_p, headers_ss, job_p);
+	return SetRequiredColumns (schema_p, PD_SAMPLE, headers_ss);
+}
+
+
+bool CheckSampleData (const LinkedList *headers_p, ServiceJob *job_p, PathogenomicsServiceData *data_p)
+{
+	return CheckRequiredColumns (data_p -> psd_column_schema_p, PD_SAMPLE, headers_p, job_p);
+}
+
+
+const char *InsertSampleData (ImportSession *session_p, json_t *values_p, const size_t row)
+{
+	const char *error_s = PrepareSampleRow (session_p, values_p, row);
+
+	if (!error_s)
+		{
+			error_s = StoreSampleRow (session_p, values_p, row);
+		}
+
+	return error_s;
+}
+
+
+const char *PrepareSampleRow (ImportSession *session_p, json_t *values_p, const size_t UNUSED_PARAM (row))
+{
+	const char *error_s = NULL;
+	const char *pathogenomics_id_s = GetJSONString (values_p, PG_ID_S);
+
+	if (pathogenomics_id_s)
+		{
+			error_s = PrepareSampleData (values_p, session_p -> is_data_p, pathogenomics_id_s, & (session_p -> is_geocode_stats), session_p -> is_date_normaliser_p);
+		}
+	else
+		{
+			error_s = "Could not get pathogenomics id";
+		}
+
+	return error_s;
 }
 
 
-const char *InsertSampleData (MongoTool *tool_p, json_t *values_p, const uint32 stage_time, PathogenomicsServiceData *data_p)
+const char *StoreSampleRow (ImportSession *session_p, json_t *values_p, const size_t row)
 {
 	const char *error_s = NULL;
 	const char *pathogenomics_id_s = GetJSONString (values_p, PG_ID_S);
 
 	if (pathogenomics_id_s)
 		{
-			error_s = PrepareSampleData (tool_p, values_p, data_p, pathogenomics_id_s);
+			/*
+			 * The genotype data is keyed by PG_ID_S and the phenotype data is
+			 * keyed by PG_UKCPVS_ID_S. So we need to check for both of these.
+			 *
+			 * If none exist in the db, we can insert as normal.
+			 * If only one of them is set, then we can update as normal.
+			 * If both exist as separate entries, we need to merge them together
+			 * and update with our sample data.
+			 * If both exist on the same entry, then we update as normal.
+			 */
+			bool success_flag = true;
+			const char *ukcpvs_id_s = GetJSONString (values_p, PG_UKCPVS_ID_S);
+			json_t *selector_p = NULL;
+
+			if (ukcpvs_id_s)
+				{
+					error_s = MergeData (session_p, values_p, pathogenomics_id_s, ukcpvs_id_s, &selector_p);
+				}		/* if (ukcpvs_id_s) */
+
+			/*
+			 * Storing this row changes the documents for its IDs, so any later
+			 * rows with the same IDs need to look them up again.
+			 */
+			ForgetPrefetchedSample (session_p, pathogenomics_id_s, ukcpvs_id_s);
 
 			if (!error_s)
 				{
 					/*
-					 * The genotype data is keyed by PG_ID_S and the phenotype data is
-					 * keyed by PG_UKCPVS_ID_S. So we need to check for both of these.
-					 *
-					 * If none exist in the db, we can insert as normal.
-					 * If only one of them is set, then we can update as normal.
-					 * If both exist as separate entries, we need to merge them together
-					 * and update with our sample data.
-					 * If both exist on the same entry, then we update as normal.
+					 * Now we insert it into the database as a json_object along with its
+					 * live date
 					 */
-					bool success_flag = true;
-					const char *ukcpvs_id_s = GetJSONString (values_p, PG_UKCPVS_ID_S);
-					json_t *selector_p = NULL;
-
-					if (ukcpvs_id_s)
-						{
-							error_s = MergeData (tool_p, values_p, pathogenomics_id_s, ukcpvs_id_s, &selector_p);
-						}		/* if (ukcpvs_id_s) */
+					json_t *record_p = json_object ();
 
-					if (!error_s)
+					if (record_p)
 						{
-							/*
-							 * Now we insert it into the database as a json_object along with its
-							 * live date
-							 */
-							json_t *record_p = json_object ();
-
-							if (record_p)
+							if (json_object_set (record_p, PG_SAMPLE_S, values_p) == 0)
 								{
-									if (json_object_set (record_p, PG_SAMPLE_S, values_p) == 0)
+									/*
+									 * jansson implementation doesn't appear to be able to have
+									 * things like json_object_get/set where the key allows the
+									 * use of a child key e.g.
+									 *
+									 * 	json_object_get (value_p, "sample.ID")
+									 *
+									 * where value_p has a "sample" child with an "ID entry
+									 *
+									 * So copy the PG_ID_S and PG_UKCPVS_ID_S to the top level
+									 */
+
+									if (json_object_set_new (record_p, PG_ID_S, json_string (pathogenomics_id_s)) == 0)
 										{
-											/*
-											 * jansson implementation doesn't appear to be able to have
-											 * things like json_object_get/set where the key allows the
-											 * use of a child key e.g.
-											 *
-											 * 	json_object_get (value_p, "sample.ID")
-											 *
-											 * where value_p has a "sample" child with an "ID entry
-											 *
-											 * So copy the PG_ID_S and PG_UKCPVS_ID_S to the top level
-											 */
-
-											if (json_object_set_new (record_p, PG_ID_S, json_string (pathogenomics_id_s)) == 0)
+											if (json_object_del (values_p, PG_ID_S) != 0)
 												{
-													if (json_object_del (values_p, PG_ID_S) != 0)
-														{
-															error_s = "Failed to remove PG_ID_S from values";
-														}
+													error_s = "Failed to remove PG_ID_S from values";
+												}
 
-													if (ukcpvs_id_s)
-														{
-															success_flag = (json_object_set_new (record_p, PG_UKCPVS_ID_S, json_string (ukcpvs_id_s)) == 0);
+											if (ukcpvs_id_s)
+												{
+													success_flag = (json_object_set_new (record_p, PG_UKCPVS_ID_S, json_string (ukcpvs_id_s)) == 0);
 
-															if (success_flag)
+													if (success_flag)
+														{
+															if (json_object_del (values_p, PG_UKCPVS_ID_S) != 0)
 																{
-																	if (json_object_del (values_p, PG_UKCPVS_ID_S) != 0)
-																		{
-																			error_s = "Failed to remove PG_UKCPVS_ID_S from values";
-																		}
+																	error_s = "Failed to remove PG_UKCPVS_ID_S from values";
 																}
+														}
 
-														}		/* if (ukcpvs_id_s) */
+												}		/* if (ukcpvs_id_s) */
 
 
-													if (success_flag)
-														{
-															char *date_s = ConcatenateStrings (PG_SAMPLE_S, PG_LIVE_DATE_SUFFIX_S);
+											if (success_flag)
+												{
+													char *date_s = ConcatenateStrings (PG_SAMPLE_S, PG_LIVE_DATE_SUFFIX_S);
 
-															if (date_s)
+													if (date_s)
+														{
+															if (AddPublishDateToJSON (record_p, date_s, session_p -> is_stage_time, true))
 																{
-																	if (AddPublishDateToJSON (record_p, date_s, stage_time, true))
+																	#if SAMPLE_METADATA_DEBUG >= STM_LEVEL_FINE
+																	PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, record_p, "sample json:");
+																	#endif
+
+																	/* If the sample has moved, the tiles for its old location need rebuilding too */
+																	if (session_p -> is_changed_tiles_p)
 																		{
-																			#if SAMPLE_METADATA_DEBUG >= STM_LEVEL_FINE
-																			PrintJSONToLog (STM_LEVEL_FINE, __FILE__, __LINE__, record_p, "sample json:");
-																			#endif
+																			if (!AddStoredMapTiles (session_p, pathogenomics_id_s))
+																				{
+																					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add the map tiles for the stored location of sample %s", pathogenomics_id_s);
+																				}
+																		}
 
-																			error_s = EasyInsertOrUpdateMongoData (tool_p, record_p, PG_ID_S);
+																	error_s = SaveImportedDocument (session_p, record_p, PG_ID_S, row);
 
-																			if ((!error_s) && selector_p)
+																	if ((!error_s) && selector_p)
+																		{
+																			if (RemoveImportedDocument (session_p, selector_p, row) != NULL)
 																				{
-																					if (!RemoveMongoDocuments (tool_p, selector_p, true))
-																						{
-																							error_s = "Failed to remove existing phenotype doc";
-																						}
+																					error_s = "Failed to remove existing phenotype doc";
 																				}
 																		}
-																	else
+
+																	if ((!error_s) && (session_p -> is_changed_ids_p))
 																		{
-																			error_s = "Failed to add current date to sample data";
+																			if (json_object_set_new (session_p -> is_changed_ids_p, GetJSONString (record_p, PG_ID_S), json_true ()) != 0)
+																				{
+																					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add sample %s to the rollups", GetJSONString (record_p, PG_ID_S));
+																				}
 																		}
 
-																	FreeCopiedString (date_s);
+																	if ((!error_s) && (session_p -> is_changed_tiles_p))
+																		{
+																			if (!AddChangedMapTiles (session_p -> is_data_p -> psd_map_tiles_p, session_p -> is_changed_tiles_p, values_p))
+																				{
+																					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add the map tiles for sample %s", GetJSONString (record_p, PG_ID_S));
+																				}
+																		}
 																}
 															else
 																{
-																	error_s = "Failed to make sample date key";
+																	error_s = "Failed to add current date to sample data";
 																}
 
-														}		/* if (success_flag) */
-
-												}		/* if (json_object_set_new (sample_p, PG_ID_S, json_string (pathogenomics_id_s)) == 0) */
-											else
-												{
+															FreeCopiedString (date_s);
+														}
+													else
+														{
+															error_s = "Failed to make sample date key";
+														}
 
-												}
+												}		/* if (success_flag) */
 
-										}		/* if (json_object_set (sample_p, PG_SAMPLE_S, values_p) == 0) */
+										}		/* if (json_object_set_new (sample_p, PG_ID_S, json_string (pathogenomics_id_s)) == 0) */
 									else
 										{
-											error_s = "Failed to add data to parent sample object";
+
 										}
 
-									json_decref (record_p);
-								}		/* if (record_p) */
+								}		/* if (json_object_set (sample_p, PG_SAMPLE_S, values_p) == 0) */
 							else
 								{
-									error_s = "Failed to allocate parent sample object";
+									error_s = "Failed to add data to parent sample object";
 								}
 
-						}		/* if (!error_s) */
+							json_decref (record_p);
+						}		/* if (record_p) */
 					else
 						{
-							error_s = "Failed to merge previous data";
-						}
-
-					if (selector_p)
-						{
-							json_decref (selector_p);
+							error_s = "Failed to allocate parent sample object";
 						}
 
 				}		/* if (!error_s) */
+			else
+				{
+					error_s = "Failed to merge previous data";
+				}
+
+			if (selector_p)
+				{
+					json_decref (selector_p);
+				}
 
 		}		/* if (pathogenomics_id_s) */
 	else
@@ -238,212 +349,168 @@ const char *InsertSampleData (MongoTool *tool_p, json_t *values_p, const uint32
 }
 
 
-bool ConvertDate (json_t *row_p)
+const char *ValidateSampleRow (json_t *values_p, DateNormaliser *normaliser_p)
 {
-	bool success_flag = false;
-	const char *date_s = GetJSONString (row_p, PG_DATE_S);
-	char iso_date_s [11];
-	char raw_date_s [9];
-
-	/* Add the dashes between the year, month and day */
-	* (iso_date_s + 4) = '-';
-	* (iso_date_s + 7) = '-';
-	* (iso_date_s + 10) = '\0';
-	* (raw_date_s + 8) = '\0';
+	const char *error_s = NULL;
 
-	if (date_s)
+	if (GetJSONString (values_p, PG_ID_S))
 		{
-			const size_t date_length = strlen (date_s);
+			error_s = ConvertDate (values_p, normaliser_p);
 
-
-			if ((* (date_s + 2) == '/') && (* (date_s + 5) == '/'))
+			if (!error_s)
 				{
-					bool year_flag = false;
-					const char *part_s = date_s + 6;
-
-					/* Is it DD/MM/YY */
-					if (date_length == 8)
+					if (HasLocationDetails (values_p))
 						{
-							/* year */
-							const char *year_prefix_s = "20";
-
-							memcpy (iso_date_s, year_prefix_s, 2 * sizeof (char));
-							memcpy (iso_date_s, year_prefix_s, 2 * sizeof (char));
+							const char *pathogen_s = GetJSONString (values_p, PG_RUST_S);
 
-							memcpy (iso_date_s + 2, part_s, 2 * sizeof (char));
-							memcpy (raw_date_s + 2, part_s, 2 * sizeof (char));
-
-							year_flag = true;
+							if (pathogen_s && (!GetPathogenName (pathogen_s)))
+								{
+									error_s = "Unknown pathogen";
+								}
 						}
-					/* Is it DD/MM/YYYY */
-					else if (date_length == 10)
+					else
 						{
-							/* year */
-							memcpy (iso_date_s, part_s, 4 * sizeof (char));
-							memcpy (raw_date_s, part_s, 4 * sizeof (char));
-
-							year_flag = true;
+							error_s = "No GPS coordinates or address to locate the sample with";
 						}
 
-					if (year_flag)
-						{
-							/* month */
-							part_s = date_s + 3;
-							memcpy (iso_date_s + 5, part_s, 2 * sizeof (char));
-							memcpy (raw_date_s + 4, part_s, 2 * sizeof (char));
-
-							/* day */
-							memcpy (iso_date_s + 8, date_s, 2 * sizeof (char));
-							memcpy (raw_date_s + 6, date_s, 2 * sizeof (char));
+				}		/* if (!error_s) */
 
-							success_flag = true;
-						}
+		}		/* if (GetJSONString (values_p, PG_ID_S)) */
+	else
+		{
+			error_s = "Could not get pathogenomics id";
+		}
 
-				}		/* if ((* (date_s + 2) == '/') && (* (date_s + 5) == '/')) */
-			else
-				{
-#define NUM_MONTHS (12)
-					const char *months_ss [NUM_MONTHS] = { "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec" };
+	return error_s;
+}
 
-					bool loop_flag = true;
-					uint month_index = 0;
-					uint8 i = 0;
 
-					while (loop_flag)
-						{
-							const char *month_s = * (months_ss + i);
+void PrefetchSampleRows (ImportSession *session_p, const json_t *rows_p)
+{
+	json_t *ukcpvs_ids_p;
 
-							if (Strnicmp (month_s, date_s, strlen (month_s)) == 0)
-								{
-									month_index = i;
-									loop_flag = false;
-								}
-							else
-								{
-									++ i;
+	if (session_p -> is_changed_tiles_p)
+		{
+			PrefetchStoredLocations (session_p, rows_p);
+		}
 
-									if (i == NUM_MONTHS)
-										{
-											loop_flag = false;
-										}
-								}
+	ukcpvs_ids_p = GetMergeableRowValues (rows_p, PG_UKCPVS_ID_S, NULL);
 
-						}		/* while (loop_flag) */
+	if (ukcpvs_ids_p)
+		{
+			if (json_array_size (ukcpvs_ids_p) > 0)
+				{
+					json_t *ukcpvs_matches_p = FetchUKCPVSMatches (session_p -> is_tool_p, ukcpvs_ids_p);
 
-					if (month_index > 0)
+					if (ukcpvs_matches_p)
 						{
-							const char *value_p = date_s + strlen (* (months_ss + month_index));
+							/* We only need the ID counts for the rows with a single UKCPVS match */
+							json_t *ids_p = GetMergeableRowValues (rows_p, PG_ID_S, ukcpvs_matches_p);
+							json_t *id_counts_p = NULL;
 
-							loop_flag = (*value_p != '\0');
+							if (ids_p)
+								{
+									id_counts_p = (json_array_size (ids_p) > 0) ? FetchIdCounts (session_p -> is_tool_p, ids_p) : json_object ();
+									json_decref (ids_p);
+								}
 
-							while (loop_flag)
+							if (InitPrefetchedSamples (session_p))
 								{
-									if (isdigit (*value_p))
+									if (json_object_update (json_object_get (session_p -> is_prefetched_p, PG_UKCPVS_ID_S), ukcpvs_matches_p) != 0)
 										{
-											loop_flag = false;
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to store prefetched UKCPVS ID matches");
 										}
-									else
-										{
-											++ value_p;
 
-											loop_flag = (*value_p != '\0');
+									if (id_counts_p)
+										{
+											if (json_object_update (json_object_get (session_p -> is_prefetched_p, PG_ID_S), id_counts_p) != 0)
+												{
+													PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to store prefetched ID matches");
+												}
 										}
 								}
 
-							if (*value_p != '\0')
-								{
-									/* Do we have a number? */
-									if (isdigit (* (value_p + 1)))
-										{
-											bool match_flag = false;
+							#if SAMPLE_METADATA_DEBUG >= STM_LEVEL_FINE
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Prefetched matches for " SIZET_FMT " UKCPVS IDs and " SIZET_FMT " IDs", json_object_size (ukcpvs_matches_p), id_counts_p ? json_object_size (id_counts_p) : 0);
+							#endif
 
-											/* Do we have a 2 digit year... */
-											if (* (value_p + 2) == '\0')
-												{
-													*iso_date_s = '2';
-													* (iso_date_s + 1) = '0';
-													memcpy (iso_date_s + 2, value_p, 2 * sizeof (char));
+							if (id_counts_p)
+								{
+									json_decref (id_counts_p);
+								}
 
-													*raw_date_s = '2';
-													* (raw_date_s + 1) = '0';
-													memcpy (raw_date_s + 2, value_p, 2 * sizeof (char));
+							json_decref (ukcpvs_matches_p);
+						}		/* if (ukcpvs_matches_p) */
 
-													match_flag = true;
-												}
-											/* ... or a 4 digit one? */
-											else if ((isdigit (* (value_p + 2))) && (isdigit (* (value_p + 3))))
-												{
-													memcpy (iso_date_s, value_p, 4 * sizeof (char));
-													memcpy (raw_date_s, value_p, 4 * sizeof (char));
+				}		/* if (json_array_size (ukcpvs_ids_p) > 0) */
 
-													match_flag = true;
-												}
+			json_decref (ukcpvs_ids_p);
+		}		/* if (ukcpvs_ids_p) */
 
-											if (match_flag)
-												{
-													char month_s [3];
+}
 
-													sprintf (month_s, "%02d", month_index + 1);
 
-													memcpy (iso_date_s + 5, month_s, 2 * sizeof (char));
-													* (iso_date_s + 8) = '0';
-													* (iso_date_s + 9) = '1';
+const char *ConvertDate (json_t *row_p, DateNormaliser *normaliser_p)
+{
+	const char *error_s = NULL;
+	char iso_date_s [PG_ISO_DATE_BUFFER_SIZE];
+	const char *id_s = GetJSONString (row_p, PG_ID_S);
 
-													memcpy (raw_date_s + 4, month_s, 2 * sizeof (char));
-													* (raw_date_s + 6) = '0';
-													* (raw_date_s + 7) = '1';
+	if (!id_s)
+		{
+			id_s = "unknown sample";
+		}
 
-													success_flag = true;
-												}
+	switch (NormaliseRowDate (normaliser_p, row_p, PG_DATE_S, iso_date_s))
+		{
+			case DS_CONVERTED:
+				{
+					char raw_date_s [9];
 
-										}
-								}
-						}		/* if (month_index > 0) */
-				}
+					/* The compact date is the ISO one without the dashes */
+					memcpy (raw_date_s, iso_date_s, 4 * sizeof (char));
+					memcpy (raw_date_s + 4, iso_date_s + 5, 2 * sizeof (char));
+					memcpy (raw_date_s + 6, iso_date_s + 8, 2 * sizeof (char));
+					* (raw_date_s + 8) = '\0';
 
-			if (success_flag)
-				{
 					if (SetDateForSchemaOrg (row_p, PG_DATE_S, iso_date_s))
 						{
 							if (json_object_set_new (row_p, PG_RAW_DATE_S, json_string (raw_date_s)) != 0)
 								{
-									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set raw date to " INT32_FMT, raw_date_s);
-									success_flag = false;
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set raw date to %s", raw_date_s);
+									error_s = "Failed to set compact date";
 								}
 						}
 					else
 						{
 							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to SetDateForSchemaOrge for %s", iso_date_s);
-							success_flag = false;
+							error_s = "Failed to set date";
 						}
 				}
-			else
-				{
-					char *dump_s = json_dumps (row_p, JSON_INDENT (2) | JSON_PRESERVE_ORDER);
-
-					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get date from %s", dump_s);
-
-					free (dump_s);
-				}
+				break;
 
+			case DS_MISSING:
+				PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No date for %s", id_s);
+				error_s = "No collection date";
+				break;
 
-		}		/* if (date_s) */
-	else
-		{
-			char *dump_s = json_dumps (row_p, JSON_INDENT (2) | JSON_PRESERVE_ORDER);
-
-			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No date for %s", date_s, dump_s);
+			default:
+				{
+					const char *date_s = json_string_value (json_object_get (row_p, PG_DATE_S));
 
-			free (dump_s);
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to get date from \"%s\" for %s", date_s ? date_s : "a non-text value", id_s);
+					error_s = "The collection date isn't in one of the recognised forms or isn't a real date";
+				}
+				break;
 		}
 
-	return success_flag;
+	return error_s;
 }
 
 
 
 
-bool GetLocationData (json_t *row_p, const char * const id_s, GrassrootsServer *grassroots_p)
+bool GetLocationData (json_t *row_p, const char * const id_s, PathogenomicsServiceData *data_p, GeocodeCacheStats *stats_p)
 {
 	bool got_location_flag = false;
 	const char *town_s = GetJSONString (row_p, PG_TOWN_S);
@@ -452,37 +519,144 @@ bool GetLocationData (json_t *row_p, const char * const id_s, GrassrootsServer *
 	const char *postcode_s = GetJSONString (row_p, PG_POSTCODE_S);
 	const char *gps_s = GetJSONString (row_p, PG_GPS_S);
 	const char *country_code_s = NULL;
+	GeocodeCache *cache_p = data_p -> psd_geocode_cache_p;
+	char *cache_key_s = NULL;
+	GeocodeCacheResult cache_res = GCR_MISS;
+
+	/*
+	 * If the sample has GPS values that we can parse, or an address that is
+	 * in the gazetteer, we don't need to call the geocoder. Samples with GPS
+	 * values that we can't parse still go to the geocoder rather than the
+	 * gazetteer since a centroid would be less accurate.
+	 */
+	if (!IsStringEmpty (gps_s))
+		{
+			double64 latitude;
+			double64 longitude;
 
-	Address *address_p = AllocateAddress (NULL, NULL, town_s, county_s, country_s, postcode_s, country_code_s, gps_s);
+			if (ParseGPSCoordinate (gps_s, &latitude, &longitude))
+				{
+					got_location_flag = SetLocationFromCoordinates (row_p, id_s, town_s, county_s, country_s, postcode_s, latitude, longitude);
+				}
+		}
+	else if (data_p -> psd_gazetteer_p)
+		{
+			double64 latitude;
+			double64 longitude;
 
-	if (address_p)
+			if (FindInGazetteer (data_p -> psd_gazetteer_p, town_s, county_s, country_s, postcode_s, &latitude, &longitude))
+				{
+					got_location_flag = SetLocationFromCoordinates (row_p, id_s, town_s, county_s, country_s, postcode_s, latitude, longitude);
+				}
+		}
+
+	if ((!got_location_flag) && (cache_p))
 		{
-			if (DetermineGPSLocationForAddress (address_p, NULL, grassroots_p))
+			cache_key_s = MakeGeocodeCacheKey (town_s, county_s, country_s, postcode_s, gps_s);
+
+			if (cache_key_s)
 				{
-					/*
-					 * The address now has GPS coordinates so we need to add the
-					 * appropriate location data to the JSON object.
-					 */
-					if (ConvertAddressToJSON (address_p, row_p))
+					json_t *location_p = NULL;
+
+					cache_res = FindInGeocodeCache (cache_p, cache_key_s, &location_p, stats_p);
+
+					if (cache_res == GCR_FOUND)
 						{
-							got_location_flag = true;
+							if (json_object_update (row_p, location_p) == 0)
+								{
+									got_location_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add cached location for \"%s\"", id_s);
+								}
+
+							json_decref (location_p);
+						}
+					else if (cache_res == GCR_NO_LOCATION)
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "No location for \"%s\", the geocoder previously failed to find \"%s\"", id_s, cache_key_s);
 						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to make geocode cache key for \"%s\"", id_s);
+				}
+
+		}		/* if ((!got_location_flag) && (cache_p)) */
+
+	if ((!got_location_flag) && (cache_res == GCR_MISS))
+		{
+			Address *address_p = AllocateAddress (NULL, NULL, town_s, county_s, country_s, postcode_s, country_code_s, gps_s);
+
+			if (address_p)
+				{
+					GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (data_p -> psd_base_data.sd_service_p);
+
+					if (DetermineGPSLocationForAddress (address_p, NULL, grassroots_p))
+						{
+							/*
+							 * The address now has GPS coordinates so we need to add the
+							 * appropriate location data to the JSON object. This is built
+							 * separately from the row so that it can be cached.
+							 */
+							json_t *location_p = json_object ();
+
+							if (location_p)
+								{
+									if (ConvertAddressToJSON (address_p, location_p))
+										{
+											if (json_object_update (row_p, location_p) == 0)
+												{
+													got_location_flag = true;
+
+													if (cache_key_s)
+														{
+															AddToGeocodeCache (cache_p, cache_key_s, location_p);
+														}
+												}
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "ConvertAddressToJSON failed for \"%s\"", id_s);
+										}
+
+									json_decref (location_p);
+								}		/* if (location_p) */
+
+						}		/* if (DetermineGPSLocationForAddress (address_p)) */
 					else
 						{
-							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "ConvertAddressToJSON failed for \"%s\"", id_s);
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "DetermineGPSLocationForAddress failed for \"%s\"", id_s);
+
+							/*
+							 * The failure may be temporary, such as a quota or network error,
+							 * rather than the address not existing so it is only remembered
+							 * for the cache's negative TTL, which is kept short.
+							 */
+							if (cache_key_s)
+								{
+									AddToGeocodeCache (cache_p, cache_key_s, NULL);
+								}
 						}
 
-				}		/* if (DetermineGPSLocationForAddress (address_p)) */
+					FreeAddress (address_p);
+				}		/* if (address_p) */
 			else
 				{
-					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "DetermineGPSLocationForAddress failed for \"%s\"", id_s);
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate Address for \"%s\"", id_s);
 				}
 
-			FreeAddress (address_p);
-		}		/* if (address_p) */
-	else
+		}		/* if ((!got_location_flag) && (cache_res == GCR_MISS)) */
+
+	if (got_location_flag)
 		{
-			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate Address for \"%s\"", id_s);
+			AddGeoPoint (row_p, id_s);
+		}
+
+	if (cache_key_s)
+		{
+			FreeCopiedString (cache_key_s);
 		}
 
 	return got_location_flag;
@@ -759,17 +933,17 @@ static bool AddSchemaOrgContext (json_t *values_p)
 }
 
 
-static const char *PrepareSampleData (MongoTool *tool_p, json_t *values_p, PathogenomicsServiceData *data_p, const char *pathogenomics_id_s)
+static const char *PrepareSampleData (json_t *values_p, PathogenomicsServiceData *data_p, const char *pathogenomics_id_s, GeocodeCacheStats *geocode_stats_p, DateNormaliser *normaliser_p)
 {
 	const char *error_s = NULL;
 
 	if (AddSchemaOrgContext (values_p))
 		{
-			if (ConvertDate (values_p))
-				{
-					GrassrootsServer *grassroots_p = GetGrassrootsServerFromService (data_p -> psd_base_data.sd_service_p);
+			error_s = ConvertDate (values_p, normaliser_p);
 
-					if (GetLocationData (values_p, pathogenomics_id_s, grassroots_p))
+			if (!error_s)
+				{
+					if (GetLocationData (values_p, pathogenomics_id_s, data_p, geocode_stats_p))
 						{
 							/* convert YR/SR/LR to yellow, stem or leaf rust */
 							if (ReplacePathogen (values_p))
@@ -793,17 +967,13 @@ static const char *PrepareSampleData (MongoTool *tool_p, json_t *values_p, Patho
 									error_s = "Failed to convert pathogen name";
 								}
 
-						}		/* if (GetLocationData (tool_p, values_p, data_p, pathogenomics_id_s)) */
+						}		/* if (GetLocationData (values_p, pathogenomics_id_s, data_p, geocode_stats_p)) */
 					else
 						{
 							error_s = "Failed to add location data into system";
 						}
 
-				}		/* if (ConvertDate (values_p)) */
-			else
-				{
-					error_s = "Could not get date";
-				}
+				}		/* if (!error_s) */
 
 		}		/* if (AddSchemaOrgContext (values_p)) */
 	else
@@ -815,58 +985,570 @@ static const char *PrepareSampleData (MongoTool *tool_p, json_t *values_p, Patho
 }
 
 
-static const char *MergeData (MongoTool *tool_p, json_t *values_p, const char * const pathogenomics_id_s, const char * const ukcpvs_id_s, json_t **selector_pp)
+static const char *MergeData (ImportSession *session_p, json_t *values_p, const char * const pathogenomics_id_s, const char * const ukcpvs_id_s, json_t **selector_pp)
 {
 	const char *error_s = NULL;
-	json_t *ukcpvs_docs_p = NULL;
-	int32 num_ukcpvs_matches = GetAllMongoResultsForKeyValuePair (tool_p, &ukcpvs_docs_p, PG_UKCPVS_ID_S, ukcpvs_id_s, NULL);
+	json_t *ukcpvs_doc_p = NULL;
+	int32 num_ukcpvs_matches = GetUKCPVSMatch (session_p, ukcpvs_id_s, &ukcpvs_doc_p);
 
 	if (num_ukcpvs_matches == 1)
 		{
-			json_t *id_docs_p = NULL;
-			int32 num_id_matches = GetAllMongoResultsForKeyValuePair (tool_p, &id_docs_p, PG_ID_S, pathogenomics_id_s, NULL);
+			int32 num_id_matches = GetIdMatchCount (session_p, pathogenomics_id_s);
 
 			if (num_id_matches == 1)
 				{
 					/* We need to merge the existing documents together and then update the values with the sample data */
-					json_t *ukcpvs_doc_p = json_array_get (ukcpvs_docs_p, 0);
-
 					if (ukcpvs_doc_p)
 						{
-							json_t *id_doc_p = json_array_get (id_docs_p, 0);
+							json_error_t err;
 
-							if (id_doc_p)
+							/* remove the mongodb _id attribute */
+							json_object_del (ukcpvs_doc_p, MONGO_ID_S);
+
+							/*
+							 * After the update call, ukcpvs_id_s will go out of scope so store its value.
+							 * The merged record will also have this UKCPVS ID so make sure that it is
+							 * only the separate phenotype document that gets removed, as the removal may
+							 * be run as part of an unordered bulk operation.
+							 */
+							*selector_pp = json_pack_ex (&err, 0, "{s:s,s:{s:s}}", PG_UKCPVS_ID_S, ukcpvs_id_s, PG_ID_S, "$ne", pathogenomics_id_s);
+
+							if (*selector_pp)
 								{
-									json_error_t err;
+									/* Update our sample data with the values from ukcpvs_id_p */
+									if (!json_object_update (values_p, ukcpvs_doc_p) == 0)
+										{
+											error_s = "Failed to merge ukcpvs_id-based data with our sample data";
+										}
+								}
+							else
+								{
+									error_s = "Failed to store ukcpvs_id-based data for merging";
+								}
+
+						}		/* if (ukcpvs_doc_p) */
+
+				}		/* if (num_id_matches == 1) */
+
+		}		/* if (num_ukcpvs_matches == 1) */
+
+	if (ukcpvs_doc_p)
+		{
+			json_decref (ukcpvs_doc_p);
+		}
+
+	return error_s;
+}
+
+
+/*
+ * Get the number of documents with a UKCPVS ID and, if there is only
+ * one, a new reference to it. The prefetched matches are used if there
+ * are any, otherwise the database is queried.
+ */
+static int32 GetUKCPVSMatch (ImportSession *session_p, const char * const ukcpvs_id_s, json_t **doc_pp)
+{
+	int32 num_matches;
+	json_t *entry_p = GetPrefetchedEntry (session_p, PG_UKCPVS_ID_S, ukcpvs_id_s);
+
+	if (entry_p)
+		{
+			num_matches = (int32) json_integer_value (json_object_get (entry_p, S_PREFETCH_COUNT_S));
+
+			if (num_matches == 1)
+				{
+					*doc_pp = json_object_get (entry_p, S_PREFETCH_DOC_S);
+
+					if (*doc_pp)
+						{
+							json_incref (*doc_pp);
+						}
+				}
+		}
+	else
+		{
+			json_t *docs_p = NULL;
+
+			num_matches = GetAllMongoResultsForKeyValuePair (session_p -> is_tool_p, &docs_p, PG_UKCPVS_ID_S, ukcpvs_id_s, NULL);
+
+			if (docs_p)
+				{
+					if (num_matches == 1)
+						{
+							*doc_pp = json_array_get (docs_p, 0);
+
+							if (*doc_pp)
+								{
+									json_incref (*doc_pp);
+								}
+						}
+
+					json_decref (docs_p);
+				}
+		}
+
+	return num_matches;
+}
 
-									/* remove the mongodb _id attribute */
-									json_object_del (ukcpvs_doc_p, MONGO_ID_S);
 
-									/* after the update call, ukcpvs_id_s will go out of scope so store its value */
-									*selector_pp = json_pack_ex (&err, 0, "{s:s}", PG_UKCPVS_ID_S, ukcpvs_id_s);
+static int32 GetIdMatchCount (ImportSession *session_p, const char * const pathogenomics_id_s)
+{
+	int32 num_matches;
+	json_t *entry_p = GetPrefetchedEntry (session_p, PG_ID_S, pathogenomics_id_s);
+
+	if (entry_p)
+		{
+			num_matches = (int32) json_integer_value (entry_p);
+		}
+	else
+		{
+			json_t *docs_p = NULL;
+
+			num_matches = GetAllMongoResultsForKeyValuePair (session_p -> is_tool_p, &docs_p, PG_ID_S, pathogenomics_id_s, NULL);
+
+			if (docs_p)
+				{
+					json_decref (docs_p);
+				}
+		}
+
+	return num_matches;
+}
+
+
+static json_t *GetPrefetchedEntry (ImportSession *session_p, const char * const key_s, const char * const value_s)
+{
+	json_t *entry_p = NULL;
+
+	if (session_p -> is_prefetched_p)
+		{
+			json_t *entries_p = json_object_get (session_p -> is_prefetched_p, key_s);
+
+			if (entries_p)
+				{
+					entry_p = json_object_get (entries_p, value_s);
+				}
+		}
+
+	return entry_p;
+}
+
+
+static void ForgetPrefetchedSample (ImportSession *session_p, const char * const pathogenomics_id_s, const char * const ukcpvs_id_s)
+{
+	if (session_p -> is_prefetched_p)
+		{
+			json_t *entries_p = json_object_get (session_p -> is_prefetched_p, PG_ID_S);
+
+			if (entries_p)
+				{
+					json_object_del (entries_p, pathogenomics_id_s);
+				}
+
+			if (ukcpvs_id_s)
+				{
+					entries_p = json_object_get (session_p -> is_prefetched_p, PG_UKCPVS_ID_S);
+
+					if (entries_p)
+						{
+							json_object_del (entries_p, ukcpvs_id_s);
+						}
+				}
+		}
+}
+
+
+/*
+ * Create the store of prefetched sample matches if it doesn't exist yet.
+ */
+static bool InitPrefetchedSamples (ImportSession *session_p)
+{
+	if (!session_p -> is_prefetched_p)
+		{
+			json_error_t err;
 
-									if (*selector_pp)
+			session_p -> is_prefetched_p = json_pack_ex (&err, 0, "{s:{},s:{},s:{}}", PG_UKCPVS_ID_S, PG_ID_S, S_PREFETCH_LOCATIONS_S);
+
+			if (!session_p -> is_prefetched_p)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to allocate prefetched sample matches: %s", err.text);
+				}
+		}
+
+	return (session_p -> is_prefetched_p != NULL);
+}
+
+
+/*
+ * Get the stored locations of a batch of rows' samples with a single query
+ * so that the tiles that they are moving from can be found without going
+ * back to the database for each row.
+ */
+static void PrefetchStoredLocations (ImportSession *session_p, const json_t *rows_p)
+{
+	json_t *ids_p = json_array ();
+
+	if (ids_p)
+		{
+			size_t i;
+			json_t *row_p;
+			bool success_flag = true;
+
+			json_array_foreach (rows_p, i, row_p)
+				{
+					const char *id_s = GetJSONString (row_p, PG_ID_S);
+
+					if (id_s)
+						{
+							if (json_array_append_new (ids_p, json_string (id_s)) != 0)
+								{
+									success_flag = false;
+									break;
+								}
+						}
+				}
+
+			if (success_flag && (json_array_size (ids_p) > 0))
+				{
+					json_t *locations_p = FetchStoredLocations (session_p -> is_tool_p, ids_p);
+
+					if (locations_p)
+						{
+							if (InitPrefetchedSamples (session_p))
+								{
+									if (json_object_update (json_object_get (session_p -> is_prefetched_p, S_PREFETCH_LOCATIONS_S), locations_p) != 0)
 										{
-											/* Update our sample data with the values from ukcpvs_id_p */
-											if (!json_object_update (values_p, ukcpvs_doc_p) == 0)
+											PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to store prefetched sample locations");
+										}
+								}
+
+							json_decref (locations_p);
+						}
+				}
+
+			json_decref (ids_p);
+		}		/* if (ids_p) */
+}
+
+
+/*
+ * Add the map tiles that contain the stored location of a sample to
+ * the session's changed tiles, using the prefetched location if there
+ * is one.
+ */
+static bool AddStoredMapTiles (ImportSession *session_p, const char * const pathogenomics_id_s)
+{
+	bool success_flag = false;
+	json_t *stored_p = GetPrefetchedEntry (session_p, S_PREFETCH_LOCATIONS_S, pathogenomics_id_s);
+
+	if (stored_p)
+		{
+			json_incref (stored_p);
+		}
+	else
+		{
+			json_t *ids_p = json_pack ("[s]", pathogenomics_id_s);
+
+			if (ids_p)
+				{
+					json_t *locations_p = FetchStoredLocations (session_p -> is_tool_p, ids_p);
+
+					if (locations_p)
+						{
+							stored_p = json_incref (json_object_get (locations_p, pathogenomics_id_s));
+							json_decref (locations_p);
+						}
+
+					json_decref (ids_p);
+				}
+		}
+
+	if (stored_p)
+		{
+			success_flag = json_is_object (stored_p) ? AddChangedMapTiles (session_p -> is_data_p -> psd_map_tiles_p, session_p -> is_changed_tiles_p, stored_p) : true;
+			json_decref (stored_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Get the stored sample, with just its GeoJSON point, for each of a set
+ * of IDs, or null for those that haven't been stored yet.
+ */
+static json_t *FetchStoredLocations (MongoTool *tool_p, json_t *ids_p)
+{
+	json_t *locations_p = NULL;
+	char *geo_s = ConcatenateVarargsStrings (PG_SAMPLE_S, ".", PG_GEO_S, NULL);
+
+	if (geo_s)
+		{
+			const char *fields_ss [] = { PG_ID_S, geo_s, NULL };
+			json_t *docs_p = FindDocumentsWithValues (tool_p, PG_ID_S, ids_p, fields_ss);
+
+			if (docs_p)
+				{
+					locations_p = json_object ();
+
+					if (locations_p)
+						{
+							size_t i;
+							json_t *value_p;
+
+							json_array_foreach (ids_p, i, value_p)
+								{
+									if (json_object_set_new (locations_p, json_string_value (value_p), json_null ()) != 0)
+										{
+											json_decref (locations_p);
+											locations_p = NULL;
+											break;
+										}
+								}
+
+							if (locations_p)
+								{
+									json_array_foreach (docs_p, i, value_p)
+										{
+											const char *id_s = GetJSONString (value_p, PG_ID_S);
+											json_t *sample_p = json_object_get (value_p, PG_SAMPLE_S);
+
+											if (id_s && sample_p)
 												{
-													error_s = "Failed to merge ukcpvs_id-based data with our sample data";
+													if (json_object_set (locations_p, id_s, sample_p) != 0)
+														{
+															json_decref (locations_p);
+															locations_p = NULL;
+															break;
+														}
 												}
 										}
-									else
+								}
+
+						}		/* if (locations_p) */
+
+					json_decref (docs_p);
+				}		/* if (docs_p) */
+
+			FreeCopiedString (geo_s);
+		}		/* if (geo_s) */
+
+	return locations_p;
+}
+
+
+/*
+ * Get the distinct values of a key for the rows that may need merging,
+ * i.e. those with both an ID and a UKCPVS ID. If ukcpvs_matches_p is
+ * given, only the rows whose UKCPVS ID matches a single document are used.
+ */
+static json_t *GetMergeableRowValues (const json_t *rows_p, const char * const key_s, const json_t *ukcpvs_matches_p)
+{
+	json_t *values_p = json_array ();
+
+	if (values_p)
+		{
+			json_t *seen_p = json_object ();
+
+			if (seen_p)
+				{
+					size_t i;
+					json_t *row_p;
+
+					json_array_foreach (rows_p, i, row_p)
+						{
+							const char *ukcpvs_id_s = GetJSONString (row_p, PG_UKCPVS_ID_S);
+
+							if (ukcpvs_id_s && GetJSONString (row_p, PG_ID_S))
+								{
+									const char *value_s = GetJSONString (row_p, key_s);
+									bool add_flag = true;
+
+									if (ukcpvs_matches_p)
 										{
-											error_s = "Failed to store ukcpvs_id-based data for merging";
+											json_t *entry_p = json_object_get (ukcpvs_matches_p, ukcpvs_id_s);
+
+											add_flag = (entry_p && (json_integer_value (json_object_get (entry_p, S_PREFETCH_COUNT_S)) == 1));
 										}
 
-								}		/* if (id_doc_p) */
+									if (add_flag && (!json_object_get (seen_p, value_s)))
+										{
+											if ((json_object_set (seen_p, value_s, json_true ()) != 0) || (json_array_append_new (values_p, json_string (value_s)) != 0))
+												{
+													json_decref (values_p);
+													values_p = NULL;
+													break;
+												}
+										}
+								}
+						}		/* json_array_foreach (rows_p, i, row_p) */
 
-						}		/* if (ukcpvs_doc_p) */
+					json_decref (seen_p);
+				}		/* if (seen_p) */
+			else
+				{
+					json_decref (values_p);
+					values_p = NULL;
+				}
 
-				}		/* if (num_id_matches == 1) */
+		}		/* if (values_p) */
 
-		}		/* if (num_ukcpvs_matches == 1) */
+	return values_p;
+}
 
-	return error_s;
+
+/*
+ * Get the number of documents for each of a set of UKCPVS IDs along with
+ * the document itself for those with exactly one.
+ */
+static json_t *FetchUKCPVSMatches (MongoTool *tool_p, json_t *ukcpvs_ids_p)
+{
+	json_t *matches_p = NULL;
+	json_t *docs_p = FindDocumentsWithValues (tool_p, PG_UKCPVS_ID_S, ukcpvs_ids_p, NULL);
+
+	if (docs_p)
+		{
+			matches_p = json_object ();
+
+			if (matches_p)
+				{
+					size_t i;
+					json_t *value_p;
+
+					json_array_foreach (ukcpvs_ids_p, i, value_p)
+						{
+							if (json_object_set_new (matches_p, json_string_value (value_p), json_pack ("{s:i}", S_PREFETCH_COUNT_S, 0)) != 0)
+								{
+									json_decref (matches_p);
+									matches_p = NULL;
+									break;
+								}
+						}
+
+					if (matches_p)
+						{
+							json_t *doc_p;
+
+							json_array_foreach (docs_p, i, doc_p)
+								{
+									const char *ukcpvs_id_s = GetJSONString (doc_p, PG_UKCPVS_ID_S);
+									json_t *entry_p = ukcpvs_id_s ? json_object_get (matches_p, ukcpvs_id_s) : NULL;
+
+									if (entry_p)
+										{
+											const json_int_t count = json_integer_value (json_object_get (entry_p, S_PREFETCH_COUNT_S)) + 1;
+
+											json_object_set_new (entry_p, S_PREFETCH_COUNT_S, json_integer (count));
+
+											if (count == 1)
+												{
+													json_object_set (entry_p, S_PREFETCH_DOC_S, doc_p);
+												}
+											else
+												{
+													json_object_del (entry_p, S_PREFETCH_DOC_S);
+												}
+										}
+								}
+						}
+
+				}		/* if (matches_p) */
+
+			json_decref (docs_p);
+		}		/* if (docs_p) */
+
+	return matches_p;
+}
+
+
+/*
+ * Get the number of documents for each of a set of IDs.
+ */
+static json_t *FetchIdCounts (MongoTool *tool_p, json_t *ids_p)
+{
+	json_t *counts_p = NULL;
+	const char *fields_ss [] = { PG_ID_S, NULL };
+	json_t *docs_p = FindDocumentsWithValues (tool_p, PG_ID_S, ids_p, fields_ss);
+
+	if (docs_p)
+		{
+			counts_p = json_object ();
+
+			if (counts_p)
+				{
+					size_t i;
+					json_t *value_p;
+
+					json_array_foreach (ids_p, i, value_p)
+						{
+							if (json_object_set_new (counts_p, json_string_value (value_p), json_integer (0)) != 0)
+								{
+									json_decref (counts_p);
+									counts_p = NULL;
+									break;
+								}
+						}
+
+					if (counts_p)
+						{
+							json_t *doc_p;
+
+							json_array_foreach (docs_p, i, doc_p)
+								{
+									const char *id_s = GetJSONString (doc_p, PG_ID_S);
+									json_t *count_p = id_s ? json_object_get (counts_p, id_s) : NULL;
+
+									if (count_p)
+										{
+											json_integer_set (count_p, json_integer_value (count_p) + 1);
+										}
+								}
+						}
+
+				}		/* if (counts_p) */
+
+			json_decref (docs_p);
+		}		/* if (docs_p) */
+
+	return counts_p;
+}
+
+
+/*
+ * Get all of the documents where the given key has any of the given values.
+ * This returns NULL if the query failed.
+ */
+static json_t *FindDocumentsWithValues (MongoTool *tool_p, const char * const key_s, json_t *values_p, const char **fields_ss)
+{
+	json_t *docs_p = NULL;
+	json_error_t err;
+	json_t *query_p = json_pack_ex (&err, 0, "{s:{s:O}}", key_s, "$in", values_p);
+
+	if (query_p)
+		{
+			if (FindMatchingMongoDocumentsByJSON (tool_p, query_p, fields_ss, NULL))
+				{
+					docs_p = GetAllExistingMongoResultsAsJSON (tool_p);
+
+					/* No results is an empty array rather than a failure */
+					if (!docs_p)
+						{
+							docs_p = json_array ();
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to find documents by \"%s\"", key_s);
+				}
+
+			json_decref (query_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create query for \"%s\": %s", key_s, err.text);
+		}
+
+	return docs_p;
 }
 
 
@@ -1102,26 +1784,91 @@ bool RefineLocationDataForOpenCage (PathogenomicsServiceData *service_data_p, js
 }
 
 
-static bool ReplacePathogen (json_t *data_p)
+static bool SetLocationFromCoordinates (json_t *row_p, const char * const id_s, const char *town_s, const char *county_s, const char *country_s, const char *postcode_s, const double64 latitude, const double64 longitude)
 {
-	bool success_flag = true;
-	const char *value_s = NULL;
-	const char *pathogen_s = GetJSONString (data_p, PG_RUST_S);
+	bool got_location_flag = false;
+	Address *address_p = AllocateAddress (NULL, NULL, town_s, county_s, country_s, postcode_s, NULL, NULL);
 
-	if (pathogen_s)
+	if (address_p)
 		{
-			if ((strcmp ("YR", pathogen_s) == 0) || (strcmp ("Yellow Rust", pathogen_s) == 0))
+			if (SetAddressCentreCoordinate (address_p, latitude, longitude, NULL))
 				{
-					value_s = "Yellow Rust";
+					if (ConvertAddressToJSON (address_p, row_p))
+						{
+							got_location_flag = true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "ConvertAddressToJSON failed for \"%s\"", id_s);
+						}
 				}
-			else if ((strcmp ("SR", pathogen_s) == 0) || (strcmp ("Stem Rust", pathogen_s) == 0))
+			else
 				{
-					value_s = "Stem Rust";
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to set location %f, %f for \"%s\"", latitude, longitude, id_s);
 				}
-			else if ((strcmp ("LR", pathogen_s) == 0) || (strcmp ("Leaf Rust", pathogen_s) == 0))
+
+			FreeAddress (address_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to allocate Address for \"%s\"", id_s);
+		}
+
+	return got_location_flag;
+}
+
+
+/*
+ * Add the sample's location as a GeoJSON point so that it can be
+ * geospatially indexed.
+ */
+static bool AddGeoPoint (json_t *row_p, const char * const id_s)
+{
+	bool success_flag = false;
+	double64 latitude;
+	double64 longitude;
+
+	if (FindLocationCoordinates (row_p, &latitude, &longitude))
+		{
+			if ((latitude >= -90.0) && (latitude <= 90.0) && (longitude >= -180.0) && (longitude <= 180.0))
 				{
-					value_s = "Leaf Rust";
+					json_error_t err;
+					json_t *point_p = json_pack_ex (&err, 0, "{s:s,s:[f,f]}", "type", "Point", "coordinates", longitude, latitude);
+
+					if (point_p)
+						{
+							if (json_object_set_new (row_p, PG_GEO_S, point_p) == 0)
+								{
+									success_flag = true;
+								}
+							else
+								{
+									PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to add GeoJSON point for \"%s\"", id_s);
+								}
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create GeoJSON point for \"%s\": %s", id_s, err.text);
+						}
 				}
+			else
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Location %f, %f for \"%s\" is out of range", latitude, longitude, id_s);
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool ReplacePathogen (json_t *data_p)
+{
+	bool success_flag = true;
+	const char *pathogen_s = GetJSONString (data_p, PG_RUST_S);
+
+	if (pathogen_s)
+		{
+			const char *value_s = GetPathogenName (pathogen_s);
 
 			if (value_s)
 				{
@@ -1147,3 +1894,59 @@ static bool ReplacePathogen (json_t *data_p)
 	return success_flag;
 }
 
+
+/*
+ * Get the full name for a pathogen's code, e.g. YR for Yellow Rust,
+ * or NULL if it isn't one that we know.
+ */
+static const char *GetPathogenName (const char *pathogen_s)
+{
+	const char *value_s = NULL;
+
+	if ((strcmp ("YR", pathogen_s) == 0) || (strcmp ("Yellow Rust", pathogen_s) == 0))
+		{
+			value_s = "Yellow Rust";
+		}
+	else if ((strcmp ("SR", pathogen_s) == 0) || (strcmp ("Stem Rust", pathogen_s) == 0))
+		{
+			value_s = "Stem Rust";
+		}
+	else if ((strcmp ("LR", pathogen_s) == 0) || (strcmp ("Leaf Rust", pathogen_s) == 0))
+		{
+			value_s = "Leaf Rust";
+		}
+
+	return value_s;
+}
+
+
+/*
+ * Check, without geocoding, that a sample has either GPS coordinates
+ * that we can parse or an address that the geocoder could look up.
+ */
+static bool HasLocationDetails (const json_t *row_p)
+{
+	bool location_flag = false;
+	const char *gps_s = GetJSONString (row_p, PG_GPS_S);
+
+	if (!IsStringEmpty (gps_s))
+		{
+			double64 latitude;
+			double64 longitude;
+
+			location_flag = ParseGPSCoordinate (gps_s, &latitude, &longitude);
+		}
+
+	if (!location_flag)
+		{
+			const char *keys_ss [] = { PG_TOWN_S, PG_COUNTY_S, PG_COUNTRY_S, PG_POSTCODE_S, NULL };
+			const char **key_ss;
+
+			for (key_ss = keys_ss; (*key_ss) && (!location_flag); ++ key_ss)
+				{
+					location_flag = !IsStringEmpty (GetJSONString (row_p, *key_ss));
+				}
+		}
+
+	return location_flag;
+}
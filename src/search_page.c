@@ -0,0 +1,578 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * search_page.c
+ *
+ */
+
+#include <string.h>
+
+#include "search_page.h"
+#include "aggregation_utils.h"
+#include "memory_allocations.h"
+#include "string_utils.h"
+#include "json_util.h"
+#include "mongodb_tool.h"
+#include "streams.h"
+
+
+static const char * const S_LIMIT_S = "limit";
+
+static const char * const S_SKIP_S = "skip";
+
+static const char * const S_SORT_S = "sort";
+
+/* The keys within a decoded continuation token */
+static const char * const S_TOKEN_SORT_S = "sort";
+
+static const char * const S_TOKEN_AFTER_S = "after";
+
+/* The field added to each document to hold its sort key values */
+static const char * const S_PAGE_KEY_S = "_page";
+
+
+static bool GetCount (const json_t *search_p, const char *key_s, uint32 *value_p);
+
+static json_t *GetSortOrder (const json_t *sort_p);
+
+static json_t *GetAfterQuery (const SearchPage *page_p);
+
+static json_t *GetSortKeyExpression (const json_t *sort_p);
+
+static char *EncodeToken (const json_t *token_p);
+
+static json_t *DecodeToken (const char *token_s);
+
+static int GetHexValue (const char c);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+bool InitSearchPage (SearchPage *page_p, const json_t *search_p, const uint32 max_limit, const char **error_ss)
+{
+	uint32 limit = 0;
+	const char *token_s = GetJSONString (search_p, PG_CONTINUATION_S);
+	const json_t *sort_p = json_object_get (search_p, S_SORT_S);
+	json_t *token_p = NULL;
+
+	page_p -> sp_sort_p = NULL;
+	page_p -> sp_after_p = NULL;
+	page_p -> sp_skip = 0;
+	page_p -> sp_limit = max_limit;
+
+	if (!GetCount (search_p, S_LIMIT_S, &limit))
+		{
+			*error_ss = "\"limit\" must be a non-negative integer";
+			return false;
+		}
+
+	if ((limit > 0) && ((max_limit == 0) || (limit < max_limit)))
+		{
+			page_p -> sp_limit = limit;
+		}
+
+	if (!GetCount (search_p, S_SKIP_S, & (page_p -> sp_skip)))
+		{
+			*error_ss = "\"skip\" must be a non-negative integer";
+			return false;
+		}
+
+	if (token_s)
+		{
+			token_p = DecodeToken (token_s);
+
+			if (!token_p)
+				{
+					*error_ss = "Invalid continuation token";
+					return false;
+				}
+
+			/* Without a sort order of its own, the request carries on with the token's */
+			if (!sort_p)
+				{
+					sort_p = json_object_get (token_p, S_TOKEN_SORT_S);
+				}
+		}
+
+	if (sort_p)
+		{
+			page_p -> sp_sort_p = GetSortOrder (sort_p);
+
+			if (!page_p -> sp_sort_p)
+				{
+					*error_ss = "\"sort\" must be an object of field names with values of 1 or -1";
+				}
+		}
+	else
+		{
+			page_p -> sp_sort_p = json_pack ("{s:i}", MONGO_ID_S, 1);
+
+			if (!page_p -> sp_sort_p)
+				{
+					*error_ss = "Failed to create sort order";
+				}
+		}
+
+	if ((page_p -> sp_sort_p) && (token_p))
+		{
+			json_t *after_p = json_object_get (token_p, S_TOKEN_AFTER_S);
+
+			if (!json_equal (page_p -> sp_sort_p, json_object_get (token_p, S_TOKEN_SORT_S)))
+				{
+					*error_ss = "The continuation token is for a different sort order";
+				}
+			else if ((!json_is_array (after_p)) || (json_array_size (after_p) != json_object_size (page_p -> sp_sort_p)))
+				{
+					*error_ss = "Invalid continuation token";
+				}
+			else
+				{
+					page_p -> sp_after_p = json_incref (after_p);
+				}
+
+			if (!page_p -> sp_after_p)
+				{
+					json_decref (page_p -> sp_sort_p);
+					page_p -> sp_sort_p = NULL;
+				}
+		}
+
+	if (token_p)
+		{
+			json_decref (token_p);
+		}
+
+	return (page_p -> sp_sort_p != NULL);
+}
+
+
+void ClearSearchPage (SearchPage *page_p)
+{
+	if (page_p -> sp_sort_p)
+		{
+			json_decref (page_p -> sp_sort_p);
+			page_p -> sp_sort_p = NULL;
+		}
+
+	if (page_p -> sp_after_p)
+		{
+			json_decref (page_p -> sp_after_p);
+			page_p -> sp_after_p = NULL;
+		}
+}
+
+
+bool AddSearchPageStartStages (const SearchPage *page_p, json_t *stages_p)
+{
+	bool success_flag = true;
+
+	if (page_p -> sp_after_p)
+		{
+			success_flag = AddAggregationStage (stages_p, "$match", GetAfterQuery (page_p));
+		}
+
+	if (success_flag)
+		{
+			if (AddAggregationStage (stages_p, "$sort", json_incref (page_p -> sp_sort_p)))
+				{
+					json_t *key_p = json_object ();
+
+					if (key_p)
+						{
+							if (json_object_set_new (key_p, S_PAGE_KEY_S, GetSortKeyExpression (page_p -> sp_sort_p)) != 0)
+								{
+									json_decref (key_p);
+									key_p = NULL;
+								}
+						}
+
+					success_flag = AddAggregationStage (stages_p, "$addFields", key_p);
+				}
+			else
+				{
+					success_flag = false;
+				}
+		}
+
+	return success_flag;
+}
+
+
+bool AddSearchPageEndStages (const SearchPage *page_p, json_t *stages_p)
+{
+	bool success_flag = true;
+
+	if (page_p -> sp_skip > 0)
+		{
+			success_flag = AddAggregationStage (stages_p, "$skip", json_integer (page_p -> sp_skip));
+		}
+
+	if ((success_flag) && (page_p -> sp_limit > 0))
+		{
+			success_flag = AddAggregationStage (stages_p, "$limit", json_integer (page_p -> sp_limit));
+		}
+
+	return success_flag;
+}
+
+
+const char *GetSearchPageKeyField (void)
+{
+	return S_PAGE_KEY_S;
+}
+
+
+char *FinishSearchPage (const SearchPage *page_p, json_t *docs_p)
+{
+	char *token_s = NULL;
+	json_t *last_key_p = NULL;
+	size_t i;
+	json_t *doc_p;
+
+	json_array_foreach (docs_p, i, doc_p)
+		{
+			json_t *key_p = json_object_get (doc_p, S_PAGE_KEY_S);
+
+			if (key_p)
+				{
+					if (last_key_p)
+						{
+							json_decref (last_key_p);
+						}
+
+					last_key_p = json_incref (key_p);
+					json_object_del (doc_p, S_PAGE_KEY_S);
+				}
+		}
+
+	/* A full page means that there may be more to come */
+	if ((last_key_p) && (page_p -> sp_limit > 0) && (json_array_size (docs_p) == page_p -> sp_limit))
+		{
+			json_t *token_p = json_pack ("{s:O,s:O}", S_TOKEN_SORT_S, page_p -> sp_sort_p, S_TOKEN_AFTER_S, last_key_p);
+
+			if (token_p)
+				{
+					token_s = EncodeToken (token_p);
+					json_decref (token_p);
+				}
+
+			if (!token_s)
+				{
+					PrintErrors (STM_LEVEL_WARNING, __FILE__, __LINE__, "Failed to create continuation token");
+				}
+		}
+
+	if (last_key_p)
+		{
+			json_decref (last_key_p);
+		}
+
+	return token_s;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+static bool GetCount (const json_t *search_p, const char *key_s, uint32 *value_p)
+{
+	const json_t *count_p = json_object_get (search_p, key_s);
+
+	if (count_p)
+		{
+			if (json_is_integer (count_p) && (json_integer_value (count_p) >= 0) && (json_integer_value (count_p) <= UINT32_MAX))
+				{
+					*value_p = (uint32) json_integer_value (count_p);
+				}
+			else
+				{
+					return false;
+				}
+		}
+
+	return true;
+}
+
+
+/*
+ * Copy and check the requested sort order, adding the MongoDB id as
+ * the final key if it isn't already there.
+ */
+static json_t *GetSortOrder (const json_t *sort_p)
+{
+	json_t *order_p = NULL;
+
+	if (json_is_object (sort_p) && (json_object_size (sort_p) > 0))
+		{
+			order_p = json_object ();
+
+			if (order_p)
+				{
+					const char *key_s;
+					json_t *value_p;
+
+					json_object_foreach ((json_t *) sort_p, key_s, value_p)
+						{
+							if ((*key_s != '$') && (strcmp (key_s, S_PAGE_KEY_S) != 0) && json_is_integer (value_p) &&
+									((json_integer_value (value_p) == 1) || (json_integer_value (value_p) == -1)))
+								{
+									if (json_object_set_new (order_p, key_s, json_integer (json_integer_value (value_p))) != 0)
+										{
+											json_decref (order_p);
+											return NULL;
+										}
+								}
+							else
+								{
+									json_decref (order_p);
+									return NULL;
+								}
+						}
+
+					if (!json_object_get (order_p, MONGO_ID_S))
+						{
+							if (json_object_set_new (order_p, MONGO_ID_S, json_integer (1)) != 0)
+								{
+									json_decref (order_p);
+									order_p = NULL;
+								}
+						}
+				}
+		}
+
+	return order_p;
+}
+
+
+/*
+ * Match the documents that come after the previous page's last document
+ * in the sort order. For a sort on a, b and _id this is
+ *
+ * 	{ "$or": [ { a: { $gt: a0 } }, { a: a0, b: { $gt: b0 } }, { a: a0, b: b0, _id: { $gt: id0 } } ] }
+ *
+ * with $lt used instead for the descending keys.
+ */
+static json_t *GetAfterQuery (const SearchPage *page_p)
+{
+	json_t *clauses_p = json_array ();
+
+	if (clauses_p)
+		{
+			const size_t num_keys = json_object_size (page_p -> sp_sort_p);
+			size_t i;
+
+			for (i = 0; i < num_keys; ++ i)
+				{
+					json_t *clause_p = json_object ();
+					void *iter_p = json_object_iter (page_p -> sp_sort_p);
+					size_t j;
+
+					if (!clause_p)
+						{
+							json_decref (clauses_p);
+							return NULL;
+						}
+
+					for (j = 0; j <= i; ++ j)
+						{
+							const char *key_s = json_object_iter_key (iter_p);
+							json_t *value_p = json_array_get (page_p -> sp_after_p, j);
+							int res;
+
+							if (j < i)
+								{
+									res = json_object_set (clause_p, key_s, value_p);
+								}
+							else
+								{
+									const char *op_s = (json_integer_value (json_object_iter_value (iter_p)) > 0) ? "$gt" : "$lt";
+
+									res = json_object_set_new (clause_p, key_s, json_pack ("{s:O}", op_s, value_p));
+								}
+
+							if (res != 0)
+								{
+									json_decref (clause_p);
+									json_decref (clauses_p);
+									return NULL;
+								}
+
+							iter_p = json_object_iter_next (page_p -> sp_sort_p, iter_p);
+						}
+
+					if (json_array_append_new (clauses_p, clause_p) != 0)
+						{
+							json_decref (clauses_p);
+							return NULL;
+						}
+				}		/* for (i = 0; i < num_keys; ++ i) */
+
+			return json_pack ("{s:o}", "$or", clauses_p);
+		}		/* if (clauses_p) */
+
+	return NULL;
+}
+
+
+/*
+ * An array of the field paths of the sort keys, e.g. [ "$a", "$b", "$_id" ]
+ */
+static json_t *GetSortKeyExpression (const json_t *sort_p)
+{
+	json_t *expression_p = json_array ();
+
+	if (expression_p)
+		{
+			const char *key_s;
+			json_t *value_p;
+
+			json_object_foreach ((json_t *) sort_p, key_s, value_p)
+				{
+					char *path_s = ConcatenateStrings ("$", key_s);
+
+					if ((!path_s) || (json_array_append_new (expression_p, json_string (path_s)) != 0))
+						{
+							if (path_s)
+								{
+									FreeCopiedString (path_s);
+								}
+
+							json_decref (expression_p);
+							return NULL;
+						}
+
+					FreeCopiedString (path_s);
+				}
+		}
+
+	return expression_p;
+}
+
+
+/*
+ * The token is the hex-encoded compact JSON of the sort order and the
+ * last sort key. The values are in MongoDB extended JSON so that ids
+ * and dates keep their types when the token is used.
+ */
+static char *EncodeToken (const json_t *token_p)
+{
+	char *token_s = NULL;
+	char *value_s = json_dumps (token_p, JSON_COMPACT);
+
+	if (value_s)
+		{
+			const size_t length = strlen (value_s);
+
+			token_s = (char *) AllocMemory ((2 * length) + 1);
+
+			if (token_s)
+				{
+					static const char * const S_HEX_DIGITS_S = "0123456789abcdef";
+					const unsigned char *src_p = (const unsigned char *) value_s;
+					char *dest_p = token_s;
+
+					while (*src_p)
+						{
+							*dest_p ++ = S_HEX_DIGITS_S [(*src_p) >> 4];
+							*dest_p ++ = S_HEX_DIGITS_S [(*src_p) & 0x0F];
+							++ src_p;
+						}
+
+					*dest_p = '\0';
+				}
+
+			free (value_s);
+		}
+
+	return token_s;
+}
+
+
+static json_t *DecodeToken (const char *token_s)
+{
+	json_t *token_p = NULL;
+	const size_t length = strlen (token_s);
+
+	if ((length > 0) && ((length % 2) == 0))
+		{
+			char *value_s = (char *) AllocMemory ((length / 2) + 1);
+
+			if (value_s)
+				{
+					char *dest_p = value_s;
+					bool success_flag = true;
+
+					while (success_flag && *token_s)
+						{
+							const int high = GetHexValue (*token_s);
+							const int low = GetHexValue (* (token_s + 1));
+
+							if ((high >= 0) && (low >= 0) && ((high > 0) || (low > 0)))
+								{
+									*dest_p ++ = (char) ((high << 4) | low);
+									token_s += 2;
+								}
+							else
+								{
+									success_flag = false;
+								}
+						}
+
+					*dest_p = '\0';
+
+					if (success_flag)
+						{
+							json_error_t err;
+
+							token_p = json_loads (value_s, 0, &err);
+
+							if (token_p && !json_is_object (token_p))
+								{
+									json_decref (token_p);
+									token_p = NULL;
+								}
+						}
+
+					FreeMemory (value_s);
+				}
+		}
+
+	return token_p;
+}
+
+
+static int GetHexValue (const char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		{
+			return c - '0';
+		}
+	else if ((c >= 'a') && (c <= 'f'))
+		{
+			return c - 'a' + 10;
+		}
+	else if ((c >= 'A') && (c <= 'F'))
+		{
+			return c - 'A' + 10;
+		}
+
+	return -1;
+}
@@ -0,0 +1,392 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * upload_checkpoints.c
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "upload_checkpoints.h"
+#include "memory_allocations.h"
+#include "json_util.h"
+#include "streams.h"
+
+
+#ifdef _DEBUG
+	#define UPLOAD_CHECKPOINTS_DEBUG	(STM_LEVEL_FINE)
+#else
+	#define UPLOAD_CHECKPOINTS_DEBUG	(STM_LEVEL_NONE)
+#endif
+
+
+static const char * const S_UPLOAD_ID_S = "upload_id";
+
+static const char * const S_DATA_S = "data";
+
+static const char * const S_ROWS_S = "rows";
+
+static const char * const S_BATCHES_S = "batches";
+
+static const char * const S_IMPORTED_S = "imported";
+
+static const char * const S_FINGERPRINT_S = "fingerprint";
+
+static const char * const S_UPDATED_S = "updated";
+
+
+struct UploadCheckpoints
+{
+	/* The connection to the collection of checkpoints */
+	MongoTool *ucs_tool_p;
+
+	/* The MongoTool isn't thread-safe and uploads may be imported at the same time */
+	pthread_mutex_t ucs_mutex;
+};
+
+
+static json_t *GetStoredCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s, bool *success_flag_p);
+
+static bool GetCheckpointCount (const json_t *doc_p, const char *key_s, uint32 *value_p);
+
+static bool GetCheckpointFingerprint (const json_t *doc_p, uint64 *fingerprint_p);
+
+
+/****************************************/
+/********** PUBLIC FUNCTIONS ************/
+/****************************************/
+
+
+UploadCheckpoints *AllocateUploadCheckpoints (MongoClientManager *mongo_manager_p, const char *database_s, const char *collection_s)
+{
+	MongoTool *tool_p = AllocateMongoTool (NULL, mongo_manager_p);
+
+	if (tool_p)
+		{
+			if (SetMongoToolDatabaseAndCollection (tool_p, database_s, collection_s))
+				{
+					UploadCheckpoints *checkpoints_p = (UploadCheckpoints *) AllocMemory (sizeof (UploadCheckpoints));
+
+					if (checkpoints_p)
+						{
+							checkpoints_p -> ucs_tool_p = tool_p;
+
+							pthread_mutex_init (& (checkpoints_p -> ucs_mutex), NULL);
+
+							return checkpoints_p;
+						}
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to set upload checkpoints collection to \"%s\".\"%s\"", database_s, collection_s);
+				}
+
+			FreeMongoTool (tool_p);
+		}		/* if (tool_p) */
+
+	return NULL;
+}
+
+
+void FreeUploadCheckpoints (UploadCheckpoints *checkpoints_p)
+{
+	pthread_mutex_destroy (& (checkpoints_p -> ucs_mutex));
+
+	FreeMongoTool (checkpoints_p -> ucs_tool_p);
+	FreeMemory (checkpoints_p);
+}
+
+
+bool GetUploadCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s, const char *data_type_s, UploadCheckpoint *checkpoint_p, const char **error_ss)
+{
+	bool success_flag = false;
+	json_t *doc_p;
+
+	checkpoint_p -> uc_num_rows = 0;
+	checkpoint_p -> uc_num_batches = 0;
+	checkpoint_p -> uc_num_imports = 0;
+	checkpoint_p -> uc_fingerprint = 0;
+
+	doc_p = GetStoredCheckpoint (checkpoints_p, upload_id_s, &success_flag);
+
+	if (doc_p)
+		{
+			const char *stored_data_type_s = GetJSONString (doc_p, S_DATA_S);
+
+			success_flag = false;
+
+			/* The rows would be skipped for the wrong type of data */
+			if (stored_data_type_s && (strcmp (stored_data_type_s, data_type_s) == 0))
+				{
+					if (GetCheckpointCount (doc_p, S_ROWS_S, & (checkpoint_p -> uc_num_rows)) &&
+							GetCheckpointCount (doc_p, S_BATCHES_S, & (checkpoint_p -> uc_num_batches)) &&
+							GetCheckpointCount (doc_p, S_IMPORTED_S, & (checkpoint_p -> uc_num_imports)) &&
+							GetCheckpointFingerprint (doc_p, & (checkpoint_p -> uc_fingerprint)))
+						{
+							success_flag = true;
+
+							#if UPLOAD_CHECKPOINTS_DEBUG >= STM_LEVEL_FINE
+							PrintLog (STM_LEVEL_FINE, __FILE__, __LINE__, "Upload \"%s\" has " UINT32_FMT " rows committed in " UINT32_FMT " batches", upload_id_s, checkpoint_p -> uc_num_rows, checkpoint_p -> uc_num_batches);
+							#endif
+						}
+					else
+						{
+							checkpoint_p -> uc_num_rows = 0;
+							checkpoint_p -> uc_num_batches = 0;
+							checkpoint_p -> uc_num_imports = 0;
+							checkpoint_p -> uc_fingerprint = 0;
+
+							*error_ss = "The checkpoint for the upload id is invalid";
+						}
+				}
+			else
+				{
+					*error_ss = "The upload id has already been used for a different type of data";
+				}
+
+			json_decref (doc_p);
+		}
+	else if (!success_flag)
+		{
+			*error_ss = "Failed to get the checkpoint for the upload id";
+		}
+
+	return success_flag;
+}
+
+
+bool SaveUploadCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s, const char *data_type_s, const UploadCheckpoint *checkpoint_p)
+{
+	bool success_flag = false;
+	json_error_t err;
+	json_t *selector_p = json_pack_ex (&err, 0, "{s:s}", S_UPLOAD_ID_S, upload_id_s);
+
+	if (selector_p)
+		{
+			/* The fingerprint is stored as hex as it can be too large for a signed integer */
+			char fingerprint_s [17];
+			json_t *update_p;
+
+			sprintf (fingerprint_s, "%016llx", (unsigned long long) (checkpoint_p -> uc_fingerprint));
+
+			update_p = json_pack_ex (&err, 0, "{s:{s:s,s:I,s:I,s:I,s:s},s:{s:b}}",
+															 "$set",
+															 S_DATA_S, data_type_s,
+															 S_ROWS_S, (json_int_t) (checkpoint_p -> uc_num_rows),
+															 S_BATCHES_S, (json_int_t) (checkpoint_p -> uc_num_batches),
+															 S_IMPORTED_S, (json_int_t) (checkpoint_p -> uc_num_imports),
+															 S_FINGERPRINT_S, fingerprint_s,
+															 "$currentDate",
+															 S_UPDATED_S, true);
+
+			if (update_p)
+				{
+					bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+					if (selector_bson_p)
+						{
+							bson_t *update_bson_p = ConvertJSONToBSON (update_p);
+
+							if (update_bson_p)
+								{
+									bson_t opts;
+									bson_error_t error;
+
+									bson_init (&opts);
+									BSON_APPEND_BOOL (&opts, "upsert", true);
+
+									pthread_mutex_lock (& (checkpoints_p -> ucs_mutex));
+
+									if (mongoc_collection_update_one (checkpoints_p -> ucs_tool_p -> mt_collection_p, selector_bson_p, update_bson_p, &opts, NULL, &error))
+										{
+											success_flag = true;
+										}
+									else
+										{
+											PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to store checkpoint for upload \"%s\": %s", upload_id_s, error.message);
+										}
+
+									pthread_mutex_unlock (& (checkpoints_p -> ucs_mutex));
+
+									bson_destroy (&opts);
+
+									bson_destroy (update_bson_p);
+								}
+
+							bson_destroy (selector_bson_p);
+						}
+
+					json_decref (update_p);
+				}
+			else
+				{
+					PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create checkpoint for upload \"%s\": %s", upload_id_s, err.text);
+				}
+
+			json_decref (selector_p);
+		}
+	else
+		{
+			PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to create checkpoint selector for upload \"%s\": %s", upload_id_s, err.text);
+		}
+
+	return success_flag;
+}
+
+
+bool RemoveUploadCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s)
+{
+	bool success_flag = false;
+	json_t *selector_p = json_pack ("{s:s}", S_UPLOAD_ID_S, upload_id_s);
+
+	if (selector_p)
+		{
+			bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+			if (selector_bson_p)
+				{
+					bson_error_t error;
+
+					pthread_mutex_lock (& (checkpoints_p -> ucs_mutex));
+
+					if (mongoc_collection_delete_one (checkpoints_p -> ucs_tool_p -> mt_collection_p, selector_bson_p, NULL, NULL, &error))
+						{
+							success_flag = true;
+						}
+					else
+						{
+							PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to remove checkpoint for upload \"%s\": %s", upload_id_s, error.message);
+						}
+
+					pthread_mutex_unlock (& (checkpoints_p -> ucs_mutex));
+
+					bson_destroy (selector_bson_p);
+				}
+
+			json_decref (selector_p);
+		}
+
+	return success_flag;
+}
+
+
+/****************************************/
+/********** STATIC FUNCTIONS ************/
+/****************************************/
+
+
+/*
+ * Get the stored checkpoint document for an upload. If there isn't
+ * one, NULL is returned and success_flag_p is still set to true.
+ */
+static json_t *GetStoredCheckpoint (UploadCheckpoints *checkpoints_p, const char *upload_id_s, bool *success_flag_p)
+{
+	json_t *doc_p = NULL;
+	json_t *selector_p = json_pack ("{s:s}", S_UPLOAD_ID_S, upload_id_s);
+
+	*success_flag_p = false;
+
+	if (selector_p)
+		{
+			bson_t *selector_bson_p = ConvertJSONToBSON (selector_p);
+
+			if (selector_bson_p)
+				{
+					bson_t opts;
+					mongoc_cursor_t *cursor_p;
+
+					bson_init (&opts);
+					BSON_APPEND_INT64 (&opts, "limit", 1);
+
+					pthread_mutex_lock (& (checkpoints_p -> ucs_mutex));
+
+					cursor_p = mongoc_collection_find_with_opts (checkpoints_p -> ucs_tool_p -> mt_collection_p, selector_bson_p, &opts, NULL);
+
+					if (cursor_p)
+						{
+							const bson_t *bson_doc_p;
+							bson_error_t error;
+
+							if (mongoc_cursor_next (cursor_p, &bson_doc_p))
+								{
+									doc_p = ConvertBSONToJSON (bson_doc_p);
+									*success_flag_p = (doc_p != NULL);
+								}
+							else if (mongoc_cursor_error (cursor_p, &error))
+								{
+									PrintErrors (STM_LEVEL_SEVERE, __FILE__, __LINE__, "Failed to look up checkpoint for upload \"%s\": %s", upload_id_s, error.message);
+								}
+							else
+								{
+									*success_flag_p = true;
+								}
+
+							mongoc_cursor_destroy (cursor_p);
+						}
+
+					pthread_mutex_unlock (& (checkpoints_p -> ucs_mutex));
+
+					bson_destroy (&opts);
+
+					bson_destroy (selector_bson_p);
+				}
+
+			json_decref (selector_p);
+		}		/* if (selector_p) */
+
+	return doc_p;
+}
+
+
+static bool GetCheckpointCount (const json_t *doc_p, const char *key_s, uint32 *value_p)
+{
+	bool success_flag = false;
+	int value;
+
+	if (GetJSONInteger (doc_p, key_s, &value))
+		{
+			if (value >= 0)
+				{
+					*value_p = (uint32) value;
+					success_flag = true;
+				}
+		}
+
+	return success_flag;
+}
+
+
+static bool GetCheckpointFingerprint (const json_t *doc_p, uint64 *fingerprint_p)
+{
+	bool success_flag = false;
+	const char *fingerprint_s = GetJSONString (doc_p, S_FINGERPRINT_S);
+
+	if (fingerprint_s)
+		{
+			unsigned long long value;
+
+			if (sscanf (fingerprint_s, "%llx", &value) == 1)
+				{
+					*fingerprint_p = (uint64) value;
+					success_flag = true;
+				}
+		}
+
+	return success_flag;
+}
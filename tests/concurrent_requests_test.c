@@ -0,0 +1,355 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * concurrent_requests_test.c
+ *
+ * Run overlapping searches and imports against a single Pathogenomics
+ * Service from a number of threads to check that RunPathogenomicsService ()
+ * is re-entrant. Each thread imports samples with IDs of its own and then
+ * searches for them, so every job can be checked against what that thread,
+ * and only that thread, asked for.
+ *
+ * The imports write to the databases in the service's configuration so
+ * the Grassroots installation given must point the service at a scratch
+ * database.
+ *
+ * Usage: concurrent_requests_test <grassroots path> <server config> [threads] [requests per thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pathogenomics_service.h"
+#include "pathogenomics_service_data.h"
+#include "grassroots_server.h"
+#include "service.h"
+#include "parameter_set.h"
+#include "string_utils.h"
+#include "mongodb_tool.h"
+
+
+#define DEFAULT_NUM_THREADS (8)
+
+#define DEFAULT_NUM_REQUESTS (25)
+
+
+typedef struct RequestThread
+{
+	Service *rt_service_p;
+
+	uint32 rt_index;
+
+	uint32 rt_num_requests;
+
+	/* The number of requests whose jobs were not what this thread asked for */
+	uint32 rt_num_failures;
+
+	pthread_t rt_thread;
+} RequestThread;
+
+
+static void *RunRequests (void *data_p);
+
+static bool RunImport (RequestThread *thread_p, const char *id_s);
+
+static bool RunSearch (RequestThread *thread_p, const char *id_s);
+
+static ServiceJob *RunRequest (RequestThread *thread_p, ParameterSet *params_p, const char *id_s, ServiceJobSet **jobs_pp);
+
+static ParameterSet *AllocateRequestParameters (Service *service_p);
+
+static char *GetSampleId (const uint32 thread_index, const uint32 request_index);
+
+
+int main (int argc, char *argv [])
+{
+	int ret = EXIT_FAILURE;
+
+	if ((argc >= 3) && (argc <= 5))
+		{
+			uint32 num_threads = (argc > 3) ? (uint32) atoi (argv [3]) : DEFAULT_NUM_THREADS;
+			uint32 num_requests = (argc > 4) ? (uint32) atoi (argv [4]) : DEFAULT_NUM_REQUESTS;
+			GrassrootsServer *grassroots_p = AllocateGrassrootsServer (argv [1], argv [2], NULL, NULL, NULL, false, NULL, false);
+
+			if (grassroots_p)
+				{
+					ServicesArray *services_p = GetServices (NULL, grassroots_p);
+
+					if (services_p)
+						{
+							Service *service_p = * (services_p -> sa_services_pp);
+							ServiceJobSet *initial_jobs_p = service_p -> se_jobs_p;
+							RequestThread *threads_p = (RequestThread *) calloc (num_threads, sizeof (RequestThread));
+
+							if (threads_p)
+								{
+									uint32 num_started = 0;
+									uint32 num_failures = 0;
+									uint32 i;
+
+									for (i = 0; i < num_threads; ++ i)
+										{
+											RequestThread *thread_p = threads_p + i;
+
+											thread_p -> rt_service_p = service_p;
+											thread_p -> rt_index = i;
+											thread_p -> rt_num_requests = num_requests;
+											thread_p -> rt_num_failures = 0;
+
+											if (pthread_create (& (thread_p -> rt_thread), NULL, RunRequests, thread_p) == 0)
+												{
+													++ num_started;
+												}
+											else
+												{
+													fprintf (stderr, "Failed to start thread " UINT32_FMT "\n", i);
+													++ num_failures;
+													break;
+												}
+										}
+
+									for (i = 0; i < num_started; ++ i)
+										{
+											pthread_join (threads_p [i].rt_thread, NULL);
+											num_failures += threads_p [i].rt_num_failures;
+										}
+
+									/* The run path must leave the Service's own state alone */
+									if (service_p -> se_jobs_p != initial_jobs_p)
+										{
+											fprintf (stderr, "The Service's job set was changed by a request\n");
+											++ num_failures;
+										}
+
+									printf (UINT32_FMT " threads ran " UINT32_FMT " imports and searches each with " UINT32_FMT " failures\n", num_started, num_requests, num_failures);
+
+									if ((num_failures == 0) && (num_started == num_threads))
+										{
+											ret = EXIT_SUCCESS;
+										}
+
+									free (threads_p);
+								}		/* if (threads_p) */
+
+							ReleaseServices (services_p);
+						}		/* if (services_p) */
+					else
+						{
+							fprintf (stderr, "Failed to create the Pathogenomics Service\n");
+						}
+
+					FreeGrassrootsServer (grassroots_p);
+				}		/* if (grassroots_p) */
+			else
+				{
+					fprintf (stderr, "Failed to load the Grassroots server from \"%s\" and \"%s\"\n", argv [1], argv [2]);
+				}
+		}
+	else
+		{
+			fprintf (stderr, "Usage: %s <grassroots path> <server config> [threads] [requests per thread]\n", argv [0]);
+		}
+
+	return ret;
+}
+
+
+/*
+ * Alternate between importing a new sample and searching for the one
+ * just imported so that the threads' searches and imports overlap.
+ */
+static void *RunRequests (void *data_p)
+{
+	RequestThread *thread_p = (RequestThread *) data_p;
+	uint32 i;
+
+	for (i = 0; i < thread_p -> rt_num_requests; ++ i)
+		{
+			char *id_s = GetSampleId (thread_p -> rt_index, i);
+
+			if (id_s)
+				{
+					if (! (RunImport (thread_p, id_s) && RunSearch (thread_p, id_s)))
+						{
+							++ (thread_p -> rt_num_failures);
+						}
+
+					FreeCopiedString (id_s);
+				}
+			else
+				{
+					++ (thread_p -> rt_num_failures);
+				}
+		}
+
+	return NULL;
+}
+
+
+static bool RunImport (RequestThread *thread_p, const char *id_s)
+{
+	bool success_flag = false;
+	ParameterSet *params_p = AllocateRequestParameters (thread_p -> rt_service_p);
+
+	if (params_p)
+		{
+			char *table_s = ConcatenateVarargsStrings ("ID|UKCPVS ID|Date collected|Name/Collector|Company|Country|County|Town|Postal code|GPS|Rust (YR/SR/LR)|Variety|Host\n",
+				id_s, "|", id_s, "|2020-03-15|Stress test|Stress test|UK|Norfolk|Norwich|NR4 7UH|52.6219, 1.2189|YR|Solstice|Wheat\n", NULL);
+
+			if (table_s)
+				{
+					ServiceData *data_p = thread_p -> rt_service_p -> se_data_p;
+
+					if (EasyCreateAndAddStringParameterToParameterSet (data_p, params_p, NULL, PT_TABLE, "Upload", "Upload", "The data to upload", table_s, PL_ALL))
+						{
+							ServiceJobSet *jobs_p = NULL;
+							ServiceJob *job_p = RunRequest (thread_p, params_p, id_s, &jobs_p);
+
+							if (job_p)
+								{
+									if (job_p -> sj_status == OS_SUCCEEDED)
+										{
+											success_flag = true;
+										}
+									else
+										{
+											fprintf (stderr, "Importing \"%s\" finished with status %d\n", id_s, job_p -> sj_status);
+										}
+								}
+
+							if (jobs_p)
+								{
+									FreeServiceJobSet (jobs_p);
+								}
+						}
+
+					FreeCopiedString (table_s);
+				}
+
+			FreeParameterSet (params_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Search for the sample that this thread has just imported. If any other
+ * request's results or state had leaked into this one, there would be
+ * more or fewer than one result.
+ */
+static bool RunSearch (RequestThread *thread_p, const char *id_s)
+{
+	bool success_flag = false;
+	ParameterSet *params_p = AllocateRequestParameters (thread_p -> rt_service_p);
+
+	if (params_p)
+		{
+			json_t *query_p = json_pack ("{s:{s:s}}", MONGO_OPERATION_DATA_S, PG_ID_S, id_s);
+
+			if (query_p)
+				{
+					ServiceData *data_p = thread_p -> rt_service_p -> se_data_p;
+
+					if (EasyCreateAndAddJSONParameterToParameterSet (data_p, params_p, NULL, PT_JSON, "Search", "Search", "The search to run", query_p, PL_ALL))
+						{
+							ServiceJobSet *jobs_p = NULL;
+							ServiceJob *job_p = RunRequest (thread_p, params_p, id_s, &jobs_p);
+
+							if (job_p)
+								{
+									const size_t num_results = GetNumberOfServiceJobResults (job_p);
+
+									if ((job_p -> sj_status == OS_SUCCEEDED) && (num_results == 1))
+										{
+											success_flag = true;
+										}
+									else
+										{
+											fprintf (stderr, "Searching for \"%s\" finished with status %d and " SIZET_FMT " results\n", id_s, job_p -> sj_status, num_results);
+										}
+								}
+
+							if (jobs_p)
+								{
+									FreeServiceJobSet (jobs_p);
+								}
+						}
+
+					json_decref (query_p);
+				}
+
+			FreeParameterSet (params_p);
+		}
+
+	return success_flag;
+}
+
+
+static ServiceJob *RunRequest (RequestThread *thread_p, ParameterSet *params_p, const char *id_s, ServiceJobSet **jobs_pp)
+{
+	ServiceJob *job_p = NULL;
+	ServiceJobSet *jobs_p = RunService (thread_p -> rt_service_p, params_p, NULL, NULL);
+
+	if (jobs_p)
+		{
+			job_p = GetServiceJobFromServiceJobSet (jobs_p, 0);
+
+			if (!job_p)
+				{
+					fprintf (stderr, "No job for \"%s\"\n", id_s);
+				}
+
+			*jobs_pp = jobs_p;
+		}
+	else
+		{
+			fprintf (stderr, "No job set for \"%s\"\n", id_s);
+		}
+
+	return job_p;
+}
+
+
+static ParameterSet *AllocateRequestParameters (Service *service_p)
+{
+	ParameterSet *params_p = AllocateParameterSet ("Concurrent requests", "The parameters for one request");
+
+	if (params_p)
+		{
+			if (EasyCreateAndAddStringParameterToParameterSet (service_p -> se_data_p, params_p, NULL, PT_STRING, "Collection", "Collection", "The collection to act upon", PG_SAMPLE_S, PL_ALL))
+				{
+					return params_p;
+				}
+
+			FreeParameterSet (params_p);
+		}
+
+	return NULL;
+}
+
+
+static char *GetSampleId (const uint32 thread_index, const uint32 request_index)
+{
+	char buffer_s [64];
+
+	sprintf (buffer_s, "concurrent-test-" UINT32_FMT "-" UINT32_FMT, thread_index, request_index);
+
+	return EasyCopyToNewString (buffer_s);
+}
@@ -0,0 +1,117 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * coordinate_parser_test.c
+ *
+ * Check that ParseGPSCoordinate () reads each of the forms of GPS value
+ * that samples can have and rejects the ones that it can't place.
+ *
+ * Usage: coordinate_parser_test
+ */
+
+#include "coordinate_parser.h"
+#include "unit_test.h"
+
+
+/* The tolerance for values given in decimal degrees */
+#define DEGREES_TOLERANCE (0.000001)
+
+/* About 3 metres, for values given in minutes and seconds */
+#define SECONDS_TOLERANCE (0.00003)
+
+/*
+ * About 10 metres, which covers the error of the Helmert transformation
+ * and the size of the squares that the shorter references are for.
+ */
+#define GRID_TOLERANCE (0.0001)
+
+
+static void CheckCoordinate (const char *value_s, const double64 latitude, const double64 longitude, const double64 tolerance);
+
+static void CheckRejected (const char *value_s);
+
+
+int main (void)
+{
+	/* Decimal degrees */
+	CheckCoordinate ("52.6219, 1.2197", 52.6219, 1.2197, DEGREES_TOLERANCE);
+	CheckCoordinate ("  52.6219 , 1.2197  ", 52.6219, 1.2197, DEGREES_TOLERANCE);
+	CheckCoordinate ("52.6219N 1.2197E", 52.6219, 1.2197, DEGREES_TOLERANCE);
+	CheckCoordinate ("-33.8688, 151.2093", -33.8688, 151.2093, DEGREES_TOLERANCE);
+	CheckCoordinate ("33.8688S 151.2093E", -33.8688, 151.2093, DEGREES_TOLERANCE);
+
+	/* The hemispheres put the latitude first whichever order they are in */
+	CheckCoordinate ("1.2197E 52.6219N", 52.6219, 1.2197, DEGREES_TOLERANCE);
+
+	/* Degrees and decimal minutes */
+	CheckCoordinate ("52\xC2\xB0" "37.31'N 1\xC2\xB0" "13.18'E", 52.0 + (37.31 / 60.0), 1.0 + (13.18 / 60.0), SECONDS_TOLERANCE);
+
+	/* Degrees, minutes and seconds */
+	CheckCoordinate ("52\xC2\xB0" "37'18.8\"N 1\xC2\xB0" "13'10.9\"E", 52.621889, 1.219694, SECONDS_TOLERANCE);
+	CheckCoordinate ("N 52 37 18.8 E 1 13 10.9", 52.621889, 1.219694, SECONDS_TOLERANCE);
+
+	/* National Grid references, with and without spaces and at different precisions */
+	CheckCoordinate ("TG 51409 13177", 52.65798, 1.71605, GRID_TOLERANCE);
+	CheckCoordinate ("TG 5140 1317", 52.65798, 1.71605, GRID_TOLERANCE);
+	CheckCoordinate ("TG2161 0688", 52.61449, 1.27210, GRID_TOLERANCE);
+
+	CheckRejected ("");
+	CheckRejected ("abc");
+	CheckRejected ("52.6219");
+	CheckRejected ("91.0, 0");
+	CheckRejected ("52.6 N 200 E");
+	CheckRejected ("52.6219N 1.2197N");
+	CheckRejected ("TG 216 0688");
+	CheckRejected ("ZZ 2161 0688");
+
+	return GetUnitTestResult ("coordinate_parser_test");
+}
+
+
+static void CheckCoordinate (const char *value_s, const double64 latitude, const double64 longitude, const double64 tolerance)
+{
+	double64 parsed_latitude = 0.0;
+	double64 parsed_longitude = 0.0;
+	const bool parsed_flag = ParseGPSCoordinate (value_s, &parsed_latitude, &parsed_longitude);
+
+	UT_CHECK (parsed_flag);
+
+	if (parsed_flag)
+		{
+			UT_CHECK_NEAR (parsed_latitude, latitude, tolerance);
+			UT_CHECK_NEAR (parsed_longitude, longitude, tolerance);
+		}
+	else
+		{
+			fprintf (stderr, "failed to parse \"%s\"\n", value_s);
+		}
+}
+
+
+static void CheckRejected (const char *value_s)
+{
+	double64 latitude;
+	double64 longitude;
+	const bool parsed_flag = ParseGPSCoordinate (value_s, &latitude, &longitude);
+
+	UT_CHECK (!parsed_flag);
+
+	if (parsed_flag)
+		{
+			fprintf (stderr, "\"%s\" should not have been parsed\n", value_s);
+		}
+}
@@ -0,0 +1,260 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * date_normaliser_test.c
+ *
+ * Check that a DateNormaliser converts each of the forms of date that
+ * uploads can have, in both day and month orders, that it rejects
+ * malformed dates and that it counts each row's DateStatus.
+ *
+ * Usage: date_normaliser_test
+ */
+
+#include "date_normaliser.h"
+#include "unit_test.h"
+
+
+static void CheckDate (DateNormaliser *normaliser_p, const char *date_s, const char *expected_s);
+
+static void CheckNumericDate (DateNormaliser *normaliser_p, const double64 date, const char *expected_s);
+
+static void CheckDateOrders (void);
+
+static void CheckRowCounts (void);
+
+
+int main (void)
+{
+	DateNormaliser *day_first_p = AllocateDateNormaliser (DO_DAY_FIRST);
+	DateNormaliser *month_first_p = AllocateDateNormaliser (DO_MONTH_FIRST);
+
+	UT_CHECK (day_first_p != NULL);
+	UT_CHECK (month_first_p != NULL);
+
+	if (day_first_p && month_first_p)
+		{
+			DateNormaliser *normalisers_pp [2] = { day_first_p, month_first_p };
+			uint32 i;
+
+			/* Day first */
+			CheckDate (day_first_p, "15/03/2020", "2020-03-15");
+			CheckDate (day_first_p, "15/03/20", "2020-03-15");
+			CheckDate (day_first_p, "15-03-2020", "2020-03-15");
+			CheckDate (day_first_p, "15.03.2020", "2020-03-15");
+			CheckDate (day_first_p, "01/02/2020", "2020-02-01");
+			CheckDate (day_first_p, "03/15/2020", NULL);
+
+			/* Month first */
+			CheckDate (month_first_p, "03/15/2020", "2020-03-15");
+			CheckDate (month_first_p, "01/02/2020", "2020-01-02");
+			CheckDate (month_first_p, "15/03/2020", NULL);
+
+			/* Neither order changes how the other forms are read */
+			for (i = 0; i < 2; ++ i)
+				{
+					DateNormaliser *normaliser_p = normalisers_pp [i];
+
+					CheckDate (normaliser_p, "2020-03-15", "2020-03-15");
+					CheckDate (normaliser_p, "2020-03-15T10:30:00Z", "2020-03-15");
+					CheckDate (normaliser_p, "20200315", "2020-03-15");
+					CheckDate (normaliser_p, "2020-03", "2020-03-01");
+					CheckDate (normaliser_p, "03/2020", "2020-03-01");
+					CheckDate (normaliser_p, "Mar 2020", "2020-03-01");
+					CheckDate (normaliser_p, "15 Mar 2020", "2020-03-15");
+					CheckDate (normaliser_p, "15-Mar-20", "2020-03-15");
+					CheckDate (normaliser_p, "15th March 2020", "2020-03-15");
+					CheckDate (normaliser_p, "March 15, 2020", "2020-03-15");
+					CheckDate (normaliser_p, "Sept 2021", "2021-09-01");
+					CheckDate (normaliser_p, "43905", "2020-03-15");
+					CheckNumericDate (normaliser_p, 43905.0, "2020-03-15");
+					CheckNumericDate (normaliser_p, 43905.5, "2020-03-15");
+
+					/* Leap years */
+					CheckDate (normaliser_p, "2020-02-29", "2020-02-29");
+					CheckDate (normaliser_p, "2019-02-29", NULL);
+
+					/* Days that don't exist */
+					CheckDate (normaliser_p, "2020-02-30", NULL);
+					CheckDate (normaliser_p, "2020-13-01", NULL);
+
+					/* Malformed trailing tokens mustn't be read as a shorter form */
+					CheckDate (normaliser_p, "2020-03-123", NULL);
+					CheckDate (normaliser_p, "03/2020/123", NULL);
+					CheckDate (normaliser_p, "20200315 123", NULL);
+					CheckDate (normaliser_p, "15/03/2020x", NULL);
+
+					CheckDate (normaliser_p, "2020", NULL);
+					CheckDate (normaliser_p, "foo", NULL);
+					CheckDate (normaliser_p, "", NULL);
+				}
+
+			/* The second time round, the dates come from the normaliser's cache */
+			CheckDate (day_first_p, "15/03/2020", "2020-03-15");
+			CheckDate (day_first_p, "2020-03-123", NULL);
+		}
+
+	/* Without a normaliser, numeric dates are read as day-first */
+	CheckDate (NULL, "15/03/2020", "2020-03-15");
+	CheckDate (NULL, "03/15/2020", NULL);
+
+	if (day_first_p)
+		{
+			FreeDateNormaliser (day_first_p);
+		}
+
+	if (month_first_p)
+		{
+			FreeDateNormaliser (month_first_p);
+		}
+
+	CheckDateOrders ();
+	CheckRowCounts ();
+
+	return GetUnitTestResult ("date_normaliser_test");
+}
+
+
+/*
+ * Check that a date converts to the expected ISO 8601 one, or, if
+ * expected_s is NULL, that it is rejected.
+ */
+static void CheckDate (DateNormaliser *normaliser_p, const char *date_s, const char *expected_s)
+{
+	json_t *date_p = json_string (date_s);
+
+	UT_CHECK (date_p != NULL);
+
+	if (date_p)
+		{
+			char iso_date_s [PG_ISO_DATE_BUFFER_SIZE];
+			const bool converted_flag = NormaliseDate (normaliser_p, date_p, iso_date_s);
+
+			if (expected_s)
+				{
+					UT_CHECK (converted_flag);
+
+					if (converted_flag)
+						{
+							UT_CHECK_STRING (iso_date_s, expected_s);
+						}
+					else
+						{
+							fprintf (stderr, "failed to convert \"%s\"\n", date_s);
+						}
+				}
+			else
+				{
+					UT_CHECK (!converted_flag);
+
+					if (converted_flag)
+						{
+							fprintf (stderr, "\"%s\" should not have been converted but gave %s\n", date_s, iso_date_s);
+						}
+				}
+
+			json_decref (date_p);
+		}
+}
+
+
+static void CheckNumericDate (DateNormaliser *normaliser_p, const double64 date, const char *expected_s)
+{
+	json_t *date_p = json_real (date);
+
+	UT_CHECK (date_p != NULL);
+
+	if (date_p)
+		{
+			char iso_date_s [PG_ISO_DATE_BUFFER_SIZE];
+
+			UT_CHECK (NormaliseDate (normaliser_p, date_p, iso_date_s));
+			UT_CHECK_STRING (iso_date_s, expected_s);
+
+			json_decref (date_p);
+		}
+}
+
+
+static void CheckDateOrders (void)
+{
+	DateOrder order = DO_NUM_ORDERS;
+
+	UT_CHECK_STRING (GetDateOrderName (DO_DAY_FIRST), "DD/MM/YYYY");
+	UT_CHECK_STRING (GetDateOrderName (DO_MONTH_FIRST), "MM/DD/YYYY");
+	UT_CHECK (GetDateOrderName (DO_NUM_ORDERS) == NULL);
+
+	UT_CHECK (GetDateOrderFromName ("MM/DD/YYYY", &order));
+	UT_CHECK (order == DO_MONTH_FIRST);
+	UT_CHECK (!GetDateOrderFromName ("YYYY/MM/DD", &order));
+}
+
+
+/*
+ * Check that each row is counted once, when it is converted with
+ * NormaliseRowDate (), and not when its batch is converted beforehand.
+ */
+static void CheckRowCounts (void)
+{
+	DateNormaliser *normaliser_p = AllocateDateNormaliser (DO_DAY_FIRST);
+	json_t *rows_p = json_pack ("[{s:s},{s:s},{s:i},{},{s:s}]", "date", "15/03/2020", "date", "2020-03-123", "date", 43905, "date", "15/03/2020");
+
+	UT_CHECK (normaliser_p != NULL);
+	UT_CHECK (rows_p != NULL);
+
+	if (normaliser_p && rows_p)
+		{
+			const DateStatus expected_statuses [5] = { DS_CONVERTED, DS_INVALID, DS_CONVERTED, DS_MISSING, DS_CONVERTED };
+			size_t counts [DS_NUM_STATUSES];
+			size_t i;
+			json_t *row_p;
+
+			NormaliseDateColumn (normaliser_p, rows_p, "date");
+
+			GetDateStatusCounts (normaliser_p, counts);
+			UT_CHECK (counts [DS_CONVERTED] == 0);
+			UT_CHECK (counts [DS_MISSING] == 0);
+			UT_CHECK (counts [DS_INVALID] == 0);
+
+			json_array_foreach (rows_p, i, row_p)
+				{
+					char iso_date_s [PG_ISO_DATE_BUFFER_SIZE];
+					const DateStatus status = NormaliseRowDate (normaliser_p, row_p, "date", iso_date_s);
+
+					UT_CHECK (status == expected_statuses [i]);
+
+					if (status == DS_CONVERTED)
+						{
+							UT_CHECK_STRING (iso_date_s, "2020-03-15");
+						}
+				}
+
+			GetDateStatusCounts (normaliser_p, counts);
+			UT_CHECK (counts [DS_CONVERTED] == 3);
+			UT_CHECK (counts [DS_MISSING] == 1);
+			UT_CHECK (counts [DS_INVALID] == 1);
+		}
+
+	if (rows_p)
+		{
+			json_decref (rows_p);
+		}
+
+	if (normaliser_p)
+		{
+			FreeDateNormaliser (normaliser_p);
+		}
+}
@@ -0,0 +1,279 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * mongo_tool_pool_test.c
+ *
+ * Check that a MongoToolPool hands out no more MongoTools than its size,
+ * that checking out from a full pool times out, that checking a tool back
+ * in wakes a request that is waiting for one and that the utilisation
+ * counts add up.
+ *
+ * The test has its own AllocateMongoTool () and FreeMongoTool () so that
+ * it doesn't need a database and can count the tools that the pool
+ * creates and frees. It mustn't be linked with the Grassroots MongoDB
+ * library.
+ *
+ * Usage: mongo_tool_pool_test
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mongo_tool_pool.h"
+#include "unit_test.h"
+
+
+#define POOL_SIZE (2)
+
+/* The timeout, in milliseconds, for the pool that is checked for timeouts */
+#define SHORT_TIMEOUT (100)
+
+/* The timeout, in milliseconds, for the pool that is checked for waking waiters */
+#define LONG_TIMEOUT (10000)
+
+/* How long, in milliseconds, to keep a waiting request waiting for */
+#define WAKE_DELAY (50)
+
+
+typedef struct Waiter
+{
+	MongoToolPool *wa_pool_p;
+
+	MongoTool *wa_tool_p;
+
+	/* How long the request waited for, in milliseconds */
+	long wa_wait_time;
+} Waiter;
+
+
+static uint32 s_num_allocated_tools = 0;
+
+static uint32 s_num_freed_tools = 0;
+
+
+static void CheckCheckOuts (void);
+
+static void CheckWakingWaiter (void);
+
+static void *WaitForMongoTool (void *data_p);
+
+static json_int_t GetPoolCount (const json_t *stats_p, const char *key_s);
+
+static long GetMillisecondsSince (const struct timespec *start_p);
+
+static void SleepForMilliseconds (const long ms);
+
+
+int main (void)
+{
+	UT_CHECK (AllocateMongoToolPool (NULL, 0, SHORT_TIMEOUT) == NULL);
+
+	CheckCheckOuts ();
+	CheckWakingWaiter ();
+
+	/* Every MongoTool that the pools created has been freed with them */
+	UT_CHECK (s_num_allocated_tools == s_num_freed_tools);
+
+	return GetUnitTestResult ("mongo_tool_pool_test");
+}
+
+
+/*
+ * The stand-ins for the Grassroots MongoDB library's functions. The pool
+ * only compares the MongoTools that it gets so they just need to be
+ * distinct pointers.
+ */
+MongoTool *AllocateMongoTool (User *UNUSED_PARAM (user_p), MongoClientManager *UNUSED_PARAM (mongo_manager_p))
+{
+	MongoTool *tool_p = (MongoTool *) malloc (1);
+
+	if (tool_p)
+		{
+			++ s_num_allocated_tools;
+		}
+
+	return tool_p;
+}
+
+
+void FreeMongoTool (MongoTool *tool_p)
+{
+	++ s_num_freed_tools;
+	free (tool_p);
+}
+
+
+static void CheckCheckOuts (void)
+{
+	MongoToolPool *pool_p = AllocateMongoToolPool (NULL, POOL_SIZE, SHORT_TIMEOUT);
+
+	UT_CHECK (pool_p != NULL);
+
+	if (pool_p)
+		{
+			MongoTool *first_p = CheckOutMongoTool (pool_p);
+			MongoTool *second_p = CheckOutMongoTool (pool_p);
+			MongoTool *third_p;
+			json_t *stats_p;
+			struct timespec start;
+			long wait_time;
+
+			/* The tools are created as they are needed */
+			UT_CHECK (first_p != NULL);
+			UT_CHECK (second_p != NULL);
+			UT_CHECK (first_p != second_p);
+			UT_CHECK (s_num_allocated_tools == POOL_SIZE);
+
+			/* The pool is full so this waits for the timeout and gets nothing */
+			clock_gettime (CLOCK_REALTIME, &start);
+			third_p = CheckOutMongoTool (pool_p);
+			wait_time = GetMillisecondsSince (&start);
+
+			UT_CHECK (third_p == NULL);
+			UT_CHECK (wait_time >= SHORT_TIMEOUT - 10);
+			UT_CHECK (wait_time < LONG_TIMEOUT);
+
+			/* A tool that is checked back in is reused rather than a new one being created */
+			CheckInMongoTool (pool_p, first_p);
+			third_p = CheckOutMongoTool (pool_p);
+
+			UT_CHECK (third_p == first_p);
+			UT_CHECK (s_num_allocated_tools == POOL_SIZE);
+
+			/* Checking in a tool twice or one that isn't from the pool doesn't free up a place */
+			CheckInMongoTool (pool_p, second_p);
+			CheckInMongoTool (pool_p, second_p);
+			CheckInMongoTool (pool_p, (MongoTool *) &start);
+
+			second_p = CheckOutMongoTool (pool_p);
+			UT_CHECK (second_p != NULL);
+			UT_CHECK (CheckOutMongoTool (pool_p) == NULL);
+
+			stats_p = json_object ();
+			UT_CHECK (stats_p != NULL);
+
+			if (stats_p)
+				{
+					UT_CHECK (AddMongoToolPoolStatsToJSON (pool_p, stats_p));
+
+					UT_CHECK (GetPoolCount (stats_p, "size") == POOL_SIZE);
+					UT_CHECK (GetPoolCount (stats_p, "connections") == POOL_SIZE);
+					UT_CHECK (GetPoolCount (stats_p, "in use") == POOL_SIZE);
+					UT_CHECK (GetPoolCount (stats_p, "peak in use") == POOL_SIZE);
+					UT_CHECK (GetPoolCount (stats_p, "checkouts") == 4);
+					UT_CHECK (GetPoolCount (stats_p, "waits") == 2);
+					UT_CHECK (GetPoolCount (stats_p, "timeouts") == 2);
+					UT_CHECK (GetPoolCount (stats_p, "total wait ms") >= 2 * (SHORT_TIMEOUT - 10));
+
+					json_decref (stats_p);
+				}
+
+			CheckInMongoTool (pool_p, first_p);
+			CheckInMongoTool (pool_p, second_p);
+
+			FreeMongoToolPool (pool_p);
+		}
+}
+
+
+static void CheckWakingWaiter (void)
+{
+	MongoToolPool *pool_p = AllocateMongoToolPool (NULL, 1, LONG_TIMEOUT);
+
+	UT_CHECK (pool_p != NULL);
+
+	if (pool_p)
+		{
+			MongoTool *tool_p = CheckOutMongoTool (pool_p);
+			Waiter waiter;
+			pthread_t thread;
+
+			UT_CHECK (tool_p != NULL);
+
+			waiter.wa_pool_p = pool_p;
+			waiter.wa_tool_p = NULL;
+			waiter.wa_wait_time = 0;
+
+			if (pthread_create (&thread, NULL, WaitForMongoTool, &waiter) == 0)
+				{
+					/* Give the waiter time to start waiting before returning the tool */
+					SleepForMilliseconds (WAKE_DELAY);
+					CheckInMongoTool (pool_p, tool_p);
+
+					pthread_join (thread, NULL);
+
+					/* The waiter got the returned tool long before its timeout */
+					UT_CHECK (waiter.wa_tool_p == tool_p);
+					UT_CHECK (waiter.wa_wait_time < LONG_TIMEOUT / 2);
+
+					if (waiter.wa_tool_p)
+						{
+							CheckInMongoTool (pool_p, waiter.wa_tool_p);
+						}
+				}
+			else
+				{
+					UT_CHECK (!"Failed to create waiting thread");
+					CheckInMongoTool (pool_p, tool_p);
+				}
+
+			FreeMongoToolPool (pool_p);
+		}
+}
+
+
+static void *WaitForMongoTool (void *data_p)
+{
+	Waiter *waiter_p = (Waiter *) data_p;
+	struct timespec start;
+
+	clock_gettime (CLOCK_REALTIME, &start);
+	waiter_p -> wa_tool_p = CheckOutMongoTool (waiter_p -> wa_pool_p);
+	waiter_p -> wa_wait_time = GetMillisecondsSince (&start);
+
+	return NULL;
+}
+
+
+static json_int_t GetPoolCount (const json_t *stats_p, const char *key_s)
+{
+	const json_t *pool_stats_p = json_object_get (stats_p, "connection pool");
+
+	return json_integer_value (json_object_get (pool_stats_p, key_s));
+}
+
+
+static long GetMillisecondsSince (const struct timespec *start_p)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+
+	return ((long) (now.tv_sec - start_p -> tv_sec)) * 1000L + (now.tv_nsec - start_p -> tv_nsec) / 1000000L;
+}
+
+
+static void SleepForMilliseconds (const long ms)
+{
+	struct timespec delay;
+
+	delay.tv_sec = ms / 1000L;
+	delay.tv_nsec = (ms % 1000L) * 1000000L;
+
+	nanosleep (&delay, NULL);
+}
@@ -0,0 +1,298 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * search_page_test.c
+ *
+ * Check that the continuation token for a full page of search results
+ * gives the next page the same sort order and starts it after the last
+ * document, and that requests with invalid paging values or tokens are
+ * rejected.
+ *
+ * Usage: search_page_test
+ */
+
+#include "search_page.h"
+#include "string_utils.h"
+#include "mongodb_tool.h"
+#include "unit_test.h"
+
+
+#define MAX_LIMIT (100)
+
+
+static void CheckDefaults (void);
+
+static void CheckLimits (void);
+
+static void CheckRoundTrip (void);
+
+static void CheckLastPage (void);
+
+static void CheckInvalidRequests (void);
+
+static bool InitPageFromJSON (SearchPage *page_p, const char *request_s, const char **error_ss);
+
+static json_t *GetPageOfDocuments (const uint32 num_docs);
+
+
+int main (void)
+{
+	CheckDefaults ();
+	CheckLimits ();
+	CheckRoundTrip ();
+	CheckLastPage ();
+	CheckInvalidRequests ();
+
+	return GetUnitTestResult ("search_page_test");
+}
+
+
+static void CheckDefaults (void)
+{
+	SearchPage page;
+	const char *error_s = NULL;
+
+	UT_CHECK (InitPageFromJSON (&page, "{}", &error_s));
+	UT_CHECK (page.sp_limit == MAX_LIMIT);
+	UT_CHECK (page.sp_skip == 0);
+	UT_CHECK (page.sp_after_p == NULL);
+
+	/* The documents are sorted by their ids when the request has no order */
+	UT_CHECK (json_object_size (page.sp_sort_p) == 1);
+	UT_CHECK (json_integer_value (json_object_get (page.sp_sort_p, MONGO_ID_S)) == 1);
+
+	ClearSearchPage (&page);
+}
+
+
+static void CheckLimits (void)
+{
+	SearchPage page;
+	const char *error_s = NULL;
+
+	UT_CHECK (InitPageFromJSON (&page, "{\"limit\": 10, \"skip\": 20}", &error_s));
+	UT_CHECK (page.sp_limit == 10);
+	UT_CHECK (page.sp_skip == 20);
+	ClearSearchPage (&page);
+
+	/* Asking for more than the maximum gets the maximum */
+	UT_CHECK (InitPageFromJSON (&page, "{\"limit\": 1000}", &error_s));
+	UT_CHECK (page.sp_limit == MAX_LIMIT);
+	ClearSearchPage (&page);
+
+	UT_CHECK (!InitPageFromJSON (&page, "{\"limit\": -1}", &error_s));
+	UT_CHECK_STRING (error_s, "\"limit\" must be a non-negative integer");
+
+	UT_CHECK (!InitPageFromJSON (&page, "{\"skip\": \"10\"}", &error_s));
+	UT_CHECK_STRING (error_s, "\"skip\" must be a non-negative integer");
+}
+
+
+static void CheckRoundTrip (void)
+{
+	SearchPage first_page;
+	const char *error_s = NULL;
+
+	UT_CHECK (InitPageFromJSON (&first_page, "{\"limit\": 3, \"sort\": {\"sample.Date collected\": -1, \"sample.Country\": 1}}", &error_s));
+
+	if (first_page.sp_sort_p)
+		{
+			json_t *stages_p = json_array ();
+			json_t *docs_p = GetPageOfDocuments (3);
+			char *token_s = NULL;
+
+			/* The id is added as the last key so that every document has its own place */
+			UT_CHECK (json_object_size (first_page.sp_sort_p) == 3);
+			UT_CHECK (json_integer_value (json_object_get (first_page.sp_sort_p, MONGO_ID_S)) == 1);
+
+			/* The first page has no $match, just the $sort and the $addFields for the keys */
+			UT_CHECK (AddSearchPageStartStages (&first_page, stages_p));
+			UT_CHECK (json_array_size (stages_p) == 2);
+			UT_CHECK (json_equal (json_object_get (json_array_get (stages_p, 0), "$sort"), first_page.sp_sort_p));
+			UT_CHECK (json_object_get (json_object_get (json_array_get (stages_p, 1), "$addFields"), GetSearchPageKeyField ()) != NULL);
+
+			token_s = FinishSearchPage (&first_page, docs_p);
+			UT_CHECK (token_s != NULL);
+
+			/* The sort keys are removed from the results */
+			UT_CHECK (json_object_get (json_array_get (docs_p, 2), GetSearchPageKeyField ()) == NULL);
+
+			if (token_s)
+				{
+					SearchPage next_page;
+					json_t *request_p = json_pack ("{s:s}", PG_CONTINUATION_S, token_s);
+
+					/* Without a sort order of its own, the next page carries on with the token's */
+					UT_CHECK (InitSearchPage (&next_page, request_p, MAX_LIMIT, &error_s));
+					UT_CHECK (json_equal (next_page.sp_sort_p, first_page.sp_sort_p));
+
+					if (next_page.sp_after_p)
+						{
+							json_t *last_doc_p = GetPageOfDocuments (3);
+							json_t *after_stages_p = json_array ();
+							const json_t *match_p;
+
+							/* It starts after the last document, with the id still an ObjectId */
+							UT_CHECK (json_equal (next_page.sp_after_p, json_object_get (json_array_get (last_doc_p, 2), GetSearchPageKeyField ())));
+
+							UT_CHECK (AddSearchPageStartStages (&next_page, after_stages_p));
+							UT_CHECK (json_array_size (after_stages_p) == 3);
+
+							/* One clause for each key of the sort order */
+							match_p = json_object_get (json_object_get (json_array_get (after_stages_p, 0), "$match"), "$or");
+							UT_CHECK (json_array_size (match_p) == 3);
+
+							/* The first key is descending */
+							UT_CHECK (json_object_get (json_object_get (json_array_get (match_p, 0), "sample.Date collected"), "$lt") != NULL);
+
+							/* The last clause matches the earlier keys exactly and the id after the last one */
+							UT_CHECK (json_is_string (json_object_get (json_array_get (match_p, 2), "sample.Date collected")));
+							UT_CHECK (json_object_get (json_object_get (json_array_get (match_p, 2), MONGO_ID_S), "$gt") != NULL);
+
+							json_decref (after_stages_p);
+							json_decref (last_doc_p);
+						}
+					else
+						{
+							UT_CHECK (next_page.sp_after_p != NULL);
+						}
+
+					ClearSearchPage (&next_page);
+
+					/* The token can't be used with a different sort order */
+					json_object_set_new (request_p, "sort", json_pack ("{s:i}", "sample.Country", 1));
+					UT_CHECK (!InitSearchPage (&next_page, request_p, MAX_LIMIT, &error_s));
+					UT_CHECK_STRING (error_s, "The continuation token is for a different sort order");
+
+					json_decref (request_p);
+					FreeCopiedString (token_s);
+				}
+
+			json_decref (docs_p);
+			json_decref (stages_p);
+		}
+
+	ClearSearchPage (&first_page);
+}
+
+
+/*
+ * A page that isn't full is the last one so it doesn't get a token.
+ */
+static void CheckLastPage (void)
+{
+	SearchPage page;
+	const char *error_s = NULL;
+
+	UT_CHECK (InitPageFromJSON (&page, "{\"limit\": 5, \"sort\": {\"sample.Date collected\": -1, \"sample.Country\": 1}}", &error_s));
+
+	if (page.sp_sort_p)
+		{
+			json_t *docs_p = GetPageOfDocuments (3);
+
+			UT_CHECK (FinishSearchPage (&page, docs_p) == NULL);
+			UT_CHECK (json_object_get (json_array_get (docs_p, 0), GetSearchPageKeyField ()) == NULL);
+
+			json_decref (docs_p);
+		}
+
+	ClearSearchPage (&page);
+}
+
+
+static void CheckInvalidRequests (void)
+{
+	SearchPage page;
+	const char *error_s = NULL;
+
+	UT_CHECK (!InitPageFromJSON (&page, "{\"sort\": {\"sample.Country\": 2}}", &error_s));
+	UT_CHECK_STRING (error_s, "\"sort\" must be an object of field names with values of 1 or -1");
+
+	UT_CHECK (!InitPageFromJSON (&page, "{\"sort\": {\"$where\": 1}}", &error_s));
+	UT_CHECK (!InitPageFromJSON (&page, "{\"sort\": {}}", &error_s));
+
+	/* Not hex */
+	UT_CHECK (!InitPageFromJSON (&page, "{\"continuation\": \"zz\"}", &error_s));
+	UT_CHECK_STRING (error_s, "Invalid continuation token");
+
+	/* An odd number of digits */
+	UT_CHECK (!InitPageFromJSON (&page, "{\"continuation\": \"7b7\"}", &error_s));
+	UT_CHECK_STRING (error_s, "Invalid continuation token");
+
+	/* An embedded '\0' */
+	UT_CHECK (!InitPageFromJSON (&page, "{\"continuation\": \"7b007d\"}", &error_s));
+	UT_CHECK_STRING (error_s, "Invalid continuation token");
+
+	/* Valid hex for [1], which isn't an object */
+	UT_CHECK (!InitPageFromJSON (&page, "{\"continuation\": \"5b315d\"}", &error_s));
+	UT_CHECK_STRING (error_s, "Invalid continuation token");
+
+	/* {} has neither a sort order nor a position */
+	UT_CHECK (!InitPageFromJSON (&page, "{\"continuation\": \"7b7d\"}", &error_s));
+}
+
+
+static bool InitPageFromJSON (SearchPage *page_p, const char *request_s, const char **error_ss)
+{
+	bool success_flag = false;
+	json_error_t err;
+	json_t *request_p = json_loads (request_s, 0, &err);
+
+	UT_CHECK (request_p != NULL);
+
+	if (request_p)
+		{
+			success_flag = InitSearchPage (page_p, request_p, MAX_LIMIT, error_ss);
+			json_decref (request_p);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Make a page of documents as the start stages leave them, each with its
+ * sort key values for a sort on the date, country and id.
+ */
+static json_t *GetPageOfDocuments (const uint32 num_docs)
+{
+	static const char * const S_IDS_SS [] = { "5f1d7a4e2b3c4d5e6f708192", "5f1d7a4e2b3c4d5e6f708193", "5f1d7a4e2b3c4d5e6f708194", "5f1d7a4e2b3c4d5e6f708195", "5f1d7a4e2b3c4d5e6f708196" };
+	static const char * const S_DATES_SS [] = { "2020-03-15", "2020-03-14", "2020-03-14", "2020-03-10", "2020-02-01" };
+	static const char * const S_COUNTRIES_SS [] = { "UK", "France", "UK", "UK", "Spain" };
+	json_t *docs_p = json_array ();
+
+	if (docs_p)
+		{
+			uint32 i;
+
+			for (i = 0; i < num_docs; ++ i)
+				{
+					json_t *doc_p = json_pack ("{s:{s:s},s:{s:s,s:s},s:[s,s,{s:s}]}",
+																		 MONGO_ID_S, "$oid", S_IDS_SS [i],
+																		 "sample", "Date collected", S_DATES_SS [i], "Country", S_COUNTRIES_SS [i],
+																		 GetSearchPageKeyField (), S_DATES_SS [i], S_COUNTRIES_SS [i], "$oid", S_IDS_SS [i]);
+
+					if (json_array_append_new (docs_p, doc_p) != 0)
+						{
+							json_decref (docs_p);
+							return NULL;
+						}
+				}
+		}
+
+	return docs_p;
+}
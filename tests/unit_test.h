@@ -0,0 +1,87 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * unit_test.h
+ *
+ * The checks shared by the unit tests. Each test is a program of its
+ * own that counts its failed checks and exits with a non-zero status
+ * if there were any.
+ */
+
+#ifndef UNIT_TEST_H_
+#define UNIT_TEST_H_
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "typedefs.h"
+
+
+static uint32 s_num_checks = 0;
+
+static uint32 s_num_failures = 0;
+
+
+/**
+ * Check a condition, printing it with where it is if it doesn't hold.
+ */
+#define UT_CHECK(cond) \
+	do \
+		{ \
+			++ s_num_checks; \
+			if (! (cond)) \
+				{ \
+					++ s_num_failures; \
+					fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+				} \
+		} \
+	while (0)
+
+
+/**
+ * Check that two doubles are within a tolerance of each other.
+ */
+#define UT_CHECK_NEAR(actual, expected, tolerance) UT_CHECK (fabs ((actual) - (expected)) <= (tolerance))
+
+
+/**
+ * Check that two strings are equal, treating NULL as different to any string.
+ */
+#define UT_CHECK_STRING(actual_s, expected_s) UT_CHECK (((actual_s) != NULL) && (strcmp ((actual_s), (expected_s)) == 0))
+
+
+/**
+ * Print the number of checks that failed for a test.
+ *
+ * @param name_s The name of the test.
+ * @return The exit status for the test's main ().
+ */
+static int GetUnitTestResult (const char *name_s)
+{
+	if (s_num_failures > 0)
+		{
+			fprintf (stderr, "%s: " UINT32_FMT " of " UINT32_FMT " checks failed\n", name_s, s_num_failures, s_num_checks);
+			return 1;
+		}
+
+	printf ("%s: all " UINT32_FMT " checks passed\n", name_s, s_num_checks);
+	return 0;
+}
+
+
+#endif /* UNIT_TEST_H_ */
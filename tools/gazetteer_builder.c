@@ -0,0 +1,346 @@
+/*
+** Copyright 2014-2016 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * gazetteer_builder.c
+ *
+ * Build a gazetteer index for the Pathogenomics Service from a
+ * tab-separated file with the columns
+ *
+ *   country  county  town  postcode  latitude  longitude
+ *
+ * Any of the place columns can be empty and each row is indexed by its
+ * most specific non-empty column, so a row with a postcode is a postcode
+ * centroid, a row with a town but no postcode is a town centroid and so on.
+ * Blank lines and lines starting with '#' are ignored. If the same place
+ * appears more than once, the first row for it is used.
+ *
+ * Usage: gazetteer_builder <input.tsv> <output.idx>
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gazetteer.h"
+
+
+typedef struct BuilderEntry
+{
+	GazetteerEntry be_entry;
+
+	/* The position of the entry in the input so that the first duplicate wins */
+	size_t be_index;
+} BuilderEntry;
+
+
+typedef struct BuilderEntries
+{
+	BuilderEntry *be_entries_p;
+
+	size_t be_num_entries;
+
+	size_t be_capacity;
+} BuilderEntries;
+
+
+static bool ParseLine (char *line_s, BuilderEntries *entries_p, const size_t line_number);
+
+static bool AddEntry (BuilderEntries *entries_p, const GazetteerLevel level, const char *country_s, const char *county_s, const char *town_s, const char *postcode_s, const float32 latitude, const float32 longitude);
+
+static int CompareEntries (const void *v0_p, const void *v1_p);
+
+static size_t RemoveDuplicateEntries (BuilderEntries *entries_p);
+
+static bool WriteGazetteer (const char *filename_s, const BuilderEntries *entries_p, const size_t num_entries);
+
+
+int main (int argc, char *argv [])
+{
+	int ret = EXIT_FAILURE;
+
+	if (argc == 3)
+		{
+			FILE *in_f = fopen (argv [1], "r");
+
+			if (in_f)
+				{
+					BuilderEntries entries = { NULL, 0, 0 };
+					char *line_s = NULL;
+					size_t line_length = 0;
+					size_t line_number = 0;
+					bool success_flag = true;
+
+					while (success_flag && (getline (&line_s, &line_length, in_f) != -1))
+						{
+							++ line_number;
+							success_flag = ParseLine (line_s, &entries, line_number);
+						}
+
+					free (line_s);
+					fclose (in_f);
+
+					if (success_flag)
+						{
+							if (entries.be_num_entries <= UINT32_MAX)
+								{
+									size_t num_unique_entries;
+
+									qsort (entries.be_entries_p, entries.be_num_entries, sizeof (BuilderEntry), CompareEntries);
+									num_unique_entries = RemoveDuplicateEntries (&entries);
+
+									if (WriteGazetteer (argv [2], &entries, num_unique_entries))
+										{
+											printf ("Wrote " SIZET_FMT " places from " SIZET_FMT " lines to \"%s\"\n", num_unique_entries, line_number, argv [2]);
+											ret = EXIT_SUCCESS;
+										}
+								}
+							else
+								{
+									fprintf (stderr, "Too many places: " SIZET_FMT "\n", entries.be_num_entries);
+								}
+						}
+
+					free (entries.be_entries_p);
+				}		/* if (in_f) */
+			else
+				{
+					fprintf (stderr, "Failed to open \"%s\"\n", argv [1]);
+				}
+		}
+	else
+		{
+			fprintf (stderr, "Usage: %s <input.tsv> <output.idx>\n", argv [0]);
+		}
+
+	return ret;
+}
+
+
+static bool ParseLine (char *line_s, BuilderEntries *entries_p, const size_t line_number)
+{
+	char *columns_ss [6];
+	size_t num_columns = 0;
+	char *c_p = line_s;
+	char *end_p;
+	float32 latitude;
+	float32 longitude;
+	const char *country_s;
+	const char *county_s;
+	const char *town_s;
+	const char *postcode_s;
+
+	/* Remove any line ending */
+	line_s [strcspn (line_s, "\r\n")] = '\0';
+
+	if ((*line_s == '\0') || (*line_s == '#'))
+		{
+			return true;
+		}
+
+	columns_ss [num_columns ++] = c_p;
+
+	while ((c_p = strchr (c_p, '\t')) != NULL)
+		{
+			if (num_columns == 6)
+				{
+					fprintf (stderr, "Too many columns on line " SIZET_FMT "\n", line_number);
+					return false;
+				}
+
+			*c_p = '\0';
+			++ c_p;
+			columns_ss [num_columns ++] = c_p;
+		}
+
+	if (num_columns != 6)
+		{
+			fprintf (stderr, "Expected 6 columns on line " SIZET_FMT " but got " SIZET_FMT "\n", line_number, num_columns);
+			return false;
+		}
+
+	latitude = strtof (columns_ss [4], &end_p);
+	if ((end_p == columns_ss [4]) || (*end_p != '\0') || (latitude < -90.0f) || (latitude > 90.0f))
+		{
+			fprintf (stderr, "Invalid latitude \"%s\" on line " SIZET_FMT "\n", columns_ss [4], line_number);
+			return false;
+		}
+
+	longitude = strtof (columns_ss [5], &end_p);
+	if ((end_p == columns_ss [5]) || (*end_p != '\0') || (longitude < -180.0f) || (longitude > 180.0f))
+		{
+			fprintf (stderr, "Invalid longitude \"%s\" on line " SIZET_FMT "\n", columns_ss [5], line_number);
+			return false;
+		}
+
+	country_s = columns_ss [0];
+	county_s = columns_ss [1];
+	town_s = columns_ss [2];
+	postcode_s = columns_ss [3];
+
+	if (*postcode_s)
+		{
+			/* Store postcodes without a country too as many samples don't have one */
+			if (!AddEntry (entries_p, GL_POSTCODE, country_s, NULL, NULL, postcode_s, latitude, longitude))
+				{
+					return false;
+				}
+
+			return (*country_s == '\0') || AddEntry (entries_p, GL_POSTCODE, NULL, NULL, NULL, postcode_s, latitude, longitude);
+		}
+	else if (*town_s)
+		{
+			/* Store towns without a county too as many samples don't have one */
+			if (!AddEntry (entries_p, GL_TOWN, country_s, county_s, town_s, NULL, latitude, longitude))
+				{
+					return false;
+				}
+
+			return (*county_s == '\0') || AddEntry (entries_p, GL_TOWN, country_s, NULL, town_s, NULL, latitude, longitude);
+		}
+	else if (*county_s)
+		{
+			return AddEntry (entries_p, GL_COUNTY, country_s, county_s, NULL, NULL, latitude, longitude);
+		}
+	else if (*country_s)
+		{
+			return AddEntry (entries_p, GL_COUNTRY, country_s, NULL, NULL, NULL, latitude, longitude);
+		}
+
+	fprintf (stderr, "No place on line " SIZET_FMT "\n", line_number);
+
+	return false;
+}
+
+
+static bool AddEntry (BuilderEntries *entries_p, const GazetteerLevel level, const char *country_s, const char *county_s, const char *town_s, const char *postcode_s, const float32 latitude, const float32 longitude)
+{
+	BuilderEntry *entry_p;
+
+	if (entries_p -> be_num_entries == entries_p -> be_capacity)
+		{
+			const size_t new_capacity = (entries_p -> be_capacity > 0) ? (entries_p -> be_capacity << 1) : 1024;
+			BuilderEntry *new_entries_p = (BuilderEntry *) realloc (entries_p -> be_entries_p, new_capacity * sizeof (BuilderEntry));
+
+			if (!new_entries_p)
+				{
+					fprintf (stderr, "Failed to allocate memory for " SIZET_FMT " places\n", new_capacity);
+					return false;
+				}
+
+			entries_p -> be_entries_p = new_entries_p;
+			entries_p -> be_capacity = new_capacity;
+		}
+
+	entry_p = (entries_p -> be_entries_p) + (entries_p -> be_num_entries);
+
+	if (!HashGazetteerKey (level, country_s, county_s, town_s, postcode_s, & (entry_p -> be_entry.ge_hash)))
+		{
+			fprintf (stderr, "Failed to hash place\n");
+			return false;
+		}
+
+	entry_p -> be_entry.ge_latitude = latitude;
+	entry_p -> be_entry.ge_longitude = longitude;
+	entry_p -> be_index = entries_p -> be_num_entries;
+
+	++ (entries_p -> be_num_entries);
+
+	return true;
+}
+
+
+static int CompareEntries (const void *v0_p, const void *v1_p)
+{
+	const BuilderEntry *entry0_p = (const BuilderEntry *) v0_p;
+	const BuilderEntry *entry1_p = (const BuilderEntry *) v1_p;
+
+	if (entry0_p -> be_entry.ge_hash != entry1_p -> be_entry.ge_hash)
+		{
+			return (entry0_p -> be_entry.ge_hash < entry1_p -> be_entry.ge_hash) ? -1 : 1;
+		}
+
+	if (entry0_p -> be_index != entry1_p -> be_index)
+		{
+			return (entry0_p -> be_index < entry1_p -> be_index) ? -1 : 1;
+		}
+
+	return 0;
+}
+
+
+/* The entries must be sorted so that the first duplicate is the one to keep */
+static size_t RemoveDuplicateEntries (BuilderEntries *entries_p)
+{
+	size_t num_unique_entries = 0;
+	size_t i;
+
+	for (i = 0; i < entries_p -> be_num_entries; ++ i)
+		{
+			const BuilderEntry *entry_p = (entries_p -> be_entries_p) + i;
+
+			if ((num_unique_entries == 0) || (entries_p -> be_entries_p [num_unique_entries - 1].be_entry.ge_hash != entry_p -> be_entry.ge_hash))
+				{
+					entries_p -> be_entries_p [num_unique_entries] = *entry_p;
+					++ num_unique_entries;
+				}
+		}
+
+	return num_unique_entries;
+}
+
+
+static bool WriteGazetteer (const char *filename_s, const BuilderEntries *entries_p, const size_t num_entries)
+{
+	bool success_flag = false;
+	FILE *out_f = fopen (filename_s, "wb");
+
+	if (out_f)
+		{
+			GazetteerHeader header;
+			size_t i;
+
+			memcpy (header.gh_magic, GAZETTEER_MAGIC_S, sizeof (header.gh_magic));
+			header.gh_version = GAZETTEER_VERSION;
+			header.gh_num_entries = (uint32) num_entries;
+
+			success_flag = (fwrite (&header, sizeof (GazetteerHeader), 1, out_f) == 1);
+
+			for (i = 0; success_flag && (i < num_entries); ++ i)
+				{
+					success_flag = (fwrite (& (entries_p -> be_entries_p [i].be_entry), sizeof (GazetteerEntry), 1, out_f) == 1);
+				}
+
+			if (fclose (out_f) != 0)
+				{
+					success_flag = false;
+				}
+
+			if (!success_flag)
+				{
+					fprintf (stderr, "Failed to write \"%s\"\n", filename_s);
+					remove (filename_s);
+				}
+		}
+	else
+		{
+			fprintf (stderr, "Failed to open \"%s\" for writing\n", filename_s);
+		}
+
+	return success_flag;
+}